@@ -41,11 +41,237 @@ void apple2_full( uint8_t *dst_pixels, uint8_t *src_pixels, size_t width, size_t
 
 #ifdef APPLE2_IMPLEMENTATION
 
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+//Maximum number of threads used to process rows
+#ifndef APPLE2_MAX_THREADS
+#define APPLE2_MAX_THREADS 8
+#endif
+
+//Minimum number of pixels given to each thread.  Small images are not
+//worth the cost of starting threads.
+#ifndef APPLE2_MIN_THREAD_PIXELS
+#define APPLE2_MIN_THREAD_PIXELS 32768
+#endif
+
 static uint32_t apple2_palette[2][4] = {
 	{0x000000,0x62c000,0xad44ff,0xffffff},
 	{0x000000,0xdc681f,0x48a1e3,0xffffff},
 };
 
+//Squared channel distance from every possible channel value to every
+//palette color.  Index as [channel][value][palette*4+color], so the
+//8 distances for a pixel are three contiguous row additions.
+static uint32_t apple2_dist[3][256][8];
+//Palette colors as RGB bytes [palette][color][channel]
+static uint8_t apple2_rgb[2][4][3];
+static pthread_once_t apple2_once = PTHREAD_ONCE_INIT;
+
+static void apple2_init_tables( void ) {
+	size_t c, v, p, i;
+	int channel;
+	int channel_dist;
+	
+	for( p=0; p<2; p++ ) {
+		for( i=0; i<4; i++ ) {
+			for( c=0; c<3; c++ ) {
+				channel = (apple2_palette[p][i]>>(16-8*c))&0xFF;
+				apple2_rgb[p][i][c] = channel;
+				for( v=0; v<256; v++ ) {
+					channel_dist = channel - (int)v;
+					apple2_dist[c][v][4*p+i] = channel_dist * channel_dist;
+				}
+			}
+		}
+	}
+}
+
+//Select the palette for a chunk of 7 (averaged) pixels.  Returns the
+//selected palette, and the color index of each pixel in idx.  The palette
+//with the lowest average distance wins, and within a palette the first
+//closest color wins (both match the original brute force search).
+static inline uint32_t apple2_chunk( const uint8_t *chunk, uint8_t *idx ) {
+	size_t i, k;
+	const uint32_t *dr, *dg, *db;
+	uint32_t d[8];
+	uint32_t best0, best1;
+	uint32_t idx0, idx1;
+	uint32_t lt;
+	uint32_t total0 = 0;
+	uint32_t total1 = 0;
+	uint8_t idx_pal0[7];
+	uint8_t idx_pal1[7];
+	uint32_t use_pal1;
+	
+	for( i=0; i<7; i++ ) {
+		dr = apple2_dist[0][chunk[3*i]];
+		dg = apple2_dist[1][chunk[3*i+1]];
+		db = apple2_dist[2][chunk[3*i+2]];
+		for( k=0; k<8; k++ ) {
+			d[k] = dr[k] + dg[k] + db[k];
+		}
+		best0 = d[0]; idx0 = 0;
+		best1 = d[4]; idx1 = 0;
+		for( k=1; k<4; k++ ) {
+			lt = d[k] < best0;
+			best0 = lt ? d[k] : best0;
+			idx0  = lt ? k : idx0;
+			lt = d[4+k] < best1;
+			best1 = lt ? d[4+k] : best1;
+			idx1  = lt ? k : idx1;
+		}
+		total0 += best0;
+		total1 += best1;
+		idx_pal0[i] = idx0;
+		idx_pal1[i] = idx1;
+	}
+	use_pal1 = !((total0/7) < (total1/7));
+	for( i=0; i<7; i++ ) {
+		idx[i] = use_pal1 ? idx_pal1[i] : idx_pal0[i];
+	}
+	return use_pal1;
+}
+
+//Render one chunk of 14 output pixels (7 pixel pairs).  pairs holds the
+//6 bytes written for each palette/color index pair.
+static inline void apple2_write( uint8_t *dst, const uint8_t *idx, uint32_t pal, const uint8_t pairs[2][4][6] ) {
+	size_t i;
+	for( i=0; i<7; i++ ) {
+		memcpy(dst+6*i, pairs[pal][idx[i]], 6);
+	}
+}
+
+static void apple2_rows( uint8_t *dst_pixels, uint8_t *src_pixels, size_t width, size_t y0, size_t y1, int bw, uint32_t fg ) {
+	size_t y, x, i, p, c;
+	size_t full_width = width - (width%14);
+	uint8_t chunk_pixels[21];
+	uint8_t chunk_out[42];
+	uint8_t pal_idx[7];
+	uint32_t pal;
+	uint8_t pairs[2][4][6];
+	uint8_t fg_rgb[3];
+	uint8_t *src;
+	uint8_t *dst;
+	
+	//Build the output for each pixel pair up front, so that the inner
+	//loop does not depend upon the mode.  In color mode both pixels are
+	//the palette color.  In black and white mode the two bits of the
+	//color index select fg or black for each pixel.
+	fg_rgb[0] = (fg>>16)&0xff;
+	fg_rgb[1] = (fg>>8)&0xff;
+	fg_rgb[2] = fg&0xff;
+	for( p=0; p<2; p++ ) {
+		for( c=0; c<4; c++ ) {
+			if( bw ) {
+				memset(pairs[p][c],0,6);
+				if( c & 2 ) { memcpy(pairs[p][c],fg_rgb,3); }
+				if( c & 1 ) { memcpy(pairs[p][c]+3,fg_rgb,3); }
+			} else {
+				memcpy(pairs[p][c],apple2_rgb[p][c],3);
+				memcpy(pairs[p][c]+3,apple2_rgb[p][c],3);
+			}
+		}
+	}
+	
+	for( y=y0; y<y1; y++ ) {
+		src = src_pixels + 3*y*width;
+		dst = dst_pixels + 3*y*width;
+		//Full chunks never run past the edge of the row
+		for( x=0; x<full_width; x=x+14 ) {
+			for( i=0; i<7; i++ ) {
+				chunk_pixels[3*i]   = (src[6*i]   + src[6*i+3]) / 2;
+				chunk_pixels[3*i+1] = (src[6*i+1] + src[6*i+4]) / 2;
+				chunk_pixels[3*i+2] = (src[6*i+2] + src[6*i+5]) / 2;
+			}
+			pal = apple2_chunk(chunk_pixels,pal_idx);
+			apple2_write(dst,pal_idx,pal,pairs);
+			src = src + 42;
+			dst = dst + 42;
+		}
+		//Partial chunk at the end of the row.  A trailing odd pixel is
+		//used as is, and missing pixels are black.
+		if( x < width ) {
+			memset(chunk_pixels,0,sizeof(chunk_pixels));
+			for( i=0; i<14 && x+i<width; i=i+2 ) {
+				if( x+i+1 < width ) {
+					chunk_pixels[3*(i/2)]   = (src[3*i]   + src[3*i+3]) / 2;
+					chunk_pixels[3*(i/2)+1] = (src[3*i+1] + src[3*i+4]) / 2;
+					chunk_pixels[3*(i/2)+2] = (src[3*i+2] + src[3*i+5]) / 2;
+				} else {
+					memcpy(chunk_pixels+3*(i/2),src+3*i,3);
+				}
+			}
+			pal = apple2_chunk(chunk_pixels,pal_idx);
+			apple2_write(chunk_out,pal_idx,pal,pairs);
+			memcpy(dst,chunk_out,3*(width-x));
+		}
+	}
+}
+
+typedef struct {
+	uint8_t *dst_pixels;
+	uint8_t *src_pixels;
+	size_t width;
+	size_t y0;
+	size_t y1;
+	int bw;
+	uint32_t fg;
+} apple2_job_t;
+
+static void* apple2_thread( void *arg ) {
+	apple2_job_t *job = (apple2_job_t*)arg;
+	apple2_rows(job->dst_pixels,job->src_pixels,job->width,job->y0,job->y1,job->bw,job->fg);
+	return 0;
+}
+
+void apple2( uint8_t *dst_pixels, uint8_t *src_pixels, size_t width, size_t height, int bw, uint32_t fg ) {
+	apple2_job_t jobs[APPLE2_MAX_THREADS];
+	pthread_t threads[APPLE2_MAX_THREADS];
+	uint8_t started[APPLE2_MAX_THREADS];
+	long cpus;
+	size_t nthreads;
+	size_t i;
+	
+	pthread_once(&apple2_once,apple2_init_tables);
+	
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = (width*height) / APPLE2_MIN_THREAD_PIXELS;
+	if( cpus > 0 && nthreads > (size_t)cpus ) { nthreads = cpus; }
+	if( nthreads > APPLE2_MAX_THREADS ) { nthreads = APPLE2_MAX_THREADS; }
+	if( nthreads > height ) { nthreads = height; }
+	if( nthreads < 2 ) {
+		apple2_rows(dst_pixels,src_pixels,width,0,height,bw,fg);
+		return;
+	}
+	
+	//Rows are independent, so each thread gets a band of rows.
+	//The calling thread processes the last band.
+	for( i=0; i<nthreads; i++ ) {
+		jobs[i].dst_pixels = dst_pixels;
+		jobs[i].src_pixels = src_pixels;
+		jobs[i].width = width;
+		jobs[i].y0 = (height*i)/nthreads;
+		jobs[i].y1 = (height*(i+1))/nthreads;
+		jobs[i].bw = bw;
+		jobs[i].fg = fg;
+	}
+	for( i=0; i<nthreads-1; i++ ) {
+		started[i] = pthread_create(&threads[i],0,apple2_thread,&jobs[i]) == 0;
+		if( !started[i] ) {
+			apple2_thread(&jobs[i]);
+		}
+	}
+	apple2_thread(&jobs[nthreads-1]);
+	for( i=0; i<nthreads-1; i++ ) {
+		if( started[i] ) {
+			pthread_join(threads[i],0);
+		}
+	}
+}
+
+#ifdef APPLE2_UNREALISTIC
 static uint32_t apply_palette( uint8_t *dst, uint8_t *dstidx, uint8_t *src, uint32_t *pal ) {
 	uint32_t min_dist;
 	size_t i, p, c;
@@ -83,98 +309,6 @@ static uint32_t apply_palette( uint8_t *dst, uint8_t *dstidx, uint8_t *src, uint
 	return total_dist/7;
 }
 
-void apple2( uint8_t *dst_pixels, uint8_t *src_pixels, size_t width, size_t height, int bw, uint32_t fg ) {
-	size_t y, x, i;
-	uint8_t chunk_pixels[21];
-	uint8_t *pal_idx;
-	uint8_t *pal_pixels;
-	uint8_t pal0_pixels[21];
-	uint8_t pal1_pixels[21];
-	uint8_t pal0_idx[7];
-	uint8_t pal1_idx[7];
-	uint32_t pal0_dist;
-	uint32_t pal1_dist;
-	uint8_t r,g,b;
-	
-	for( y=0; y<height; y++ ) {
-		for( x=0; x<width; x=x+14 ) {
-			for( i=0; i<14; i=i+2 ) {
-				if( x+i < width ) {
-					r = src_pixels[3*(y*width+x+i)];
-					g = src_pixels[3*(y*width+x+i)+1];
-					b = src_pixels[3*(y*width+x+i)+2];
-					if( x+i+1 < width ) {
-						r = (r + src_pixels[3*(y*width+x+i+1)]) / 2;
-						g = (g + src_pixels[3*(y*width+x+i+1)+1]) / 2;
-						b = (b + src_pixels[3*(y*width+x+i+1)+2]) / 2;
-					}
-				}
-				else {
-					r = 0;
-					g = 0;
-					b = 0;
-				}
-				chunk_pixels[3*(i/2)] = r;
-				chunk_pixels[3*(i/2)+1] = g;
-				chunk_pixels[3*(i/2)+2] = b;
-			}
-			pal0_dist = apply_palette( pal0_pixels, pal0_idx, chunk_pixels, apple2_palette[0] );
-			pal1_dist = apply_palette( pal1_pixels, pal1_idx, chunk_pixels, apple2_palette[1] );
-			if( pal0_dist < pal1_dist ) {
-				pal_idx    = pal0_idx;
-				pal_pixels = pal0_pixels;
-			}
-			else {
-				pal_idx    = pal1_idx;
-				pal_pixels = pal1_pixels;
-			}
-			if( bw ) {
-				for( i=0; i<14; i=i+2 ) {
-					if( x+i < width ) {
-						if( pal_idx[i/2] & 2 ) {
-							dst_pixels[3*(y*width+x+i)]   = (fg>>16)&0xff;
-							dst_pixels[3*(y*width+x+i)+1] = (fg>>8)&0xff;
-							dst_pixels[3*(y*width+x+i)+2] = fg&0xff;
-						}
-						else {
-							dst_pixels[3*(y*width+x+i)]   = 0;
-							dst_pixels[3*(y*width+x+i)+1] = 0;
-							dst_pixels[3*(y*width+x+i)+2] = 0;
-						}
-						if( x+i+1 < width ) {
-							if( pal_idx[i/2] & 1 ) {
-								dst_pixels[3*(y*width+x+i+1)]   = (fg>>16)&0xff;
-								dst_pixels[3*(y*width+x+i+1)+1] = (fg>>8)&0xff;
-								dst_pixels[3*(y*width+x+i+1)+2] = fg&0xff;
-							}
-							else {
-								dst_pixels[3*(y*width+x+i+1)]   = 0;
-								dst_pixels[3*(y*width+x+i+1)+1] = 0;
-								dst_pixels[3*(y*width+x+i+1)+2] = 0;
-							}
-						}
-					}
-				}
-			}
-			else {
-				for( i=0; i<14; i=i+2 ) {
-					if( x+i < width ) {
-						dst_pixels[3*(y*width+x+i)]   = pal_pixels[3*(i/2)];
-						dst_pixels[3*(y*width+x+i)+1] = pal_pixels[3*(i/2)+1];
-						dst_pixels[3*(y*width+x+i)+2] = pal_pixels[3*(i/2)+2];
-						if( x+i+1 < width ) {
-							dst_pixels[3*(y*width+x+i+1)]   = pal_pixels[3*(i/2)];
-							dst_pixels[3*(y*width+x+i+1)+1] = pal_pixels[3*(i/2)+1];
-							dst_pixels[3*(y*width+x+i+1)+2] = pal_pixels[3*(i/2)+2];
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
-#ifdef APPLE2_UNREALISTIC
 void apple2_full( uint8_t *dst_pixels, uint8_t *src_pixels, size_t width, size_t height ) {
 	size_t y, x, i;
 	uint8_t chunk_pixels[21];
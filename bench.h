@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Code shared by the benchmark tools (encbench, encfidelity, quantbench):
+//synthetic and loaded test images, the palette modes swept, a monotonic
+//timer, list parsing for the command lines, and a runner that measures a
+//case in a forked child.
+
+typedef struct {
+	char* name;
+	uint8_t* pixels;
+	size_t width;
+	size_t height;
+} bench_image_t;
+
+typedef struct {
+	const char* name;
+	uint8_t stdpal;
+	size_t palsize;
+	uint8_t dither;
+} bench_palette_t;
+
+//Palette modes, matching the imgconvert options
+extern const bench_palette_t bench_palettes[];
+extern const size_t bench_npalettes;
+
+//Returned by bench_fork when the case ran past its time limit
+#define BENCH_TIMEOUT 2
+
+//Monotonic time in ns
+uint64_t bench_now_ns( void );
+
+//Generate a named test image (exits if it cannot be allocated):
+//  gradient : smooth color ramps (many similar colors)
+//  noise    : random colors (xorshift, so every run uses the same pixels)
+//  flat     : a single color
+//  plasma   : large smooth shapes
+//  unique   : every pixel a different color, spread over the color cube
+//  few      : 8 flat bands
+//  twocolor : black top half, white bottom half
+bench_image_t bench_synth_image( const char* name, size_t width, size_t height );
+
+//Load an image file, named by its base name.  Only built when stb_image.h
+//is included before the implementation.  Returns 0 on success.
+int bench_load_image( const char* path, bench_image_t* img );
+
+void bench_free_image( bench_image_t* img );
+
+//Parse a comma separated list of up to max sizes, each 1 to maxvalue.
+//Returns the number parsed, or 0 if the list is invalid.
+size_t bench_parse_sizes( char* str, size_t* sizes, size_t max, size_t maxvalue );
+
+//True if name is in the comma separated list (or there is no list)
+int bench_in_list( const char* list, const char* name );
+
+//Run fn(arg,result) in a forked child with stdout sent to /dev/null, so
+//code that writes to stdout itself does not mix into the results, and copy
+//the size bytes of result back from it.  limit_s (if not 0) is the time
+//limit in seconds.  peak_rss_kb (if not NULL) is set to the child's peak
+//RSS.  Returns 0 if the child finished, BENCH_TIMEOUT if it ran past the
+//time limit, and 1 on any other failure.
+int bench_fork( void (*fn)( void* arg, void* result ), void* arg, void* result, size_t size,
+		unsigned int limit_s, long* peak_rss_kb );
+
+#ifdef BENCH_IMPLEMENTATION
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+const bench_palette_t bench_palettes[] = {
+	{ "true",   0, 0,   0 },
+	{ "sp16",   1, 16,  0 },
+	{ "sp256",  1, 256, 0 },
+	{ "sp24",   1, 24,  0 },
+	{ "bw",     1, 0,   0 },
+	{ "p16",    0, 16,  0 },
+	{ "p64",    0, 64,  0 },
+	#ifdef USE_QUANTPNM
+	{ "p16dither", 0, 16, 1 },
+	#endif //USE_QUANTPNM
+};
+const size_t bench_npalettes = sizeof(bench_palettes)/sizeof(bench_palettes[0]);
+
+uint64_t bench_now_ns( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+bench_image_t bench_synth_image( const char* name, size_t width, size_t height ) {
+	static const uint32_t bands[8] = {
+		0x000000, 0xff0000, 0x00ff00, 0x0000ff,
+		0xffff00, 0xff00ff, 0x00ffff, 0xffffff
+	};
+	bench_image_t img;
+	uint8_t* p;
+	uint32_t seed = 12345;
+	uint32_t rgb;
+	size_t x, y;
+	double v;
+	
+	img.name = strdup(name);
+	img.width = width;
+	img.height = height;
+	img.pixels = (uint8_t*)malloc(3*width*height);
+	if( img.name == 0 || img.pixels == 0 ) {
+		fprintf(stderr,"Failed to allocate image %s\n",name);
+		exit(1);
+	}
+	p = img.pixels;
+	for( y=0; y<height; y++ ) {
+		for( x=0; x<width; x++ ) {
+			if( strcmp(name,"gradient") == 0 ) {
+				*(p++) = 255*x/width;
+				*(p++) = 255*y/height;
+				*(p++) = 255-255*x/width;
+				continue;
+			}
+			if( strcmp(name,"noise") == 0 ) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				*(p++) = seed;
+				*(p++) = seed >> 8;
+				*(p++) = seed >> 16;
+				continue;
+			}
+			if( strcmp(name,"plasma") == 0 ) {
+				v = sin(x/37.0) + sin(y/23.0) + sin((x+y)/51.0);
+				*(p++) = 127.5+127.5*sin(v*M_PI/3.0);
+				*(p++) = 127.5+127.5*sin(v*M_PI/3.0+2.0);
+				*(p++) = 127.5+127.5*sin(v*M_PI/3.0+4.0);
+				continue;
+			}
+			if( strcmp(name,"flat") == 0 ) {
+				rgb = 0x4080C0;
+			}
+			else if( strcmp(name,"unique") == 0 ) {
+				//An odd multiplier is a bijection modulo 2^24, so no two
+				//pixels (of the first 2^24) share a color
+				rgb = (uint32_t)((y*width+x)*2654435761u);
+			}
+			else if( strcmp(name,"few") == 0 ) {
+				rgb = bands[8*x/width];
+			}
+			else {
+				rgb = (y >= height/2) ? 0xffffff : 0x000000;
+			}
+			*(p++) = rgb>>16;
+			*(p++) = rgb>>8;
+			*(p++) = rgb;
+		}
+	}
+	return img;
+}
+
+#ifdef STBI_INCLUDE_STB_IMAGE_H
+int bench_load_image( const char* path, bench_image_t* img ) {
+	const char* base;
+	int width, height, channels;
+	img->pixels = stbi_load(path,&width,&height,&channels,3);
+	if( img->pixels == 0 ) {
+		fprintf(stderr,"Failed to load image: %s\n",path);
+		return 1;
+	}
+	base = strrchr(path,'/');
+	img->name = strdup(base ? base+1 : path);
+	img->width = width;
+	img->height = height;
+	return 0;
+}
+#endif //STBI_INCLUDE_STB_IMAGE_H
+
+void bench_free_image( bench_image_t* img ) {
+	free(img->name);
+	free(img->pixels);
+	img->name = 0;
+	img->pixels = 0;
+}
+
+size_t bench_parse_sizes( char* str, size_t* sizes, size_t max, size_t maxvalue ) {
+	size_t n = 0;
+	char* end;
+	while( n < max ) {
+		sizes[n] = strtoul(str,&end,10);
+		if( end == str || sizes[n] == 0 || sizes[n] > maxvalue ) {
+			return 0;
+		}
+		n++;
+		if( *end != ',' ) {
+			break;
+		}
+		str = end+1;
+	}
+	return n;
+}
+
+int bench_in_list( const char* list, const char* name ) {
+	size_t len = strlen(name);
+	const char* p = list;
+	if( list == 0 ) {
+		return 1;
+	}
+	while( (p = strstr(p,name)) != 0 ) {
+		if( (p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ',') ) {
+			return 1;
+		}
+		p += len;
+	}
+	return 0;
+}
+
+int bench_fork( void (*fn)( void* arg, void* result ), void* arg, void* result, size_t size,
+		unsigned int limit_s, long* peak_rss_kb ) {
+	struct rusage usage;
+	int fds[2];
+	int status;
+	int devnull;
+	int failed = 0;
+	pid_t pid;
+	
+	if( pipe(fds) ) {
+		fprintf(stderr,"Failed to create pipe\n");
+		return 1;
+	}
+	fflush(stdout);
+	pid = fork();
+	if( pid < 0 ) {
+		fprintf(stderr,"Failed to fork\n");
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	if( pid == 0 ) {
+		close(fds[0]);
+		devnull = open("/dev/null",O_WRONLY);
+		if( devnull >= 0 ) {
+			dup2(devnull,1);
+			close(devnull);
+		}
+		alarm(limit_s);
+		fn(arg,result);
+		if( write(fds[1],result,size) != (ssize_t)size ) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	memset(result,0,size);
+	if( read(fds[0],result,size) != (ssize_t)size ) {
+		failed = 1;
+	}
+	close(fds[0]);
+	if( wait4(pid,&status,0,&usage) < 0 ) {
+		return 1;
+	}
+	if( peak_rss_kb ) {
+		*peak_rss_kb = usage.ru_maxrss;
+	}
+	if( WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM ) {
+		return BENCH_TIMEOUT;
+	}
+	if( failed || !WIFEXITED(status) || WEXITSTATUS(status) ) {
+		return 1;
+	}
+	return 0;
+}
+
+#endif //BENCH_IMPLEMENTATION
+#endif //__BENCH_H__
@@ -33,14 +33,13 @@
 void edge_detect( uint8_t *edge, uint8_t threshold, 
 		uint8_t* rgb_image_pixels, size_t width, size_t height );
 
-int edge_scale( uint8_t *rgb_edge_pixels, uint32_t fg, uint8_t invert, uint8_t threshold, 
+//edge is a caller provided scratch buffer of width*height bytes
+int edge_scale( uint8_t *rgb_edge_pixels, uint8_t *edge, uint32_t fg, uint8_t invert, uint8_t threshold, 
 		uint8_t *rgb_image_pixels, size_t width, size_t height );
 
-int edge_highlight( uint8_t *rgb_edge_pixels, uint32_t fg, uint8_t threshold, uint8_t mix,
+int edge_highlight( uint8_t *rgb_edge_pixels, uint8_t *edge, uint32_t fg, uint8_t threshold, uint8_t mix,
 		uint8_t *rgb_image_pixels, size_t width, size_t height );
 
-void edge_free();
-
 #endif //__EDGE_DETECT_H__
 
 #ifdef EDGE_DETECT_IMPLEMENTATION
@@ -57,8 +56,6 @@ void edge_free();
 
 #define MAX_DISTANCE 441.673
 
-uint8_t *g_scratch = 0;
-
 void edge_detect( uint8_t *edge, uint8_t threshold, 
 		uint8_t* rgb_image_pixels, size_t width, size_t height ) {
 	size_t i,x,y;
@@ -103,21 +100,15 @@ void edge_detect( uint8_t *edge, uint8_t threshold,
 	}
 }
 
-int edge_scale( uint8_t *rgb_edge_pixels, uint32_t rgb, uint8_t invert, uint8_t threshold,
+int edge_scale( uint8_t *rgb_edge_pixels, uint8_t *edge, uint32_t rgb, uint8_t invert, uint8_t threshold,
 		uint8_t *rgb_image_pixels, size_t width, size_t height ) {
 	size_t i;
 	uint8_t *dstrgb;
-	uint8_t *edge;
 	uint8_t cred = (rgb>>16)&0xFF;
 	uint8_t cgreen = (rgb>>8)&0xFF;
 	uint8_t cblue = (rgb)&0xFF;
 	int red, green, blue;
 	float ratio;
-	edge = (uint8_t*)realloc(g_scratch,width*height);
-	if( edge == 0 ) {
-		fprintf(stderr,"Failed to allocate buffer for edge detection.\n");
-		return 1;
-	}
 	edge_detect(edge, threshold, rgb_image_pixels, width, height);
 	for( i=0; i<width*height;i++ ) {
 		dstrgb = &(rgb_edge_pixels[3*i]);
@@ -142,22 +133,16 @@ int edge_scale( uint8_t *rgb_edge_pixels, uint32_t rgb, uint8_t invert, uint8_t
 	return 0;
 }
 
-int edge_highlight( uint8_t *rgb_edge_pixels, uint32_t fg, uint8_t threshold, uint8_t mix,
+int edge_highlight( uint8_t *rgb_edge_pixels, uint8_t *edge, uint32_t fg, uint8_t threshold, uint8_t mix,
 		uint8_t *rgb_image_pixels, size_t width, size_t height ) {
 	size_t i;
 	uint8_t *dstrgb;
 	uint8_t *srcrgb;
-	uint8_t *edge;
 	uint8_t fg_red = (fg>>16)&0xFF;
 	uint8_t fg_green = (fg>>8)&0xFF;
 	uint8_t fg_blue = (fg)&0xFF;
 	uint32_t red, green, blue;
 	float ratio;
-	edge = (uint8_t*)realloc(g_scratch,width*height);
-	if( edge == 0 ) {
-		fprintf(stderr,"Failed to allocate buffer for edge detection.\n");
-		return 1;
-	}
 	if( mix ) { mix = 1; } //mix need to be precisely 0 or 1 for the math later
 	edge_detect(edge, threshold, rgb_image_pixels, width, height);
 	for( i=0; i<width*height;i++ ) {
@@ -182,12 +167,5 @@ int edge_highlight( uint8_t *rgb_edge_pixels, uint32_t fg, uint8_t threshold, ui
 	}
 	return 0;
 }
-
-void edge_free() {
-	if( g_scratch ) {
-		free(g_scratch);
-		g_scratch = 0;
-	}
-}
 	
 #endif //EDGE_DETECT_IMPLEMENTATION
\ No newline at end of file
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __ENC_CACHE_H__
+#define __ENC_CACHE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//On-disk cache of encoded output, addressed by term_encode_cache_key().
+//Each entry is one file (<key>.<ext>, the key as 16 hex digits and ext one of
+//txt or bin) in the cache directory.  Any other file in the directory is
+//never counted or removed.  Reading an entry marks it as recently used.
+//Entries are written to a temporary file and renamed into place, so several
+//threads or processes may share a cache directory.
+//The size of the directory is kept as a running estimate (the size found by
+//the last scan plus every entry stored since), and only once that goes over
+//max_bytes is the directory scanned and the least recently used entries
+//evicted, down to ENC_CACHE_LOW_WATER of max_bytes.  Entries stored by other
+//processes are only seen by the next scan.
+typedef struct {
+	char* dir;
+	size_t max_bytes;
+	//Estimated size of the entries in dir
+	size_t used;
+	pthread_mutex_t lock;
+} enc_cache_t;
+
+//Eviction leaves the cache this fraction (in eighths) of max_bytes, so the
+//directory is scanned at most once per max_bytes/8 stored
+#define ENC_CACHE_LOW_WATER 7
+
+//Create the cache directory if it does not exist, and evict old entries if
+//it is already larger than max_bytes
+int enc_cache_init( enc_cache_t* cache, const char* dir, size_t max_bytes );
+void enc_cache_destroy( enc_cache_t* cache );
+
+//Open a cached entry for reading, or return 0 if there is none
+FILE* enc_cache_open( enc_cache_t* cache, uint64_t key, const char* ext );
+
+//Copy an open entry to dst and close it
+int enc_cache_copy( FILE* src, FILE* dst );
+
+//Store an entry (replacing any existing one), and evict old entries if the
+//estimated cache size goes over max_bytes.  ext must be txt or bin.
+int enc_cache_store( enc_cache_t* cache, uint64_t key, const char* ext, const char* data, size_t len );
+
+//Scan the cache directory, and if it is larger than max_bytes remove least
+//recently used entries until it fits in ENC_CACHE_LOW_WATER of max_bytes
+void enc_cache_evict( enc_cache_t* cache );
+
+#ifdef ENC_CACHE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+typedef struct {
+	//<16 hex digits>.<ext>
+	char name[24];
+	size_t size;
+	struct timespec used;
+} enc_cache_entry_t;
+
+//Extensions of cache entries
+static const char* enc_cache_exts[] = { "txt", "bin", 0 };
+
+static int enc_cache_known_ext( const char* ext ) {
+	int i;
+	for( i=0; enc_cache_exts[i]; i++ ) {
+		if( strcmp(ext,enc_cache_exts[i]) == 0 ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Is name a file enc_cache_path() would create
+static int enc_cache_is_entry( const char* name ) {
+	int i;
+	for( i=0; i<16; i++ ) {
+		if( ! ((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')) ) {
+			return 0;
+		}
+	}
+	return name[16] == '.' && enc_cache_known_ext(name+17);
+}
+
+static void enc_cache_evict_locked( enc_cache_t* cache );
+
+static void enc_cache_path( enc_cache_t* cache, char* path, uint64_t key, const char* ext ) {
+	snprintf(path,PATH_MAX,"%s/%016llx.%s",cache->dir,(unsigned long long)key,ext);
+}
+
+int enc_cache_init( enc_cache_t* cache, const char* dir, size_t max_bytes ) {
+	memset(cache,0,sizeof(enc_cache_t));
+	if( strlen(dir) > PATH_MAX-64 ) {
+		fprintf(stderr,"Cache directory name is too long\n");
+		return 1;
+	}
+	if( mkdir(dir,0700) && errno != EEXIST ) {
+		fprintf(stderr,"Failed to create cache directory %s: %s\n",dir,strerror(errno));
+		return 1;
+	}
+	cache->dir = strdup(dir);
+	cache->max_bytes = max_bytes;
+	if( cache->dir == 0 ) {
+		return 1;
+	}
+	pthread_mutex_init(&cache->lock,0);
+	enc_cache_evict(cache);
+	return 0;
+}
+
+void enc_cache_destroy( enc_cache_t* cache ) {
+	if( cache->dir ) {
+		free(cache->dir);
+		cache->dir = 0;
+		pthread_mutex_destroy(&cache->lock);
+	}
+}
+
+FILE* enc_cache_open( enc_cache_t* cache, uint64_t key, const char* ext ) {
+	char path[PATH_MAX];
+	FILE* fp;
+	if( ! enc_cache_known_ext(ext) ) {
+		return 0;
+	}
+	enc_cache_path(cache,path,key,ext);
+	fp = fopen(path,"rb");
+	if( fp ) {
+		//The modification time records when the entry was last used
+		utimensat(AT_FDCWD,path,0,0);
+	}
+	return fp;
+}
+
+int enc_cache_copy( FILE* src, FILE* dst ) {
+	char buf[65536];
+	size_t len;
+	int err = 0;
+	while( (len = fread(buf,1,sizeof(buf),src)) > 0 ) {
+		if( fwrite(buf,1,len,dst) != len ) {
+			err = 1;
+			break;
+		}
+	}
+	if( ferror(src) ) {
+		err = 1;
+	}
+	fclose(src);
+	return err;
+}
+
+int enc_cache_store( enc_cache_t* cache, uint64_t key, const char* ext, const char* data, size_t len ) {
+	char path[PATH_MAX];
+	char tmppath[PATH_MAX];
+	FILE* fp;
+	int fd;
+	
+	if( ! enc_cache_known_ext(ext) ) {
+		fprintf(stderr,"Unknown cache entry type %s\n",ext);
+		return 1;
+	}
+	snprintf(tmppath,PATH_MAX,"%s/.tmpXXXXXX",cache->dir);
+	fd = mkstemp(tmppath);
+	if( fd < 0 ) {
+		fprintf(stderr,"Failed to create cache file: %s\n",strerror(errno));
+		return 1;
+	}
+	fp = fdopen(fd,"wb");
+	if( fp == 0 ) {
+		close(fd);
+		unlink(tmppath);
+		return 1;
+	}
+	if( fwrite(data,1,len,fp) != len ) {
+		fprintf(stderr,"Failed to write cache file\n");
+		fclose(fp);
+		unlink(tmppath);
+		return 1;
+	}
+	fclose(fp);
+	enc_cache_path(cache,path,key,ext);
+	if( rename(tmppath,path) ) {
+		fprintf(stderr,"Failed to store cache file: %s\n",strerror(errno));
+		unlink(tmppath);
+		return 1;
+	}
+	//A replaced entry is counted twice until the next scan
+	pthread_mutex_lock(&cache->lock);
+	cache->used += len;
+	if( cache->used > cache->max_bytes ) {
+		enc_cache_evict_locked(cache);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
+
+static int enc_cache_entry_cmp( const void* a, const void* b ) {
+	const struct timespec* ta = &(((const enc_cache_entry_t*)a)->used);
+	const struct timespec* tb = &(((const enc_cache_entry_t*)b)->used);
+	if( ta->tv_sec != tb->tv_sec ) {
+		return ta->tv_sec < tb->tv_sec ? -1 : 1;
+	}
+	if( ta->tv_nsec != tb->tv_nsec ) {
+		return ta->tv_nsec < tb->tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+static void enc_cache_evict_locked( enc_cache_t* cache ) {
+	DIR* dir;
+	struct dirent* de;
+	struct stat st;
+	char path[PATH_MAX];
+	enc_cache_entry_t* entries = 0;
+	enc_cache_entry_t* alloctmp;
+	size_t nentries = 0;
+	size_t entrieslen = 0;
+	size_t total = 0;
+	size_t low;
+	size_t i;
+	
+	dir = opendir(cache->dir);
+	if( dir == 0 ) {
+		return;
+	}
+	while( (de = readdir(dir)) != 0 ) {
+		//Skip temporary files still being written, and anything that is
+		//not a cache entry
+		if( ! enc_cache_is_entry(de->d_name) ) {
+			continue;
+		}
+		snprintf(path,PATH_MAX,"%s/%s",cache->dir,de->d_name);
+		if( stat(path,&st) || ! S_ISREG(st.st_mode) ) {
+			continue;
+		}
+		if( nentries == entrieslen ) {
+			entrieslen = entrieslen ? 2*entrieslen : 64;
+			alloctmp = (enc_cache_entry_t*)realloc(entries,sizeof(enc_cache_entry_t)*entrieslen);
+			if( alloctmp == 0 ) {
+				break;
+			}
+			entries = alloctmp;
+		}
+		strcpy(entries[nentries].name,de->d_name);
+		entries[nentries].size = st.st_size;
+		entries[nentries].used = st.st_mtim;
+		total += st.st_size;
+		nentries++;
+	}
+	closedir(dir);
+	
+	if( total > cache->max_bytes ) {
+		low = cache->max_bytes/8*ENC_CACHE_LOW_WATER;
+		qsort(entries,nentries,sizeof(enc_cache_entry_t),enc_cache_entry_cmp);
+		for( i=0; i<nentries && total > low; i++ ) {
+			snprintf(path,PATH_MAX,"%s/%s",cache->dir,entries[i].name);
+			//Another process may already have removed it
+			unlink(path);
+			total -= entries[i].size;
+		}
+	}
+	cache->used = total;
+	if( entries ) {
+		free(entries);
+	}
+}
+
+void enc_cache_evict( enc_cache_t* cache ) {
+	pthread_mutex_lock(&cache->lock);
+	enc_cache_evict_locked(cache);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+#endif //ENC_CACHE_IMPLEMENTATION
+
+#endif //__ENC_CACHE_H__
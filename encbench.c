@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//Renderer throughput benchmark
+//
+//Encodes a fixed set of synthetic images (plus any image files named on the
+//command line) with every renderer built into term_encode, sweeping widths
+//and palette modes.  One CSV line is printed per case, so runs from
+//different commits can be compared line by line.
+//
+//Each case runs in a forked child, so its peak RSS can be reported and
+//renderers that write to stdout themselves (libsixel) do not mix into the
+//results.
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+//Implementation block
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#include "term_encode.h"
+
+//Default minimum time spent encoding each case
+#define DEFAULT_MIN_MS 100
+//Every case encodes at least this many frames
+#define MIN_FRAMES 3
+#define MAX_WIDTHS 16
+#define MAX_IMAGES 32
+
+//A case to run
+typedef struct {
+	uint8_t renderer;
+	bench_image_t* img;
+	size_t width;
+	const bench_palette_t* pal;
+	uint64_t min_ms;
+} bench_case_t;
+
+//Results sent from a case's child process
+typedef struct {
+	int error;
+	uint64_t frames;
+	uint64_t ns;
+	uint64_t cells;
+	uint64_t text_bytes;
+} bench_result_t;
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] [-w #[,#...]] [-r renderer[,renderer...]] [-t ms] [imgfile ...]\n",cmd);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h : Print usage message\n");
+	fprintf(stderr,"-w : Character widths to sweep (default 80,200)\n");
+	fprintf(stderr,"-r : Renderers to run by name (default every renderer built)\n");
+	fprintf(stderr,"-t : Minimum time to encode each case in ms (default %d)\n",DEFAULT_MIN_MS);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"Synthetic gradient, noise, flat, and plasma images are always run,\n");
+	fprintf(stderr,"followed by each imgfile.  Results are printed as CSV:\n");
+	fprintf(stderr,"  renderer,image,imgwidth,imgheight,width,palette,frames,ms_per_frame,\n");
+	fprintf(stderr,"  mpixels_per_s,cells,cells_per_s,bytes_per_cell,peak_rss_kb\n");
+	fprintf(stderr,"mpixels_per_s counts input image pixels.  Output written by libsixel\n");
+	fprintf(stderr,"is not counted, so its cells and bytes are 0.\n");
+	exit(1);
+}
+
+//Encode one case for at least min_ms (in the child process)
+static void runCase( void* arg, void* resultp ) {
+	bench_case_t* bc = (bench_case_t*)arg;
+	bench_image_t* img = bc->img;
+	bench_result_t* result = (bench_result_t*)resultp;
+	term_encode_t enc;
+	term_encode_stats_t stats;
+	char* textbuf = 0;
+	size_t textlen = 0;
+	uint64_t t0;
+	size_t i;
+	
+	memset(result,0,sizeof(*result));
+	term_encode_init(&enc);
+	enc.renderer = bc->renderer;
+	enc.win_width = bc->width;
+	enc.stdpal = bc->pal->stdpal;
+	enc.reqpalsize = bc->pal->palsize;
+	enc.dither = bc->pal->dither;
+	enc.enctext = 1;
+	enc.textfp = open_memstream(&textbuf,&textlen);
+	if( enc.textfp == 0 ) {
+		result->error = 1;
+		return;
+	}
+	while( result->frames < MIN_FRAMES || result->ns < bc->min_ms*1000000ULL ) {
+		//The encoder may modify (and owns) imgpixels, so each frame
+		//gets a fresh copy
+		enc.imgpixels = (uint8_t*)malloc(3*img->width*img->height);
+		if( enc.imgpixels == 0 ) {
+			result->error = 1;
+			break;
+		}
+		memcpy(enc.imgpixels,img->pixels,3*img->width*img->height);
+		enc.imgwidth = img->width;
+		enc.imgheight = img->height;
+		fseek(enc.textfp,0,SEEK_SET);
+		
+		t0 = bench_now_ns();
+		if( term_encode(&enc) ) {
+			result->error = 1;
+			break;
+		}
+		result->ns += bench_now_ns()-t0;
+		result->frames++;
+		
+		term_encode_get_stats(&enc,&stats);
+		result->text_bytes += stats.text_bytes;
+		if( result->frames == 1 ) {
+			//Every text renderer ends each character row with a newline
+			fflush(enc.textfp);
+			for( i=0; i<stats.text_bytes && i<textlen; i++ ) {
+				if( textbuf[i] == '\n' ) {
+					result->cells += bc->width;
+				}
+			}
+		}
+		free(enc.imgpixels);
+		enc.imgpixels = 0;
+	}
+	fclose(enc.textfp);
+	enc.textfp = 0;
+	free(textbuf);
+	term_encode_destroy(&enc);
+}
+
+//Run a case in a child process and print its CSV line
+static int benchCase( uint8_t renderer, const char* rname, bench_image_t* img, size_t width,
+		const bench_palette_t* pal, uint64_t min_ms ) {
+	bench_case_t bc;
+	bench_result_t result;
+	long rss;
+	double sec;
+	
+	bc.renderer = renderer;
+	bc.img = img;
+	bc.width = width;
+	bc.pal = pal;
+	bc.min_ms = min_ms;
+	if( bench_fork(runCase,&bc,&result,sizeof(result),0,&rss) || result.error || result.frames == 0 ) {
+		fprintf(stderr,"Failed: %s %s width %lu palette %s\n",rname,img->name,width,pal->name);
+		return 1;
+	}
+	
+	sec = result.ns/1000000000.0;
+	printf("%s,%s,%lu,%lu,%lu,%s,%lu,%.3f,%.3f,%lu,%.0f,%.2f,%ld\n",
+		rname,img->name,img->width,img->height,width,pal->name,
+		(unsigned long)result.frames,
+		1000.0*sec/result.frames,
+		img->width*img->height*(double)result.frames/sec/1000000.0,
+		(unsigned long)result.cells,
+		result.cells*(double)result.frames/sec,
+		result.cells ? result.text_bytes/(double)result.frames/result.cells : 0.0,
+		rss);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	bench_image_t images[MAX_IMAGES];
+	size_t nimages = 0;
+	size_t widths[MAX_WIDTHS] = { 80, 200 };
+	size_t nwidths = 2;
+	char* rlist = 0;
+	uint64_t min_ms = DEFAULT_MIN_MS;
+	term_encode_renderer_info_t info;
+	size_t i, w, p;
+	int renderer;
+	int failed = 0;
+	
+	i=1;
+	while( i < (size_t)argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-w") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			nwidths = bench_parse_sizes(argv[++i],widths,MAX_WIDTHS,SIZE_MAX);
+			if( nwidths == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-r") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			rlist = argv[++i];
+		}
+		else if( strcmp(argv[i],"-t") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			min_ms = strtoul(argv[++i],0,10);
+		}
+		else if( argv[i][0] == '-' ) {
+			usage(argv[0]);
+		}
+		else {
+			if( nimages+4 >= MAX_IMAGES ) {
+				usage(argv[0]);
+			}
+			if( bench_load_image(argv[i],&(images[nimages])) ) {
+				exit(1);
+			}
+			nimages++;
+		}
+		i++;
+	}
+	
+	//Synthetic images run first, then the files in order
+	memmove(&(images[4]),&(images[0]),sizeof(bench_image_t)*nimages);
+	images[0] = bench_synth_image("gradient",640,480);
+	images[1] = bench_synth_image("noise",640,480);
+	images[2] = bench_synth_image("flat",640,480);
+	images[3] = bench_synth_image("plasma",1280,720);
+	nimages += 4;
+	
+	printf("renderer,image,imgwidth,imgheight,width,palette,frames,ms_per_frame,"
+		"mpixels_per_s,cells,cells_per_s,bytes_per_cell,peak_rss_kb\n");
+	for( renderer=0; renderer<256; renderer++ ) {
+		if( term_encode_renderer_info(renderer,&info) || ! bench_in_list(rlist,info.name) ) {
+			continue;
+		}
+		for( i=0; i<nimages; i++ ) {
+			for( w=0; w<nwidths; w++ ) {
+				for( p=0; p<bench_npalettes; p++ ) {
+					failed |= benchCase(renderer,info.name,&(images[i]),widths[w],&(bench_palettes[p]),min_ms);
+				}
+			}
+		}
+	}
+	
+	for( i=0; i<nimages; i++ ) {
+		bench_free_image(&(images[i]));
+	}
+	return failed;
+}
@@ -0,0 +1,807 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//Byte efficiency versus fidelity benchmark
+//
+//Encodes images with each renderer and palette mode, then rasterizes the
+//ANSI output back into an image the way a terminal would draw it: every
+//character cell becomes CELL_W x CELL_H pixels, filled with the cell's
+//foreground color where the glyph has ink and its background color
+//elsewhere.  Block elements, sextants, and braille have exact coverage
+//masks.  The result is compared against the source image resized to the
+//same size (PSNR over RGB, SSIM over luma), so each renderer and palette
+//mode gets a fidelity per byte figure.
+//
+//A saved ANSI file (-ansi) or newdraw binary (-bin) can also be rasterized
+//and compared against its source image.
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <arpa/inet.h>
+
+//Implementation block
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+//term_encode has its own (external) copy of stb_image_resize; inline
+//keeps the unused functions quiet
+#define STBIRDEF static inline
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+#include "term_encode.h"
+
+//Pixels per character cell, about the shape of a monospace font's cell
+#define CELL_W 8
+#define CELL_H 16
+//Reported PSNR when the images are identical
+#define PSNR_MAX 99.0
+//SSIM window size and step in pixels
+#define SSIM_WIN  8
+#define SSIM_STEP 4
+//Ink coverage assumed for glyphs without a mask (text characters)
+#define TEXT_COVERAGE 64
+//Colors of unset (or reset) text
+#define DEFAULT_FG 0xFFFFFF
+#define DEFAULT_BG 0x000000
+#define MAX_WIDTHS 16
+#define MAX_IMAGES 32
+
+//Draw braille dots as solid blocks filling the 2x4 grid (-d)
+static uint8_t full_dots = 0;
+
+typedef struct {
+	uint32_t fg;
+	uint32_t bg;
+	uint32_t character;
+} fid_cell_t;
+
+//Character grid decoded from ANSI text or a newdraw binary
+typedef struct {
+	fid_cell_t* cells;
+	size_t width;
+	size_t height;
+	//Extent of the cells actually written
+	size_t cols;
+	size_t rows;
+} fid_grid_t;
+
+//The 16 standard colors; 16-255 follow the xterm color cube and grey ramp
+static const uint32_t std16[16] = {
+	0x000000,0x800000,0x008000,0x808000,0x000080,0x800080,0x008080,0xc0c0c0,
+	0x808080,0xff0000,0x00ff00,0xffff00,0x0000ff,0xff00ff,0x00ffff,0xffffff };
+static const uint8_t cube_levels[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+
+static uint32_t stdColor( size_t idx ) {
+	uint8_t v;
+	if( idx < 16 ) {
+		return std16[idx];
+	}
+	if( idx < 232 ) {
+		idx -= 16;
+		return (cube_levels[idx/36]<<16) | (cube_levels[(idx/6)%6]<<8) | cube_levels[idx%6];
+	}
+	if( idx < 256 ) {
+		v = 8 + 10*(idx-232);
+		return (v<<16) | (v<<8) | v;
+	}
+	return DEFAULT_FG;
+}
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] [-d] [-w #[,#...]] [-r renderer[,renderer...]] [imgfile ...]\n",cmd);
+	fprintf(stderr,"%s [-h] [-d] [-o rasterfile.ppm] (-ansi textfile | -bin binfile) imgfile\n",cmd);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h    : Print usage message\n");
+	fprintf(stderr,"-d    : Draw braille dots as solid blocks instead of round dots\n");
+	fprintf(stderr,"-w    : Character widths to sweep (default 80,200)\n");
+	fprintf(stderr,"-r    : Renderers to run by name (default every text renderer built)\n");
+	fprintf(stderr,"-ansi : Compare saved ANSI output (imgconvert) against imgfile\n");
+	fprintf(stderr,"-bin  : Compare a saved newdraw binary against imgfile\n");
+	fprintf(stderr,"-o    : Also write the rasterized -ansi or -bin file as a PPM\n");
+	fprintf(stderr,"\n");
+	fprintf(stderr,"Synthetic gradient and plasma images are always swept, followed by\n");
+	fprintf(stderr,"each imgfile.  Results are printed as CSV:\n");
+	fprintf(stderr,"  renderer,image,imgwidth,imgheight,width,palette,cols,rows,\n");
+	fprintf(stderr,"  bytes,bytes_per_cell,psnr,ssim\n");
+	fprintf(stderr,"Cells are rasterized at %dx%d pixels.\n",CELL_W,CELL_H);
+	exit(1);
+}
+
+//Store a cell, growing the grid as needed
+static void gridPut( fid_grid_t* grid, size_t col, size_t row, fid_cell_t* cell ) {
+	fid_cell_t* cells;
+	size_t width, height;
+	size_t x, y;
+	
+	if( col >= grid->width || row >= grid->height ) {
+		width  = col >= grid->width  ? col+1+grid->width  : grid->width;
+		height = row >= grid->height ? row+1+grid->height : grid->height;
+		cells = (fid_cell_t*)malloc(width*height*sizeof(fid_cell_t));
+		if( cells == 0 ) {
+			fprintf(stderr,"Failed to allocate %lux%lu character grid\n",width,height);
+			exit(1);
+		}
+		for( y=0; y<height; y++ ) {
+			for( x=0; x<width; x++ ) {
+				if( x < grid->width && y < grid->height ) {
+					cells[y*width+x] = grid->cells[y*grid->width+x];
+				} else {
+					cells[y*width+x].fg = DEFAULT_FG;
+					cells[y*width+x].bg = DEFAULT_BG;
+					cells[y*width+x].character = ' ';
+				}
+			}
+		}
+		free(grid->cells);
+		grid->cells = cells;
+		grid->width = width;
+		grid->height = height;
+	}
+	grid->cells[row*grid->width+col] = *cell;
+	if( col >= grid->cols ) {
+		grid->cols = col+1;
+	}
+	if( row >= grid->rows ) {
+		grid->rows = row+1;
+	}
+}
+
+//Apply the parameters of an SGR (ESC [ ... m) sequence
+static void parseSGR( const char* params, uint32_t* fg, uint32_t* bg, uint8_t* reverse ) {
+	long p[32];
+	size_t n = 0;
+	size_t i;
+	char* end;
+	
+	while( n < 32 ) {
+		p[n++] = strtol(params,&end,10);
+		if( *end != ';' ) {
+			break;
+		}
+		params = end+1;
+	}
+	for( i=0; i<n; i++ ) {
+		if( p[i] == 0 ) {
+			*fg = DEFAULT_FG;
+			*bg = DEFAULT_BG;
+			*reverse = 0;
+		}
+		else if( p[i] == 7 ) {
+			*reverse = 1;
+		}
+		else if( p[i] == 27 ) {
+			*reverse = 0;
+		}
+		else if( p[i] >= 30 && p[i] <= 37 ) {
+			*fg = std16[p[i]-30];
+		}
+		else if( p[i] >= 90 && p[i] <= 97 ) {
+			*fg = std16[p[i]-90+8];
+		}
+		else if( p[i] >= 40 && p[i] <= 47 ) {
+			*bg = std16[p[i]-40];
+		}
+		else if( p[i] >= 100 && p[i] <= 107 ) {
+			*bg = std16[p[i]-100+8];
+		}
+		else if( p[i] == 39 ) {
+			*fg = DEFAULT_FG;
+		}
+		else if( p[i] == 49 ) {
+			*bg = DEFAULT_BG;
+		}
+		else if( (p[i] == 38 || p[i] == 48) && i+2 < n && p[i+1] == 5 ) {
+			if( p[i] == 38 ) { *fg = stdColor(p[i+2]); }
+			else             { *bg = stdColor(p[i+2]); }
+			i += 2;
+		}
+		else if( (p[i] == 38 || p[i] == 48) && i+4 < n && p[i+1] == 2 ) {
+			if( p[i] == 38 ) { *fg = ((p[i+2]&0xFF)<<16) | ((p[i+3]&0xFF)<<8) | (p[i+4]&0xFF); }
+			else             { *bg = ((p[i+2]&0xFF)<<16) | ((p[i+3]&0xFF)<<8) | (p[i+4]&0xFF); }
+			i += 4;
+		}
+		//Bold, blink, underline, ... don't change the colors drawn
+	}
+}
+
+//Decode ANSI text into a character grid.  Handles SGR colors, cursor home,
+//clear, cursor forward (CUF), repeat (REP), erase character (ECH), and erase
+//line (EL).  Erased cells take the current background color.
+static void parseANSI( const char* text, size_t len, fid_grid_t* grid ) {
+	fid_cell_t cell;
+	fid_cell_t last;
+	uint32_t fg = DEFAULT_FG;
+	uint32_t bg = DEFAULT_BG;
+	uint8_t reverse = 0;
+	size_t col = 0;
+	size_t row = 0;
+	size_t i = 0;
+	size_t start;
+	size_t n;
+	size_t k;
+	uint32_t c;
+	char params[256];
+	
+	last.fg = fg;
+	last.bg = bg;
+	last.character = ' ';
+	while( i < len ) {
+		c = (uint8_t)text[i];
+		if( c == 0x1b && i+1 < len && text[i+1] == '[' ) {
+			i += 2;
+			start = i;
+			while( i < len && ((text[i] >= '0' && text[i] <= '9') || text[i] == ';' || text[i] == '?') ) {
+				i++;
+			}
+			if( i >= len ) {
+				break;
+			}
+			n = i-start < sizeof(params)-1 ? i-start : sizeof(params)-1;
+			memcpy(params,text+start,n);
+			params[n] = 0;
+			n = strtoul(params,0,10);
+			cell.fg = reverse ? fg : bg;
+			cell.bg = reverse ? fg : bg;
+			cell.character = ' ';
+			switch( text[i] ) {
+				case 'm':
+					parseSGR(params,&fg,&bg,&reverse);
+					break;
+				case 'H':
+					col = 0;
+					row = 0;
+					break;
+				case 'C':
+					col += n ? n : 1;
+					break;
+				case 'b':
+					for( k=0; k<(n ? n : 1); k++ ) {
+						gridPut(grid,col++,row,&last);
+					}
+					break;
+				case 'X':
+					for( k=0; k<(n ? n : 1); k++ ) {
+						gridPut(grid,col+k,row,&cell);
+					}
+					break;
+				case 'K':
+					//Erase to the end of the written width
+					for( k=col; k<grid->cols; k++ ) {
+						gridPut(grid,k,row,&cell);
+					}
+					break;
+			}
+			i++;
+			continue;
+		}
+		if( c == '\r' ) {
+			col = 0;
+			i++;
+			continue;
+		}
+		if( c == '\n' ) {
+			row++;
+			i++;
+			continue;
+		}
+		if( c < 0x20 ) {
+			i++;
+			continue;
+		}
+		//UTF-8 decode
+		if( c >= 0xF0 && i+3 < len ) {
+			c = ((c&0x07)<<18) | ((text[i+1]&0x3F)<<12) | ((text[i+2]&0x3F)<<6) | (text[i+3]&0x3F);
+			i += 4;
+		}
+		else if( c >= 0xE0 && i+2 < len ) {
+			c = ((c&0x0F)<<12) | ((text[i+1]&0x3F)<<6) | (text[i+2]&0x3F);
+			i += 3;
+		}
+		else if( c >= 0xC0 && i+1 < len ) {
+			c = ((c&0x1F)<<6) | (text[i+1]&0x3F);
+			i += 2;
+		}
+		else {
+			i++;
+		}
+		cell.fg = reverse ? bg : fg;
+		cell.bg = reverse ? fg : bg;
+		cell.character = c;
+		gridPut(grid,col++,row,&cell);
+		last = cell;
+	}
+}
+
+//Decode a newdraw binary into a character grid
+static int parseBin( FILE* fp, fid_grid_t* grid ) {
+	char magic[7];
+	uint32_t tmp;
+	uint32_t width, height;
+	uint8_t color_mode;
+	uint8_t attrs[5];
+	fid_cell_t cell;
+	uint32_t fg, bg;
+	size_t x, y;
+	
+	if( fread(magic,7,1,fp) != 1 || strncmp(magic,"newdraw",7) != 0 ) {
+		fprintf(stderr,"Not a newdraw binary file\n");
+		return 1;
+	}
+	if( fread(&tmp,4,1,fp) != 1 ) { goto parseBinError; }
+	width = ntohl(tmp);
+	if( fread(&tmp,4,1,fp) != 1 ) { goto parseBinError; }
+	height = ntohl(tmp);
+	if( fread(&color_mode,1,1,fp) != 1 ) { goto parseBinError; }
+	for( y=0; y<height; y++ ) {
+		for( x=0; x<width; x++ ) {
+			if( fread(&tmp,4,1,fp) != 1 ) { goto parseBinError; }
+			fg = ntohl(tmp);
+			if( fread(&tmp,4,1,fp) != 1 ) { goto parseBinError; }
+			bg = ntohl(tmp);
+			//reverse, blink, bold, underline, line type
+			if( fread(attrs,5,1,fp) != 1 ) { goto parseBinError; }
+			if( fread(&tmp,4,1,fp) != 1 ) { goto parseBinError; }
+			cell.character = ntohl(tmp);
+			//Color mode 2 is true color, the others index the standard palette
+			if( color_mode != 2 ) {
+				fg = stdColor(fg);
+				bg = stdColor(bg);
+			}
+			cell.fg = attrs[0] ? bg : fg;
+			cell.bg = attrs[0] ? fg : bg;
+			gridPut(grid,x,y,&cell);
+		}
+	}
+	return 0;
+	
+	parseBinError:
+	fprintf(stderr,"Truncated newdraw binary file\n");
+	return 1;
+}
+
+//Fill mask (CELL_W x CELL_H, 0-255) with the ink coverage of a character
+static void glyphMask( uint32_t c, uint8_t* mask ) {
+	//Quadrant bits for U+2596-U+259F: 1 upper left, 2 upper right,
+	//4 lower left, 8 lower right
+	static const uint8_t quadrants[10] = { 4, 8, 1, 13, 9, 7, 11, 2, 6, 14 };
+	size_t x, y;
+	uint32_t bits;
+	uint8_t v;
+	
+	for( y=0; y<CELL_H; y++ ) {
+		for( x=0; x<CELL_W; x++ ) {
+			v = 0;
+			if( c == ' ' || c == 0xA0 || c == 0x2800 ) {
+				v = 0;
+			}
+			else if( c == 0x2588 ) {
+				v = 255;
+			}
+			else if( c == 0x2580 ) {
+				v = y < CELL_H/2 ? 255 : 0;
+			}
+			else if( c >= 0x2581 && c <= 0x2587 ) {
+				//Lower one eighth to seven eighths
+				v = y >= CELL_H - CELL_H*(c-0x2580)/8 ? 255 : 0;
+			}
+			else if( c >= 0x2589 && c <= 0x258F ) {
+				//Left seven eighths to one eighth
+				v = x < CELL_W*(0x2590-c)/8 ? 255 : 0;
+			}
+			else if( c == 0x2590 ) {
+				v = x >= CELL_W/2 ? 255 : 0;
+			}
+			else if( c >= 0x2591 && c <= 0x2593 ) {
+				//Light, medium, and dark shade
+				v = 64*(c-0x2590);
+			}
+			else if( c == 0x2594 ) {
+				v = y < CELL_H/8 ? 255 : 0;
+			}
+			else if( c == 0x2595 ) {
+				v = x >= CELL_W - CELL_W/8 ? 255 : 0;
+			}
+			else if( c >= 0x2596 && c <= 0x259F ) {
+				bits = quadrants[c-0x2596];
+				v = (bits >> ((y*2/CELL_H)*2 + x*2/CELL_W)) & 1 ? 255 : 0;
+			}
+			else if( c >= 0x1FB00 && c <= 0x1FB3B ) {
+				//Sextants skip the patterns that are the left and right
+				//half blocks (21 and 42).  Bit 0 is the top left of the
+				//3 rows of 2.
+				bits = c - 0x1FB00 + 1;
+				if( bits >= 21 ) { bits++; }
+				if( bits >= 42 ) { bits++; }
+				v = (bits >> ((y*3/CELL_H)*2 + x*2/CELL_W)) & 1 ? 255 : 0;
+			}
+			else if( c > 0x2800 && c <= 0x28FF ) {
+				//Braille dots are drawn as the center quarter of their
+				//spot in a 2x4 grid (or the whole spot with -d).  Dots 1-3
+				//and 4-6 are the top 3 rows of the left and right columns,
+				//7 and 8 the bottom row.
+				bits = c - 0x2800;
+				if( y*4/CELL_H < 3 ) {
+					bits = bits >> ((x*2/CELL_W)*3 + y*4/CELL_H);
+				} else {
+					bits = bits >> (6 + x*2/CELL_W);
+				}
+				if( (bits & 1) && ( full_dots ||
+						((x % (CELL_W/2)) >= CELL_W/8 && (x % (CELL_W/2)) < 3*CELL_W/8 &&
+						(y % (CELL_H/4)) >= CELL_H/16 && (y % (CELL_H/4)) < 3*CELL_H/16) ) ) {
+					v = 255;
+				}
+			}
+			else if( c > ' ' ) {
+				v = TEXT_COVERAGE;
+			}
+			mask[y*CELL_W+x] = v;
+		}
+	}
+}
+
+//Draw the written part of the grid (cols*CELL_W x rows*CELL_H)
+static uint8_t* rasterize( fid_grid_t* grid ) {
+	uint8_t mask[CELL_W*CELL_H];
+	uint8_t* pixels;
+	uint8_t* p;
+	fid_cell_t* cell;
+	size_t width = grid->cols*CELL_W;
+	size_t col, row;
+	size_t x, y;
+	size_t ch;
+	int fg, bg;
+	
+	pixels = (uint8_t*)malloc(3*width*grid->rows*CELL_H);
+	if( pixels == 0 ) {
+		fprintf(stderr,"Failed to allocate raster\n");
+		exit(1);
+	}
+	for( row=0; row<grid->rows; row++ ) {
+		for( col=0; col<grid->cols; col++ ) {
+			cell = &(grid->cells[row*grid->width+col]);
+			glyphMask(cell->character,mask);
+			for( y=0; y<CELL_H; y++ ) {
+				p = pixels + 3*((row*CELL_H+y)*width + col*CELL_W);
+				for( x=0; x<CELL_W; x++ ) {
+					for( ch=0; ch<3; ch++ ) {
+						fg = (cell->fg >> (16-8*ch)) & 0xFF;
+						bg = (cell->bg >> (16-8*ch)) & 0xFF;
+						*(p++) = bg + ((fg-bg)*mask[y*CELL_W+x] + 127)/255;
+					}
+				}
+			}
+		}
+	}
+	return pixels;
+}
+
+static double psnr( const uint8_t* a, const uint8_t* b, size_t len ) {
+	double err = 0;
+	double d;
+	size_t i;
+	for( i=0; i<len; i++ ) {
+		d = (double)a[i] - (double)b[i];
+		err += d*d;
+	}
+	if( err == 0 ) {
+		return PSNR_MAX;
+	}
+	return 10.0*log10(255.0*255.0*len/err);
+}
+
+//Mean SSIM of the luma over SSIM_WIN windows every SSIM_STEP pixels
+static double ssim( const uint8_t* a, const uint8_t* b, size_t width, size_t height ) {
+	const double c1 = (0.01*255)*(0.01*255);
+	const double c2 = (0.03*255)*(0.03*255);
+	const double n = SSIM_WIN*SSIM_WIN;
+	double sa, sb, saa, sbb, sab;
+	double ma, mb, va, vb, cov;
+	double ya, yb;
+	double total = 0;
+	size_t windows = 0;
+	size_t x, y, wx, wy;
+	const uint8_t *pa, *pb;
+	
+	for( y=0; y+SSIM_WIN<=height; y+=SSIM_STEP ) {
+		for( x=0; x+SSIM_WIN<=width; x+=SSIM_STEP ) {
+			sa = sb = saa = sbb = sab = 0;
+			for( wy=0; wy<SSIM_WIN; wy++ ) {
+				pa = a + 3*((y+wy)*width+x);
+				pb = b + 3*((y+wy)*width+x);
+				for( wx=0; wx<SSIM_WIN; wx++ ) {
+					ya = 0.299*pa[0] + 0.587*pa[1] + 0.114*pa[2];
+					yb = 0.299*pb[0] + 0.587*pb[1] + 0.114*pb[2];
+					sa += ya;
+					sb += yb;
+					saa += ya*ya;
+					sbb += yb*yb;
+					sab += ya*yb;
+					pa += 3;
+					pb += 3;
+				}
+			}
+			ma = sa/n;
+			mb = sb/n;
+			va = saa/n - ma*ma;
+			vb = sbb/n - mb*mb;
+			cov = sab/n - ma*mb;
+			total += ((2*ma*mb + c1)*(2*cov + c2)) / ((ma*ma + mb*mb + c1)*(va + vb + c2));
+			windows++;
+		}
+	}
+	return windows ? total/windows : 1.0;
+}
+
+static int writePPM( const char* path, const uint8_t* pixels, size_t width, size_t height ) {
+	FILE* fp = fopen(path,"wb");
+	if( fp == 0 ) {
+		fprintf(stderr,"Failed to open %s\n",path);
+		return 1;
+	}
+	fprintf(fp,"P6\n%lu %lu\n255\n",width,height);
+	fwrite(pixels,3,width*height,fp);
+	fclose(fp);
+	return 0;
+}
+
+//Rasterize grid, compare it against img, and print the figures that
+//follow the renderer name in the CSV line
+static int compare( fid_grid_t* grid, bench_image_t* img, size_t bytes, const char* ppmpath ) {
+	uint8_t* raster;
+	uint8_t* ref;
+	size_t width = grid->cols*CELL_W;
+	size_t height = grid->rows*CELL_H;
+	int failed = 0;
+	
+	if( grid->cols == 0 || grid->rows == 0 ) {
+		fprintf(stderr,"No characters to compare for %s\n",img->name);
+		return 1;
+	}
+	raster = rasterize(grid);
+	ref = (uint8_t*)malloc(3*width*height);
+	if( ref == 0 ) {
+		fprintf(stderr,"Failed to allocate reference image\n");
+		exit(1);
+	}
+	stbir_resize_uint8(img->pixels,img->width,img->height,0,ref,width,height,0,3);
+	printf("%lu,%lu,%lu,%.2f,%.3f,%.4f\n",grid->cols,grid->rows,bytes,
+		(double)bytes/(grid->cols*grid->rows),
+		psnr(raster,ref,3*width*height),
+		ssim(raster,ref,width,height));
+	if( ppmpath ) {
+		failed = writePPM(ppmpath,raster,width,height);
+	}
+	free(ref);
+	free(raster);
+	return failed;
+}
+
+//Encode one case to memory and compare it
+static int fidelityCase( uint8_t renderer, const char* rname, bench_image_t* img, size_t width,
+		const bench_palette_t* pal ) {
+	term_encode_t enc;
+	term_encode_stats_t stats;
+	fid_grid_t grid;
+	char* textbuf = 0;
+	size_t textlen = 0;
+	int failed = 0;
+	
+	term_encode_init(&enc);
+	enc.renderer = renderer;
+	enc.win_width = width;
+	enc.stdpal = pal->stdpal;
+	enc.reqpalsize = pal->palsize;
+	enc.dither = pal->dither;
+	enc.enctext = 1;
+	enc.stats = 1;
+	enc.textfp = open_memstream(&textbuf,&textlen);
+	if( enc.textfp == 0 ) {
+		fprintf(stderr,"Failed to open memory stream\n");
+		return 1;
+	}
+	//The encoder may modify (and owns) imgpixels
+	enc.imgpixels = (uint8_t*)malloc(3*img->width*img->height);
+	if( enc.imgpixels == 0 ) {
+		fprintf(stderr,"Failed to allocate image copy\n");
+		exit(1);
+	}
+	memcpy(enc.imgpixels,img->pixels,3*img->width*img->height);
+	enc.imgwidth = img->width;
+	enc.imgheight = img->height;
+	if( term_encode(&enc) ) {
+		failed = 1;
+	}
+	term_encode_get_stats(&enc,&stats);
+	fclose(enc.textfp);
+	enc.textfp = 0;
+	term_encode_destroy(&enc);
+	
+	if( !failed ) {
+		memset(&grid,0,sizeof(grid));
+		parseANSI(textbuf,textlen,&grid);
+		printf("%s,%s,%lu,%lu,%lu,%s,",rname,img->name,img->width,img->height,width,pal->name);
+		failed = compare(&grid,img,stats.text_bytes,0);
+		free(grid.cells);
+	}
+	if( failed ) {
+		fprintf(stderr,"Failed: %s %s width %lu palette %s\n",rname,img->name,width,pal->name);
+	}
+	free(textbuf);
+	return failed;
+}
+
+//Compare a saved ANSI file or newdraw binary against its source image
+static int compareFile( const char* path, uint8_t binary, bench_image_t* img, const char* ppmpath ) {
+	fid_grid_t grid;
+	FILE* fp;
+	char* text;
+	long len;
+	const char* base;
+	int failed = 0;
+	
+	fp = fopen(path,"rb");
+	if( fp == 0 ) {
+		fprintf(stderr,"Failed to open %s\n",path);
+		return 1;
+	}
+	if( fseek(fp,0,SEEK_END) || (len = ftell(fp)) < 0 || fseek(fp,0,SEEK_SET) ) {
+		fprintf(stderr,"Failed to read %s\n",path);
+		fclose(fp);
+		return 1;
+	}
+	memset(&grid,0,sizeof(grid));
+	if( binary ) {
+		failed = parseBin(fp,&grid);
+	}
+	else {
+		text = (char*)malloc(len ? len : 1);
+		if( text == 0 || fread(text,1,len,fp) != (size_t)len ) {
+			fprintf(stderr,"Failed to read %s\n",path);
+			failed = 1;
+		}
+		else {
+			parseANSI(text,len,&grid);
+		}
+		free(text);
+	}
+	fclose(fp);
+	if( !failed ) {
+		base = strrchr(path,'/');
+		printf("%s,%s,%lu,%lu,%lu,-,",base ? base+1 : path,img->name,img->width,img->height,grid.cols);
+		failed = compare(&grid,img,len,ppmpath);
+	}
+	free(grid.cells);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	bench_image_t images[MAX_IMAGES];
+	size_t nimages = 0;
+	size_t widths[MAX_WIDTHS] = { 80, 200 };
+	size_t nwidths = 2;
+	char* rlist = 0;
+	char* cmppath = 0;
+	uint8_t binary = 0;
+	char* ppmpath = 0;
+	term_encode_renderer_info_t info;
+	size_t i, w, p;
+	int renderer;
+	int failed = 0;
+	
+	i=1;
+	while( i < (size_t)argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-d") == 0 ) {
+			full_dots = 1;
+		}
+		else if( strcmp(argv[i],"-w") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			nwidths = bench_parse_sizes(argv[++i],widths,MAX_WIDTHS,SIZE_MAX);
+			if( nwidths == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-r") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			rlist = argv[++i];
+		}
+		else if( strcmp(argv[i],"-ansi") == 0 || strcmp(argv[i],"-bin") == 0 ) {
+			if( i >= (size_t)argc-1 || cmppath ) {
+				usage(argv[0]);
+			}
+			binary = strcmp(argv[i],"-bin") == 0;
+			cmppath = argv[++i];
+		}
+		else if( strcmp(argv[i],"-o") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			ppmpath = argv[++i];
+		}
+		else if( argv[i][0] == '-' ) {
+			usage(argv[0]);
+		}
+		else {
+			if( nimages+2 >= MAX_IMAGES ) {
+				usage(argv[0]);
+			}
+			if( bench_load_image(argv[i],&(images[nimages])) ) {
+				exit(1);
+			}
+			nimages++;
+		}
+		i++;
+	}
+	
+	printf("renderer,image,imgwidth,imgheight,width,palette,cols,rows,"
+		"bytes,bytes_per_cell,psnr,ssim\n");
+	if( cmppath ) {
+		if( nimages != 1 ) {
+			usage(argv[0]);
+		}
+		failed = compareFile(cmppath,binary,&(images[0]),ppmpath);
+	}
+	else {
+		if( ppmpath ) {
+			usage(argv[0]);
+		}
+		//Synthetic images run first, then the files in order
+		memmove(&(images[2]),&(images[0]),sizeof(bench_image_t)*nimages);
+		images[0] = bench_synth_image("gradient",640,480);
+		images[1] = bench_synth_image("plasma",1280,720);
+		nimages += 2;
+		
+		for( renderer=0; renderer<256; renderer++ ) {
+			//Sixel output is an image, not characters
+			if( renderer == ENC_RENDER_SIXEL || renderer == ENC_RENDER_LIBSIXEL ||
+					term_encode_renderer_info(renderer,&info) || ! bench_in_list(rlist,info.name) ) {
+				continue;
+			}
+			for( i=0; i<nimages; i++ ) {
+				for( w=0; w<nwidths; w++ ) {
+					for( p=0; p<bench_npalettes; p++ ) {
+						failed |= fidelityCase(renderer,info.name,&(images[i]),widths[w],&(bench_palettes[p]));
+					}
+				}
+			}
+		}
+	}
+	
+	for( i=0; i<nimages; i++ ) {
+		bench_free_image(&(images[i]));
+	}
+	return failed;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//Multi-threaded encoder stress test
+//
+//Encodes a set of cases (every thread-safe renderer, in each palette mode,
+//with filters and images taken in turn) once on one thread to get the
+//reference output, then runs them again on several threads at once, each
+//thread starting at a different case so different renderers and images
+//are encoding at the same time.  Every text and newdraw binary output must
+//match its reference byte for byte.
+//
+//aalib, libcaca, and libsixel keep their own global state, so their
+//renderers are not run.
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//Implementation block
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+
+#include "term_encode.h"
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_ITERATIONS 2
+//Frames encoded by each encoder, so reused buffers are exercised
+#define FRAMES 2
+#define MAX_IMAGES 32
+#define MAX_CASES 1024
+
+typedef struct {
+	uint8_t renderer;
+	const char* rname;
+	bench_image_t* img;
+	size_t width;
+	const bench_palette_t* pal;
+	uint8_t filter;
+	uint8_t runs;
+	uint8_t sixel;
+	//Reference output
+	char* text;
+	size_t textlen;
+	char* binary;
+	size_t binarylen;
+} stress_case_t;
+
+typedef struct {
+	pthread_t thread;
+	size_t first;
+	size_t iterations;
+	size_t encodes;
+	size_t mismatches;
+} stress_thread_t;
+
+//Filters taken in turn by the cases
+static const uint8_t filters[] = {
+	ENC_FILTER_NONE, ENC_FILTER_EDGE_LINE, ENC_FILTER_EDGE_HIGHLIGHT, ENC_FILTER_APPLE2
+};
+#define NFILTERS (sizeof(filters)/sizeof(filters[0]))
+
+static stress_case_t cases[MAX_CASES];
+static size_t ncases = 0;
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] [-t threads] [-n iterations] [-r renderer[,renderer...]] [imgfile ...]\n",cmd);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h : Print usage message\n");
+	fprintf(stderr,"-t : Threads encoding at once (default %d)\n",DEFAULT_THREADS);
+	fprintf(stderr,"-n : Times each thread runs every case (default %d)\n",DEFAULT_ITERATIONS);
+	fprintf(stderr,"-r : Renderers to run by name (default every thread-safe renderer built)\n");
+	fprintf(stderr,"\n");
+	fprintf(stderr,"Synthetic gradient, noise, and plasma images are always used, followed\n");
+	fprintf(stderr,"by each imgfile.  Exits with 1 if any output differs from the single\n");
+	fprintf(stderr,"threaded reference.\n");
+	exit(1);
+}
+
+//Encode a case FRAMES times with one encoder.  The outputs are returned in
+//malloc'd buffers.
+static int encodeCase( stress_case_t* sc, char** text, size_t* textlen, char** binary, size_t* binarylen ) {
+	term_encode_t enc;
+	FILE* binfp;
+	char* framebin;
+	size_t framebinlen;
+	size_t frame;
+	int failed = 0;
+	
+	*text = 0;
+	*textlen = 0;
+	*binary = 0;
+	*binarylen = 0;
+	term_encode_init(&enc);
+	enc.renderer = sc->renderer;
+	enc.win_width = sc->width;
+	enc.stdpal = sc->pal->stdpal;
+	enc.reqpalsize = sc->pal->palsize;
+	enc.dither = sc->pal->dither;
+	enc.filter = sc->filter;
+	enc.runs = sc->runs;
+	enc.sixel = sc->sixel;
+	enc.enctext = 1;
+	//The sixel renderer has no newdraw output
+	enc.encbinary = sc->renderer != ENC_RENDER_SIXEL;
+	enc.textfp = open_memstream(text,textlen);
+	binfp = open_memstream(binary,binarylen);
+	if( enc.textfp == 0 || binfp == 0 ) {
+		fprintf(stderr,"Failed to open memory stream\n");
+		exit(1);
+	}
+	for( frame=0; frame<FRAMES && !failed; frame++ ) {
+		//The encoder may modify (and owns) imgpixels
+		enc.imgpixels = (uint8_t*)malloc(3*sc->img->width*sc->img->height);
+		if( enc.imgpixels == 0 ) {
+			fprintf(stderr,"Failed to allocate image copy\n");
+			exit(1);
+		}
+		memcpy(enc.imgpixels,sc->img->pixels,3*sc->img->width*sc->img->height);
+		enc.imgwidth = sc->img->width;
+		enc.imgheight = sc->img->height;
+		//Each newdraw binary is a whole file, closed by term_encode()
+		framebin = 0;
+		framebinlen = 0;
+		if( enc.encbinary ) {
+			enc.binaryfp = open_memstream(&framebin,&framebinlen);
+			if( enc.binaryfp == 0 ) {
+				fprintf(stderr,"Failed to open memory stream\n");
+				exit(1);
+			}
+		}
+		if( term_encode(&enc) ) {
+			failed = 1;
+		}
+		if( enc.binaryfp ) {
+			fclose(enc.binaryfp);
+			enc.binaryfp = 0;
+		}
+		if( framebin ) {
+			fwrite(framebin,1,framebinlen,binfp);
+			free(framebin);
+		}
+		free(enc.imgpixels);
+		enc.imgpixels = 0;
+	}
+	fclose(enc.textfp);
+	enc.textfp = 0;
+	fclose(binfp);
+	term_encode_destroy(&enc);
+	return failed;
+}
+
+static void* stressThread( void* arg ) {
+	stress_thread_t* st = (stress_thread_t*)arg;
+	stress_case_t* sc;
+	char* text;
+	char* binary;
+	size_t textlen, binarylen;
+	size_t i, n;
+	
+	for( n=0; n<st->iterations; n++ ) {
+		for( i=0; i<ncases; i++ ) {
+			sc = &(cases[(st->first+i)%ncases]);
+			if( encodeCase(sc,&text,&textlen,&binary,&binarylen) ||
+					textlen != sc->textlen || memcmp(text,sc->text,textlen) != 0 ||
+					binarylen != sc->binarylen || (binarylen && memcmp(binary,sc->binary,binarylen) != 0) ) {
+				fprintf(stderr,"Mismatch: %s %s width %lu palette %s filter %d\n",
+					sc->rname,sc->img->name,sc->width,sc->pal->name,sc->filter);
+				st->mismatches++;
+			}
+			st->encodes++;
+			free(text);
+			free(binary);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	bench_image_t images[MAX_IMAGES];
+	size_t nimages = 0;
+	stress_thread_t* threads;
+	size_t nthreads = DEFAULT_THREADS;
+	size_t iterations = DEFAULT_ITERATIONS;
+	char* rlist = 0;
+	term_encode_renderer_info_t info;
+	stress_case_t* sc;
+	size_t encodes = 0;
+	size_t mismatches = 0;
+	size_t i, p;
+	int renderer;
+	
+	i=1;
+	while( i < (size_t)argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-t") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			nthreads = strtoul(argv[++i],0,10);
+			if( nthreads == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-n") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			iterations = strtoul(argv[++i],0,10);
+		}
+		else if( strcmp(argv[i],"-r") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			rlist = argv[++i];
+		}
+		else if( argv[i][0] == '-' ) {
+			usage(argv[0]);
+		}
+		else {
+			if( nimages+3 >= MAX_IMAGES ) {
+				usage(argv[0]);
+			}
+			if( bench_load_image(argv[i],&(images[nimages])) ) {
+				exit(1);
+			}
+			nimages++;
+		}
+		i++;
+	}
+	
+	//Synthetic images first, then the files in order
+	memmove(&(images[3]),&(images[0]),sizeof(bench_image_t)*nimages);
+	images[0] = bench_synth_image("gradient",320,240);
+	images[1] = bench_synth_image("noise",320,240);
+	images[2] = bench_synth_image("plasma",640,360);
+	nimages += 3;
+	
+	//Every renderer in every palette mode, with the images, filters, and
+	//run and sixel modes taken in turn
+	for( renderer=0; renderer<256; renderer++ ) {
+		if( (renderer >= ENC_RENDER_AA && renderer <= ENC_RENDER_CACABLK) ||
+				renderer == ENC_RENDER_LIBSIXEL ||
+				term_encode_renderer_info(renderer,&info) || ! bench_in_list(rlist,info.name) ) {
+			continue;
+		}
+		for( p=0; p<bench_npalettes && ncases<MAX_CASES; p++ ) {
+			sc = &(cases[ncases]);
+			memset(sc,0,sizeof(*sc));
+			sc->renderer = renderer;
+			sc->rname = info.name;
+			sc->img = &(images[ncases%nimages]);
+			sc->width = renderer == ENC_RENDER_SIXEL ? 240 : 80;
+			sc->pal = &(bench_palettes[p]);
+			sc->filter = filters[ncases%NFILTERS];
+			sc->runs = ncases%3;
+			sc->sixel = ncases%3;
+			if( encodeCase(sc,&(sc->text),&(sc->textlen),&(sc->binary),&(sc->binarylen)) ) {
+				fprintf(stderr,"Failed: %s %s palette %s\n",info.name,sc->img->name,sc->pal->name);
+				exit(1);
+			}
+			ncases++;
+		}
+	}
+	if( ncases == 0 ) {
+		usage(argv[0]);
+	}
+	
+	threads = (stress_thread_t*)calloc(nthreads,sizeof(stress_thread_t));
+	if( threads == 0 ) {
+		fprintf(stderr,"Failed to allocate threads\n");
+		exit(1);
+	}
+	for( i=0; i<nthreads; i++ ) {
+		threads[i].first = i*ncases/nthreads;
+		threads[i].iterations = iterations;
+		if( pthread_create(&(threads[i].thread),0,stressThread,&(threads[i])) ) {
+			fprintf(stderr,"Failed to create thread\n");
+			exit(1);
+		}
+	}
+	for( i=0; i<nthreads; i++ ) {
+		pthread_join(threads[i].thread,0);
+		encodes += threads[i].encodes;
+		mismatches += threads[i].mismatches;
+	}
+	printf("%lu cases, %lu threads, %lu encoders run, %lu mismatches\n",
+		ncases,nthreads,encodes,mismatches);
+	
+	for( i=0; i<ncases; i++ ) {
+		free(cases[i].text);
+		free(cases[i].binary);
+	}
+	for( i=0; i<nimages; i++ ) {
+		bench_free_image(&(images[i]));
+	}
+	free(threads);
+	return mismatches ? 1 : 0;
+}
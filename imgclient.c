@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define IMGSERVER_IMPLEMENTATION
+#include "imgserver.h"
+
+#include "term_encode.h"
+
+//Simple client for imgserver (mostly for testing)
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] -s socketpath [-n #] [-sp 16|256|24 | -p # | -bw] -w # [-c] [-b binfile]\n",cmd);
+	fprintf(stderr,"     [-dither] [-crop x y w h]  [([-edge | -line | -glow | -hi | -apple2bw] 0xRRGGBB) | -apple2 ]\n");
+	fprintf(stderr,"     renderer imgfile\n");
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h     : Print usage message\n");
+	fprintf(stderr,"-s     : Server socket\n");
+	fprintf(stderr,"-n     : Send the request # times on one connection (only the last is output)\n");
+	fprintf(stderr,"-sp    : Use standard 16 or 256 color palette (or 24 shade grey scale)\n");
+	fprintf(stderr,"-p     : Use a true color palette of # colors (<= 256)\n");
+	fprintf(stderr,"-bw    : Disable colors (as possible)\n");
+	fprintf(stderr,"-w     : Set the character width\n");
+	fprintf(stderr,"-c     : Clear terminal\n");
+	fprintf(stderr,"-b     : Binary file to save (for newdraw)\n");
+	fprintf(stderr,"-dither: Use palette quantizer with dither (if the server supports it)\n");
+	fprintf(stderr,"-crop  : Crop the image before processing\n");
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-= Filters =-\n");
+	fprintf(stderr,"-edge     : Render edge detection (scaled) using specified color\n");
+	fprintf(stderr,"-line     : Render edges as solid lines using specified color\n");
+	fprintf(stderr,"-glow     : Mix edge detection (scaled) with image\n");
+	fprintf(stderr,"-hi       : Mix edge line with images\n");
+	fprintf(stderr,"-apple2bw : Render like an apple2 hi-res black and white  image\n");
+	fprintf(stderr,"-apple2   : Render like an apple2 hi-res color image\n");
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-= Renderers =-\n");
+	fprintf(stderr,"-sixel  : Sixel\n");
+	fprintf(stderr,"-libsixel: Sixel encoded by libsixel\n");
+	fprintf(stderr,"-simple : ANSI Simple\n");
+	fprintf(stderr,"-half   : ANSI Half-Character\n");
+	fprintf(stderr,"-qchar  : ANSI Quarter-Character\n");
+	fprintf(stderr,"-six    : ANSI Sextant-Character\n");
+	fprintf(stderr,"-bra    : ANSI Braille-Character\n");
+	fprintf(stderr,"-ascii     : Native ASCII Art\n");
+	fprintf(stderr,"-asciiext  : Native ASCII Art with extended characters\n");
+	fprintf(stderr,"-asciifg   : Native ASCII Art with Foreground Color\n");
+	fprintf(stderr,"-asciifgext: Native ASCII Art with Foreground Color and\n");
+	fprintf(stderr,"             extended characters\n");
+	fprintf(stderr,"-asciibg   : Native ASCII Art with Foreground and Background Color\n");
+	fprintf(stderr,"-asciibgext: Native ASCII Art with Foreground and Background\n");
+	fprintf(stderr,"             Color and extended characters\n");
+	fprintf(stderr,"-aa     : ASCII Art\n");
+	fprintf(stderr,"-aaext  : ASCII Art with extended characters\n");
+	fprintf(stderr,"-aafg   : ASCII Art with Foreground Color\n");
+	fprintf(stderr,"-aafgext: ASCII Art with Foreground Color and\n");
+	fprintf(stderr,"          extended characters\n");
+	fprintf(stderr,"-aabg   : ASCII Art with Background Color\n");
+	fprintf(stderr,"-aabgext: ASCII Art with Background Color and\n");
+	fprintf(stderr,"          extended characters\n");
+	fprintf(stderr,"-caca   : CACA (Color ASCII Art)\n");
+	fprintf(stderr,"-cacablk: CACA with block characters\n");
+	fprintf(stderr,"Renderers and options not built into the server will fail.\n");
+	fprintf(stderr,"\n");
+	exit(1);
+}
+
+static struct {
+	char* arg;
+	uint32_t renderer;
+} renderers[] = {
+	{"-sixel",   ENC_RENDER_SIXEL},
+	{"-libsixel",ENC_RENDER_LIBSIXEL},
+	{"-simple",  ENC_RENDER_SIMPLE},
+	{"-half",    ENC_RENDER_HALF},
+	{"-qchar",   ENC_RENDER_QUARTER},
+	{"-six",     ENC_RENDER_SEXTANT},
+	{"-bra",     ENC_RENDER_BRAILLE},
+	{"-ascii",     ENC_RENDER_ASCII},
+	{"-asciiext",  ENC_RENDER_ASCIIEXT},
+	{"-asciifg",   ENC_RENDER_ASCIIFG},
+	{"-asciifgext",ENC_RENDER_ASCIIFGEXT},
+	{"-asciibg",   ENC_RENDER_ASCIIBG},
+	{"-asciibgext",ENC_RENDER_ASCIIBGEXT},
+	{"-aa",      ENC_RENDER_AA},
+	{"-aaext",   ENC_RENDER_AAEXT},
+	{"-aafg",    ENC_RENDER_AAFG},
+	{"-aafgext", ENC_RENDER_AAFGEXT},
+	{"-aabg",    ENC_RENDER_AABG},
+	{"-aabgext", ENC_RENDER_AABGEXT},
+	{"-caca",    ENC_RENDER_CACA},
+	{"-cacablk", ENC_RENDER_CACABLK},
+	{0, 0}
+};
+
+//Filters that take a color argument
+static struct {
+	char* arg;
+	uint32_t filter;
+} filters[] = {
+	{"-edge",     ENC_FILTER_EDGE_SCALE},
+	{"-line",     ENC_FILTER_EDGE_LINE},
+	{"-glow",     ENC_FILTER_EDGE_GLOW},
+	{"-hi",       ENC_FILTER_EDGE_HIGHLIGHT},
+	{"-apple2bw", ENC_FILTER_APPLE2_BW},
+	{0, 0}
+};
+
+static uint8_t* readFile( char* path, size_t* len ) {
+	FILE* fp;
+	uint8_t* data;
+	long size;
+	fp = fopen(path,"rb");
+	if( fp == 0 ) {
+		return 0;
+	}
+	if( fseek(fp,0,SEEK_END) || (size = ftell(fp)) <= 0 || fseek(fp,0,SEEK_SET) ) {
+		fclose(fp);
+		return 0;
+	}
+	data = (uint8_t*)malloc(size);
+	if( data == 0 || fread(data,1,size,fp) != (size_t)size ) {
+		if( data ) { free(data); }
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	*len = size;
+	return data;
+}
+
+int main(int argc, char** argv) {
+	size_t i, j;
+	char* sockpath = 0;
+	char* imgpath = 0;
+	char* binpath = 0;
+	size_t repeat = 1;
+	imgserver_request_t req;
+	imgserver_response_t rsp;
+	struct sockaddr_un addr;
+	uint8_t* imgdata;
+	size_t imgdatalen;
+	char* text;
+	char* bin;
+	FILE* binfp;
+	int sock;
+	
+	memset(&req,0,sizeof(req));
+	req.magic = IMGSERVER_REQUEST_MAGIC;
+	req.version = IMGSERVER_VERSION;
+	req.flags = IMGSERVER_TEXT;
+	
+	i=1;
+	while( i < argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-s") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			sockpath = argv[++i];
+		}
+		else if( strcmp(argv[i],"-n") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			repeat = atoi(argv[++i]);
+			if( repeat == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-sp") == 0 ) {
+			if( i >= argc-1 || req.palsize || (req.flags & IMGSERVER_STDPAL) ) {
+				usage(argv[0]);
+			}
+			req.flags |= IMGSERVER_STDPAL;
+			req.palsize = atoi(argv[++i]);
+			if( req.palsize != 16 && req.palsize != 256 && req.palsize != 24 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-p") == 0 ) {
+			if( i >= argc-1 || req.palsize || (req.flags & IMGSERVER_STDPAL) ) {
+				usage(argv[0]);
+			}
+			req.palsize = atoi(argv[++i]);
+			if( req.palsize == 0 || req.palsize > 256 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-bw") == 0 ) {
+			if( req.palsize || (req.flags & IMGSERVER_STDPAL) ) {
+				usage(argv[0]);
+			}
+			req.flags |= IMGSERVER_STDPAL;
+		}
+		else if( strcmp(argv[i],"-w") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			req.win_width = atoi(argv[++i]);
+			if( req.win_width == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-c") == 0 ) {
+			req.flags |= IMGSERVER_CLEAR;
+		}
+		else if( strcmp(argv[i],"-b") == 0 ) {
+			if( i >= argc-1 || binpath != 0 ) {
+				usage(argv[0]);
+			}
+			binpath = argv[++i];
+			req.flags |= IMGSERVER_BINARY;
+		}
+		else if( strcmp(argv[i],"-dither") == 0 ) {
+			req.flags |= IMGSERVER_DITHER;
+		}
+		else if( strcmp(argv[i],"-crop") == 0 ) {
+			if( i >= argc-4 ) {
+				usage(argv[0]);
+			}
+			req.crop_x = atoi(argv[++i]);
+			req.crop_y = atoi(argv[++i]);
+			req.crop_w = atoi(argv[++i]);
+			req.crop_h = atoi(argv[++i]);
+			if( req.crop_w == 0 || req.crop_h == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-apple2") == 0 ) {
+			if( req.filter != ENC_FILTER_NONE ) {
+				usage(argv[0]);
+			}
+			req.filter = ENC_FILTER_APPLE2;
+		}
+		else {
+			for( j=0; renderers[j].arg; j++ ) {
+				if( strcmp(argv[i],renderers[j].arg) == 0 ) {
+					break;
+				}
+			}
+			if( renderers[j].arg ) {
+				if( req.renderer ) {
+					usage(argv[0]);
+				}
+				req.renderer = renderers[j].renderer;
+				i++;
+				continue;
+			}
+			for( j=0; filters[j].arg; j++ ) {
+				if( strcmp(argv[i],filters[j].arg) == 0 ) {
+					break;
+				}
+			}
+			if( filters[j].arg ) {
+				if( i >= argc-1 || req.filter != ENC_FILTER_NONE ) {
+					usage(argv[0]);
+				}
+				req.filter = filters[j].filter;
+				errno = 0;
+				req.color_rgb = strtoul(argv[++i],0,16);
+				if( errno ) {
+					usage(argv[0]);
+				}
+				//Edge filters invert dark colors (same as imgconvert)
+				if( (req.filter == ENC_FILTER_EDGE_SCALE || req.filter == ENC_FILTER_EDGE_LINE) &&
+						((req.color_rgb>>16)&0xFF) < 0x80 &&
+						((req.color_rgb>> 8)&0xFF) < 0x80 &&
+						((req.color_rgb    )&0xFF) < 0x80 ) {
+					req.flags |= IMGSERVER_INVERT;
+				}
+				i++;
+				continue;
+			}
+			if( imgpath != 0 ) {
+				usage(argv[0]);
+			}
+			imgpath = argv[i];
+		}
+		i++;
+	}
+	if( sockpath == 0 || imgpath == 0 || req.renderer == ENC_RENDER_NONE || req.win_width == 0 ) {
+		usage(argv[0]);
+	}
+	if( strlen(sockpath) >= sizeof(addr.sun_path) ) {
+		fprintf(stderr,"Socket path is too long\n");
+		exit(1);
+	}
+	
+	imgdata = readFile(imgpath,&imgdatalen);
+	if( imgdata == 0 ) {
+		fprintf(stderr,"Failed to read image: %s\n",imgpath);
+		exit(1);
+	}
+	if( imgdatalen > IMGSERVER_MAX_IMAGE ) {
+		fprintf(stderr,"Image is too large for the server\n");
+		exit(1);
+	}
+	req.image_len = imgdatalen;
+	imgserver_swap(&req,sizeof(req));
+	
+	sock = socket(AF_UNIX,SOCK_STREAM,0);
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,sockpath);
+	if( sock < 0 || connect(sock,(struct sockaddr*)&addr,sizeof(addr)) ) {
+		fprintf(stderr,"Failed to connect to %s: %s\n",sockpath,strerror(errno));
+		exit(1);
+	}
+	
+	text = 0;
+	bin = 0;
+	for( i=0; i<repeat; i++ ) {
+		if( imgserver_send(sock,&req,sizeof(req)) || imgserver_send(sock,imgdata,imgdatalen) ||
+				imgserver_recv(sock,&rsp,sizeof(rsp)) ) {
+			fprintf(stderr,"Lost connection to server\n");
+			exit(1);
+		}
+		imgserver_swap(&rsp,sizeof(rsp));
+		if( rsp.magic != IMGSERVER_RESPONSE_MAGIC ) {
+			fprintf(stderr,"Invalid response from server\n");
+			exit(1);
+		}
+		text = (char*)realloc(text,rsp.text_len+1);
+		bin = (char*)realloc(bin,rsp.binary_len+1);
+		if( text == 0 || bin == 0 ) {
+			fprintf(stderr,"Failed to allocate response buffer\n");
+			exit(1);
+		}
+		if( imgserver_recv(sock,text,rsp.text_len) || imgserver_recv(sock,bin,rsp.binary_len) ) {
+			fprintf(stderr,"Lost connection to server\n");
+			exit(1);
+		}
+		if( rsp.status ) {
+			text[rsp.text_len] = 0;
+			fprintf(stderr,"Server error: %s",text);
+			exit(1);
+		}
+	}
+	close(sock);
+	
+	fwrite(text,1,rsp.text_len,stdout);
+	if( binpath ) {
+		binfp = fopen(binpath,"wb");
+		if( binfp == 0 || fwrite(bin,1,rsp.binary_len,binfp) != rsp.binary_len ) {
+			fprintf(stderr,"Failed to write binary file.\n");
+			exit(1);
+		}
+		fclose(binfp);
+	}
+	free(text);
+	free(bin);
+	free(imgdata);
+	return 0;
+}
@@ -26,37 +26,77 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 //Implemenation block
 #define STB_IMAGE_IMPLEMENTATION
-#define STBI_NO_THREAD_LOCALS
 #include "stb_image.h"
 
+#define STRIP_LOAD_IMPLEMENTATION
+#include "strip_load.h"
+
+#define ENC_CACHE_IMPLEMENTATION
+#include "enc_cache.h"
+
 #include "term_encode.h"
 
+//Default -cachesize in MB
+#define DEFAULT_CACHE_MB 256
 
 static void usage(char* cmd) {
 	fprintf(stderr,"Usage:\n");
-	fprintf(stderr,"%s [-h] [-sp 16|256|24 | -p # | -bw] [-w #] [-c] [-b binfile]\n",cmd);
+	fprintf(stderr,"%s [-h] [-sp 16|256|24 | -p # | -bw] [-w #[,#...]] [-c] [-b binfile]\n",cmd);
 	fprintf(stderr,"     ");
 	#ifdef USE_QUANTPNM
 	fprintf(stderr,"[-dither] ");
 	#endif //USE_QUANTPNM
-	fprintf(stderr,"[-crop x y w h]  [([-edge | -line | -glow | -hi | -apple2bw] 0xRRGGBB) | -apple2 ]\n");
-	fprintf(stderr,"     renderer imgfile\n");
+	fprintf(stderr,"[-lowmem] [-cache dir [-cachesize #]] [-stats] [-trace file]\n");
+	fprintf(stderr,"     [-crop x y w h] [-runs erase|rep]\n");
+	fprintf(stderr,"     [([-edge | -line | -glow | -hi | -apple2bw] 0xRRGGBB) | -apple2 ]\n");
+	fprintf(stderr,"     renderer (imgfile | -batch listfile [-j #] [-o textfile])\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-h     : Print usage message\n");
 	fprintf(stderr,"-sp    : Use standard 16 or 256 color palette (or 24 shade grey scale)\n");
 	fprintf(stderr,"-p     : Use a true color palette of # colors (<= 256)\n");
 	fprintf(stderr,"-bw    : Disable colors (as possible)\n");
 	fprintf(stderr,"-w     : Set the character width (terminal width used by default)\n");
+	fprintf(stderr,"         A comma seperated list renders the image at each width\n");
 	fprintf(stderr,"-c     : Clear terminal\n");
 	fprintf(stderr,"-b     : Binary file to save (for newdraw)\n");
 	#ifdef USE_QUANTPNM
 	fprintf(stderr,"-dither: Use palette quantizer with dither\n");
 	#endif //USE_QUANTPNM
+	fprintf(stderr,"-lowmem: Read PNM images a scanline at a time, shrinking them as they\n");
+	fprintf(stderr,"         are read (memory use depends upon output size, not image size)\n");
+	fprintf(stderr,"-cache : Directory used to cache encoded output.  Output for an image\n");
+	fprintf(stderr,"         and set of options that was encoded before is copied from the\n");
+	fprintf(stderr,"         cache instead of being decoded and encoded again\n");
+	fprintf(stderr,"-cachesize: Maximum cache size in MB (default %d), least recently\n",DEFAULT_CACHE_MB);
+	fprintf(stderr,"         used output is removed (only the cache's own <key>.txt and\n");
+	fprintf(stderr,"         <key>.bin files, other files in the directory are left alone)\n");
+	fprintf(stderr,"-stats : Print encoder stage timings and counters to stderr\n");
+	fprintf(stderr,"-trace : Write a Chrome trace event file (chrome://tracing or\n");
+	fprintf(stderr,"         ui.perfetto.dev) of the load and encoder stages to file\n");
 	fprintf(stderr,"-crop  : Crop the image before processing\n");
+	fprintf(stderr,"-runs  : Erase runs of blank cells (erase), and also repeat runs\n");
+	fprintf(stderr,"         of other characters (rep), instead of writing each cell\n");
+	fprintf(stderr,"-batch : Convert every image listed (one per line) in listfile (- for stdin)\n");
+	fprintf(stderr,"-j     : Number of batch worker threads (number of CPUs by default)\n");
+	fprintf(stderr,"-o     : Text file to save for each batch image\n");
+	fprintf(stderr,"         Batch -o and -b file names are templates:\n");
+	fprintf(stderr,"           %%n = image file name without directory or extension\n");
+	fprintf(stderr,"           %%f = image file name with extension\n");
+	fprintf(stderr,"           %%d = image directory (. if the list gives none)\n");
+	fprintf(stderr,"           %%w = character width\n");
+	fprintf(stderr,"           %%%% = %%\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-= Filters =-\n");
 	fprintf(stderr,"-edge     : Render edge detection (scaled) using specified color\n");
@@ -67,14 +107,23 @@ static void usage(char* cmd) {
 	fprintf(stderr,"-apple2   : Render like an apple2 hi-res color image\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-= Renderers =-\n");
-	#ifdef USE_LIBSIXEL
 	fprintf(stderr,"-sixel  : Sixel\n");
+	#ifdef USE_LIBSIXEL
+	fprintf(stderr,"-libsixel: Sixel encoded by libsixel\n");
 	#endif //USE_LIBSIXEL
 	fprintf(stderr,"-simple : ANSI Simple\n");
 	fprintf(stderr,"-half   : ANSI Half-Character\n");
 	fprintf(stderr,"-qchar  : ANSI Quarter-Character\n");
 	fprintf(stderr,"-six    : ANSI Sextant-Character\n");
 	fprintf(stderr,"-bra    : ANSI Braille-Character\n");
+	fprintf(stderr,"-ascii     : Native ASCII Art\n");
+	fprintf(stderr,"-asciiext  : Native ASCII Art with extended characters\n");
+	fprintf(stderr,"-asciifg   : Native ASCII Art with Foreground Color\n");
+	fprintf(stderr,"-asciifgext: Native ASCII Art with Foreground Color and\n");
+	fprintf(stderr,"             extended characters\n");
+	fprintf(stderr,"-asciibg   : Native ASCII Art with Foreground and Background Color\n");
+	fprintf(stderr,"-asciibgext: Native ASCII Art with Foreground and Background\n");
+	fprintf(stderr,"             Color and extended characters\n");
 	#ifdef USE_AALIB
 	fprintf(stderr,"-aa     : ASCII Art\n");
 	fprintf(stderr,"-aaext  : ASCII Art with extended characters\n");
@@ -92,16 +141,714 @@ static void usage(char* cmd) {
 	fprintf(stderr,"\n");
 	exit(1);
 }
+
+//Maximum number of comma seperated widths given to -w
+#define MAX_WIDTHS 16
+
+//Memory map a file so it can be decoded in place by the stb_image from-memory
+//path.  Returns 0 if the file cannot be mapped.
+static uint8_t* mapFile( char* path, size_t* len ) {
+	int fd;
+	struct stat st;
+	void* map;
+	
+	fd = open(path,O_RDONLY);
+	if( fd < 0 ) {
+		return 0;
+	}
+	if( fstat(fd,&st) || st.st_size == 0 || st.st_size > INT_MAX ) {
+		close(fd);
+		return 0;
+	}
+	map = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if( map == MAP_FAILED ) {
+		return 0;
+	}
+	//Decoders read the file from front to back
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+	*len = st.st_size;
+	return (uint8_t*)map;
+}
+
+//Load (or reload) the image for the current win_width.  imgdata is the mapped
+//file, or 0 to read it with stdio.
+static int loadImage( term_encode_t* enc, char* imgpath, uint8_t* imgdata, size_t imgdatalen, int lowmem ) {
+	int imgwidth;
+	int imgheight;
+	int imgchannels;
+	int scale;
+	int info;
+	size_t target;
+	size_t srcwidth;
+	FILE* imgfp;
+	
+	imgfp = 0;
+	if( lowmem ) {
+		imgfp = fopen(imgpath,"rb");
+		if( imgfp && ! strip_is_pnm(imgfp) ) {
+			fclose(imgfp);
+			imgfp = 0;
+		}
+	}
+	if( imgfp ) {
+		//Renderers use at most 2 pixels per column, so shrinking to 4 pixels
+		//per column leaves the final resize something to filter.
+		enc->imgpixels = strip_load_pnm(imgfp, 4*enc->win_width,
+			enc->crop.x, enc->crop.y, enc->crop.w, enc->crop.h,
+			&enc->imgwidth, &enc->imgheight);
+		fclose(imgfp);
+		if( enc->imgpixels == 0 ) {
+			fprintf(stderr,"Failed to load image: %s\n",imgpath);
+			return 1;
+		}
+		//Crop has already been applied
+		enc->crop.w = 0;
+		enc->crop.h = 0;
+		return 0;
+	}
+	
+	//Decode at the smallest scale (1/2, 1/4, 1/8) that is still at least
+	//as wide as the renderer needs.
+	scale = 1;
+	target = term_encode_pixel_width(enc);
+	if( target ) {
+		if( imgdata ) {
+			info = stbi_info_from_memory(imgdata, imgdatalen, &imgwidth, &imgheight, &imgchannels);
+		} else {
+			info = stbi_info(imgpath, &imgwidth, &imgheight, &imgchannels);
+		}
+		if( info ) {
+			srcwidth = imgwidth;
+			if( enc->crop.w && enc->crop.h && enc->crop.x < srcwidth ) {
+				if( enc->crop.x+enc->crop.w < srcwidth ) {
+					srcwidth = enc->crop.w;
+				} else {
+					srcwidth = srcwidth - enc->crop.x;
+				}
+			}
+			while( scale < 8 && srcwidth/(2*scale) >= target ) {
+				scale = scale*2;
+			}
+		}
+	}
+	if( imgdata ) {
+		enc->imgpixels = stbi_load_from_memory_scaled(imgdata, imgdatalen, &imgwidth, &imgheight, &imgchannels, 3, scale);
+	} else {
+		enc->imgpixels = stbi_load_scaled(imgpath, &imgwidth, &imgheight, &imgchannels, 3, scale);
+	}
+	if( enc->imgpixels == 0 ) {
+		fprintf(stderr,"Failed to load image: %s\n",imgpath);
+		return 1;
+	}
+	enc->imgwidth = imgwidth;
+	enc->imgheight = imgheight;
+	//Crop is in full size image coordinates
+	if( scale > 1 && enc->crop.w && enc->crop.h ) {
+		enc->crop.x = enc->crop.x/scale;
+		enc->crop.y = enc->crop.y/scale;
+		enc->crop.w = (enc->crop.w+scale-1)/scale;
+		enc->crop.h = (enc->crop.h+scale-1)/scale;
+	}
+	return 0;
+}
+	
+//Hash of everything that determines the decoded image, for cache keys
+static uint64_t imageHash( uint8_t* imgdata, size_t imgdatalen, int lowmem ) {
+	uint64_t hash;
+	hash = term_encode_hash(TERM_ENCODE_HASH_INIT,imgdata,imgdatalen);
+	//PNM images are shrunk differently when loaded with -lowmem
+	return term_encode_hash(hash,&lowmem,sizeof(lowmem));
+}
+
+//Copy cached text and binary output to textfp and binfp (either may be 0
+//if not wanted).  Returns 0 if everything wanted was in the cache.
+static int cacheFetch( enc_cache_t* cache, uint64_t key, FILE* textfp, FILE* binfp ) {
+	FILE* textcache = 0;
+	FILE* bincache = 0;
+	int err = 0;
+	
+	if( textfp ) {
+		textcache = enc_cache_open(cache,key,"txt");
+	}
+	if( binfp ) {
+		bincache = enc_cache_open(cache,key,"bin");
+	}
+	if( (textfp && textcache == 0) || (binfp && bincache == 0) ) {
+		if( textcache ) { fclose(textcache); }
+		if( bincache ) { fclose(bincache); }
+		return 1;
+	}
+	if( textcache ) {
+		err |= enc_cache_copy(textcache,textfp);
+	}
+	if( bincache ) {
+		err |= enc_cache_copy(bincache,binfp);
+	}
+	if( err ) {
+		fprintf(stderr,"Failed to copy cached output\n");
+	}
+	return err;
+}
+
+//Expand an output file name template for an image path and width.
+//Returns 1 if the result does not fit in dst.
+static int expandTemplate( char* dst, size_t dstlen, char* tmpl, char* imgpath, size_t width ) {
+	char* name;
+	size_t namelen;
+	char* dir;
+	size_t dirlen;
+	char* src;
+	size_t srclen;
+	size_t len = 0;
+	int n;
+	
+	name = strrchr(imgpath,'/');
+	if( name ) {
+		dir = imgpath;
+		dirlen = name == imgpath ? 1 : (size_t)(name-imgpath);
+		name++;
+	}
+	else {
+		dir = ".";
+		dirlen = 1;
+		name = imgpath;
+	}
+	namelen = strrchr(name,'.') ? (size_t)(strrchr(name,'.')-name) : strlen(name);
+	if( namelen == 0 ) {
+		namelen = strlen(name);
+	}
+	while( *tmpl ) {
+		if( tmpl[0] == '%' && (tmpl[1] == 'n' || tmpl[1] == 'f' || tmpl[1] == 'd') ) {
+			src = tmpl[1] == 'd' ? dir : name;
+			srclen = tmpl[1] == 'n' ? namelen : tmpl[1] == 'f' ? strlen(name) : dirlen;
+			if( len+srclen >= dstlen ) { return 1; }
+			memcpy(&(dst[len]),src,srclen);
+			len += srclen;
+			tmpl += 2;
+		}
+		else if( tmpl[0] == '%' && tmpl[1] == 'w' ) {
+			n = snprintf(&(dst[len]),dstlen-len,"%lu",width);
+			if( n < 0 || len+n >= dstlen ) { return 1; }
+			len += n;
+			tmpl += 2;
+		}
+		else {
+			if( len+1 >= dstlen ) { return 1; }
+			if( tmpl[0] == '%' && tmpl[1] == '%' ) {
+				tmpl++;
+			}
+			dst[len++] = *(tmpl++);
+		}
+	}
+	dst[len] = 0;
+	return 0;
+}
+
+static int writeFile( char* path, char* data, size_t len ) {
+	FILE* fp;
+	fp = fopen(path,"wb");
+	if( fp == 0 ) {
+		fprintf(stderr,"Failed to open %s for writing: %s\n",path,strerror(errno));
+		return 1;
+	}
+	if( fwrite(data,1,len,fp) != len ) {
+		fprintf(stderr,"Failed to write %s\n",path);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+//Encode into memory, write the output to textfp and binfp (if non-zero),
+//and store it in the cache.
+static int cacheEncode( enc_cache_t* cache, uint64_t key, term_encode_t* enc, FILE* textfp, FILE* binfp ) {
+	char* textbuf = 0;
+	size_t textlen = 0;
+	char* binbuf = 0;
+	size_t binlen = 0;
+	int err;
+	
+	enc->textfp = open_memstream(&textbuf,&textlen);
+	enc->binaryfp = binfp ? open_memstream(&binbuf,&binlen) : 0;
+	if( enc->textfp == 0 || (binfp && enc->binaryfp == 0) ) {
+		fprintf(stderr,"Failed to allocate output buffers\n");
+		return 1;
+	}
+	err = term_encode(enc);
+	fclose(enc->textfp);
+	enc->textfp = 0;
+	//The encoder closes the binary file when it finishes
+	if( enc->binaryfp ) {
+		fclose(enc->binaryfp);
+		enc->binaryfp = 0;
+	}
+	if( ! err ) {
+		if( fwrite(textbuf,1,textlen,textfp) != textlen || (binfp && fwrite(binbuf,1,binlen,binfp) != binlen) ) {
+			fprintf(stderr,"Failed to write output\n");
+			err = 1;
+		}
+	}
+	if( ! err ) {
+		enc_cache_store(cache,key,"txt",textbuf,textlen);
+		if( binfp ) {
+			enc_cache_store(cache,key,"bin",binbuf,binlen);
+		}
+	}
+	free(textbuf);
+	if( binbuf ) { free(binbuf); }
+	return err;
+}
+
+static double elapsedMs( struct timespec* start, struct timespec* end ) {
+	return (end->tv_sec-start->tv_sec)*1000.0 + (end->tv_nsec-start->tv_nsec)/1000000.0;
+}
+
+typedef struct {
+	//Shared encoder configuration (copied into each worker's encoder)
+	term_encode_t* config;
+	size_t* widths;
+	size_t nwidths;
+	int lowmem;
+	//Output cache (0 if not used)
+	enc_cache_t* cache;
+	char* texttmpl;
+	char* bintmpl;
+	
+	char** paths;
+	size_t npaths;
+	//Next path to convert
+	size_t next;
+	
+	//Totals
+	size_t converted;
+	size_t cached;
+	size_t failed;
+	double decode_ms;
+	double encode_ms;
+	double write_ms;
+	//Encoder figures (summed when config->stats is set)
+	term_encode_stats_t stats;
+	
+	pthread_mutex_t lock;
+} batch_t;
+
+//Decode, encode, and write one image at one width.
+//Encoded output is collected in memory and written once encoding is done.
+//Output found in the cache is copied instead, and counts as write time.
+static int batchConvert( batch_t* batch, term_encode_t* enc, char* imgpath, size_t width,
+		uint8_t* imgdata, size_t imgdatalen, uint64_t datahash, double* times, int* hit ) {
+	char textpath[PATH_MAX];
+	char binpath[PATH_MAX];
+	char* textbuf = 0;
+	size_t textlen = 0;
+	char* binbuf = 0;
+	size_t binlen = 0;
+	struct timespec t0, t1, t2, t3;
+	uint64_t key = 0;
+	int err = 0;
+	
+	if( (batch->texttmpl && expandTemplate(textpath,PATH_MAX,batch->texttmpl,imgpath,width)) ||
+			(batch->bintmpl && expandTemplate(binpath,PATH_MAX,batch->bintmpl,imgpath,width)) ) {
+		fprintf(stderr,"Output path too long for %s\n",imgpath);
+		return 1;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	enc->win_width = width;
+	enc->crop = batch->config->crop;
+	if( enc->imgpixels ) {
+		free(enc->imgpixels);
+		enc->imgpixels = 0;
+	}
+	if( batch->texttmpl ) {
+		enc->textfp = open_memstream(&textbuf,&textlen);
+	}
+	if( batch->bintmpl ) {
+		enc->binaryfp = open_memstream(&binbuf,&binlen);
+	}
+	*hit = 0;
+	if( (batch->texttmpl && enc->textfp == 0) || (batch->bintmpl && enc->binaryfp == 0) ) {
+		fprintf(stderr,"Failed to allocate output buffers\n");
+		err = 1;
+	}
+	else if( batch->cache ) {
+		key = term_encode_cache_key(enc,datahash);
+		*hit = cacheFetch(batch->cache,key,enc->textfp,enc->binaryfp) == 0;
+	}
+	
+	t1 = t0;
+	if( ! err && ! *hit ) {
+		term_encode_trace_begin("load");
+		err = loadImage(enc,imgpath,imgdata,imgdatalen,batch->lowmem);
+		term_encode_trace_end("load");
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+	}
+	if( ! err && ! *hit ) {
+		err = term_encode(enc);
+	}
+	if( enc->textfp ) {
+		fclose(enc->textfp);
+		enc->textfp = 0;
+	}
+	//The encoder closes the binary file when it finishes
+	if( enc->binaryfp ) {
+		fclose(enc->binaryfp);
+		enc->binaryfp = 0;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC,&t2);
+	term_encode_trace_begin("write");
+	if( ! err && ! *hit && batch->cache ) {
+		if( batch->texttmpl ) {
+			enc_cache_store(batch->cache,key,"txt",textbuf,textlen);
+		}
+		if( batch->bintmpl ) {
+			enc_cache_store(batch->cache,key,"bin",binbuf,binlen);
+		}
+	}
+	if( ! err && batch->texttmpl ) {
+		err = writeFile(textpath,textbuf,textlen);
+	}
+	if( ! err && batch->bintmpl ) {
+		err = writeFile(binpath,binbuf,binlen);
+	}
+	if( textbuf ) { free(textbuf); }
+	if( binbuf ) { free(binbuf); }
+	term_encode_trace_end("write");
+	clock_gettime(CLOCK_MONOTONIC,&t3);
+	
+	if( *hit ) {
+		times[0] = 0;
+		times[1] = 0;
+		times[2] = elapsedMs(&t0,&t3);
+	} else {
+		times[0] = elapsedMs(&t0,&t1);
+		times[1] = elapsedMs(&t1,&t2);
+		times[2] = elapsedMs(&t2,&t3);
+	}
+	return err;
+}
+
+static void* batchWorker( void* arg ) {
+	batch_t* batch = (batch_t*)arg;
+	term_encode_t enc;
+	char* imgpath;
+	uint8_t* imgdata;
+	size_t imgdatalen = 0;
+	uint64_t datahash = 0;
+	size_t i;
+	double times[3];
+	term_encode_stats_t stats;
+	int err;
+	int hit;
+	
+	//Each worker reuses one encoder (and its buffers) for all of its images
+	enc = *(batch->config);
+	term_encode_trace_thread("batch");
+	while( 1 ) {
+		pthread_mutex_lock(&batch->lock);
+		if( batch->next >= batch->npaths ) {
+			pthread_mutex_unlock(&batch->lock);
+			break;
+		}
+		imgpath = batch->paths[batch->next++];
+		pthread_mutex_unlock(&batch->lock);
+		
+		//The cache key needs the file contents even when loading with -lowmem
+		imgdata = (batch->lowmem && batch->cache == 0) ? 0 : mapFile(imgpath,&imgdatalen);
+		if( batch->cache && imgdata ) {
+			datahash = imageHash(imgdata,imgdatalen,batch->lowmem);
+		}
+		for( i=0; i<batch->nwidths; i++ ) {
+			if( batch->cache && imgdata == 0 ) {
+				fprintf(stderr,"Failed to load image: %s\n",imgpath);
+				err = 1;
+			} else {
+				err = batchConvert(batch,&enc,imgpath,batch->widths[i],imgdata,imgdatalen,datahash,times,&hit);
+			}
+			if( ! err && hit ) {
+				fprintf(stderr,"%s (%lu): cached, write %.2f ms\n",imgpath,batch->widths[i],times[2]);
+			}
+			else if( ! err ) {
+				fprintf(stderr,"%s (%lu): decode %.2f ms, encode %.2f ms, write %.2f ms\n",
+					imgpath,batch->widths[i],times[0],times[1],times[2]);
+			}
+			pthread_mutex_lock(&batch->lock);
+			if( err ) {
+				batch->failed++;
+			} else {
+				batch->converted++;
+				batch->cached += hit;
+				batch->decode_ms += times[0];
+				batch->encode_ms += times[1];
+				batch->write_ms += times[2];
+				if( ! hit && enc.stats && term_encode_get_stats(&enc,&stats) == 0 ) {
+					term_encode_stats_add(&batch->stats,&stats);
+				}
+			}
+			pthread_mutex_unlock(&batch->lock);
+		}
+		if( imgdata ) {
+			munmap(imgdata,imgdatalen);
+		}
+	}
+	term_encode_destroy(&enc);
+	return 0;
+}
+
+//Read the list of image paths (one per line)
+static char** readList( char* listpath, size_t* npaths ) {
+	FILE* fp;
+	char** paths = 0;
+	char** alloctmp;
+	size_t pathslen = 0;
+	char* line = 0;
+	size_t linelen = 0;
+	ssize_t len;
+	
+	*npaths = 0;
+	if( strcmp(listpath,"-") == 0 ) {
+		fp = stdin;
+	} else {
+		fp = fopen(listpath,"r");
+		if( fp == 0 ) {
+			fprintf(stderr,"Failed to open batch list: %s\n",listpath);
+			return 0;
+		}
+	}
+	while( (len = getline(&line,&linelen,fp)) >= 0 ) {
+		while( len && (line[len-1] == '\n' || line[len-1] == '\r') ) {
+			line[--len] = 0;
+		}
+		if( len == 0 ) {
+			continue;
+		}
+		if( *npaths == pathslen ) {
+			pathslen = pathslen ? 2*pathslen : 64;
+			alloctmp = (char**)realloc(paths,sizeof(char*)*pathslen);
+			if( alloctmp == 0 ) {
+				fprintf(stderr,"Failed to allocate batch list\n");
+				exit(1);
+			}
+			paths = alloctmp;
+		}
+		paths[(*npaths)++] = strdup(line);
+	}
+	if( line ) { free(line); }
+	if( fp != stdin ) { fclose(fp); }
+	return paths;
+}
+
+typedef struct {
+	char* path;
+	//Index of the image in batch paths
+	size_t image;
+} batch_output_t;
+
+//Copy an output path with its directory resolved, so that names for the same
+//file (./x and x, or through a link to the directory) compare equal.  The
+//path is copied as it is if the directory can not be resolved.
+static char* resolveOutputPath( char* path ) {
+	char dir[PATH_MAX];
+	char resolved[PATH_MAX];
+	char* name;
+	
+	name = strrchr(path,'/');
+	if( name == 0 ) {
+		strcpy(dir,".");
+		name = path;
+	}
+	else {
+		memcpy(dir,path,name == path ? 1 : name-path);
+		dir[name == path ? 1 : name-path] = 0;
+		name++;
+	}
+	if( realpath(dir,resolved) == 0 || strlen(resolved)+1+strlen(name) >= PATH_MAX ) {
+		return strdup(path);
+	}
+	if( strcmp(resolved,"/") ) {
+		strcat(resolved,"/");
+	}
+	strcat(resolved,name);
+	return strdup(resolved);
+}
+
+static int batchOutputCmp( const void* a, const void* b ) {
+	return strcmp(((const batch_output_t*)a)->path,((const batch_output_t*)b)->path);
+}
+
+//Expand every output file name before converting anything, and fail if two
+//outputs have the same name (the workers would write the file at the same
+//time, and one output would be lost).
+static int batchCheckOutputs( batch_t* batch ) {
+	char path[PATH_MAX];
+	char* tmpls[2];
+	batch_output_t* outputs;
+	size_t noutputs = 0;
+	size_t i, j, t;
+	int hint = 0;
+	int err = 0;
+	
+	tmpls[0] = batch->texttmpl;
+	tmpls[1] = batch->bintmpl;
+	outputs = (batch_output_t*)malloc(sizeof(batch_output_t)*batch->npaths*batch->nwidths*2);
+	if( outputs == 0 ) {
+		fprintf(stderr,"Failed to allocate batch output names\n");
+		return 1;
+	}
+	for( i=0; i<batch->npaths && ! err; i++ ) {
+		for( j=0; j<batch->nwidths && ! err; j++ ) {
+			for( t=0; t<2 && ! err; t++ ) {
+				if( tmpls[t] == 0 ) {
+					continue;
+				}
+				if( expandTemplate(path,PATH_MAX,tmpls[t],batch->paths[i],batch->widths[j]) ) {
+					fprintf(stderr,"Output path too long for %s\n",batch->paths[i]);
+					err = 1;
+				}
+				else if( (outputs[noutputs].path = resolveOutputPath(path)) == 0 ) {
+					fprintf(stderr,"Failed to allocate batch output names\n");
+					err = 1;
+				}
+				else {
+					outputs[noutputs++].image = i;
+				}
+			}
+		}
+	}
+	
+	if( ! err ) {
+		qsort(outputs,noutputs,sizeof(batch_output_t),batchOutputCmp);
+		for( i=1; i<noutputs; i++ ) {
+			if( strcmp(outputs[i-1].path,outputs[i].path) ) {
+				continue;
+			}
+			if( outputs[i-1].image == outputs[i].image ) {
+				fprintf(stderr,"-o and -b would both be written to %s\n",outputs[i].path);
+			}
+			else {
+				fprintf(stderr,"%s and %s would both be written to %s\n",
+					batch->paths[outputs[i-1].image],batch->paths[outputs[i].image],outputs[i].path);
+				hint = 1;
+			}
+			err = 1;
+		}
+		if( hint ) {
+			fprintf(stderr,"Use %%f (file name with extension) or %%d (directory) in -o and -b to tell them apart.\n");
+		}
+	}
+	for( i=0; i<noutputs; i++ ) {
+		free(outputs[i].path);
+	}
+	free(outputs);
+	return err;
+}
+
+static int batchRun( term_encode_t* config, char* listpath, size_t nthreads,
+		size_t* widths, size_t nwidths, int lowmem, enc_cache_t* cache, char* texttmpl, char* bintmpl ) {
+	batch_t batch;
+	pthread_t* threads;
+	struct timespec start, end;
+	double total_ms;
+	size_t i;
+	
+	memset(&batch,0,sizeof(batch_t));
+	batch.config = config;
+	batch.widths = widths;
+	batch.nwidths = nwidths;
+	batch.lowmem = lowmem;
+	batch.cache = cache;
+	batch.texttmpl = texttmpl;
+	batch.bintmpl = bintmpl;
+	batch.paths = readList(listpath,&batch.npaths);
+	if( batch.paths == 0 && batch.npaths == 0 ) {
+		return 1;
+	}
+	if( batchCheckOutputs(&batch) ) {
+		for( i=0; i<batch.npaths; i++ ) {
+			free(batch.paths[i]);
+		}
+		free(batch.paths);
+		return 1;
+	}
+	pthread_mutex_init(&batch.lock,0);
+	
+	if( nthreads == 0 ) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if( nthreads < 1 ) {
+		nthreads = 1;
+	}
+	if( nthreads > batch.npaths ) {
+		nthreads = batch.npaths ? batch.npaths : 1;
+	}
+	threads = (pthread_t*)malloc(sizeof(pthread_t)*nthreads);
+	if( threads == 0 ) {
+		fprintf(stderr,"Failed to allocate batch threads\n");
+		return 1;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for( i=0; i<nthreads; i++ ) {
+		if( pthread_create(&(threads[i]),0,batchWorker,&batch) ) {
+			fprintf(stderr,"Failed to start batch thread\n");
+			exit(1);
+		}
+	}
+	for( i=0; i<nthreads; i++ ) {
+		pthread_join(threads[i],0);
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	total_ms = elapsedMs(&start,&end);
+	
+	fprintf(stderr,"%lu converted (%lu cached), %lu failed, %lu threads, %.2f ms (%.1f images/s)\n",
+		batch.converted,batch.cached,batch.failed,nthreads,total_ms,
+		total_ms > 0 ? 1000.0*batch.converted/total_ms : 0.0);
+	fprintf(stderr,"totals: decode %.2f ms, encode %.2f ms, write %.2f ms\n",
+		batch.decode_ms,batch.encode_ms,batch.write_ms);
+	if( config->stats ) {
+		term_encode_stats_print(stderr,&batch.stats);
+	}
+	
+	for( i=0; i<batch.npaths; i++ ) {
+		free(batch.paths[i]);
+	}
+	free(batch.paths);
+	free(threads);
+	pthread_mutex_destroy(&batch.lock);
+	return batch.failed != 0;
+}
 	
 int main(int argc, char** argv) {
 	size_t i;
 	term_encode_t enc;
 	char* imgpath = 0;
-	int imgwidth;
-	int imgheight;
-	int imgchannels;
+	char* widthstr;
+	size_t widths[MAX_WIDTHS];
+	size_t nwidths = 0;
+	uint8_t* imgdata = 0;
+	size_t imgdatalen = 0;
+	crop_rect_t crop;
+	int lowmem = 0;
+	char* binpath = 0;
+	char* listpath = 0;
+	char* texttmpl = 0;
+	size_t nthreads = 0;
+	enc_cache_t cache;
+	char* cachedir = 0;
+	size_t cachemb = DEFAULT_CACHE_MB;
+	uint64_t datahash = 0;
+	uint64_t key;
+	FILE* binfp;
+	term_encode_stats_t stats;
+	term_encode_stats_t total;
+	char* trace_path = 0;
+	int err;
 	
 	term_encode_init(&enc);
+	memset(&total,0,sizeof(total));
 	
 	i=1;
 	while( i < argc ) {
@@ -159,9 +906,23 @@ int main(int argc, char** argv) {
 			if( i >= argc-1 ) {
 				usage(argv[0]);
 			}
-			enc.win_width = atoi(argv[++i]);
-			if( enc.win_width == 0 ) {
-				usage(argv[0]);
+			widthstr = argv[++i];
+			while( 1 ) {
+				if( nwidths >= MAX_WIDTHS ) {
+					usage(argv[0]);
+				}
+				widths[nwidths] = strtoul(widthstr,&widthstr,10);
+				if( widths[nwidths] == 0 ) {
+					usage(argv[0]);
+				}
+				nwidths++;
+				if( *widthstr == 0 ) {
+					break;
+				}
+				else if( *widthstr != ',' ) {
+					usage(argv[0]);
+				}
+				widthstr++;
 			}
 		}
 		else if( strcmp(argv[i],"-c") == 0 ) {
@@ -171,21 +932,80 @@ int main(int argc, char** argv) {
 			if( i >= argc-1 ) {
 				usage(argv[0]);
 			}
-			else if( enc.binaryfp != 0 ) {
+			else if( binpath != 0 ) {
 				usage(argv[0]);
 			}
-			enc.binaryfp = fopen(argv[++i],"wb");
-			if( enc.binaryfp == 0 ) {
-				fprintf(stderr,"Failed to open binary files for writing.\n");
-				exit(1);
-			}
+			binpath = argv[++i];
 			enc.encbinary = 1;
 		}
+		else if( strcmp(argv[i],"-batch") == 0 ) {
+			if( i >= argc-1 || listpath != 0 ) {
+				usage(argv[0]);
+			}
+			listpath = argv[++i];
+		}
+		else if( strcmp(argv[i],"-j") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			nthreads = atoi(argv[++i]);
+			if( nthreads == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-o") == 0 ) {
+			if( i >= argc-1 || texttmpl != 0 ) {
+				usage(argv[0]);
+			}
+			texttmpl = argv[++i];
+		}
 		#ifdef USE_QUANTPNM
 		else if( strcmp(argv[i],"-dither") == 0 ) {
 			enc.dither = 1;
 		}
 		#endif //USE_QUANTPNM
+		else if( strcmp(argv[i],"-runs") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			i++;
+			if( strcmp(argv[i],"erase") == 0 ) {
+				enc.runs = ENC_RUNS_ERASE;
+			}
+			else if( strcmp(argv[i],"rep") == 0 ) {
+				enc.runs = ENC_RUNS_REP;
+			}
+			else {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-lowmem") == 0 ) {
+			lowmem = 1;
+		}
+		else if( strcmp(argv[i],"-stats") == 0 ) {
+			enc.stats = 1;
+		}
+		else if( strcmp(argv[i],"-trace") == 0 ) {
+			if( i >= argc-1 || trace_path != 0 ) {
+				usage(argv[0]);
+			}
+			trace_path = argv[++i];
+		}
+		else if( strcmp(argv[i],"-cache") == 0 ) {
+			if( i >= argc-1 || cachedir != 0 ) {
+				usage(argv[0]);
+			}
+			cachedir = argv[++i];
+		}
+		else if( strcmp(argv[i],"-cachesize") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			cachemb = atoi(argv[++i]);
+			if( cachemb == 0 ) {
+				usage(argv[0]);
+			}
+		}
 		else if( strcmp(argv[i],"-crop") == 0 ) {
 			if( i >= argc-4 ) {
 				usage(argv[0]);
@@ -273,13 +1093,19 @@ int main(int argc, char** argv) {
 			}
 			enc.filter = ENC_FILTER_APPLE2;
 		}
-		#ifdef USE_LIBSIXEL
 		else if( strcmp(argv[i],"-sixel") == 0 ) {
 			if( enc.renderer ) {
 				usage(argv[0]);
 			}
 			enc.renderer = ENC_RENDER_SIXEL;
 		}
+		#ifdef USE_LIBSIXEL
+		else if( strcmp(argv[i],"-libsixel") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_LIBSIXEL;
+		}
 		#endif //SIXEL
 		else if( strcmp(argv[i],"-simple") == 0 ) {
 			if( enc.renderer ) {
@@ -311,6 +1137,42 @@ int main(int argc, char** argv) {
 			}
 			enc.renderer = ENC_RENDER_BRAILLE;
 		}
+		else if( strcmp(argv[i],"-ascii") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCII;
+		}
+		else if( strcmp(argv[i],"-asciiext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIEXT;
+		}
+		else if( strcmp(argv[i],"-asciifg") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIFG;
+		}
+		else if( strcmp(argv[i],"-asciifgext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIFGEXT;
+		}
+		else if( strcmp(argv[i],"-asciibg") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIBG;
+		}
+		else if( strcmp(argv[i],"-asciibgext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIBGEXT;
+		}
 		#ifdef USE_AALIB
 		else if( strcmp(argv[i],"-aa") == 0 ) {
 			if( enc.renderer ) {
@@ -372,31 +1234,125 @@ int main(int argc, char** argv) {
 		i++;
 	}
 	
-	if( imgpath == 0 ) {
+	if( imgpath == 0 && listpath == 0 ) {
 		fprintf(stderr,"No Image path specified\n");
 		exit(1);
 	}
+	if( imgpath != 0 && listpath != 0 ) {
+		usage(argv[0]);
+	}
+	if( trace_path ) {
+		term_encode_trace_start();
+		term_encode_trace_thread("main");
+	}
 	
 	if( enc.renderer == ENC_RENDER_NONE ) {
 		fprintf(stderr,"A renderer must be enabled.\n");
 		exit(1);
 	}
-	enc.enctext = 1;
 	
-	if( enc.win_width == 0  && enc.renderer != ENC_RENDER_SIXEL ) {
-		term_encode_detect_win_width(&enc);
+	if( cachedir && enc_cache_init(&cache,cachedir,cachemb*1024*1024) ) {
+		exit(1);
 	}
 	
-	//Load Image File
-	enc.imgpixels = stbi_load(imgpath, &imgwidth, &imgheight, &imgchannels, 3);
-	if( enc.imgpixels == 0 ) {
-		printf("Failed to load image\n");
+	if( listpath ) {
+		if( texttmpl == 0 && binpath == 0 ) {
+			fprintf(stderr,"Batch mode requires -o and/or -b.\n");
+			exit(1);
+		}
+		if( nwidths == 0 ) {
+			fprintf(stderr,"Batch mode requires -w.\n");
+			exit(1);
+		}
+		if( nwidths > 1 && ((texttmpl && strstr(texttmpl,"%w") == 0) || (binpath && strstr(binpath,"%w") == 0)) ) {
+			fprintf(stderr,"Output templates must include %%w when using several widths.\n");
+			exit(1);
+		}
+		enc.enctext = texttmpl != 0;
+		err = batchRun(&enc,listpath,nthreads,widths,nwidths,lowmem,cachedir ? &cache : 0,texttmpl,binpath);
+		if( trace_path && term_encode_trace_write(trace_path) ) {
+			err = 1;
+		}
+		exit(err);
+	}
+	enc.enctext = 1;
+	if( binpath ) {
+		enc.binaryfp = fopen(binpath,"wb");
+		if( enc.binaryfp == 0 ) {
+			fprintf(stderr,"Failed to open binary files for writing.\n");
+			exit(1);
+		}
+	}
+	
+	if( nwidths > 1 && binpath ) {
+		fprintf(stderr,"Only one width can be used with a binary file.\n");
 		exit(1);
 	}
-	enc.imgwidth = imgwidth;
-	enc.imgheight = imgheight;
+	if( nwidths == 0 ) {
+		if( enc.renderer != ENC_RENDER_SIXEL && enc.renderer != ENC_RENDER_LIBSIXEL ) {
+			term_encode_detect_win_width(&enc);
+		}
+		widths[nwidths++] = enc.win_width;
+	}
 	
-	term_encode(&enc);
+	//Map the image file once and decode it from memory for each width
+	//(the cache key needs the file contents even when loading with -lowmem)
+	if( ! lowmem || cachedir ) {
+		imgdata = mapFile(imgpath,&imgdatalen);
+	}
+	if( cachedir ) {
+		if( imgdata == 0 ) {
+			fprintf(stderr,"Failed to load image: %s\n",imgpath);
+			exit(1);
+		}
+		datahash = imageHash(imgdata,imgdatalen,lowmem);
+	}
+	binfp = enc.binaryfp;
+	crop = enc.crop;
+	for( i=0; i<nwidths; i++ ) {
+		enc.win_width = widths[i];
+		enc.crop = crop;
+		if( cachedir ) {
+			key = term_encode_cache_key(&enc,datahash);
+			if( cacheFetch(&cache,key,stdout,binfp) == 0 ) {
+				continue;
+			}
+		}
+		if( enc.imgpixels ) {
+			free(enc.imgpixels);
+			enc.imgpixels = 0;
+		}
+		term_encode_trace_begin("load");
+		if( loadImage(&enc,imgpath,imgdata,imgdatalen,lowmem) ) {
+			exit(1);
+		}
+		term_encode_trace_end("load");
+		if( cachedir ) {
+			if( cacheEncode(&cache,key,&enc,stdout,binfp) ) {
+				exit(1);
+			}
+		} else {
+			term_encode(&enc);
+		}
+		if( enc.stats && term_encode_get_stats(&enc,&stats) == 0 ) {
+			term_encode_stats_add(&total,&stats);
+		}
+	}
+	if( enc.stats ) {
+		term_encode_stats_print(stderr,&total);
+	}
+	if( cachedir ) {
+		if( binfp ) {
+			fclose(binfp);
+		}
+		enc_cache_destroy(&cache);
+	}
+	if( imgdata ) {
+		munmap(imgdata,imgdatalen);
+	}
 	
 	term_encode_destroy(&enc);
+	if( trace_path && term_encode_trace_write(trace_path) ) {
+		exit(1);
+	}
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//Implemenation block
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define IMGSERVER_IMPLEMENTATION
+#include "imgserver.h"
+
+#include "term_encode.h"
+
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] [-v] [-j #] socketpath\n",cmd);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h     : Print usage message\n");
+	fprintf(stderr,"-v     : Print each request and how long it took\n");
+	fprintf(stderr,"-j     : Number of worker threads (number of CPUs by default)\n");
+	fprintf(stderr,"\n");
+	exit(1);
+}
+
+typedef struct {
+	int sock;
+	int verbose;
+} server_t;
+
+static int sendResponse( int fd, uint32_t status, char* text, size_t textlen, char* bin, size_t binlen ) {
+	imgserver_response_t rsp;
+	rsp.magic = IMGSERVER_RESPONSE_MAGIC;
+	rsp.status = status;
+	rsp.text_len = textlen;
+	rsp.binary_len = binlen;
+	imgserver_swap(&rsp,sizeof(rsp));
+	if( imgserver_send(fd,&rsp,sizeof(rsp)) ) { return 1; }
+	if( textlen && imgserver_send(fd,text,textlen) ) { return 1; }
+	if( binlen && imgserver_send(fd,bin,binlen) ) { return 1; }
+	return 0;
+}
+
+static int sendError( int fd, char* msg ) {
+	return sendResponse(fd,1,msg,strlen(msg),0,0);
+}
+
+//Decode at the smallest scale (1/2, 1/4, 1/8) that is still at least
+//as wide as the renderer needs.
+static int decodeScale( term_encode_t* enc, uint8_t* imgdata, size_t imgdatalen ) {
+	int imgwidth, imgheight, imgchannels;
+	size_t target, srcwidth;
+	int scale = 1;
+	target = term_encode_pixel_width(enc);
+	if( target && stbi_info_from_memory(imgdata,imgdatalen,&imgwidth,&imgheight,&imgchannels) ) {
+		srcwidth = imgwidth;
+		if( enc->crop.w && enc->crop.h && enc->crop.x < srcwidth ) {
+			if( enc->crop.x+enc->crop.w < srcwidth ) {
+				srcwidth = enc->crop.w;
+			} else {
+				srcwidth = srcwidth - enc->crop.x;
+			}
+		}
+		while( scale < 8 && srcwidth/(2*scale) >= target ) {
+			scale = scale*2;
+		}
+	}
+	return scale;
+}
+
+//Handle one request on a connection.  Returns 1 when the connection
+//should be closed.
+static int serveRequest( server_t* server, term_encode_t* enc, int fd, uint8_t** imgdata, size_t* imgdatalen ) {
+	imgserver_request_t req;
+	term_encode_renderer_info_t info;
+	uint8_t* alloctmp;
+	char* textbuf = 0;
+	size_t textlen = 0;
+	char* binbuf = 0;
+	size_t binlen = 0;
+	int imgwidth, imgheight, imgchannels;
+	int scale;
+	int err;
+	struct timespec start, end;
+	
+	if( imgserver_recv(fd,&req,sizeof(req)) ) {
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	imgserver_swap(&req,sizeof(req));
+	if( req.magic != IMGSERVER_REQUEST_MAGIC || req.version != IMGSERVER_VERSION ) {
+		sendError(fd,"Unsupported request\n");
+		return 1;
+	}
+	if( req.image_len == 0 || req.image_len > IMGSERVER_MAX_IMAGE ) {
+		sendError(fd,"Invalid image size\n");
+		return 1;
+	}
+	//The image buffer is kept for the life of the connection
+	if( req.image_len > *imgdatalen ) {
+		alloctmp = (uint8_t*)realloc(*imgdata,req.image_len);
+		if( alloctmp == 0 ) {
+			sendError(fd,"Failed to allocate image buffer\n");
+			return 1;
+		}
+		*imgdata = alloctmp;
+		*imgdatalen = req.image_len;
+	}
+	if( imgserver_recv(fd,*imgdata,req.image_len) ) {
+		return 1;
+	}
+	if( req.renderer == ENC_RENDER_NONE || req.win_width == 0 ) {
+		return sendError(fd,"A renderer and width must be given\n");
+	}
+	//Fields are checked here, since the encoder trusts its caller
+	if( req.renderer > 0xFF || term_encode_renderer_info(req.renderer,&info) ) {
+		return sendError(fd,"Unsupported renderer\n");
+	}
+	if( req.win_width > IMGSERVER_MAX_WIDTH ) {
+		return sendError(fd,"Invalid width\n");
+	}
+	if( req.filter > ENC_FILTER_APPLE2_BW ) {
+		return sendError(fd,"Unsupported filter\n");
+	}
+	
+	//Configure the warm encoder for this request
+	enc->renderer = req.renderer;
+	enc->win_width = req.win_width;
+	enc->stdpal = (req.flags & IMGSERVER_STDPAL) != 0;
+	enc->reqpalsize = req.palsize;
+	#ifdef USE_QUANTPNM
+	enc->dither = (req.flags & IMGSERVER_DITHER) != 0;
+	#endif //USE_QUANTPNM
+	enc->filter = req.filter;
+	enc->color_rgb = req.color_rgb;
+	enc->invert = (req.flags & IMGSERVER_INVERT) != 0;
+	enc->clearterm = (req.flags & IMGSERVER_CLEAR) != 0;
+	enc->enctext = (req.flags & IMGSERVER_TEXT) != 0;
+	enc->encbinary = (req.flags & IMGSERVER_BINARY) != 0;
+	enc->crop.x = req.crop_x;
+	enc->crop.y = req.crop_y;
+	enc->crop.w = req.crop_w;
+	enc->crop.h = req.crop_h;
+	
+	if( enc->imgpixels ) {
+		free(enc->imgpixels);
+		enc->imgpixels = 0;
+	}
+	scale = decodeScale(enc,*imgdata,req.image_len);
+	enc->imgpixels = stbi_load_from_memory_scaled(*imgdata,req.image_len,&imgwidth,&imgheight,&imgchannels,3,scale);
+	if( enc->imgpixels == 0 ) {
+		return sendError(fd,"Failed to load image\n");
+	}
+	enc->imgwidth = imgwidth;
+	enc->imgheight = imgheight;
+	//Crop is in full size image coordinates
+	if( scale > 1 && enc->crop.w && enc->crop.h ) {
+		enc->crop.x = enc->crop.x/scale;
+		enc->crop.y = enc->crop.y/scale;
+		enc->crop.w = (enc->crop.w+scale-1)/scale;
+		enc->crop.h = (enc->crop.h+scale-1)/scale;
+	}
+	
+	//The text file is also used for error messages
+	enc->textfp = open_memstream(&textbuf,&textlen);
+	enc->binaryfp = 0;
+	if( enc->encbinary ) {
+		enc->binaryfp = open_memstream(&binbuf,&binlen);
+	}
+	if( enc->textfp == 0 || (enc->encbinary && enc->binaryfp == 0) ) {
+		err = 1;
+	}
+	else {
+		err = term_encode(enc);
+	}
+	if( enc->textfp ) {
+		fclose(enc->textfp);
+		enc->textfp = 0;
+	}
+	//The encoder closes the binary file when it finishes
+	if( enc->binaryfp ) {
+		fclose(enc->binaryfp);
+		enc->binaryfp = 0;
+	}
+	
+	if( err ) {
+		err = sendError(fd,"Failed to encode image\n");
+	} else {
+		err = sendResponse(fd,0,textbuf,textlen,binbuf,binlen);
+	}
+	if( textbuf ) { free(textbuf); }
+	if( binbuf ) { free(binbuf); }
+	
+	if( server->verbose ) {
+		clock_gettime(CLOCK_MONOTONIC,&end);
+		fprintf(stderr,"renderer %u width %u: %u bytes in, %lu text, %lu binary, %.2f ms\n",
+			req.renderer,req.win_width,req.image_len,textlen,binlen,
+			(end.tv_sec-start.tv_sec)*1000.0 + (end.tv_nsec-start.tv_nsec)/1000000.0);
+	}
+	return err;
+}
+
+static void* serverWorker( void* arg ) {
+	server_t* server = (server_t*)arg;
+	term_encode_t enc;
+	uint8_t* imgdata = 0;
+	size_t imgdatalen = 0;
+	int fd;
+	
+	//Each worker keeps one warm encoder (and its resize and palette buffers)
+	//for every request it serves.
+	term_encode_init(&enc);
+	while( 1 ) {
+		fd = accept(server->sock,0,0);
+		if( fd < 0 ) {
+			if( errno == EINTR || errno == ECONNABORTED ) {
+				continue;
+			}
+			fprintf(stderr,"Failed to accept connection: %s\n",strerror(errno));
+			break;
+		}
+		while( serveRequest(server,&enc,fd,&imgdata,&imgdatalen) == 0 );
+		close(fd);
+	}
+	if( imgdata ) {
+		free(imgdata);
+	}
+	term_encode_destroy(&enc);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	size_t i;
+	char* sockpath = 0;
+	size_t nthreads = 0;
+	server_t server;
+	pthread_t* threads;
+	struct sockaddr_un addr;
+	
+	memset(&server,0,sizeof(server_t));
+	
+	i=1;
+	while( i < argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-v") == 0 ) {
+			server.verbose = 1;
+		}
+		else if( strcmp(argv[i],"-j") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			nthreads = atoi(argv[++i]);
+			if( nthreads == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else {
+			if( sockpath != 0 ) {
+				usage(argv[0]);
+			}
+			sockpath = argv[i];
+		}
+		i++;
+	}
+	if( sockpath == 0 ) {
+		usage(argv[0]);
+	}
+	if( strlen(sockpath) >= sizeof(addr.sun_path) ) {
+		fprintf(stderr,"Socket path is too long\n");
+		exit(1);
+	}
+	if( nthreads == 0 ) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if( nthreads < 1 ) {
+		nthreads = 1;
+	}
+	
+	//Clients that disconnect early should not kill the server
+	signal(SIGPIPE,SIG_IGN);
+	
+	server.sock = socket(AF_UNIX,SOCK_STREAM,0);
+	if( server.sock < 0 ) {
+		fprintf(stderr,"Failed to create socket: %s\n",strerror(errno));
+		exit(1);
+	}
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,sockpath);
+	unlink(sockpath);
+	if( bind(server.sock,(struct sockaddr*)&addr,sizeof(addr)) || listen(server.sock,64) ) {
+		fprintf(stderr,"Failed to listen on %s: %s\n",sockpath,strerror(errno));
+		exit(1);
+	}
+	
+	threads = (pthread_t*)malloc(sizeof(pthread_t)*nthreads);
+	if( threads == 0 ) {
+		fprintf(stderr,"Failed to allocate worker threads\n");
+		exit(1);
+	}
+	for( i=0; i<nthreads; i++ ) {
+		if( pthread_create(&(threads[i]),0,serverWorker,&server) ) {
+			fprintf(stderr,"Failed to start worker thread\n");
+			exit(1);
+		}
+	}
+	for( i=0; i<nthreads; i++ ) {
+		pthread_join(threads[i],0);
+	}
+	free(threads);
+	close(server.sock);
+	unlink(sockpath);
+	return 0;
+}
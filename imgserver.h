@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __IMGSERVER_H__
+#define __IMGSERVER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Protocol between imgclient (or any other client) and imgserver over a
+//Unix domain socket.  A client sends a request header followed by the
+//encoded image file (any format stb_image can read).  The server replies
+//with a response header followed by the ANSI text and then the newdraw
+//binary.  On failure status is non-zero and the text is an error message.
+//All header fields are in network byte order.  A connection may carry any
+//number of requests.
+
+#define IMGSERVER_REQUEST_MAGIC  0x4e445251 //NDRQ
+#define IMGSERVER_RESPONSE_MAGIC 0x4e445253 //NDRS
+#define IMGSERVER_VERSION        1
+
+//Largest image file the server will accept
+#define IMGSERVER_MAX_IMAGE (64*1024*1024)
+//Largest win_width the server will accept (characters, or pixels for sixel)
+#define IMGSERVER_MAX_WIDTH 4096
+
+//Request flags
+#define IMGSERVER_TEXT   0x01  //Return ANSI text
+#define IMGSERVER_BINARY 0x02  //Return a newdraw binary
+#define IMGSERVER_CLEAR  0x04  //Include terminal clear in text
+#define IMGSERVER_STDPAL 0x08  //palsize is a standard palette
+#define IMGSERVER_DITHER 0x10  //Use the quantizer with dither
+#define IMGSERVER_INVERT 0x20  //Invert filter color
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	//One of ENC_RENDER_*
+	uint32_t renderer;
+	//Character width (required, at most IMGSERVER_MAX_WIDTH)
+	uint32_t win_width;
+	//Same as term_encode_t reqpalsize
+	uint32_t palsize;
+	//One of ENC_FILTER_* and its 0x--RRGGBB color
+	uint32_t filter;
+	uint32_t color_rgb;
+	//Optional crop (w and h of 0 for none)
+	uint32_t crop_x;
+	uint32_t crop_y;
+	uint32_t crop_w;
+	uint32_t crop_h;
+	//Length of the image file that follows
+	uint32_t image_len;
+} imgserver_request_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t status;
+	uint32_t text_len;
+	uint32_t binary_len;
+} imgserver_response_t;
+
+//Read or write exactly len bytes.  Returns 1 on error or end of file.
+int imgserver_recv( int fd, void* buf, size_t len );
+int imgserver_send( int fd, void* buf, size_t len );
+//Convert header fields between host and network byte order (in place)
+void imgserver_swap( void* header, size_t len );
+
+#ifdef IMGSERVER_IMPLEMENTATION
+
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+int imgserver_recv( int fd, void* buf, size_t len ) {
+	ssize_t n;
+	uint8_t* p = (uint8_t*)buf;
+	while( len ) {
+		n = read(fd,p,len);
+		if( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		if( n <= 0 ) {
+			return 1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int imgserver_send( int fd, void* buf, size_t len ) {
+	ssize_t n;
+	uint8_t* p = (uint8_t*)buf;
+	while( len ) {
+		n = write(fd,p,len);
+		if( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		if( n <= 0 ) {
+			return 1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+void imgserver_swap( void* header, size_t len ) {
+	size_t i;
+	uint32_t* fields = (uint32_t*)header;
+	for( i=0; i<len/sizeof(uint32_t); i++ ) {
+		fields[i] = htonl(fields[i]);
+	}
+}
+
+#endif //IMGSERVER_IMPLEMENTATION
+#endif //__IMGSERVER_H__
@@ -38,6 +38,8 @@
 #define UTF8_IMPLEMENTATION
 #define UTF8_EXT_CHARACTER_SETS
 #include "utf8.h"
+#define SGR_IMPLEMENTATION
+#include "sgr.h"
 
 #define DIRNL 0x0A
 #define DIRUP 0x41
@@ -304,6 +306,7 @@ uint8_t bgcolors[] = {40, 41, 42, 43, 44, 45, 46, 47, 100, 101, 102, 103, 104, 1
 uint8_t color_mode = CM_16;
 uint32_t codepage = 0x00002500;
 uint32_t *charset = 0;
+const utf8_glyph_t *charset_glyphs = 0;
 size_t   charsetlen = 0;
 
 size_t win_width;
@@ -698,18 +701,37 @@ void load(char* path, int resize) {
 	return;
 }
 
+//Send only the colors and attributes of cell that differ from the last
+//cell written
+size_t cell_sgr(sgr_state_t* sgr, char* params, cell_t* cell) {
+	uint32_t fg = SGR_DEFAULT;
+	uint32_t bg = SGR_DEFAULT;
+	uint8_t attrs = 0;
+	if( color_mode == CM_16 ) {
+		fg = SGR_COLOR16(cell->fgcolor);
+		bg = SGR_COLOR16(cell->bgcolor);
+	} else if( color_mode == CM_256 ) {
+		fg = SGR_COLOR256(cell->fgcolor);
+		bg = SGR_COLOR256(cell->bgcolor);
+	} else if( color_mode == CM_TRUE ) {
+		fg = SGR_RGB(cell->fgcolor);
+		bg = SGR_RGB(cell->bgcolor);
+	} //else if( color_mode == CM_BW ) { }
+	if( cell->reverse ) { attrs |= SGR_REVERSE; }
+	if( cell->blink ) { attrs |= SGR_BLINK; }
+	if( cell->bold ) { attrs |= SGR_BOLD; }
+	if( cell->underline ) { attrs |= SGR_UNDERLINE; }
+	return sgr_update(sgr,params,fg,bg,attrs);
+}
+
 void export() {
 	size_t canvas_x;
 	size_t canvas_y;
 	char* c;
+	char utf8c[UTF8_MAX_LEN];
 	cell_t *cell;
-	uint32_t scr_fgcolor;
-	uint32_t scr_bgcolor;
-	uint8_t scr_reverse;
-	uint8_t scr_blink;
-	uint8_t scr_bold;
-	uint8_t scr_underline;
-	uint8_t reset;
+	sgr_state_t sgr;
+	char params[SGR_MAX_PARAMS];
 	uint8_t move_cursor = 0;
 	FILE* fp = fopen(export_path,"wb");
 	if( fp == 0 ) {
@@ -720,70 +742,37 @@ void export() {
 		fprintf(fp,"\x1b[2J\x1b[H");
 	}
 	fprintf(fp,"\x1b[0m");
-	reset = 1;
+	sgr_init(&sgr);
 	for( canvas_y=0; canvas_y<canvas_height; canvas_y++ ) {
 		for( canvas_x=0; canvas_x<canvas_width; canvas_x++ ) {
 			cell = &(canvas[canvas_y*canvas_width+canvas_x]);
 			if( !export_spaces && cell->character == 0 ) {
-				if( ! reset ) {
-					fprintf(fp,"\x1b[0m");
-					reset = 1;
-				}
 				move_cursor = 1;
 			} else {
-				if( reset ||
-						scr_fgcolor != cell->fgcolor ||
-						scr_bgcolor != cell->bgcolor ||
-						scr_reverse != cell->reverse ||
-						scr_blink != cell->blink ||
-						scr_bold != cell->bold ||
-						scr_underline != cell->underline ) {
-					if( ! reset ) {
-						fprintf(fp,"\x1b[0m");
-					}
-					reset = 0;
-					if( move_cursor ) {
-						fprintf(fp,"\x1b[%ld;%ldH",canvas_y+1, canvas_x+1);
-						move_cursor = 0;
-					}
-					scr_fgcolor = cell->fgcolor;
-					scr_bgcolor = cell->bgcolor;
-					if( color_mode == CM_16 ) {
-						fprintf(fp,"\x1b[%d;%dm",fgcolors[scr_fgcolor],bgcolors[scr_bgcolor]);
-					} else if( color_mode == CM_256 ) {
-						fprintf(fp,"\x1b[38;5;%dm",scr_fgcolor);
-						fprintf(fp,"\x1b[48;5;%dm",scr_bgcolor);
-					} else if( color_mode == CM_TRUE ) {
-						fprintf(fp,"\x1b[38;2;%d;%d;%dm",(scr_fgcolor>>16)&0xFF,(scr_fgcolor>>8)&0xFF,scr_fgcolor&0xFF);
-						fprintf(fp,"\x1b[48;2;%d;%d;%dm",(scr_bgcolor>>16)&0xFF,(scr_bgcolor>>8)&0xFF,scr_bgcolor&0xFF);
-					} //else if( color_mode == CM_BW ) { }
-					scr_reverse = cell->reverse;
-					if( scr_reverse ) { fprintf(fp,"\x1b[7m"); }
-					scr_blink = cell->blink;
-					if(scr_blink ) { fprintf(fp,"\x1b[5m"); }
-					scr_bold = cell->bold;
-					if(scr_bold ) { fprintf(fp,"\x1b[1m"); }
-					scr_underline = cell->underline;
-					if( scr_underline ) { fprintf(fp,"\x1b[4m"); }
+				if( move_cursor ) {
+					fprintf(fp,"\x1b[%ld;%ldH",canvas_y+1, canvas_x+1);
+					move_cursor = 0;
+				}
+				if( cell_sgr(&sgr,params,cell) ) {
+					fprintf(fp,"\x1b[%sm",params);
 				}
 				if( cell->character == 0 ) {
 					c = " ";
 				} else {
-					c = utf8_encode(0,cell->character);
+					c = utf8_encode(utf8c,cell->character);
 				}
 				fprintf(fp,"%s",c);
 			}
 		}
 		if( ! move_cursor ) {
-			if( ! reset ) {
-				fprintf(fp,"\x1b[0m");
-				reset = 1;
+			if( sgr_line_end(&sgr,params) ) {
+				fprintf(fp,"\x1b[%sm",params);
 			}
 			fprintf(fp,"\r\n");
 		}
 	}
-	if( ! reset ) {
-		fprintf(fp,"\x1b[0m");
+	if( sgr_update(&sgr,params,SGR_DEFAULT,SGR_DEFAULT,0) ) {
+		fprintf(fp,"\x1b[%sm",params);
 	}
 	fclose(fp);
 }
@@ -794,90 +783,55 @@ void render() {
 	size_t term_x;
 	size_t term_y;
 	char* c;
+	char utf8c[UTF8_MAX_LEN];
+	const utf8_glyph_t* glyph;
 	size_t i;
 	cell_t *cell;
-	uint32_t scr_fgcolor;
-	uint32_t scr_bgcolor;
 	uint8_t scr_reverse;
 	uint8_t scr_blink;
 	uint8_t scr_bold;
 	uint8_t scr_underline;
 	uint8_t scr_line;
-	uint8_t reset;
+	sgr_state_t sgr;
+	char params[SGR_MAX_PARAMS];
 	uint8_t move_cursor = 0;
 	
 	printf("\x1b[2J\x1b[H\x1b[0m");
-	reset = 1;
+	sgr_init(&sgr);
 	for( canvas_y=scroll_y, term_y=0; canvas_y<canvas_height && term_y<win_height-2; canvas_y++, term_y++ ) {
 		for( canvas_x=scroll_x, term_x=0; canvas_x<canvas_width && term_x<win_width; canvas_x++, term_x++ ) {
 			cell = &(canvas[canvas_y*canvas_width+canvas_x]);
 			if( !export_spaces && cell->character == 0 ) {
-				if( ! reset ) {
-					printf("\x1b[0m");
-					reset = 1;
-				}
 				move_cursor = 1;
 			} else {
-				if( reset ||
-						scr_fgcolor != cell->fgcolor ||
-						scr_bgcolor != cell->bgcolor ||
-						scr_reverse != cell->reverse ||
-						scr_blink != cell->blink ||
-						scr_bold != cell->bold ||
-						scr_underline != cell->underline ) {
-					if( ! reset ) {
-						printf("\x1b[0m");
-					}
-					reset = 0;
-					if( move_cursor ) {
-						printf("\x1b[%ld;%ldH",canvas_y-scroll_y+1, canvas_x-scroll_x+1);
-						move_cursor = 0;
-					}
-					scr_fgcolor = cell->fgcolor;
-					scr_bgcolor = cell->bgcolor;
-					if( color_mode == CM_16 ) {
-						printf("\x1b[%d;%dm",fgcolors[scr_fgcolor],bgcolors[scr_bgcolor]);
-					} else if( color_mode == CM_256 ) {
-						printf("\x1b[38;5;%dm",scr_fgcolor);
-						printf("\x1b[48;5;%dm",scr_bgcolor);
-					} else if( color_mode == CM_TRUE ) {
-						printf("\x1b[38;2;%d;%d;%dm",(scr_fgcolor>>16)&0xFF,(scr_fgcolor>>8)&0xFF,scr_fgcolor&0xFF);
-						printf("\x1b[48;2;%d;%d;%dm",(scr_bgcolor>>16)&0xFF,(scr_bgcolor>>8)&0xFF,scr_bgcolor&0xFF);
-					} //else if( color_mode == CM_BW ) { }
-					scr_reverse = cell->reverse;
-					if( scr_reverse ) { printf("\x1b[7m"); }
-					scr_blink = cell->blink;
-					if(scr_blink ) { printf("\x1b[5m"); }
-					scr_bold = cell->bold;
-					if(scr_bold ) { printf("\x1b[1m"); }
-					scr_underline = cell->underline;
-					if( scr_underline ) { printf("\x1b[4m"); }
+				if( move_cursor ) {
+					printf("\x1b[%ld;%ldH",canvas_y-scroll_y+1, canvas_x-scroll_x+1);
+					move_cursor = 0;
+				}
+				if( cell_sgr(&sgr,params,cell) ) {
+					printf("\x1b[%sm",params);
 				}
 				if( cell->character == 0 ) {
 					c = " ";
 				} else {
-					c = utf8_encode(0,cell->character);
+					c = utf8_encode(utf8c,cell->character);
 				}
 				printf("%s",c);
 			}
 		}
 		if( ! move_cursor ) {
-			if( ! reset ) {
-				printf("\x1b[0m");
-				reset = 1;
+			if( sgr_line_end(&sgr,params) ) {
+				printf("\x1b[%sm",params);
 			}
 			printf("\r\n");
 		}
 	}
-	if( ! reset ) {
-		printf("\x1b[0m");
-		reset = 1;
+	if( sgr_update(&sgr,params,SGR_DEFAULT,SGR_DEFAULT,0) ) {
+		printf("\x1b[%sm",params);
 	}
 	
 	//Remember the attributes of the cell currently under the cursor
 	cell = &(canvas[cursor_y*canvas_width+cursor_x]);
-	scr_fgcolor = cell->fgcolor;
-	scr_bgcolor = cell->bgcolor;
 	scr_reverse = cell->reverse;
 	scr_blink = cell->blink;
 	scr_bold = cell->bold;
@@ -989,10 +943,11 @@ void render() {
 		printf("\r\n %06X",codepage&0xFFFFFF);
 		for( i=0; i<8; i++ ) {
 			if( charset ) {
-				printf(" %s",utf8_encode(0,charset[(codepage+i)%charsetlen]));
+				glyph = &charset_glyphs[(codepage+i)%charsetlen];
+				printf(" %.*s",glyph->len,glyph->bytes);
 			}
 			else {
-				printf(" %s",utf8_encode(0,codepage+i));
+				printf(" %s",utf8_encode(utf8c,codepage+i));
 			}
 		}
 		//Quit
@@ -1168,6 +1123,7 @@ int main(int argc, char** argv) {
 				usage(argv[0]);
 			}
 			charset = cp437;
+			charset_glyphs = cp437_glyphs;
 			charsetlen = 256;
 		}
 		else if( strcmp("-pet",argv[i]) == 0 ) {
@@ -1175,6 +1131,7 @@ int main(int argc, char** argv) {
 				usage(argv[0]);
 			}
 			charset = petscii;
+			charset_glyphs = petscii_glyphs;
 			charsetlen = 512;
 		}
 		else if( strcmp("-trs",argv[i]) == 0 ) {
@@ -1182,6 +1139,7 @@ int main(int argc, char** argv) {
 				usage(argv[0]);
 			}
 			charset = trs80;
+			charset_glyphs = trs80_glyphs;
 			charsetlen = 192;
 		}
 		else if( strcmp("-es",argv[i]) == 0 ) {
@@ -105,9 +105,18 @@
 #define QUANT_QUALITY_HIGHCOLOR   0x4  /* high color */
 	
 
+/* allocator for the temporary buffers used while making a palette
+   (a null allocator uses malloc and free) */
+typedef struct {
+	void *(*alloc)(void *ctx, size_t size);
+	void (*free)(void *ctx, void *ptr);
+	void *ctx;
+} quant_pnm_allocator_t;
+
 /* choose colors using median-cut method */
-uint8_t *
+void
 quant_pnm_make_palette(
+	uint8_t /* out */ *palette, /* at least 3*reqcolors bytes */
 	uint8_t /* in */  *data,  /* data for sampling */
 	size_t  /* in */  length, /* data size */
 	size_t  /* in */  reqcolors,
@@ -115,7 +124,8 @@ quant_pnm_make_palette(
 	size_t  /* in */  *origcolors,
 	uint8_t /* in */  methodForLargest,
 	uint8_t /* in */  methodForRep,
-	uint8_t /* in */  qualityMode);
+	uint8_t /* in */  qualityMode,
+	quant_pnm_allocator_t const /* in */ *allocator);
 
 
 /* apply color palette into specified pixel buffers */
@@ -183,38 +193,65 @@ typedef struct {
 	tupletable table;
 } tupletable2;
 
-static unsigned int compareplanePlane;
-	/* This is a parameter to compareplane().  We use this global variable
-	   so that compareplane() can be called by qsort(), to compare two
-	   tuples.  qsort() doesn't pass any arguments except the two tuples.
-	*/
+/* qsort() doesn't pass any arguments except the two tuples, so there is
+   one comparator per plane (rather than a global plane number, which
+   would keep several quantizers from running in parallel threads).
+*/
+#define COMPAREPLANE(plane) \
+static int \
+compareplane##plane(const void * const arg1, \
+			 const void * const arg2) \
+{ \
+	typedef const struct tupleint * const * const sortarg; \
+	sortarg comparandPP  = (sortarg) arg1; \
+	sortarg comparatorPP = (sortarg) arg2; \
+	return (int)(*comparandPP)->tuple[plane] - (int)(*comparatorPP)->tuple[plane]; \
+}
+COMPAREPLANE(0)
+COMPAREPLANE(1)
+COMPAREPLANE(2)
+COMPAREPLANE(3)
+#undef COMPAREPLANE
+
+typedef int (*compareplane_fn)(const void * const, const void * const);
+static compareplane_fn const compareplane[4] = {
+	compareplane0, compareplane1, compareplane2, compareplane3
+};
+
+
 static int
-compareplane(const void * const arg1,
-			 const void * const arg2)
+sumcompare(const void * const b1, const void * const b2)
 {
-	int lhs, rhs;
+	return (int)((boxVector)b2)->sum - (int)((boxVector)b1)->sum;
+}
 
-	typedef const struct tupleint * const * const sortarg;
-	sortarg comparandPP  = (sortarg) arg1;
-	sortarg comparatorPP = (sortarg) arg2;
-	lhs = (int)(*comparandPP)->tuple[compareplanePlane];
-	rhs = (int)(*comparatorPP)->tuple[compareplanePlane];
 
-	return lhs - rhs;
+static void *
+quant_alloc(quant_pnm_allocator_t const *allocator, size_t size)
+{
+	if (allocator) {
+		return allocator->alloc(allocator->ctx, size);
+	}
+	return malloc(size);
 }
 
 
-static int
-sumcompare(const void * const b1, const void * const b2)
+static void
+quant_free(quant_pnm_allocator_t const *allocator, void *ptr)
 {
-	return (int)((boxVector)b2)->sum - (int)((boxVector)b1)->sum;
+	if (allocator) {
+		allocator->free(allocator->ctx, ptr);
+	} else {
+		free(ptr);
+	}
 }
 
 
 static tupletable
 alloctupletable(
 	unsigned int const  /* in */  depth,
-	unsigned int const  /* in */  size)
+	unsigned int const  /* in */  size,
+	quant_pnm_allocator_t const /* in */ *allocator)
 {
 	enum { message_buffer_size = 256 };
 	char message[message_buffer_size];
@@ -246,7 +283,7 @@ alloctupletable(
 
 	allocSize = mainTableSize + size * tupleIntSize;
 
-	pool = malloc(allocSize);
+	pool = quant_alloc(allocator, allocSize);
 	if (pool == NULL) {
 		fprintf(stderr,"unable to allocate %u bytes for a %u-entry tuple table",allocSize, size);
 		exit(1);
@@ -268,13 +305,14 @@ alloctupletable(
 */
 
 static tupletable2
-newColorMap(unsigned int const newcolors, unsigned int const depth)
+newColorMap(unsigned int const newcolors, unsigned int const depth,
+			quant_pnm_allocator_t const *allocator)
 {
 	tupletable2 colormap;
 	unsigned int i;
 
 	colormap.size = 0;
-	colormap.table = alloctupletable(depth, newcolors);
+	colormap.table = alloctupletable(depth, newcolors, allocator);
 	if  (colormap.table) {
 		for (i = 0; i < newcolors; ++i) {
 			unsigned int plane;
@@ -292,11 +330,12 @@ static boxVector
 newBoxVector(
 	unsigned int const  /* in */ colors,
 	unsigned int const  /* in */ sum,
-	unsigned int const  /* in */ newcolors)
+	unsigned int const  /* in */ newcolors,
+	quant_pnm_allocator_t const /* in */ *allocator)
 {
 	boxVector bv;
 
-	bv = (boxVector)malloc(sizeof(struct box) * (size_t)newcolors);
+	bv = (boxVector)quant_alloc(allocator, sizeof(struct box) * (size_t)newcolors);
 	if (bv == NULL) {
 		fprintf(stderr, "out of memory allocating box vector table\n");
 		exit(1);
@@ -493,7 +532,8 @@ colormapFromBv(unsigned int const newcolors,
 			   unsigned int const boxes,
 			   tupletable2 const colorfreqtable,
 			   unsigned int const depth,
-			   int const methodForRep)
+			   int const methodForRep,
+			   quant_pnm_allocator_t const *allocator)
 {
 	/*
 	** Ok, we've got enough boxes.  Now choose a representative color for
@@ -506,7 +546,7 @@ colormapFromBv(unsigned int const newcolors,
 	tupletable2 colormap;
 	unsigned int bi;
 
-	colormap = newColorMap(newcolors, depth);
+	colormap = newColorMap(newcolors, depth, allocator);
 	if (!colormap.size) {
 		return colormap;
 	}
@@ -596,13 +636,10 @@ splitBox(boxVector const bv,
 	   represent the final boxes
 	*/
 
-	/* Set the gross global variable 'compareplanePlane' as a
-	   parameter to compareplane(), which is called by qsort().
-	*/
-	compareplanePlane = largestDimension;
+	/* Sort on the largest dimension (tuples have at most 4 planes) */
 	qsort((char*) &colorfreqtable.table[boxStart], boxSize,
 		  sizeof(colorfreqtable.table[boxStart]),
-		  compareplane);
+		  compareplane[largestDimension]);
 
 	{
 		/* Now find the median based on the counts, so that about half
@@ -637,7 +674,8 @@ mediancut(tupletable2 const colorfreqtable,
 		  unsigned int const newcolors,
 		  int const methodForLargest,
 		  int const methodForRep,
-		  tupletable2 *const colormapP)
+		  tupletable2 *const colormapP,
+		  quant_pnm_allocator_t const *allocator)
 {
 /*----------------------------------------------------------------------------
    Compute a set of only 'newcolors' colors that best represent an
@@ -663,7 +701,7 @@ mediancut(tupletable2 const colorfreqtable,
 
 	/* There is at least one box that contains at least 2 colors; ergo,
 	   there is more splitting we can do.  */
-	bv = newBoxVector(colorfreqtable.size, sum, newcolors);
+	bv = newBoxVector(colorfreqtable.size, sum, newcolors, allocator);
 	if (bv == NULL) {
 		fprintf(stderr,"Failed to create box vector\n");
 		exit(1);
@@ -689,9 +727,9 @@ mediancut(tupletable2 const colorfreqtable,
 	}
 	*colormapP = colormapFromBv(newcolors, bv, boxes,
 								colorfreqtable, depth,
-								methodForRep);
+								methodForRep, allocator);
 
-	free(bv);
+	quant_free(allocator, bv);
 }
 
 
@@ -714,7 +752,8 @@ computeHistogram(uint8_t const	/* in */  *data,
 				 unsigned int		   /* in */  length,
 				 unsigned long const	/* in */  depth,
 				 tupletable2 * const	/* out */ colorfreqtableP,
-				 int const			  /* in */  qualityMode)
+				 int const			  /* in */  qualityMode,
+				 quant_pnm_allocator_t const /* in */ *allocator)
 {
 	typedef unsigned short unit_t;
 	unsigned int i, n;
@@ -754,13 +793,14 @@ computeHistogram(uint8_t const	/* in */  *data,
 	fprintf(stderr, "making histogram...\n");
 	#endif
 
-	histogram = (unit_t *)calloc( (size_t)(1 << depth * 5), sizeof(unit_t));
+	histogram = (unit_t *)quant_alloc(allocator, (size_t)(1 << depth * 5) * sizeof(unit_t));
 	if (histogram == NULL) {
 		fprintf(stderr,"unable to allocate memory for histogram.");
 		exit(1);
 	}
+	memset(histogram, 0, (size_t)(1 << depth * 5) * sizeof(unit_t));
 	it = ref = refmap
-		= (unsigned short *)malloc((size_t)(1 << depth * 5) * sizeof(unit_t));
+		= (unsigned short *)quant_alloc(allocator, (size_t)(1 << depth * 5) * sizeof(unit_t));
 	if (!it) {
 		fprintf(stderr,"unable to allocate memory for lookup table.");
 		exit(1);
@@ -778,7 +818,7 @@ computeHistogram(uint8_t const	/* in */  *data,
 
 	colorfreqtableP->size = (unsigned int)(ref - refmap);
 
-	colorfreqtableP->table = alloctupletable(depth, (unsigned int)(ref - refmap));
+	colorfreqtableP->table = alloctupletable(depth, (unsigned int)(ref - refmap), allocator);
 
 	for (i = 0; i < colorfreqtableP->size; ++i) {
 		if (histogram[refmap[i]] > 0) {
@@ -795,8 +835,8 @@ computeHistogram(uint8_t const	/* in */  *data,
 	fprintf(stderr, "%lu colors found\n", colorfreqtableP->size);
 	#endif
 	
-	free(refmap);
-	free(histogram);
+	quant_free(allocator, refmap);
+	quant_free(allocator, histogram);
 }
 
 
@@ -809,7 +849,8 @@ computeColorMapFromInput(uint8_t const *data,
 						 int const methodForRep,
 						 int const qualityMode,
 						 tupletable2 * const colormapP,
-						 size_t *origcolors)
+						 size_t *origcolors,
+						 quant_pnm_allocator_t const *allocator)
 {
 /*----------------------------------------------------------------------------
    Produce a colormap containing the best colors to represent the
@@ -835,7 +876,7 @@ computeColorMapFromInput(uint8_t const *data,
 	unsigned int n;
 
 	computeHistogram(data, length, depth,
-							  &colorfreqtable, qualityMode);
+							  &colorfreqtable, qualityMode, allocator);
 	if (origcolors) {
 		*origcolors = colorfreqtable.size;
 	}
@@ -848,7 +889,7 @@ computeColorMapFromInput(uint8_t const *data,
 		#endif
 		/* *colormapP = colorfreqtable; */
 		colormapP->size = colorfreqtable.size;
-		colormapP->table = alloctupletable(depth, colorfreqtable.size);
+		colormapP->table = alloctupletable(depth, colorfreqtable.size, allocator);
 		for (i = 0; i < colorfreqtable.size; ++i) {
 			colormapP->table[i]->value = colorfreqtable.table[i]->value;
 			for (n = 0; n < depth; ++n) {
@@ -860,13 +901,13 @@ computeColorMapFromInput(uint8_t const *data,
 		fprintf(stderr, "choosing %d colors...\n", reqColors);
 		#endif
 		mediancut(colorfreqtable, depth, reqColors,
-						   methodForLargest, methodForRep, colormapP);
+						   methodForLargest, methodForRep, colormapP, allocator);
 		#ifdef DEBUG
 		fprintf(stderr, "%lu colors are choosed.\n", colorfreqtable.size);
 		#endif
 	}
 
-	free(colorfreqtable.table);
+	quant_free(allocator, colorfreqtable.table);
 }
 
 
@@ -1197,8 +1238,9 @@ lookup_mono_lightbg(uint8_t const * const pixel,
 
 
 /* choose colors using median-cut method */
-uint8_t *
+void
 quant_pnm_make_palette(
+	uint8_t /* out */ *palette, /* at least 3*reqcolors bytes */
 	uint8_t /* in */  *data,  /* data for sampling */
 	size_t  /* in */  length, /* data size */
 	size_t  /* in */  reqcolors,
@@ -1206,14 +1248,13 @@ quant_pnm_make_palette(
 	size_t  /* in */  *origcolors,
 	uint8_t /* in */  methodForLargest,
 	uint8_t /* in */  methodForRep,
-	uint8_t /* in */  qualityMode)
+	uint8_t /* in */  qualityMode,
+	quant_pnm_allocator_t const /* in */ *allocator)
 {
 	unsigned int i;
 	unsigned int n;
-	int ret;
 	tupletable2 colormap;
 	unsigned int depth = 3;
-	uint8_t *palette;
 
 	if( methodForLargest == QUANT_LARGE_AUTO ) {
 		methodForLargest = QUANT_LARGE_NORM;
@@ -1232,24 +1273,18 @@ quant_pnm_make_palette(
 	computeColorMapFromInput(data, length, depth,
 								   reqcolors, methodForLargest,
 								   methodForRep, qualityMode,
-								   &colormap, origcolors);
+								   &colormap, origcolors, allocator);
 	*ncolors = colormap.size;
 	#ifdef DEBUG
 	fprintf(stderr, "tupletable size: %zu\n", *ncolors);
 	#endif
-	palette = (uint8_t *)malloc(*ncolors * depth);
-	if( palette == 0 ) {
-		fprintf(stderr,"Failed to allocate palette\n");
-		exit(1);
-	}
 	for (i = 0; i < *ncolors; i++) {
 		for (n = 0; n < depth; ++n) {
 			(palette)[i * depth + n] = colormap.table[i]->tuple[n];
 		}
 	}
 
-	free(colormap.table);
-	return palette;
+	quant_free(allocator, colormap.table);
 }
 
 
@@ -60,6 +60,12 @@ void quant_bw(
 
 #include <math.h>
 
+//Run each time quant_quantize reduces its palette (quantbench defines
+//this to count them)
+#ifndef QUANT_REDUCE_HOOK
+#define QUANT_REDUCE_HOOK( distance, palsize )
+#endif
+
 #define SQUARE( x ) ((double)(x)*(double)(x))
 #define DR( buf, idx ) ((double)buf[3*(idx)])
 #define DG( buf, idx ) ((double)buf[3*(idx)+1])
@@ -142,6 +148,7 @@ void quant_quantize(
 					#endif
 					reduce_palette(palette,&cpalsize,
 						palpixels,i,distance);
+					QUANT_REDUCE_HOOK(distance,cpalsize);
 					#ifdef DEBUG
 					printf("   new palsize(%lu)\n",cpalsize);
 					#endif
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//Quantizer benchmark
+//
+//Times quant.h (quant_quantize, quant_apply_palette, quant_bw) and, when
+//built with USE_QUANTPNM, quant-pnm.h (quant_pnm_make_palette,
+//quant_pnm_apply_palette) on generated inputs that bring out their worst
+//cases, and prints one CSV line per case.
+//
+//Each case runs in a forked child with a time limit, so a quantizer that
+//goes quadratic is reported as a timeout instead of stalling the run.
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+//Count palette reductions made by quant_quantize
+static uint64_t reductions;
+static uint64_t reduce_distance;
+#define QUANT_REDUCE_HOOK( distance, palsize ) { reductions++; reduce_distance = (distance); }
+
+//Implementation block
+#define BENCH_IMPLEMENTATION
+#include "bench.h"
+#define QUANT_IMPLEMENTATION
+#ifdef USE_QUANTPNM
+#include "quant-pnm.h"
+#endif
+#include "quant.h"
+
+//Default minimum time spent running each case
+#define DEFAULT_MIN_MS 200
+//Default time limit for each case
+#define DEFAULT_LIMIT_S 20
+#define MAX_PALSIZES 16
+
+#define QB_QUANTIZE   0
+#define QB_APPLY      1
+#define QB_BW         2
+#define QB_PNM_MAKE   3
+#define QB_PNM_APPLY  4
+static const char* func_names[] = {
+	"quant_quantize", "quant_apply_palette", "quant_bw",
+	"quant_pnm_make_palette", "quant_pnm_apply_palette"
+};
+#ifdef USE_QUANTPNM
+#define NFUNCS 5
+#else
+#define NFUNCS 3
+#endif
+
+//Generated inputs
+static const char* input_names[] = {
+	//Random colors
+	"noise",
+	//Smooth ramps (many similar colors)
+	"gradient",
+	//Every pixel a different color, spread over the whole color cube
+	"unique",
+	//8 flat bands
+	"few",
+	//Black top half, white bottom half.  Quantized to 1 color, the
+	//palette is reduced once for every distance step between the two.
+	"twocolor",
+};
+#define NINPUTS (sizeof(input_names)/sizeof(input_names[0]))
+
+//A case to run
+typedef struct {
+	int func;
+	uint8_t* input;
+	size_t width;
+	size_t height;
+	size_t reqpalsize;
+	uint64_t min_ms;
+} qb_case_t;
+
+//Results sent from a case's child process
+typedef struct {
+	int error;
+	uint64_t runs;
+	uint64_t ns;
+	uint64_t reductions;
+	uint64_t distance;
+	uint64_t palsize;
+} qb_result_t;
+
+static void usage(char* cmd) {
+	fprintf(stderr,"Usage:\n");
+	fprintf(stderr,"%s [-h] [-s width height] [-p #[,#...]] [-t ms] [-l seconds]\n",cmd);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"-h : Print usage message\n");
+	fprintf(stderr,"-s : Size of the generated inputs (default 320 240)\n");
+	fprintf(stderr,"-p : Palette sizes to request (default 1,2,16,256)\n");
+	fprintf(stderr,"-t : Minimum time to run each case in ms (default %d)\n",DEFAULT_MIN_MS);
+	fprintf(stderr,"-l : Time limit for each case in seconds (default %d)\n",DEFAULT_LIMIT_S);
+	fprintf(stderr,"\n");
+	fprintf(stderr,"Results are printed as CSV:\n");
+	fprintf(stderr,"  function,input,width,height,colors,palsize,runs,ms_per_run,\n");
+	fprintf(stderr,"  ms_per_mpixel,reductions_per_run,reduce_distance,out_palsize\n");
+	fprintf(stderr,"colors is the number of distinct input colors.  quant_apply_palette\n");
+	fprintf(stderr,"uses the palette made by quant_quantize, and quant_pnm_apply_palette\n");
+	fprintf(stderr,"(with dither) uses the palette made by quant_pnm_make_palette.  A case\n");
+	fprintf(stderr,"that runs past the time limit is printed with runs of 0 and ms_per_run\n");
+	fprintf(stderr,"of timeout.\n");
+	exit(1);
+}
+
+static size_t countColors( uint8_t* pixels, size_t npixels ) {
+	uint8_t* seen;
+	uint32_t rgb;
+	size_t colors = 0;
+	size_t i;
+	seen = (uint8_t*)calloc(1<<21,1);
+	if( seen == 0 ) {
+		return 0;
+	}
+	for( i=0; i<npixels; i++ ) {
+		rgb = (pixels[3*i]<<16) | (pixels[3*i+1]<<8) | pixels[3*i+2];
+		if( !(seen[rgb>>3] & (1<<(rgb&7))) ) {
+			seen[rgb>>3] |= 1<<(rgb&7);
+			colors++;
+		}
+	}
+	free(seen);
+	return colors;
+}
+
+//Run one function for at least min_ms (in the child process)
+static void runCase( void* arg, void* resultp ) {
+	qb_case_t* qc = (qb_case_t*)arg;
+	qb_result_t* result = (qb_result_t*)resultp;
+	int func = qc->func;
+	uint8_t* input = qc->input;
+	size_t width = qc->width;
+	size_t height = qc->height;
+	size_t npixels = width*height;
+	size_t reqpalsize = qc->reqpalsize;
+	uint8_t* rgbpixels;
+	uint8_t* palpixels;
+	uint8_t palette[3*256];
+	size_t palsize = 0;
+	uint64_t t0;
+	
+	memset(result,0,sizeof(*result));
+	rgbpixels = (uint8_t*)malloc(3*npixels);
+	palpixels = (uint8_t*)malloc(npixels);
+	if( rgbpixels == 0 || palpixels == 0 ) {
+		result->error = 1;
+		return;
+	}
+	
+	//The apply functions use a palette made once for the input
+	memcpy(rgbpixels,input,3*npixels);
+	if( func == QB_APPLY ) {
+		palsize = reqpalsize;
+		quant_quantize(palette,&palsize,palpixels,rgbpixels,npixels,0);
+	}
+	#ifdef USE_QUANTPNM
+	else if( func == QB_PNM_APPLY ) {
+		quant_pnm_make_palette(palette,rgbpixels,npixels,reqpalsize,&palsize,0,
+			QUANT_LARGE_AUTO,QUANT_REP_AUTO,QUANT_QUALITY_HIGH,0);
+	}
+	#endif //USE_QUANTPNM
+	
+	while( result->runs == 0 || result->ns < qc->min_ms*1000000ULL ) {
+		//Every function but quant_pnm_make_palette updates the pixels
+		memcpy(rgbpixels,input,3*npixels);
+		reductions = 0;
+		reduce_distance = 0;
+		t0 = bench_now_ns();
+		if( func == QB_QUANTIZE ) {
+			palsize = reqpalsize;
+			quant_quantize(palette,&palsize,palpixels,rgbpixels,npixels,1);
+		}
+		else if( func == QB_APPLY ) {
+			quant_apply_palette(palette,palsize,palpixels,rgbpixels,npixels,1);
+		}
+		else if( func == QB_BW ) {
+			quant_bw(palpixels,rgbpixels,npixels,1);
+		}
+		#ifdef USE_QUANTPNM
+		else if( func == QB_PNM_MAKE ) {
+			quant_pnm_make_palette(palette,rgbpixels,npixels,reqpalsize,&palsize,0,
+				QUANT_LARGE_AUTO,QUANT_REP_AUTO,QUANT_QUALITY_HIGH,0);
+		}
+		else if( func == QB_PNM_APPLY ) {
+			quant_pnm_apply_palette(palpixels,rgbpixels,width,height,palette,palsize,
+				QUANT_DIFFUSE_AUTO,1,0,1,0,&palsize);
+		}
+		#endif //USE_QUANTPNM
+		result->ns += bench_now_ns()-t0;
+		result->runs++;
+		result->reductions += reductions;
+		result->distance = reduce_distance;
+	}
+	result->palsize = palsize;
+	free(rgbpixels);
+	free(palpixels);
+}
+
+//Run a case in a child process and print its CSV line
+static int benchCase( int func, const char* iname, uint8_t* input, size_t width, size_t height,
+		size_t colors, size_t reqpalsize, uint64_t min_ms, unsigned int limit_s ) {
+	qb_case_t qc;
+	qb_result_t result;
+	int status;
+	double ms;
+	
+	qc.func = func;
+	qc.input = input;
+	qc.width = width;
+	qc.height = height;
+	qc.reqpalsize = reqpalsize;
+	qc.min_ms = min_ms;
+	status = bench_fork(runCase,&qc,&result,sizeof(result),limit_s,0);
+	if( status == BENCH_TIMEOUT ) {
+		printf("%s,%s,%lu,%lu,%lu,%lu,0,timeout,,,,\n",
+			func_names[func],iname,width,height,colors,reqpalsize);
+		return 0;
+	}
+	if( status || result.error || result.runs == 0 ) {
+		fprintf(stderr,"Failed: %s %s palette %lu\n",func_names[func],iname,reqpalsize);
+		return 1;
+	}
+	ms = result.ns/1000000.0/result.runs;
+	printf("%s,%s,%lu,%lu,%lu,%lu,%lu,%.3f,%.3f,%.1f,%lu,%lu\n",
+		func_names[func],iname,width,height,colors,reqpalsize,
+		(unsigned long)result.runs,ms,ms*1000000.0/(width*height),
+		(double)result.reductions/result.runs,(unsigned long)result.distance,
+		(unsigned long)result.palsize);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	size_t width = 320;
+	size_t height = 240;
+	size_t palsizes[MAX_PALSIZES] = { 1, 2, 16, 256 };
+	size_t npalsizes = 4;
+	uint64_t min_ms = DEFAULT_MIN_MS;
+	unsigned int limit_s = DEFAULT_LIMIT_S;
+	bench_image_t input;
+	size_t colors;
+	size_t i, p;
+	int func;
+	int failed = 0;
+	
+	i=1;
+	while( i < (size_t)argc ) {
+		if( strcmp(argv[i],"-h") == 0 ) {
+			usage(argv[0]);
+		}
+		else if( strcmp(argv[i],"-s") == 0 ) {
+			if( i >= (size_t)argc-2 ) {
+				usage(argv[0]);
+			}
+			width = strtoul(argv[++i],0,10);
+			height = strtoul(argv[++i],0,10);
+			if( width == 0 || height == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-p") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			npalsizes = bench_parse_sizes(argv[++i],palsizes,MAX_PALSIZES,256);
+			if( npalsizes == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-t") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			min_ms = strtoul(argv[++i],0,10);
+		}
+		else if( strcmp(argv[i],"-l") == 0 ) {
+			if( i >= (size_t)argc-1 ) {
+				usage(argv[0]);
+			}
+			limit_s = strtoul(argv[++i],0,10);
+		}
+		else {
+			usage(argv[0]);
+		}
+		i++;
+	}
+	
+	printf("function,input,width,height,colors,palsize,runs,ms_per_run,"
+		"ms_per_mpixel,reductions_per_run,reduce_distance,out_palsize\n");
+	for( i=0; i<NINPUTS; i++ ) {
+		input = bench_synth_image(input_names[i],width,height);
+		colors = countColors(input.pixels,width*height);
+		for( func=0; func<NFUNCS; func++ ) {
+			if( func == QB_BW ) {
+				//quant_bw does not use a palette
+				failed |= benchCase(func,input_names[i],input.pixels,width,height,colors,0,min_ms,limit_s);
+				continue;
+			}
+			for( p=0; p<npalsizes; p++ ) {
+				failed |= benchCase(func,input_names[i],input.pixels,width,height,colors,palsizes[p],min_ms,limit_s);
+			}
+		}
+		bench_free_image(&input);
+	}
+	return failed;
+}
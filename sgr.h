@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __SGR_H__
+#define __SGR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Tracks the colors and attributes a terminal has been sent, so a change
+//sends only the parameters that differ, all in one SGR sequence
+//("\x1b[" params "m").  When attributes have to be turned off, whichever
+//is shorter of the individual "off" codes or a reset (0) followed by what
+//is still on is used.
+
+//Colors (SGR_DEFAULT is the terminal's own foreground or background)
+#define SGR_DEFAULT 0
+#define SGR_COLOR16(idx)  (0x01000000|(uint32_t)(idx))
+#define SGR_COLOR256(idx) (0x02000000|(uint32_t)(idx))
+#define SGR_RGB(rgb)      (0x03000000|((uint32_t)(rgb)&0xFFFFFF))
+
+//Attributes
+#define SGR_BOLD      0x01
+#define SGR_UNDERLINE 0x02
+#define SGR_BLINK     0x04
+#define SGR_REVERSE   0x08
+
+//Longest params written by sgr_update (including the null)
+#define SGR_MAX_PARAMS 64
+
+typedef struct {
+	uint32_t fg;
+	uint32_t bg;
+	uint8_t attrs;
+} sgr_state_t;
+
+//State of a terminal after a reset (\x1b[0m)
+void sgr_init( sgr_state_t* sgr );
+
+//Write the params (at least SGR_MAX_PARAMS bytes) that change the terminal
+//from *sgr to fg/bg/attrs, and update *sgr.  Returns the length of params
+//(0 if nothing changes).
+size_t sgr_update( sgr_state_t* sgr, char* params, uint32_t fg, uint32_t bg, uint8_t attrs );
+
+//Write the params needed before a line feed.  Terminals fill the lines they
+//scroll in (and erase) with the current background, so the background goes
+//back to the default and reverse is turned off.  The foreground and other
+//attributes carry over to the next line.
+size_t sgr_line_end( sgr_state_t* sgr, char* params );
+
+#ifdef SGR_IMPLEMENTATION
+
+#include <string.h>
+
+//Decimal strings of 0-255, copied as 4 bytes (the digits are followed by
+//a null, so a copy never reads past an entry) instead of being formatted
+static const char sgr_decimal[256][4] = {
+	"0","1","2","3","4","5","6","7","8","9","10","11","12","13","14","15",
+	"16","17","18","19","20","21","22","23","24","25","26","27","28","29","30","31",
+	"32","33","34","35","36","37","38","39","40","41","42","43","44","45","46","47",
+	"48","49","50","51","52","53","54","55","56","57","58","59","60","61","62","63",
+	"64","65","66","67","68","69","70","71","72","73","74","75","76","77","78","79",
+	"80","81","82","83","84","85","86","87","88","89","90","91","92","93","94","95",
+	"96","97","98","99","100","101","102","103","104","105","106","107","108","109","110","111",
+	"112","113","114","115","116","117","118","119","120","121","122","123","124","125","126","127",
+	"128","129","130","131","132","133","134","135","136","137","138","139","140","141","142","143",
+	"144","145","146","147","148","149","150","151","152","153","154","155","156","157","158","159",
+	"160","161","162","163","164","165","166","167","168","169","170","171","172","173","174","175",
+	"176","177","178","179","180","181","182","183","184","185","186","187","188","189","190","191",
+	"192","193","194","195","196","197","198","199","200","201","202","203","204","205","206","207",
+	"208","209","210","211","212","213","214","215","216","217","218","219","220","221","222","223",
+	"224","225","226","227","228","229","230","231","232","233","234","235","236","237","238","239",
+	"240","241","242","243","244","245","246","247","248","249","250","251","252","253","254","255",
+};
+
+//Parameters are never above 255
+static char* sgr_put_uint( char* p, uint8_t n ) {
+	memcpy(p,sgr_decimal[n],4);
+	return p + (n < 10 ? 1 : n < 100 ? 2 : 3);
+}
+
+static char* sgr_put_param( char* p, char* params, uint8_t n ) {
+	if( p != params ) {
+		*(p++) = ';';
+	}
+	return sgr_put_uint(p,n);
+}
+
+//base is 30 for a foreground color and 40 for a background color
+static char* sgr_put_color( char* p, char* params, uint32_t color, uint8_t base ) {
+	uint32_t idx = color & 0xFFFFFF;
+	switch( color>>24 ) {
+		case 0:
+			p = sgr_put_param(p,params,base+9);
+			break;
+		case 1:
+			p = sgr_put_param(p,params,idx < 8 ? base+idx : base+60+idx-8);
+			break;
+		case 2:
+			p = sgr_put_param(p,params,base+8);
+			memcpy(p,";5;",3);
+			p = sgr_put_uint(p+3,idx);
+			break;
+		default:
+			p = sgr_put_param(p,params,base+8);
+			memcpy(p,";2;",3);
+			p = sgr_put_uint(p+3,(idx>>16)&0xFF);
+			*(p++) = ';';
+			p = sgr_put_uint(p,(idx>>8)&0xFF);
+			*(p++) = ';';
+			p = sgr_put_uint(p,idx&0xFF);
+			break;
+	}
+	return p;
+}
+
+static char* sgr_put_attrs_on( char* p, char* params, uint8_t attrs ) {
+	if( attrs & SGR_BOLD ) { p = sgr_put_param(p,params,1); }
+	if( attrs & SGR_UNDERLINE ) { p = sgr_put_param(p,params,4); }
+	if( attrs & SGR_BLINK ) { p = sgr_put_param(p,params,5); }
+	if( attrs & SGR_REVERSE ) { p = sgr_put_param(p,params,7); }
+	return p;
+}
+
+void sgr_init( sgr_state_t* sgr ) {
+	sgr->fg = SGR_DEFAULT;
+	sgr->bg = SGR_DEFAULT;
+	sgr->attrs = 0;
+}
+
+size_t sgr_update( sgr_state_t* sgr, char* params, uint32_t fg, uint32_t bg, uint8_t attrs ) {
+	char reset[SGR_MAX_PARAMS];
+	uint8_t off = sgr->attrs & ~attrs;
+	char* p = params;
+	char* r;
+	
+	if( fg == sgr->fg && bg == sgr->bg && attrs == sgr->attrs ) {
+		params[0] = 0;
+		return 0;
+	}
+	if( off & SGR_BOLD ) { p = sgr_put_param(p,params,22); }
+	if( off & SGR_UNDERLINE ) { p = sgr_put_param(p,params,24); }
+	if( off & SGR_BLINK ) { p = sgr_put_param(p,params,25); }
+	if( off & SGR_REVERSE ) { p = sgr_put_param(p,params,27); }
+	p = sgr_put_attrs_on(p,params,attrs & ~sgr->attrs);
+	if( fg != sgr->fg ) {
+		p = sgr_put_color(p,params,fg,30);
+	}
+	if( bg != sgr->bg ) {
+		p = sgr_put_color(p,params,bg,40);
+	}
+	*p = 0;
+	
+	if( off ) {
+		r = sgr_put_param(reset,reset,0);
+		r = sgr_put_attrs_on(r,reset,attrs);
+		if( fg != SGR_DEFAULT ) {
+			r = sgr_put_color(r,reset,fg,30);
+		}
+		if( bg != SGR_DEFAULT ) {
+			r = sgr_put_color(r,reset,bg,40);
+		}
+		*r = 0;
+		if( r-reset < p-params ) {
+			memcpy(params,reset,r-reset+1);
+			p = params + (r-reset);
+		}
+	}
+	
+	sgr->fg = fg;
+	sgr->bg = bg;
+	sgr->attrs = attrs;
+	return p-params;
+}
+
+size_t sgr_line_end( sgr_state_t* sgr, char* params ) {
+	return sgr_update(sgr,params,sgr->fg,SGR_DEFAULT,sgr->attrs & ~SGR_REVERSE);
+}
+
+#endif //SGR_IMPLEMENTATION
+#endif //__SGR_H__
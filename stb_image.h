@@ -426,6 +426,14 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 // for stbi_load_from_file, file pointer is left pointing immediately after image
 #endif
 
+// decode at 1/scale of the full size (scale = 1, 2, 4 or 8, rounding up). JPEG
+// is scaled in the DCT domain, PNM drops pixels while reading scanlines, and
+// other formats are box filtered after decoding.
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled     (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
@@ -814,6 +822,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int scale_shift; // decode at 1/(1<<scale_shift) size
 } stbi__context;
 
 
@@ -827,6 +837,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->scale_shift = 0;
 }
 
 // initialize a callback-based context
@@ -840,6 +851,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->scale_shift = 0;
 }
 
 #ifndef STBI_NO_STDIO
@@ -900,6 +912,7 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int scaled; // loader already applied scale_shift
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
@@ -1237,6 +1250,35 @@ static void stbi__vertical_flip_slices(void *image, int w, int h, int z, int byt
 }
 #endif
 
+// average each (1<<shift) x (1<<shift) block into one pixel, in place
+static void stbi__box_shrink(stbi_uc *pixels, int *x, int *y, int channels, int shift)
+{
+   int w = *x, h = *y, step = 1 << shift;
+   int ow = (w + step-1) >> shift, oh = (h + step-1) >> shift;
+   int i,j,u,v,c,count;
+   stbi__uint32 sum[4];
+   stbi_uc *out = pixels;
+   for (j=0; j < oh; ++j) {
+      for (i=0; i < ow; ++i) {
+         sum[0] = sum[1] = sum[2] = sum[3] = 0;
+         count = 0;
+         // reads are never behind the write position, so this is safe in place
+         for (v=j*step; v < j*step+step && v < h; ++v) {
+            for (u=i*step; u < i*step+step && u < w; ++u) {
+               stbi_uc *p = pixels + (v*w + u)*channels;
+               for (c=0; c < channels; ++c)
+                  sum[c] += p[c];
+               ++count;
+            }
+         }
+         for (c=0; c < channels; ++c)
+            *out++ = (stbi_uc) ((sum[c] + count/2) / count);
+      }
+   }
+   *x = ow;
+   *y = oh;
+}
+
 static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
    stbi__result_info ri;
@@ -1255,6 +1297,11 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
+   if (s->scale_shift && !ri.scaled) {
+      int channels = req_comp ? req_comp : *comp;
+      stbi__box_shrink((stbi_uc *) result, x, y, channels, s->scale_shift);
+   }
+
    if (stbi__vertically_flip_on_load) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
@@ -1353,6 +1400,33 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
    return result;
 }
 
+static int stbi__scale_shift(int scale)
+{
+   switch (scale) {
+      case 1: return 0;
+      case 2: return 1;
+      case 4: return 2;
+      case 8: return 3;
+   }
+   return -1;
+}
+
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   FILE *f;
+   unsigned char *result;
+   stbi__context s;
+   int shift = stbi__scale_shift(scale);
+   if (shift < 0) return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+   f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   s.scale_shift = shift;
+   result = stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
    unsigned char *result;
@@ -1413,6 +1487,16 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_scaled(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   stbi__context s;
+   int shift = stbi__scale_shift(scale);
+   if (shift < 0) return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+   stbi__start_mem(&s,buffer,len);
+   s.scale_shift = shift;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1618,7 +1702,7 @@ stbi_inline static int stbi__at_eof(stbi__context *s)
 }
 #endif
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC)
+#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
 static void stbi__skip(stbi__context *s, int n)
@@ -1974,6 +2058,8 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // components are decoded at 1/(1<<scale_shift) size
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2912,6 +2998,63 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// C(u) * cos((2x+1) * u * pi / 2n) for the reduced size idcts, indexed [x][u]
+static const float stbi__idct_scaled_cos4[4][4] = {
+   { 0.70710678f,  0.92387953f,  0.70710678f,  0.38268343f },
+   { 0.70710678f,  0.38268343f, -0.70710678f, -0.92387953f },
+   { 0.70710678f, -0.38268343f, -0.70710678f,  0.92387953f },
+   { 0.70710678f, -0.92387953f,  0.70710678f, -0.38268343f },
+};
+static const float stbi__idct_scaled_cos2[2][2] = {
+   { 0.70710678f,  0.70710678f },
+   { 0.70710678f, -0.70710678f },
+};
+
+// reduced size idct: the top-left n x n coefficients produce an n x n block
+// (n = 8 >> shift), which approximates the average of each block of pixels
+// the full idct would have produced
+static void stbi__idct_scaled(stbi_uc *out, int out_stride, short data[64], int shift)
+{
+   float tmp[4][4], v;
+   const float *cs;
+   int n = 8 >> shift, i, j, u;
+   if (n == 1) {
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+      return;
+   }
+   cs = n == 4 ? &stbi__idct_scaled_cos4[0][0] : &stbi__idct_scaled_cos2[0][0];
+   // rows
+   for (j=0; j < n; ++j) {
+      for (i=0; i < n; ++i) {
+         v = 0;
+         for (u=0; u < n; ++u)
+            v += cs[i*n+u] * data[j*8+u];
+         tmp[j][i] = v;
+      }
+   }
+   // columns
+   for (j=0; j < n; ++j) {
+      for (i=0; i < n; ++i) {
+         v = 0;
+         for (u=0; u < n; ++u)
+            v += cs[j*n+u] * tmp[u][i];
+         out[j*out_stride+i] = stbi__clamp((int) (v * 0.25f + 128.5f));
+      }
+   }
+}
+
+// idct the block at pixel x2,y2 of component n into the (possibly scaled) component buffer
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int x2, int y2, short data[64])
+{
+   int shift = z->scale_shift;
+   int w2 = z->img_comp[n].w2 >> shift;
+   stbi_uc *out = z->img_comp[n].data + w2*(y2 >> shift) + (x2 >> shift);
+   if (shift)
+      stbi__idct_scaled(out, w2, data, shift);
+   else
+      z->idct_block_kernel(out, w2, data);
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2930,7 +3073,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i*8, j*8, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2958,7 +3101,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, x2, y2, data);
                      }
                   }
                }
@@ -3055,7 +3198,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i*8, j*8, data);
             }
          }
       }
@@ -3299,7 +3442,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2 >> z->scale_shift, z->img_comp[i].h2 >> z->scale_shift, 15);
       if (z->img_comp[i].raw_data == NULL)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
       // align blocks for idct using mmx/sse
@@ -3768,6 +3911,7 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 {
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
+   j->scale_shift = 0;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
 #ifdef STBI_SSE2
@@ -3819,6 +3963,19 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // components were decoded at reduced size, so shrink the geometry to match
+   if (z->scale_shift) {
+      int k, shift = z->scale_shift, r = (1 << shift) - 1;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + r) >> shift;
+         z->img_comp[k].y = (z->img_comp[k].y + r) >> shift;
+         z->img_comp[k].w2 >>= shift;
+         z->img_comp[k].h2 >>= shift;
+      }
+      z->s->img_x = (z->s->img_x + r) >> shift;
+      z->s->img_y = (z->s->img_y + r) >> shift;
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3976,9 +4133,10 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    unsigned char* result;
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
    if (!j) return stbi__errpuc("outofmem", "Out of memory");
-   STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   j->scale_shift = s->scale_shift;
+   ri->scaled = 1;
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
    return result;
@@ -7444,9 +7602,38 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    if (!stbi__mad4sizes_valid(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0))
       return stbi__errpuc("too large", "PNM too large");
 
-   out = (stbi_uc *) stbi__malloc_mad4(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0);
-   if (!out) return stbi__errpuc("outofmem", "Out of memory");
-   stbi__getn(s, out, s->img_n * s->img_x * s->img_y * (ri->bits_per_channel / 8));
+   if (s->scale_shift && ri->bits_per_channel == 8) {
+      // keep every (1<<scale_shift)th pixel of every (1<<scale_shift)th scanline
+      int shift = s->scale_shift, step = 1 << shift;
+      int row_len = s->img_n * s->img_x;
+      int ow = (s->img_x + step-1) >> shift, oh = (s->img_y + step-1) >> shift;
+      int i, j, c;
+      stbi_uc *row, *dst;
+      out = (stbi_uc *) stbi__malloc_mad3(s->img_n, ow, oh, 0);
+      row = (stbi_uc *) stbi__malloc(row_len);
+      if (!out || !row) { STBI_FREE(out); STBI_FREE(row); return stbi__errpuc("outofmem", "Out of memory"); }
+      dst = out;
+      for (j=0; j < (int) s->img_y; ++j) {
+         if (j & (step-1)) {
+            stbi__skip(s, row_len);
+            continue;
+         }
+         stbi__getn(s, row, row_len);
+         for (i=0; i < ow; ++i)
+            for (c=0; c < s->img_n; ++c)
+               *dst++ = row[(i << shift)*s->img_n + c];
+      }
+      STBI_FREE(row);
+      s->img_x = ow;
+      s->img_y = oh;
+      *x = ow;
+      *y = oh;
+      ri->scaled = 1;
+   } else {
+      out = (stbi_uc *) stbi__malloc_mad4(s->img_n, s->img_x, s->img_y, ri->bits_per_channel / 8, 0);
+      if (!out) return stbi__errpuc("outofmem", "Out of memory");
+      stbi__getn(s, out, s->img_n * s->img_x * s->img_y * (ri->bits_per_channel / 8));
+   }
 
    if (req_comp && req_comp != s->img_n) {
       out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __STRIP_LOAD_H__
+#define __STRIP_LOAD_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+//Progressive box downsampler.  Input rows are pushed one at a time and are
+//averaged into the output image as they arrive, so the input image never
+//has to be held in memory.
+typedef struct {
+	size_t in_width;
+	size_t in_height;
+	size_t out_width;
+	size_t out_height;
+	//RGB output pixels (out_width*out_height*3)
+	//Ownership passes to the caller once all rows are pushed
+	uint8_t* pixels;
+	
+	//Internal
+	size_t* xstart;
+	uint64_t* sums;
+	size_t in_y;
+	size_t out_y;
+	size_t ystart;
+} strip_box_t;
+
+int strip_box_init( strip_box_t* box, size_t in_width, size_t in_height, size_t out_width, size_t out_height );
+void strip_box_row( strip_box_t* box, uint8_t* rgb );
+void strip_box_destroy( strip_box_t* box );
+
+//Returns true if fp is a binary PNM (P5/P6) that strip_load_pnm can stream.
+//fp is rewound.
+int strip_is_pnm( FILE* fp );
+
+//Read a binary PNM one scanline at a time, cropping it (if crop_w and crop_h
+//are non-zero) and shrinking it to no more than max_width pixels wide
+//(0 for no limit) while maintaining the aspect ratio.  Peak memory is one
+//input scanline plus the output image.  Returns RGB pixels that must be
+//freed, or 0 on failure.
+uint8_t* strip_load_pnm( FILE* fp, size_t max_width,
+	size_t crop_x, size_t crop_y, size_t crop_w, size_t crop_h,
+	size_t* width, size_t* height );
+
+#ifdef STRIP_LOAD_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+int strip_box_init( strip_box_t* box, size_t in_width, size_t in_height, size_t out_width, size_t out_height ) {
+	size_t x;
+	memset(box,0,sizeof(strip_box_t));
+	if( out_width == 0 || out_height == 0 || out_width > in_width || out_height > in_height ) {
+		fprintf(stderr,"Invalid downsample size: %lu %lu to %lu %lu\n",in_width,in_height,out_width,out_height);
+		return 1;
+	}
+	box->in_width = in_width;
+	box->in_height = in_height;
+	box->out_width = out_width;
+	box->out_height = out_height;
+	box->pixels = (uint8_t*)malloc(sizeof(uint8_t)*3*out_width*out_height);
+	box->xstart = (size_t*)malloc(sizeof(size_t)*(out_width+1));
+	box->sums = (uint64_t*)calloc(3*out_width,sizeof(uint64_t));
+	if( box->pixels == 0 || box->xstart == 0 || box->sums == 0 ) {
+		fprintf(stderr,"Failed to allocate downsample buffers\n");
+		strip_box_destroy(box);
+		return 1;
+	}
+	//Output column x covers input columns xstart[x] to xstart[x+1]-1
+	for( x=0; x<=out_width; x++ ) {
+		box->xstart[x] = x*in_width/out_width;
+	}
+	return 0;
+}
+
+void strip_box_row( strip_box_t* box, uint8_t* rgb ) {
+	size_t ox, x, yend;
+	uint64_t *sum;
+	uint64_t count;
+	uint8_t *dstrgb;
+	
+	if( box->out_y >= box->out_height ) {
+		return;
+	}
+	for( ox=0; ox<box->out_width; ox++ ) {
+		sum = &(box->sums[3*ox]);
+		for( x=box->xstart[ox]; x<box->xstart[ox+1]; x++ ) {
+			sum[0] += rgb[3*x];
+			sum[1] += rgb[3*x+1];
+			sum[2] += rgb[3*x+2];
+		}
+	}
+	box->in_y++;
+	
+	//Emit the output row once all of its input rows have been summed
+	yend = (box->out_y+1)*box->in_height/box->out_height;
+	if( box->in_y == yend ) {
+		dstrgb = &(box->pixels[3*box->out_y*box->out_width]);
+		for( ox=0; ox<box->out_width; ox++ ) {
+			sum = &(box->sums[3*ox]);
+			count = (box->xstart[ox+1]-box->xstart[ox])*(yend-box->ystart);
+			*(dstrgb++) = (sum[0]+count/2)/count;
+			*(dstrgb++) = (sum[1]+count/2)/count;
+			*(dstrgb++) = (sum[2]+count/2)/count;
+		}
+		memset(box->sums,0,sizeof(uint64_t)*3*box->out_width);
+		box->ystart = yend;
+		box->out_y++;
+	}
+}
+
+void strip_box_destroy( strip_box_t* box ) {
+	if( box->pixels ) {
+		free(box->pixels);
+		box->pixels = 0;
+	}
+	if( box->xstart ) {
+		free(box->xstart);
+		box->xstart = 0;
+	}
+	if( box->sums ) {
+		free(box->sums);
+		box->sums = 0;
+	}
+}
+
+int strip_is_pnm( FILE* fp ) {
+	char magic[2];
+	size_t len;
+	len = fread(magic,1,2,fp);
+	rewind(fp);
+	return len == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+}
+
+//Read a PNM header value, skipping white space and comments
+static int strip_pnm_value( FILE* fp, size_t* value ) {
+	int c;
+	c = fgetc(fp);
+	while( c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#' ) {
+		if( c == '#' ) {
+			while( c != EOF && c != '\n' ) {
+				c = fgetc(fp);
+			}
+		}
+		c = fgetc(fp);
+	}
+	if( c < '0' || c > '9' ) {
+		return 1;
+	}
+	*value = 0;
+	while( c >= '0' && c <= '9' ) {
+		*value = *value*10 + (c-'0');
+		c = fgetc(fp);
+	}
+	//A single white space character seperates the header from the pixels
+	return c == EOF;
+}
+
+uint8_t* strip_load_pnm( FILE* fp, size_t max_width,
+		size_t crop_x, size_t crop_y, size_t crop_w, size_t crop_h,
+		size_t* width, size_t* height ) {
+	char magic[2];
+	size_t imgwidth, imgheight, maxval;
+	size_t channels, samplelen, rowlen;
+	size_t x, y, c, v;
+	size_t outwidth, outheight;
+	uint8_t *row = 0;
+	uint8_t *rgbrow = 0;
+	uint8_t *src;
+	uint8_t *dstrgb;
+	uint8_t *pixels = 0;
+	strip_box_t box;
+	
+	memset(&box,0,sizeof(strip_box_t));
+	if( fread(magic,1,2,fp) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6') ) {
+		fprintf(stderr,"Not a binary PNM image\n");
+		return 0;
+	}
+	channels = magic[1] == '6' ? 3 : 1;
+	if( strip_pnm_value(fp,&imgwidth) || strip_pnm_value(fp,&imgheight) || strip_pnm_value(fp,&maxval) ||
+			imgwidth == 0 || imgheight == 0 || maxval == 0 || maxval > 65535 ) {
+		fprintf(stderr,"Invalid PNM header\n");
+		return 0;
+	}
+	samplelen = maxval > 255 ? 2 : 1;
+	rowlen = imgwidth*channels*samplelen;
+	
+	if( crop_w && crop_h ) {
+		if( crop_y >= imgheight || crop_x >= imgwidth ) {
+			fprintf(stderr,"Failed to crop image because rectange is out of bounds\n");
+			return 0;
+		}
+		if( crop_y+crop_h > imgheight ) {
+			crop_h = imgheight - crop_y;
+		}
+		if( crop_x+crop_w > imgwidth ) {
+			crop_w = imgwidth - crop_x;
+		}
+	}
+	else {
+		crop_x = 0;
+		crop_y = 0;
+		crop_w = imgwidth;
+		crop_h = imgheight;
+	}
+	
+	outwidth = crop_w;
+	outheight = crop_h;
+	if( max_width && max_width < crop_w ) {
+		outwidth = max_width;
+		outheight = (crop_h*max_width + crop_w/2)/crop_w;
+		if( outheight == 0 ) {
+			outheight = 1;
+		}
+	}
+	
+	row = (uint8_t*)malloc(sizeof(uint8_t)*rowlen);
+	rgbrow = (uint8_t*)malloc(sizeof(uint8_t)*3*crop_w);
+	if( row == 0 || rgbrow == 0 ) {
+		fprintf(stderr,"Failed to allocate scanline buffers\n");
+		goto done;
+	}
+	if( strip_box_init(&box,crop_w,crop_h,outwidth,outheight) ) {
+		goto done;
+	}
+	
+	//Skip the rows above the crop (seek if possible)
+	if( crop_y && fseek(fp,rowlen*crop_y,SEEK_CUR) ) {
+		for( y=0; y<crop_y; y++ ) {
+			if( fread(row,1,rowlen,fp) != rowlen ) {
+				fprintf(stderr,"Truncated PNM image\n");
+				goto done;
+			}
+		}
+	}
+	for( y=0; y<crop_h; y++ ) {
+		if( fread(row,1,rowlen,fp) != rowlen ) {
+			fprintf(stderr,"Truncated PNM image\n");
+			goto done;
+		}
+		src = &(row[crop_x*channels*samplelen]);
+		dstrgb = rgbrow;
+		for( x=0; x<crop_w; x++ ) {
+			for( c=0; c<channels; c++ ) {
+				if( samplelen == 2 ) {
+					v = (src[0]<<8)|src[1];
+				} else {
+					v = src[0];
+				}
+				src += samplelen;
+				if( maxval != 255 ) {
+					v = (v*255+maxval/2)/maxval;
+					if( v > 255 ) { v = 255; }
+				}
+				dstrgb[c] = v;
+			}
+			if( channels == 1 ) {
+				dstrgb[1] = dstrgb[0];
+				dstrgb[2] = dstrgb[0];
+			}
+			dstrgb += 3;
+		}
+		strip_box_row(&box,rgbrow);
+	}
+	
+	pixels = box.pixels;
+	box.pixels = 0;
+	*width = outwidth;
+	*height = outheight;
+	
+done:
+	strip_box_destroy(&box);
+	if( row ) { free(row); }
+	if( rgbrow ) { free(rgbrow); }
+	return pixels;
+}
+
+#endif //STRIP_LOAD_IMPLEMENTATION
+#endif //__STRIP_LOAD_H__
@@ -28,13 +28,21 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <arpa/inet.h>
 
 #include "term_encode.h"
 
+//Scratch allocations made while encoding come from the encoder's arena
+static void* arenaAlloc( void* ctx, size_t size );
+static void arenaFree( void* ctx, void* ptr );
+
 //Implemenation block
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
+#define STBIR_MALLOC(size,c) arenaAlloc(c,size)
+#define STBIR_FREE(ptr,c) arenaFree(c,ptr)
 #include "stb_image_resize.h"
 #define UTF8_IMPLEMENTATION
 #define UTF8_DOS_CHARACTER_SET
@@ -48,6 +56,10 @@
 #include "edge_detect.h"
 #define APPLE2_IMPLEMENTATION
 #include "apple2.h"
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+#define SGR_IMPLEMENTATION
+#include "sgr.h"
 
 #if USE_LIBSIXEL
 #include <sixel/sixel.h>
@@ -61,9 +73,294 @@
 #include <caca.h>
 #endif
 
+//Arena allocations are aligned to this many bytes
+#define ENC_ARENA_ALIGN 16
+
+//Allocation that did not fit in the arena, freed when the arena is reset
+struct arena_block {
+	struct arena_block* next;
+	uint8_t pad[ENC_ARENA_ALIGN-sizeof(struct arena_block*)];
+};
+
+//Internal encoder state (term_encode_t.state)
+struct term_encode_state {
+	//RGB pixels
+	uint8_t* rgbpixels;
+	//Palette indexes for RGB pixels
+	uint8_t* palpixels;
+	size_t palpixlen;
+	//Palette used by palpixels
+	//Length is palsize
+	uint8_t palette[3*256];
+	//Size of the standard palette held in palette (0 if none)
+	size_t stdpalsize;
+	//Size of rgbpixel/palpixels
+	size_t width;
+	size_t height;
+	//Reusable buffer for resized pixels (or a strip of them)
+	uint8_t* rszpixels;
+	//Number of bytes rszpixels can hold
+	size_t rszlen;
+	//Reusable edge detection scratch (one byte per pixel)
+	uint8_t* edgepixels;
+	size_t edgelen;
+	//Scratch arena for the allocations of a single term_encode() call.
+	//It is reset when the call returns, and grown to the call's peak use,
+	//so repeated encodes of the same size make no allocator calls.
+	uint8_t* arena;
+	size_t arenalen;
+	size_t arenaused;
+	//Offset of the latest allocation, which can be given back by a free
+	size_t arenalast;
+	//Allocations that overflowed the arena during this call
+	struct arena_block* overflow;
+	size_t overflowlen;
+	//Peak of arenaused+overflowlen during this call
+	size_t arenapeak;
+	//Figures for the last term_encode() call
+	term_encode_stats_t stats;
+	//Colors and attributes sent to textfp
+	sgr_state_t sgr;
+	//Identical cells not yet written to textfp (see ansiCell())
+	utf8_glyph_t runglyph;
+	size_t runlen;
+	uint32_t runfg;
+	uint32_t runbg;
+	uint8_t runattrs;
+	//Best ASCII renderer glyph for each quantized cell (see asciiMatch()),
+	//built for the first ascii_matchlen glyphs (0 if not built yet)
+	uint8_t ascii_match[4096];
+	size_t ascii_matchlen;
+	//Sixel color registers (percent RGB) defined on the terminal by the
+	//last image, and the palette indexes of the last image (see
+	//sixelEncode())
+	uint8_t sixelregs[3*256];
+	size_t sixelregslen;
+	//Color registers are shared (DECRST 1070 was sent), until
+	//term_encode_finish()
+	uint8_t sixelshared;
+	uint8_t* sixelpixels;
+	size_t sixelpixlen;
+	size_t sixelwidth;
+	size_t sixelheight;
+	//Optimal palette kept from image to image (see sixelPalettize()), the
+	//palette size requested for it, and its mean error on the image it was
+	//made for
+	uint8_t sixelpalette[3*256];
+	size_t sixelpalsize;
+	size_t sixelpalreq;
+	uint64_t sixelpalerror;
+	//Nearest kept palette color (plus 1) of each 15-bit color
+	uint8_t* sixelcache;
+	size_t sixelcachelen;
+	#ifdef USE_LIBCACA
+	//libcaca canvas and dither, kept across calls (see cacaRender())
+	caca_canvas_t* cacacanvas;
+	caca_dither_t* cacadither;
+	size_t cacawidth;
+	size_t cacaheight;
+	const char* cacacharset;
+	#endif
+};
+
+//Pixel layout of each renderer, indexed by ENC_RENDER_*
+//ANSI pixel_ratio values were manually fine tuned based on Dejavu San Monospace
+static const term_encode_renderer_info_t renderer_info[] = {
+	[ENC_RENDER_SIXEL]    = { "sixel",   1.0, 1.0,  0 },
+	[ENC_RENDER_SIMPLE]   = { "simple",  1.0, 0.48, 1 },
+	[ENC_RENDER_HALF]     = { "half",    1.0, 0.97, 2 },
+	[ENC_RENDER_QUARTER]  = { "qchar",   2.0, 0.48, 2 },
+	[ENC_RENDER_SEXTANT]  = { "six",     2.0, 0.72, 3 },
+	[ENC_RENDER_BRAILLE]  = { "bra",     2.0, 0.95, 4 },
+	[ENC_RENDER_AA]       = { "aa",      2.0, 0.5,  0 },
+	[ENC_RENDER_AAEXT]    = { "aaext",   2.0, 0.5,  0 },
+	[ENC_RENDER_AAFG]     = { "aafg",    2.0, 0.5,  0 },
+	[ENC_RENDER_AAFGEXT]  = { "aafgext", 2.0, 0.5,  0 },
+	[ENC_RENDER_AABG]     = { "aabg",    2.0, 0.5,  0 },
+	[ENC_RENDER_AABGEXT]  = { "aabgext", 2.0, 0.5,  0 },
+	[ENC_RENDER_CACA]     = { "caca",    1.0, 1.0,  0 },
+	[ENC_RENDER_CACABLK]  = { "cacablk", 1.0, 1.0,  0 },
+	[ENC_RENDER_ASCII]      = { "ascii",      2.0, 0.48, 2 },
+	[ENC_RENDER_ASCIIEXT]   = { "asciiext",   2.0, 0.48, 2 },
+	[ENC_RENDER_ASCIIFG]    = { "asciifg",    2.0, 0.48, 2 },
+	[ENC_RENDER_ASCIIFGEXT] = { "asciifgext", 2.0, 0.48, 2 },
+	[ENC_RENDER_ASCIIBG]    = { "asciibg",    2.0, 0.48, 2 },
+	[ENC_RENDER_ASCIIBGEXT] = { "asciibgext", 2.0, 0.48, 2 },
+	[ENC_RENDER_LIBSIXEL]   = { "libsixel",   1.0, 1.0,  0 },
+};
+#define RENDERER_INFO_LEN (sizeof(renderer_info)/sizeof(renderer_info[0]))
+
 #define ENC_FGCOLOR 0
 #define ENC_BGCOLOR 1
 
+//Allocate with the encoder's allocator hooks (malloc/free if not set)
+static void* encAlloc( term_encode_t* enc, size_t size ) {
+	if( enc->state ) {
+		enc->state->stats.allocs++;
+	}
+	if( enc->alloc_fn ) {
+		return enc->alloc_fn(enc->alloc_ctx,size);
+	}
+	return malloc(size);
+}
+
+static void encFree( term_encode_t* enc, void* ptr ) {
+	if( ptr == 0 ) {
+		return;
+	}
+	if( enc->free_fn ) {
+		enc->free_fn(enc->alloc_ctx,ptr);
+	}
+	else {
+		free(ptr);
+	}
+}
+
+//Monotonic time in nanoseconds
+static uint64_t nowNs( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static const char* stage_names[ENC_STAGE_COUNT] = {
+	"crop", "resize", "filter", "quantize", "render", "write"
+};
+
+//Start of a timed stage (0 if neither stats nor tracing are enabled)
+static uint64_t stageMark( term_encode_t* enc ) {
+	return enc->stats || trace_enabled ? nowNs() : 0;
+}
+
+//Add the time since *mark to stage, and start the next stage
+static void stageTime( term_encode_t* enc, int stage, uint64_t* mark ) {
+	uint64_t now;
+	if( enc->stats || trace_enabled ) {
+		now = nowNs();
+		if( enc->stats ) {
+			enc->state->stats.stage_ns[stage] += now-*mark;
+		}
+		if( trace_enabled && *mark ) {
+			trace_event('B',stage_names[stage],*mark);
+			trace_event('E',stage_names[stage],now);
+		}
+		*mark = now;
+	}
+}
+
+//Write encoded text, counting the bytes and escape sequences
+static void textPrintf( term_encode_t* enc, const char* fmt, ... ) {
+	va_list args;
+	const char* c;
+	int len;
+	va_start(args,fmt);
+	len = vfprintf(enc->textfp,fmt,args);
+	va_end(args);
+	if( len > 0 ) {
+		enc->state->stats.text_bytes += len;
+	}
+	for( c=fmt; *c; c++ ) {
+		if( *c == '\x1b' ) {
+			enc->state->stats.escapes++;
+		}
+	}
+}
+
+//Write len bytes of encoded text holding escapes escape sequences
+static void textWrite( term_encode_t* enc, const char* bytes, size_t len, size_t escapes ) {
+	fwrite(bytes,1,len,enc->textfp);
+	enc->state->stats.text_bytes += len;
+	enc->state->stats.escapes += escapes;
+}
+
+//Write a pre-encoded character
+static void textGlyph( term_encode_t* enc, const utf8_glyph_t* glyph ) {
+	textWrite(enc,(const char*)glyph->bytes,glyph->len,0);
+}
+
+//Grow a buffer that is reused between calls to hold size bytes.
+//The contents are not kept.
+static int growBuffer( term_encode_t* enc, uint8_t** buf, size_t* len, size_t size ) {
+	if( size <= *len ) {
+		return 0;
+	}
+	encFree(enc,*buf);
+	*len = 0;
+	*buf = (uint8_t*)encAlloc(enc,size);
+	if( *buf == 0 ) {
+		return 1;
+	}
+	*len = size;
+	return 0;
+}
+
+//ctx is the term_encode_t* (or 0 to use malloc/free)
+static void* arenaAlloc( void* ctx, size_t size ) {
+	term_encode_t* enc = (term_encode_t*)ctx;
+	struct term_encode_state* state;
+	struct arena_block* block;
+	uint8_t* ptr;
+	if( enc == 0 ) {
+		return malloc(size);
+	}
+	state = enc->state;
+	size = (size+ENC_ARENA_ALIGN-1) & ~(size_t)(ENC_ARENA_ALIGN-1);
+	if( state->arenalen - state->arenaused >= size ) {
+		ptr = &(state->arena[state->arenaused]);
+		state->arenalast = state->arenaused;
+		state->arenaused += size;
+	}
+	else {
+		block = (struct arena_block*)encAlloc(enc,sizeof(struct arena_block)+size);
+		if( block == 0 ) {
+			return 0;
+		}
+		block->next = state->overflow;
+		state->overflow = block;
+		state->overflowlen += size;
+		ptr = (uint8_t*)(block+1);
+	}
+	if( state->arenaused+state->overflowlen > state->arenapeak ) {
+		state->arenapeak = state->arenaused+state->overflowlen;
+	}
+	return ptr;
+}
+
+//Only the latest arena allocation is given back; everything else is
+//released by arenaReset()
+static void arenaFree( void* ctx, void* ptr ) {
+	term_encode_t* enc = (term_encode_t*)ctx;
+	struct term_encode_state* state;
+	if( enc == 0 ) {
+		free(ptr);
+		return;
+	}
+	state = enc->state;
+	if( ptr != 0 && (uint8_t*)ptr == &(state->arena[state->arenalast]) &&
+			state->arenalast < state->arenaused ) {
+		state->arenaused = state->arenalast;
+	}
+}
+
+//Free everything allocated from the arena.  If the arena overflowed, it
+//is replaced by one large enough for the peak use.
+static void arenaReset( term_encode_t* enc ) {
+	struct term_encode_state* state = enc->state;
+	struct arena_block* block;
+	while( state->overflow ) {
+		block = state->overflow;
+		state->overflow = block->next;
+		encFree(enc,block);
+	}
+	state->overflowlen = 0;
+	state->arenaused = 0;
+	state->arenalast = 0;
+	if( state->arenapeak > state->arenalen ) {
+		growBuffer(enc,&(state->arena),&(state->arenalen),state->arenapeak);
+	}
+	state->arenapeak = 0;
+}
+
 static int standard_palette[] = {
 	0x000000,0x800000,0x008000,0x808000,0x000080,0x800080,0x008080,0xc0c0c0,
 	0x808080,0xff0000,0x00ff00,0xffff00,0x0000ff,0xff00ff,0x00ffff,0xffffff,
@@ -97,8 +394,6 @@ static int standard_palette[] = {
 	0x080808,0x121212,0x1c1c1c,0x262626,0x303030,0x3a3a3a,0x444444,0x4e4e4e,
 	0x585858,0x626262,0x6c6c6c,0x767676,0x808080,0x8a8a8a,0x949494,0x9e9e9e,
 	0xa8a8a8,0xb2b2b2,0xbcbcbc,0xc6c6c6,0xd0d0d0,0xdadada,0xe4e4e4,0xeeeeee};
-static uint8_t fg16codes[] = {30, 31, 32, 33, 34, 35, 36, 37,  90,  91,  92,  93,  94,  95,  96,  97};
-static uint8_t bg16codes[] = {40, 41, 42, 43, 44, 45, 46, 47, 100, 101, 102, 103, 104, 105, 106, 107};
 
 static size_t findStdColorRGB(size_t palsize, uint32_t rgb) {
 	size_t i;
@@ -115,76 +410,165 @@ static size_t findStdColorRGB(size_t palsize, uint32_t rgb) {
 	exit(1);
 }
 
-static ssize_t findStdColor(size_t palsize, uint8_t r, uint8_t g, uint8_t b ) {
-	size_t i;
-	uint32_t rgb = (r<<16)|(g<<8)|b;
-	return findStdColorRGB(palsize,rgb);
-}
-
-static void ansiSetStdColor( term_encode_t* enc, uint8_t color_type, size_t color_idx ) {
+//SGR color for a standard palette index
+static uint32_t ansiStdColor( term_encode_t* enc, size_t color_idx ) {
 	if( enc->palsize == 16 ) {
-		if( color_type == ENC_FGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[%dm",fg16codes[color_idx]);
-		} else { //color_type == ENC_BGCOLOR
-			fprintf(enc->textfp,"\x1b[%dm",bg16codes[color_idx]);
-		}
-	} else { // enc->palsize == 256 (or 24, which used 256 color encoding)
-		if( color_type == ENC_FGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[38;5;%ldm",color_idx);
-		} else { //color_type == ENC_BGCOLOR
-			fprintf(enc->textfp,"\x1b[48;5;%ldm",color_idx);
-		}
+		return SGR_COLOR16(color_idx);
 	}
+	// enc->palsize == 256 (or 24, which used 256 color encoding)
+	return SGR_COLOR256(color_idx);
 }
 
-static void ansiSetColorRGB( term_encode_t* enc, uint8_t color_type, uint32_t rgb ) {
-	ssize_t color_idx;
-	uint8_t r,g,b;
+static uint32_t ansiColorRGB( term_encode_t* enc, uint32_t rgb ) {
 	if( enc->stdpal ) {
-		color_idx = findStdColorRGB(enc->palsize,rgb);
-		ansiSetStdColor(enc,color_type,color_idx);
+		return ansiStdColor(enc,findStdColorRGB(enc->palsize,rgb));
+	}
+	return SGR_RGB(rgb);
+}
+
+//Set the colors and attributes of the following text, sending only what
+//differs from the text before it
+static void ansiSGR( term_encode_t* enc, uint32_t fg, uint32_t bg, uint8_t attrs ) {
+	char seq[SGR_MAX_PARAMS+3];
+	size_t len = sgr_update(&(enc->state->sgr),seq+2,fg,bg,attrs);
+	if( len ) {
+		seq[0] = '\x1b';
+		seq[1] = '[';
+		seq[2+len] = 'm';
+		textWrite(enc,seq,len+3,1);
+	}
+}
+
+//Number of decimal digits in n
+static size_t decDigits( size_t n ) {
+	size_t digits = 1;
+	while( n >= 10 ) {
+		n = n/10;
+		digits++;
+	}
+	return digits;
+}
+
+static const utf8_glyph_t blank_glyph = UTF8_GLYPH(0x20);
+
+//A space shows only its background, unless it is underlined or reversed
+static int ansiBlank( const utf8_glyph_t* glyph, uint8_t attrs ) {
+	return glyph->len == 1 && glyph->bytes[0] == 0x20 && !(attrs & (SGR_UNDERLINE|SGR_REVERSE));
+}
+
+//Write the pending run of identical cells.  The shortest of the cells
+//themselves, REP (repeat the last character), ECH+CUF (erase characters
+//with the current background and step over them), and at the end of a
+//line EL (erase to the end of the line) that the runs option allows is
+//used.  EL also clears the terminal line past the image, so it is only
+//used for blanks in the default background.
+static void ansiFlushRun( term_encode_t* enc, int line_end ) {
+	struct term_encode_state* state = enc->state;
+	size_t n = state->runlen;
+	size_t glyphlen, cost, rep_cost, ech_cost;
+	size_t i;
+	int blank;
+	
+	if( n == 0 ) {
+		return;
+	}
+	state->runlen = 0;
+	ansiSGR(enc,state->runfg,state->runbg,state->runattrs);
+	glyphlen = state->runglyph.len;
+	blank = ansiBlank(&(state->runglyph),state->runattrs);
+	
+	if( blank && line_end && state->runbg == SGR_DEFAULT && n > 3 ) {
+		textPrintf(enc,"\x1b[K");
+		return;
+	}
+	cost = n*glyphlen;
+	rep_cost = glyphlen+3+decDigits(n-1);
+	ech_cost = 6+2*decDigits(n);
+	if( blank && ech_cost < cost && (enc->runs != ENC_RUNS_REP || ech_cost < rep_cost) ) {
+		textPrintf(enc,"\x1b[%luX\x1b[%luC",(unsigned long)n,(unsigned long)n);
+	}
+	else if( enc->runs == ENC_RUNS_REP && rep_cost < cost ) {
+		textGlyph(enc,&(state->runglyph));
+		textPrintf(enc,"\x1b[%lub",(unsigned long)(n-1));
 	}
 	else {
-		r = (rgb>>16)&0xFF;
-		g = (rgb>>8)&0xFF;
-		b = rgb&0xFF;
-		if( color_type == ENC_FGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[38;2;%d;%d;%dm",r,g,b);
-		}
-		else if( color_type == ENC_BGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[48;2;%d;%d;%dm",r,g,b);
+		for( i=0; i<n; i++ ) {
+			textGlyph(enc,&(state->runglyph));
 		}
 	}
 }
 
-static void ansiSetColor( term_encode_t* enc, uint8_t color_type, uint8_t r, uint8_t g, uint8_t b ) {
-	size_t color_idx;
-	if( enc->stdpal ) {
-		color_idx = findStdColor(enc->palsize,r,g,b);
-		ansiSetStdColor(enc,color_type,color_idx);
+//Write a character cell.  With the runs option, identical cells are held
+//back and written as a run.  The foreground of a blank does not matter, so
+//blanks keep the current one.
+static void ansiCell( term_encode_t* enc, uint32_t fg, uint32_t bg, uint8_t attrs, const utf8_glyph_t* glyph ) {
+	struct term_encode_state* state = enc->state;
+	
+	if( enc->runs == ENC_RUNS_NONE ) {
+		ansiSGR(enc,fg,bg,attrs);
+		textGlyph(enc,glyph);
+		return;
+	}
+	if( ansiBlank(glyph,attrs) ) {
+		fg = state->runlen ? state->runfg : state->sgr.fg;
+	}
+	if( state->runlen && glyph->len == state->runglyph.len &&
+			memcmp(glyph->bytes,state->runglyph.bytes,glyph->len) == 0 &&
+			fg == state->runfg && bg == state->runbg && attrs == state->runattrs ) {
+		state->runlen++;
+		return;
+	}
+	ansiFlushRun(enc,0);
+	state->runglyph = *glyph;
+	state->runfg = fg;
+	state->runbg = bg;
+	state->runattrs = attrs;
+	state->runlen = 1;
+}
+
+//End a row of text.  The foreground and attributes other than reverse carry
+//over to the next row (see sgr_line_end()).
+static void ansiNewline( term_encode_t* enc ) {
+	char seq[SGR_MAX_PARAMS+5];
+	size_t len;
+	ansiFlushRun(enc,1);
+	len = sgr_line_end(&(enc->state->sgr),seq+2);
+	if( len ) {
+		seq[0] = '\x1b';
+		seq[1] = '[';
+		memcpy(seq+2+len,"m\r\n",3);
+		textWrite(enc,seq,len+5,1);
 	}
 	else {
-		if( color_type == ENC_FGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[38;2;%d;%d;%dm",r,g,b);
-		}
-		else if( color_type == ENC_BGCOLOR ) {
-			fprintf(enc->textfp,"\x1b[48;2;%d;%d;%dm",r,g,b);
-		}
+		textWrite(enc,"\r\n",2,0);
 	}
 }
 
+//Start text in a known state
+static void ansiReset( term_encode_t* enc ) {
+	textPrintf(enc,"\x1b[0m");
+	sgr_init(&(enc->state->sgr));
+	enc->state->runlen = 0;
+}
+
+//Leave the terminal in its default state after the text
+static void ansiRestore( term_encode_t* enc ) {
+	ansiFlushRun(enc,0);
+	ansiSGR(enc,SGR_DEFAULT,SGR_DEFAULT,0);
+}
+
 static void binWriteHeader( term_encode_t *enc, size_t width, size_t height ) {
 	uint32_t tmp;
 	uint8_t color_mode;
 	
 	fprintf(enc->binaryfp,"newdraw");
 	if( width == 0 ) {
-		width = enc->width;
+		width = enc->state->width;
 	}
 	tmp = htonl(width);
 	fwrite(&tmp,4,1,enc->binaryfp);
 	if( height == 0 ) {
-		height = enc->height;
+		height = enc->state->height;
 	}
 	tmp = htonl(height);
 	fwrite(&tmp,4,1,enc->binaryfp);
@@ -192,7 +576,8 @@ static void binWriteHeader( term_encode_t *enc, size_t width, size_t height ) {
 		if( enc->palsize == 16 ) {
 			color_mode = 0;
 		}
-		else if( enc->palsize == 256 ) {
+		//The 24 shade grey scale is written as 256 color indexes
+		else if( enc->palsize == 256 || enc->palsize == 24 ) {
 			color_mode = 1;
 		}
 		else if( enc->palsize == 0 ) {
@@ -282,162 +667,158 @@ static void binClose(term_encode_t* enc) {
 	enc->binaryfp = 0;
 }
 
-static uint16_t simple_chars[16] = { 
-	0x0020, 0x2588
-};
-static void ansiEncodeSimple( term_encode_t* enc ) {
+#define SIMPLE_CHARS(X) \
+	X(0x0020), X(0x2588)
+static uint16_t simple_chars[16] = { SIMPLE_CHARS(UTF8_CODE) };
+static const utf8_glyph_t simple_glyphs[16] = { SIMPLE_CHARS(UTF8_GLYPH) };
+static void ansiEncodeSimple( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
 	uint8_t *prgb;
 	int last_bg_rgb;
 	int bg_rgb;
+	uint32_t bg = SGR_DEFAULT;
 	uint8_t r, g, b;
 	size_t x;
 	size_t y;
 	uint32_t binchar;
+	const utf8_glyph_t* glyph;
+	uint8_t idx;
 	
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
 	
-	if( enc->encbinary ) {
-		binWriteHeader(enc,0,0);
-	}
-	
-	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
-	}
-	for( y=0; y<enc->height; y++ ) {
+	for( y=0; y<rows; y++ ) {
 		last_bg_rgb = -1;
-		for( x=0; x<enc->width; x++ ) {
+		for( x=0; x<enc->state->width; x++ ) {
 			if( bw ) {
-				binchar = simple_chars[enc->rgbpixels[3*(y*enc->width+x)]&1];
+				idx = rgbpixels[3*(y*enc->state->width+x)]&1;
+				binchar = simple_chars[idx];
+				glyph = &simple_glyphs[idx];
 			}
 			else {
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(rgbpixels[3*(y*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
 				bg_rgb = (r<<16)|(g<<8)|(b);
 				binchar = simple_chars[0];
+				glyph = &simple_glyphs[0];
 			}
 			
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_bg_rgb != bg_rgb ) {
-						ansiSetColorRGB(enc,ENC_BGCOLOR,bg_rgb);
+						bg = ansiColorRGB(enc,bg_rgb);
 						last_bg_rgb = bg_rgb;
 					}
 				}
-				fprintf(enc->textfp,"%s",utf8_encode(0,binchar));
+				ansiCell(enc,SGR_DEFAULT,bg,0,glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,0x00FFFFFF,bg_rgb,0,0,0,0,binchar);
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
-	
-	if( enc->encbinary ) {
-		binClose(enc);
-	}
 }
 
-static uint16_t halfheight_chars[16] = { 
-	0x0020, 0x2584, 0x2580, 0x2588
-};
-static void ansiEncodeHalfHeight( term_encode_t* enc ) {
+#define HALFHEIGHT_CHARS(X) \
+	X(0x0020), X(0x2584), X(0x2580), X(0x2588)
+static uint16_t halfheight_chars[16] = { HALFHEIGHT_CHARS(UTF8_CODE) };
+static const utf8_glyph_t halfheight_glyphs[16] = { HALFHEIGHT_CHARS(UTF8_GLYPH) };
+static void ansiEncodeHalfHeight( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
 	uint8_t *prgb;
 	int last_fg_rgb;
 	int last_bg_rgb;
 	int fg_rgb;
 	int bg_rgb;
+	uint32_t fg, bg;
 	
 	int r, g, b;
 	size_t x;
 	size_t hy,y;
 	uint32_t binchar;
+	const utf8_glyph_t* glyph;
 	
 	uint8_t last_idx;
 	uint8_t idx = 1;
 	
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
 	
-	if( enc->encbinary ) {
-		binWriteHeader(enc,enc->width,enc->height/2);
-	}
-	
-	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
-	}
 	
-	for( hy=0; hy<enc->height/2; hy++ ) {
+	for( hy=0; hy<rows; hy++ ) {
 		y = hy*2;
 		last_fg_rgb = -1;
 		last_bg_rgb = -1;
-		for( x=0; x<enc->width; x++ ) {
+		fg = enc->state->sgr.fg;
+		bg = enc->state->sgr.bg;
+		for( x=0; x<enc->state->width; x++ ) {
 			if( bw ) {
-				idx = (enc->rgbpixels[3*(y*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+1)*enc->width+x)]&1);
+				idx = (rgbpixels[3*(y*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+1)*enc->state->width+x)]&1);
 				binchar = halfheight_chars[idx];
+				glyph = &halfheight_glyphs[idx];
 				fg_rgb = 0xFFFFFF;
 				bg_rgb = 0x000000;
 			}
 			else {
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(rgbpixels[3*(y*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
 				bg_rgb = (r<<16)|(g<<8)|(b);
-				prgb = &(enc->rgbpixels[3*((y+1)*enc->width+x)]);
+				prgb = &(rgbpixels[3*((y+1)*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
 				fg_rgb = (r<<16)|(g<<8)|(b);
 				idx = 1;
 				binchar = halfheight_chars[idx];
+				glyph = &halfheight_glyphs[idx];
 			}
 
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_fg_rgb != fg_rgb ) {
-						ansiSetColorRGB(enc,ENC_FGCOLOR,fg_rgb);
+						fg = ansiColorRGB(enc,fg_rgb);
 						last_fg_rgb = fg_rgb;
 					}
 					if( last_bg_rgb != bg_rgb ) {
-						ansiSetColorRGB(enc,ENC_BGCOLOR,bg_rgb);
+						bg = ansiColorRGB(enc,bg_rgb);
 						last_bg_rgb = bg_rgb;
 					}
 				}
-				fprintf(enc->textfp,"%s",utf8_encode(0,binchar));
+				//A block in one color is a blank, which can join a run
+				ansiCell(enc,fg,bg,0,!bw && enc->runs && fg == bg ? &blank_glyph : glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,fg_rgb,bg_rgb,0,0,0,0,binchar);
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
-	
-	if( enc->encbinary ) {
-		binClose(enc);
-	}
 }
 
-static uint16_t quarter_chars[16] = { 
-	0x0020, 0x2597, 0x2596, 0x2584, 0x259D, 0x2590, 0x259E, 0x259F, 
-	0x2598, 0x259A, 0x258C, 0x2599, 0x2580, 0x259C, 0x259B, 0x2588 
-};
-static void ansiEncodeQuarter( term_encode_t* enc ) {
+#define QUARTER_CHARS(X) \
+	X(0x0020), X(0x2597), X(0x2596), X(0x2584), X(0x259D), X(0x2590), X(0x259E), X(0x259F), \
+	X(0x2598), X(0x259A), X(0x258C), X(0x2599), X(0x2580), X(0x259C), X(0x259B), X(0x2588)
+static uint16_t quarter_chars[16] = { QUARTER_CHARS(UTF8_CODE) };
+static const utf8_glyph_t quarter_glyphs[16] = { QUARTER_CHARS(UTF8_GLYPH) };
+static void ansiEncodeQuarter( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
 	uint8_t *prgb;
 	int last_fg_rgb;
 	int last_bg_rgb;
 	int fg_rgb;
 	int bg_rgb;
+	uint32_t fg, bg;
 	
 	int r, g, b;
 	size_t hx,x;
 	size_t hy,y;
 	uint32_t binchar;
+	const utf8_glyph_t* glyph;
 	
 	uint8_t pal2[6];
 	size_t pal2size;
@@ -449,33 +830,30 @@ static void ansiEncodeQuarter( term_encode_t* enc ) {
 	
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
 	
-	if( enc->encbinary ) {
-		binWriteHeader(enc,enc->width/2,enc->height/2);
-	}
-	
-	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
-	}
 	
-	for( hy=0; hy<enc->height/2; hy++ ) {
+	for( hy=0; hy<rows; hy++ ) {
 		y = hy*2;
 		last_fg_rgb = -1;
 		last_bg_rgb = -1;
-		for( hx=0; hx<enc->width/2; hx++ ) {
+		//A single color block keeps the current foreground
+		fg = enc->state->sgr.fg;
+		bg = enc->state->sgr.bg;
+		for( hx=0; hx<enc->state->width/2; hx++ ) {
 			x = hx*2;
 			
 			if( bw ) {
-				idx = (enc->rgbpixels[3*(y*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*(y*enc->width+(x+1))]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+1)*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+1)*enc->width+(x+1))]&1);
+				idx = (rgbpixels[3*(y*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*(y*enc->state->width+(x+1))]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+1)*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+1)*enc->state->width+(x+1))]&1);
 				binchar = quarter_chars[idx];
+				glyph = &quarter_glyphs[idx];
 				fg_rgb = 0xFFFFFF;
 				bg_rgb = 0x000000;
 			}
 			else {
 				//rgb x=0 y=0
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(rgbpixels[3*(y*enc->state->width+x)]);
 				prgb4 = &(rgb4pixels[0]);
 				*(prgb4)   = *(prgb);
 				*(++prgb4) = *(++prgb);
@@ -485,7 +863,7 @@ static void ansiEncodeQuarter( term_encode_t* enc ) {
 				*(++prgb4) = *(++prgb);
 				*(++prgb4) = *(++prgb);
 				//rgb x=0 y=1
-				prgb = &(enc->rgbpixels[3*((y+1)*enc->width+x)]);
+				prgb = &(rgbpixels[3*((y+1)*enc->state->width+x)]);
 				*(++prgb4)   = *(prgb);
 				*(++prgb4) = *(++prgb);
 				*(++prgb4) = *(++prgb);
@@ -501,6 +879,7 @@ static void ansiEncodeQuarter( term_encode_t* enc ) {
 				
 				idx = (pal4pixels[0]<<3) | (pal4pixels[1]<<2) | (pal4pixels[2]<<1) | pal4pixels[3];
 				binchar = quarter_chars[idx];
+				glyph = &quarter_glyphs[idx];
 				prgb = pal2;
 				r = *(prgb);
 				g = *(++prgb);
@@ -519,51 +898,51 @@ static void ansiEncodeQuarter( term_encode_t* enc ) {
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_fg_rgb != fg_rgb ) {
-						ansiSetColorRGB(enc,ENC_FGCOLOR,fg_rgb);
+						fg = ansiColorRGB(enc,fg_rgb);
 						last_fg_rgb = fg_rgb;
 					}
 					if( last_bg_rgb != bg_rgb ) {
-						ansiSetColorRGB(enc,ENC_BGCOLOR,bg_rgb);
+						bg = ansiColorRGB(enc,bg_rgb);
 						last_bg_rgb = bg_rgb;
 					}
 				}
-				fprintf(enc->textfp,"%s",utf8_encode(0,binchar));
+				//A block in one color is a blank, which can join a run
+				ansiCell(enc,fg,bg,0,!bw && enc->runs && fg == bg ? &blank_glyph : glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,fg_rgb,bg_rgb,0,0,0,0,binchar);
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
-	
-	if( enc->encbinary ) {
-		binClose(enc);
-	}
 }
 
-static uint32_t sextant_chars[64] = {
-	0x00020,0x1FB1E,0x1FB0F,0x1FB2D,0x1FB07,0x1FB26,0x1FB16,0x1FB35,
-	0x1FB03,0x1FB22,0x1FB13,0x1FB31,0x1FB0B,0x1FB29,0x1FB1A,0x1FB39,
-	0x1FB01,0x1FB20,0x1FB11,0x1FB2F,0x1FB09,0x02590,0x1FB18,0x1FB37,
-	0x1FB05,0x1FB24,0x1FB14,0x1FB33,0x1FB0D,0x1FB2B,0x1FB1C,0x1FB3B,
-	0x1FB00,0x1FB1F,0x1FB10,0x1FB2E,0x1FB08,0x1FB27,0x1FB17,0x1FB36,
-	0x1FB04,0x1FB23,0x0258C,0x1FB32,0x1FB0C,0x1FB2A,0x1FB1B,0x1FB3A,
-	0x1FB02,0x1FB21,0x1FB12,0x1FB30,0x1FB0A,0x1FB28,0x1FB19,0x1FB38,
-	0x1FB06,0x1FB25,0x1FB15,0x1FB34,0x1FB0E,0x1FB2C,0x1FB1D,0x02588
-};
-static void ansiEncodeSextant( term_encode_t* enc ) {
+#define SEXTANT_CHARS(X) \
+	X(0x00020),X(0x1FB1E),X(0x1FB0F),X(0x1FB2D),X(0x1FB07),X(0x1FB26),X(0x1FB16),X(0x1FB35), \
+	X(0x1FB03),X(0x1FB22),X(0x1FB13),X(0x1FB31),X(0x1FB0B),X(0x1FB29),X(0x1FB1A),X(0x1FB39), \
+	X(0x1FB01),X(0x1FB20),X(0x1FB11),X(0x1FB2F),X(0x1FB09),X(0x02590),X(0x1FB18),X(0x1FB37), \
+	X(0x1FB05),X(0x1FB24),X(0x1FB14),X(0x1FB33),X(0x1FB0D),X(0x1FB2B),X(0x1FB1C),X(0x1FB3B), \
+	X(0x1FB00),X(0x1FB1F),X(0x1FB10),X(0x1FB2E),X(0x1FB08),X(0x1FB27),X(0x1FB17),X(0x1FB36), \
+	X(0x1FB04),X(0x1FB23),X(0x0258C),X(0x1FB32),X(0x1FB0C),X(0x1FB2A),X(0x1FB1B),X(0x1FB3A), \
+	X(0x1FB02),X(0x1FB21),X(0x1FB12),X(0x1FB30),X(0x1FB0A),X(0x1FB28),X(0x1FB19),X(0x1FB38), \
+	X(0x1FB06),X(0x1FB25),X(0x1FB15),X(0x1FB34),X(0x1FB0E),X(0x1FB2C),X(0x1FB1D),X(0x02588)
+static uint32_t sextant_chars[64] = { SEXTANT_CHARS(UTF8_CODE) };
+static const utf8_glyph_t sextant_glyphs[64] = { SEXTANT_CHARS(UTF8_GLYPH) };
+static void ansiEncodeSextant( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
 	uint8_t *prgb;
 	int last_fg_rgb;
 	int last_bg_rgb;
 	int fg_rgb;
 	int bg_rgb;
+	uint32_t fg, bg;
 	
 	int r, g, b;
 	size_t hx,x;
 	size_t hy,y;
 	uint32_t binchar;
+	const utf8_glyph_t* glyph;
 	
 	uint8_t pal2[6];
 	size_t pal2size;
@@ -575,34 +954,31 @@ static void ansiEncodeSextant( term_encode_t* enc ) {
 	
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
 	
-	if( enc->encbinary ) {
-		binWriteHeader(enc,enc->width/2,enc->height/3);
-	}
-	
-	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
-	}
-	for( hy=0; hy<enc->height/3; hy++ ) {
+	for( hy=0; hy<rows; hy++ ) {
 		y = hy*3;
 		last_fg_rgb = -1;
 		last_bg_rgb = -1;
-		for( hx=0; hx<enc->width/2; hx++ ) {
+		//A single color block keeps the current foreground
+		fg = enc->state->sgr.fg;
+		bg = enc->state->sgr.bg;
+		for( hx=0; hx<enc->state->width/2; hx++ ) {
 			x = hx*2;
 			
 			if( bw ) {
-				idx = (enc->rgbpixels[3*(y*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*(y*enc->width+(x+1))]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+1)*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+1)*enc->width+(x+1))]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+2)*enc->width+x)]&1);
-				idx = (idx<<1) | (enc->rgbpixels[3*((y+2)*enc->width+(x+1))]&1);
+				idx = (rgbpixels[3*(y*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*(y*enc->state->width+(x+1))]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+1)*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+1)*enc->state->width+(x+1))]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+2)*enc->state->width+x)]&1);
+				idx = (idx<<1) | (rgbpixels[3*((y+2)*enc->state->width+(x+1))]&1);
 				binchar = sextant_chars[idx];
+				glyph = &sextant_glyphs[idx];
 				fg_rgb = 0xFFFFFF;
 				bg_rgb = 0x000000;
 			}
 			else {
 				//rgb x=0 y=0
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(rgbpixels[3*(y*enc->state->width+x)]);
 				prgb6 = &(rgb6pixels[0]);
 				*(prgb6)   = *(prgb);
 				*(++prgb6) = *(++prgb);
@@ -612,7 +988,7 @@ static void ansiEncodeSextant( term_encode_t* enc ) {
 				*(++prgb6) = *(++prgb);
 				*(++prgb6) = *(++prgb);
 				//rgb x=0 y=1
-				prgb = &(enc->rgbpixels[3*((y+1)*enc->width+x)]);
+				prgb = &(rgbpixels[3*((y+1)*enc->state->width+x)]);
 				*(++prgb6)   = *(prgb);
 				*(++prgb6) = *(++prgb);
 				*(++prgb6) = *(++prgb);
@@ -621,7 +997,7 @@ static void ansiEncodeSextant( term_encode_t* enc ) {
 				*(++prgb6) = *(++prgb);
 				*(++prgb6) = *(++prgb);
 				//rgb x=0 y=2
-				prgb = &(enc->rgbpixels[3*((y+2)*enc->width+x)]);
+				prgb = &(rgbpixels[3*((y+2)*enc->state->width+x)]);
 				*(++prgb6)   = *(prgb);
 				*(++prgb6) = *(++prgb);
 				*(++prgb6) = *(++prgb);
@@ -636,6 +1012,7 @@ static void ansiEncodeSextant( term_encode_t* enc ) {
 							   pal6pixels, rgb6pixels, 6, 0);
 				idx = (pal6pixels[0]<<5) | (pal6pixels[1]<<4) | (pal6pixels[2]<<3) | (pal6pixels[3]<<2) | (pal6pixels[4]<<1) | pal6pixels[5];
 				binchar = sextant_chars[idx];
+				glyph = &sextant_glyphs[idx];
 				prgb = pal2;
 				r = *(prgb);
 				g = *(++prgb);
@@ -654,112 +1031,111 @@ static void ansiEncodeSextant( term_encode_t* enc ) {
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_fg_rgb != fg_rgb ) {
-						ansiSetColorRGB(enc,ENC_FGCOLOR,fg_rgb);
+						fg = ansiColorRGB(enc,fg_rgb);
 						last_fg_rgb = fg_rgb;
 					}
 					if( last_bg_rgb != bg_rgb ) {
-						ansiSetColorRGB(enc,ENC_BGCOLOR,bg_rgb);
+						bg = ansiColorRGB(enc,bg_rgb);
 						last_bg_rgb = bg_rgb;
 					}
 				}
-				fprintf(enc->textfp,"%s",utf8_encode(0,binchar));
+				//A block in one color is a blank, which can join a run
+				ansiCell(enc,fg,bg,0,!bw && enc->runs && fg == bg ? &blank_glyph : glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,fg_rgb,bg_rgb,0,0,0,0,binchar);
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
-	
-	if( enc->encbinary ) {
-		binClose(enc);
-	}
 }
 
-static uint16_t braille_chars[256] = {
-	0x2800, 0x2880, 0x2840, 0x28C0, 0x2820, 0x28A0, 0x2860, 0x28E0,
-	0x2804, 0x2884, 0x2844, 0x28C4, 0x2824, 0x28A4, 0x2864, 0x28E4,	
-	0x2810, 0x2890, 0x2850, 0x28D0, 0x2830, 0x28B0, 0x2870, 0x28F0,
-	0x2814, 0x2894, 0x2854, 0x28D4, 0x2834, 0x28B4, 0x2874, 0x28F4,
-	0x2802, 0x2882, 0x2842, 0x28C2, 0x2822, 0x28A2, 0x2862, 0x28E2,
-	0x2806, 0x2886, 0x2846, 0x28C6, 0x2826, 0x28A6, 0x2866, 0x28E6,
-	0x2812, 0x2892, 0x2852, 0x28D2, 0x2832, 0x28B2, 0x2872, 0x28F2,
-	0x2816, 0x2896, 0x2856, 0x28D6, 0x2836, 0x28B6, 0x2876, 0x28F6,
-	0x2808, 0x2888, 0x2848, 0x28C8, 0x2828, 0x28A8, 0x2868, 0x28E8,
-	0x280C, 0x288C, 0x284C, 0x28CC, 0x282C, 0x28AC, 0x286C, 0x28EC,
-	0x2818, 0x2898, 0x2858, 0x28D8, 0x2838, 0x28B8, 0x2878, 0x28F8,
-	0x281C, 0x289C, 0x285C, 0x28DC, 0x283C, 0x28BC, 0x287C, 0x28FC,
-	0x280A, 0x288A, 0x284A, 0x28CA, 0x282A, 0x28AA, 0x286A, 0x28EA,
-	0x280E, 0x288E, 0x284E, 0x28CE, 0x282E, 0x28AE, 0x286E, 0x28EE,
-	0x281A, 0x289A, 0x285A, 0x28DA, 0x283A, 0x28BA, 0x287A, 0x28FA,
-	0x281E, 0x289E, 0x285E, 0x28DE, 0x283E, 0x28BE, 0x287E, 0x28FE,
-	0x2801, 0x2881, 0x2841, 0x28C1, 0x2821, 0x28A1, 0x2861, 0x28E1,
-	0x2805, 0x2885, 0x2845, 0x28C5, 0x2825, 0x28A5, 0x2865, 0x28E5,
-	0x2811, 0x2891, 0x2851, 0x28D1, 0x2831, 0x28B1, 0x2871, 0x28F1,
-	0x2815, 0x2895, 0x2855, 0x28D5, 0x2835, 0x28B5, 0x2875, 0x28F5,
-	0x2803, 0x2883, 0x2843, 0x28C3, 0x2823, 0x28A3, 0x2863, 0x28E3,
-	0x2807, 0x2887, 0x2847, 0x28C7, 0x2827, 0x28A7, 0x2867, 0x28E7,
-	0x2813, 0x2893, 0x2853, 0x28D3, 0x2833, 0x28B3, 0x2873, 0x28F3,
-	0x2817, 0x2897, 0x2857, 0x28D7, 0x2837, 0x28B7, 0x2877, 0x28F7,
-	0x2809, 0x2889, 0x2849, 0x28C9, 0x2829, 0x28A9, 0x2869, 0x28E9,
-	0x280D, 0x288D, 0x284D, 0x28CD, 0x282D, 0x28AD, 0x286D, 0x28ED,
-	0x2819, 0x2899, 0x2859, 0x28D9, 0x2839, 0x28B9, 0x2879, 0x28F9,
-	0x281D, 0x289D, 0x285D, 0x28DD, 0x283D, 0x28BD, 0x287D, 0x28FD,
-	0x280B, 0x288B, 0x284B, 0x28CB, 0x282B, 0x28AB, 0x286B, 0x28EB,
-	0x280F, 0x288F, 0x284F, 0x28CF, 0x282F, 0x28AF, 0x286F, 0x28EF,
-	0x281B, 0x289B, 0x285B, 0x28DB, 0x283B, 0x28BB, 0x287B, 0x28FB,
-	0x281F, 0x289F, 0x285F, 0x28DF, 0x283F, 0x28BF, 0x287F, 0x28FF,
-};
-static void ansiEncodeBraille( term_encode_t* enc ) {
+#define BRAILLE_CHARS(X) \
+	X(0x2800), X(0x2880), X(0x2840), X(0x28C0), X(0x2820), X(0x28A0), X(0x2860), X(0x28E0), \
+	X(0x2804), X(0x2884), X(0x2844), X(0x28C4), X(0x2824), X(0x28A4), X(0x2864), X(0x28E4), \
+	X(0x2810), X(0x2890), X(0x2850), X(0x28D0), X(0x2830), X(0x28B0), X(0x2870), X(0x28F0), \
+	X(0x2814), X(0x2894), X(0x2854), X(0x28D4), X(0x2834), X(0x28B4), X(0x2874), X(0x28F4), \
+	X(0x2802), X(0x2882), X(0x2842), X(0x28C2), X(0x2822), X(0x28A2), X(0x2862), X(0x28E2), \
+	X(0x2806), X(0x2886), X(0x2846), X(0x28C6), X(0x2826), X(0x28A6), X(0x2866), X(0x28E6), \
+	X(0x2812), X(0x2892), X(0x2852), X(0x28D2), X(0x2832), X(0x28B2), X(0x2872), X(0x28F2), \
+	X(0x2816), X(0x2896), X(0x2856), X(0x28D6), X(0x2836), X(0x28B6), X(0x2876), X(0x28F6), \
+	X(0x2808), X(0x2888), X(0x2848), X(0x28C8), X(0x2828), X(0x28A8), X(0x2868), X(0x28E8), \
+	X(0x280C), X(0x288C), X(0x284C), X(0x28CC), X(0x282C), X(0x28AC), X(0x286C), X(0x28EC), \
+	X(0x2818), X(0x2898), X(0x2858), X(0x28D8), X(0x2838), X(0x28B8), X(0x2878), X(0x28F8), \
+	X(0x281C), X(0x289C), X(0x285C), X(0x28DC), X(0x283C), X(0x28BC), X(0x287C), X(0x28FC), \
+	X(0x280A), X(0x288A), X(0x284A), X(0x28CA), X(0x282A), X(0x28AA), X(0x286A), X(0x28EA), \
+	X(0x280E), X(0x288E), X(0x284E), X(0x28CE), X(0x282E), X(0x28AE), X(0x286E), X(0x28EE), \
+	X(0x281A), X(0x289A), X(0x285A), X(0x28DA), X(0x283A), X(0x28BA), X(0x287A), X(0x28FA), \
+	X(0x281E), X(0x289E), X(0x285E), X(0x28DE), X(0x283E), X(0x28BE), X(0x287E), X(0x28FE), \
+	X(0x2801), X(0x2881), X(0x2841), X(0x28C1), X(0x2821), X(0x28A1), X(0x2861), X(0x28E1), \
+	X(0x2805), X(0x2885), X(0x2845), X(0x28C5), X(0x2825), X(0x28A5), X(0x2865), X(0x28E5), \
+	X(0x2811), X(0x2891), X(0x2851), X(0x28D1), X(0x2831), X(0x28B1), X(0x2871), X(0x28F1), \
+	X(0x2815), X(0x2895), X(0x2855), X(0x28D5), X(0x2835), X(0x28B5), X(0x2875), X(0x28F5), \
+	X(0x2803), X(0x2883), X(0x2843), X(0x28C3), X(0x2823), X(0x28A3), X(0x2863), X(0x28E3), \
+	X(0x2807), X(0x2887), X(0x2847), X(0x28C7), X(0x2827), X(0x28A7), X(0x2867), X(0x28E7), \
+	X(0x2813), X(0x2893), X(0x2853), X(0x28D3), X(0x2833), X(0x28B3), X(0x2873), X(0x28F3), \
+	X(0x2817), X(0x2897), X(0x2857), X(0x28D7), X(0x2837), X(0x28B7), X(0x2877), X(0x28F7), \
+	X(0x2809), X(0x2889), X(0x2849), X(0x28C9), X(0x2829), X(0x28A9), X(0x2869), X(0x28E9), \
+	X(0x280D), X(0x288D), X(0x284D), X(0x28CD), X(0x282D), X(0x28AD), X(0x286D), X(0x28ED), \
+	X(0x2819), X(0x2899), X(0x2859), X(0x28D9), X(0x2839), X(0x28B9), X(0x2879), X(0x28F9), \
+	X(0x281D), X(0x289D), X(0x285D), X(0x28DD), X(0x283D), X(0x28BD), X(0x287D), X(0x28FD), \
+	X(0x280B), X(0x288B), X(0x284B), X(0x28CB), X(0x282B), X(0x28AB), X(0x286B), X(0x28EB), \
+	X(0x280F), X(0x288F), X(0x284F), X(0x28CF), X(0x282F), X(0x28AF), X(0x286F), X(0x28EF), \
+	X(0x281B), X(0x289B), X(0x285B), X(0x28DB), X(0x283B), X(0x28BB), X(0x287B), X(0x28FB), \
+	X(0x281F), X(0x289F), X(0x285F), X(0x28DF), X(0x283F), X(0x28BF), X(0x287F), X(0x28FF)
+static uint16_t braille_chars[256] = { BRAILLE_CHARS(UTF8_CODE) };
+static const utf8_glyph_t braille_glyphs[256] = { BRAILLE_CHARS(UTF8_GLYPH) };
+static void ansiEncodeBraille( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
 	uint8_t *prgb;
 	int last_rgb;
 	int rgb;
+	uint32_t fg, bg = SGR_DEFAULT;
 
 	int r, g, b;
 	size_t hx,x;
 	size_t hy,y;
 	uint32_t binchar;
+	const utf8_glyph_t* glyph;
 	
 	uint8_t *bwpixels;
 	uint8_t idx;
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
 	
-	bwpixels = (uint8_t*)malloc(sizeof(uint8_t)*enc->width*enc->height);
+	//Dots are thresholded against the average of the whole image, so this
+	//renderer always receives the full image (never strips).
+	bwpixels = (uint8_t*)arenaAlloc(enc,sizeof(uint8_t)*enc->state->width*enc->state->height);
 	if( bwpixels == 0 ) {
-		fprintf(enc->textfp,"Failed allocate space for black and white pixels\n");
-	}
-	quant_bw(bwpixels,enc->rgbpixels,enc->width*enc->height,0);
-	
-	if( enc->encbinary ) {
-		binWriteHeader(enc,enc->width/2,enc->height/3);
+		fprintf(stderr,"Failed allocate space for black and white pixels\n");
+		return;
 	}
+	quant_bw(bwpixels,rgbpixels,enc->state->width*enc->state->height,0);
 	
-	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
-		if( ! bw ) {
-			ansiSetColorRGB(enc,ENC_BGCOLOR,0);
-		}
+	//Dots are drawn on black
+	if( enc->enctext && ! bw ) {
+		bg = ansiColorRGB(enc,0);
 	}
-	for( hy=0; hy<enc->height/4; hy++ ) {
+	for( hy=0; hy<rows; hy++ ) {
 		y = hy*4;
 		last_rgb = -1;
-		for( hx=0; hx<enc->width/2; hx++ ) {
+		fg = enc->state->sgr.fg;
+		for( hx=0; hx<enc->state->width/2; hx++ ) {
 			x = hx*2;
 			
-			idx = (bwpixels[y*enc->width+x]&1);
-			idx = (idx<<1) | (bwpixels[y*enc->width+(x+1)]&1);
-			idx = (idx<<1) | (bwpixels[(y+1)*enc->width+x]&1);
-			idx = (idx<<1) | (bwpixels[(y+1)*enc->width+(x+1)]&1);
-			idx = (idx<<1) | (bwpixels[(y+2)*enc->width+x]&1);
-			idx = (idx<<1) | (bwpixels[(y+2)*enc->width+(x+1)]&1);
-			idx = (idx<<1) | (bwpixels[(y+3)*enc->width+x]&1);
-			idx = (idx<<1) | (bwpixels[(y+3)*enc->width+(x+1)]&1);
+			idx = (bwpixels[y*enc->state->width+x]&1);
+			idx = (idx<<1) | (bwpixels[y*enc->state->width+(x+1)]&1);
+			idx = (idx<<1) | (bwpixels[(y+1)*enc->state->width+x]&1);
+			idx = (idx<<1) | (bwpixels[(y+1)*enc->state->width+(x+1)]&1);
+			idx = (idx<<1) | (bwpixels[(y+2)*enc->state->width+x]&1);
+			idx = (idx<<1) | (bwpixels[(y+2)*enc->state->width+(x+1)]&1);
+			idx = (idx<<1) | (bwpixels[(y+3)*enc->state->width+x]&1);
+			idx = (idx<<1) | (bwpixels[(y+3)*enc->state->width+(x+1)]&1);
 			binchar = braille_chars[idx];
+			glyph = &braille_glyphs[idx];
 			
 			if( !bw ) {
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(rgbpixels[3*(y*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
@@ -767,21 +1143,21 @@ static void ansiEncodeBraille( term_encode_t* enc ) {
 					r = ( r + *(++prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
-					prgb = &(enc->rgbpixels[3*((y+1)*enc->width+x)]);
+					prgb = &(rgbpixels[3*((y+1)*enc->state->width+x)]);
 					r = ( r + *(prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
 					r = ( r + *(++prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
-					prgb = &(enc->rgbpixels[3*((y+2)*enc->width+x)]);
+					prgb = &(rgbpixels[3*((y+2)*enc->state->width+x)]);
 					r = ( r + *(prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
 					r = ( r + *(++prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
-					prgb = &(enc->rgbpixels[3*((y+3)*enc->width+x)]);
+					prgb = &(rgbpixels[3*((y+3)*enc->state->width+x)]);
 					r = ( r + *(prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
@@ -798,26 +1174,216 @@ static void ansiEncodeBraille( term_encode_t* enc ) {
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_rgb != rgb ) {
-						ansiSetColorRGB(enc,ENC_FGCOLOR,rgb);
+						fg = ansiColorRGB(enc,rgb);
 						last_rgb = rgb;
 					}
 				}
-				fprintf(enc->textfp,"%s",utf8_encode(0,binchar));
+				ansiCell(enc,fg,bg,0,glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,rgb,0,0,0,0,0,binchar);
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
 	
-	if( enc->encbinary ) {
-		binClose(enc);
+	arenaFree(enc,bwpixels);
+}
+
+//Ink coverage (0-255) of the top left, top right, bottom left and bottom
+//right quarters of each character cell, measured from DejaVu Sans Mono.
+//The printable ASCII characters are followed by the CP437 shades and
+//blocks that the extended renderers add.
+#define ASCII_CHARS(X) \
+	X(0x0020,  0,  0,  0,  0), X(0x0021, 26, 26, 15, 16), X(0x0022, 34, 34,  0,  0), X(0x0023, 59, 72, 65, 55), \
+	X(0x0024, 53, 41, 35, 83), X(0x0025, 72, 25, 23, 70), X(0x0026, 68, 18, 62, 86), X(0x0027, 19, 15,  0,  0), \
+	X(0x0028, 27, 25, 36, 26), X(0x0029, 25, 27, 26, 36), X(0x002A, 46, 46,  3,  3), X(0x002B, 15, 15, 39, 39), \
+	X(0x002C,  0,  0, 28, 16), X(0x002D,  0,  0, 14, 14), X(0x002E,  0,  0, 14, 12), X(0x002F,  3, 48, 56,  3), \
+	X(0x0030, 67, 67, 58, 58), X(0x0031, 31, 47, 27, 61), X(0x0032, 28, 63, 56, 38), X(0x0033, 39, 66, 30, 60), \
+	X(0x0034, 30, 67, 42, 70), X(0x0035, 69, 44, 31, 57), X(0x0036, 73, 48, 57, 58), X(0x0037, 28, 69, 33, 18), \
+	X(0x0038, 67, 67, 60, 60), X(0x0039, 63, 65, 44, 65), X(0x003A, 14, 12, 14, 12), X(0x003B, 14, 12, 28, 16), \
+	X(0x003C, 21, 32, 34, 32), X(0x003D, 30, 30, 30, 30), X(0x003E, 32, 21, 32, 34), X(0x003F, 24, 64, 25, 16), \
+	X(0x0040, 52, 70, 87, 72), X(0x0041, 48, 48, 63, 63), X(0x0042, 81, 71, 62, 61), X(0x0043, 59, 28, 54, 28), \
+	X(0x0044, 73, 59, 68, 53), X(0x0045, 82, 53, 64, 28), X(0x0046, 78, 54, 52,  0), X(0x0047, 61, 34, 55, 69), \
+	X(0x0048, 73, 73, 52, 52), X(0x0049, 45, 44, 43, 42), X(0x004A, 15, 65, 31, 52), X(0x004B, 82, 45, 57, 55), \
+	X(0x004C, 58,  0, 63, 30), X(0x004D, 90, 84, 54, 49), X(0x004E, 90, 57, 49, 83), X(0x004F, 63, 63, 57, 57), \
+	X(0x0050, 74, 74, 60, 11), X(0x0051, 63, 63, 57, 75), X(0x0052, 82, 66, 59, 53), X(0x0053, 73, 37, 30, 65), \
+	X(0x0054, 54, 54, 24, 24), X(0x0055, 52, 52, 56, 56), X(0x0056, 54, 54, 42, 42), X(0x0057, 68, 67, 69, 69), \
+	X(0x0058, 51, 52, 51, 50), X(0x0059, 54, 54, 24, 24), X(0x005A, 28, 75, 62, 36), X(0x005B, 45, 22, 53, 25), \
+	X(0x005C, 51,  1,  8, 51), X(0x005D, 22, 45, 25, 53), X(0x005E, 36, 36,  0,  0), X(0x005F,  0,  0, 16, 16), \
+	X(0x0060, 19,  4,  0,  0), X(0x0061, 23, 34, 66, 75), X(0x0062, 70, 36, 61, 57), X(0x0063, 31, 25, 51, 25), \
+	X(0x0064, 36, 66, 57, 60), X(0x0065, 34, 35, 67, 52), X(0x0066, 45, 57, 28, 14), X(0x0067, 36, 40, 75, 91), \
+	X(0x0068, 68, 36, 47, 47), X(0x0069, 32, 25, 38, 47), X(0x006A, 20, 38, 31, 60), X(0x006B, 59, 28, 59, 49), \
+	X(0x006C, 62,  6, 31, 28), X(0x006D, 49, 46, 57, 66), X(0x006E, 40, 36, 47, 47), X(0x006F, 35, 35, 56, 56), \
+	X(0x0070, 40, 36, 86, 57), X(0x0071, 35, 43, 56, 91), X(0x0072, 30, 32, 43,  0), X(0x0073, 34, 21, 43, 56), \
+	X(0x0074, 64, 22, 40, 23), X(0x0075, 27, 27, 56, 61), X(0x0076, 27, 27, 43, 43), X(0x0077, 28, 28, 68, 68), \
+	X(0x0078, 29, 29, 46, 46), X(0x0079, 27, 28, 72, 48), X(0x007A, 20, 41, 50, 33), X(0x007B, 22, 42, 45, 44), \
+	X(0x007C, 23, 23, 32, 32), X(0x007D, 42, 21, 45, 44), X(0x007E,  8,  1, 22, 29), \
+	X(0x2591, 48, 48, 47, 47), X(0x2592,138,117,119,136), X(0x2593,207,207,208,208), X(0x2588,255,255,255,255), \
+	X(0x2580,255,255,  0,  0), X(0x2584,  0,  0,255,255), X(0x258C,255,  0,255,  0), X(0x2590,  0,255,  0,255)
+#define ASCII_CODE(c,tl,tr,bl,br) (c)
+#define ASCII_GLYPH(c,tl,tr,bl,br) UTF8_GLYPH(c)
+#define ASCII_COVERAGE(c,tl,tr,bl,br) { tl, tr, bl, br }
+static uint16_t ascii_chars[] = { ASCII_CHARS(ASCII_CODE) };
+static const utf8_glyph_t ascii_glyphs[] = { ASCII_CHARS(ASCII_GLYPH) };
+static const uint8_t ascii_coverage[][4] = { ASCII_CHARS(ASCII_COVERAGE) };
+#define ASCII_LEN     95
+#define ASCII_EXT_LEN (sizeof(ascii_chars)/sizeof(ascii_chars[0]))
+
+//A cell is quantized to 8 levels (0-7) in each quarter
+#define ASCII_LEVELS 8
+#define ASCII_KEY(tl,tr,bl,br) (((tl)<<9) | ((tr)<<6) | ((bl)<<3) | (br))
+
+//Build the table of the best glyph (of the first len) for each quantized
+//cell.  Coverage is scaled so the most covered quarter of any glyph is full
+//brightness.  The error is the squared difference of each quarter plus
+//that of the cell as a whole, so both the shape and the brightness count.
+//This is done once per encoder, instead of matching glyphs for every cell.
+static void asciiMatch( term_encode_t* enc, size_t len ) {
+	struct term_encode_state* state = enc->state;
+	int target[4];
+	int cov[4];
+	int d, sum, err, best_err;
+	size_t key, i, j, max;
+	
+	if( state->ascii_matchlen == len ) {
+		return;
+	}
+	max = 1;
+	for( i=0; i<len; i++ ) {
+		for( j=0; j<4; j++ ) {
+			if( ascii_coverage[i][j] > max ) {
+				max = ascii_coverage[i][j];
+			}
+		}
 	}
+	for( key=0; key<4096; key++ ) {
+		target[0] = ((key>>9)&7)*255/(ASCII_LEVELS-1);
+		target[1] = ((key>>6)&7)*255/(ASCII_LEVELS-1);
+		target[2] = ((key>>3)&7)*255/(ASCII_LEVELS-1);
+		target[3] = (key&7)*255/(ASCII_LEVELS-1);
+		best_err = -1;
+		for( i=0; i<len; i++ ) {
+			sum = 0;
+			err = 0;
+			for( j=0; j<4; j++ ) {
+				cov[j] = ascii_coverage[i][j]*255/max;
+				d = target[j]-cov[j];
+				sum += d;
+				err += d*d;
+			}
+			err += sum*sum/4;
+			if( best_err < 0 || err < best_err ) {
+				best_err = err;
+				state->ascii_match[key] = i;
+			}
+		}
+	}
+	state->ascii_matchlen = len;
+}
+
+//Luminance (0-255) of an RGB pixel
+static inline int asciiLuma( uint8_t* prgb ) {
+	return (54*prgb[0] + 183*prgb[1] + 19*prgb[2]) >> 8;
+}
+
+//Native ASCII art, without aalib.  Each character covers 2x2 pixels, which
+//are matched to the glyph whose coverage of each quarter of the cell is
+//closest.  The foreground is the brightest of the 4 pixels.  asciifg uses
+//a black background and asciibg the darkest pixel, and the quarters are
+//matched between the two colors.  ascii only uses the terminal's colors.
+static void ansiEncodeAscii( term_encode_t* enc, uint8_t* rgbpixels, size_t rows ) {
+	uint8_t* prgb[4];
+	int luma[4];
+	int level[4];
+	int lo, hi, lo_luma, hi_luma, range;
+	int last_fg_rgb;
+	int last_bg_rgb;
+	int fg_rgb;
+	int bg_rgb;
+	uint32_t fg, bg;
+	size_t hx,x;
+	size_t hy,y;
+	size_t i;
+	uint8_t idx;
 	
-	free(bwpixels);
+	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
+	uint8_t extended = enc->renderer == ENC_RENDER_ASCIIEXT ||
+		enc->renderer == ENC_RENDER_ASCIIFGEXT || enc->renderer == ENC_RENDER_ASCIIBGEXT;
+	uint8_t fgcolor = enc->renderer == ENC_RENDER_ASCIIFG || enc->renderer == ENC_RENDER_ASCIIFGEXT;
+	uint8_t bgcolor = enc->renderer == ENC_RENDER_ASCIIBG || enc->renderer == ENC_RENDER_ASCIIBGEXT;
+	
+	asciiMatch(enc,extended ? ASCII_EXT_LEN : ASCII_LEN);
+	
+	for( hy=0; hy<rows; hy++ ) {
+		y = hy*2;
+		last_fg_rgb = -1;
+		last_bg_rgb = -1;
+		fg = enc->state->sgr.fg;
+		bg = enc->state->sgr.bg;
+		for( hx=0; hx<enc->state->width/2; hx++ ) {
+			x = hx*2;
+			prgb[0] = &(rgbpixels[3*(y*enc->state->width+x)]);
+			prgb[1] = prgb[0]+3;
+			prgb[2] = &(rgbpixels[3*((y+1)*enc->state->width+x)]);
+			prgb[3] = prgb[2]+3;
+			lo = 0;
+			hi = 0;
+			for( i=0; i<4; i++ ) {
+				luma[i] = asciiLuma(prgb[i]);
+				if( luma[i] < luma[lo] ) {
+					lo = i;
+				}
+				if( luma[i] > luma[hi] ) {
+					hi = i;
+				}
+			}
+			if( bw || !(fgcolor || bgcolor) ) {
+				lo_luma = 0;
+				hi_luma = 255;
+			}
+			else {
+				lo_luma = bgcolor ? luma[lo] : 0;
+				hi_luma = luma[hi];
+			}
+			range = hi_luma-lo_luma;
+			for( i=0; i<4; i++ ) {
+				level[i] = range ? ((luma[i]-lo_luma)*(ASCII_LEVELS-1) + range/2)/range : 0;
+			}
+			idx = enc->state->ascii_match[ASCII_KEY(level[0],level[1],level[2],level[3])];
+			
+			if( bw || !(fgcolor || bgcolor) ) {
+				fg_rgb = 0xFFFFFF;
+				bg_rgb = 0x000000;
+			}
+			else {
+				fg_rgb = (prgb[hi][0]<<16)|(prgb[hi][1]<<8)|prgb[hi][2];
+				bg_rgb = bgcolor ? (prgb[lo][0]<<16)|(prgb[lo][1]<<8)|prgb[lo][2] : 0x000000;
+			}
+			
+			if( enc->enctext ) {
+				if( !bw && (fgcolor || bgcolor) ) {
+					if( last_fg_rgb != fg_rgb ) {
+						fg = ansiColorRGB(enc,fg_rgb);
+						last_fg_rgb = fg_rgb;
+					}
+					if( last_bg_rgb != bg_rgb ) {
+						bg = ansiColorRGB(enc,bg_rgb);
+						last_bg_rgb = bg_rgb;
+					}
+				}
+				ansiCell(enc,fg,bg,0,&ascii_glyphs[idx]);
+			}
+			if( enc->encbinary ) {
+				binWriteCellRGB(enc,fg_rgb,bg_rgb,0,0,0,0,ascii_chars[idx]);
+			}
+		}
+		if( enc->enctext ) {
+			ansiNewline(enc);
+		}
+	}
 }
 	
 #ifdef USE_AALIB
@@ -829,8 +1395,8 @@ static aa_context* aaRender( term_encode_t* enc, size_t* char_width, size_t* cha
 	uint8_t  *prgb;
 	int r,g,b;
 	size_t i, x, y;
-	size_t cwidth = (enc->width/2)+(enc->width%2);
-	size_t cheight = (enc->height/2)+(enc->height%2);
+	size_t cwidth = (enc->state->width/2)+(enc->state->width%2);
+	size_t cheight = (enc->state->height/2)+(enc->state->height%2);
 	
 	memset(&hwparams,0,sizeof(hwparams));
 	hwparams.font = &aa_font16;
@@ -852,23 +1418,23 @@ static aa_context* aaRender( term_encode_t* enc, size_t* char_width, size_t* cha
 	}
 	
 	if( enc->palsize ) {
-		for( y=0; y<enc->height; y++ ) {
-			for( x=0; x<enc->width; x++ ) {
-				aa_putpixel(aa,x,y,enc->palpixels[y*enc->width+x]);
+		for( y=0; y<enc->state->height; y++ ) {
+			for( x=0; x<enc->state->width; x++ ) {
+				aa_putpixel(aa,x,y,enc->state->palpixels[y*enc->state->width+x]);
 			}
 		}
 		memset(palette,0,sizeof(palette));
 		for( i=0; i<enc->palsize; i++ ) {
 			aa_setpalette(palette,i,
-				enc->palette[(3*i)],
-				enc->palette[(3*i)+1],
-				enc->palette[(3*i)+2]);
+				enc->state->palette[(3*i)],
+				enc->state->palette[(3*i)+1],
+				enc->state->palette[(3*i)+2]);
 		}
 		aa_renderpalette(aa, palette, &rparams, 0, 0, cwidth, cheight);
 	} else {
-		for( y=0; y<enc->height; y++ ) {
-			for( x=0; x<enc->width; x++ ) {
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+		for( y=0; y<enc->state->height; y++ ) {
+			for( x=0; x<enc->state->width; x++ ) {
+				prgb = &(enc->state->rgbpixels[3*(y*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
@@ -888,10 +1454,10 @@ static aa_context* aaRender( term_encode_t* enc, size_t* char_width, size_t* cha
 
 static int asciiEncode( term_encode_t* enc, int extended) {
 	size_t x,y;
-	uint8_t attr, last_attr;
+	uint8_t attr;
 	uint8_t reverse, bold;
 	uint16_t c;
-	char* utf8c;
+	const utf8_glyph_t* glyph;
 	size_t char_width;
 	size_t char_height;
 	aa_context *aa;
@@ -909,26 +1475,18 @@ static int asciiEncode( term_encode_t* enc, int extended) {
 		binWriteHeader(enc,char_width,char_height);
 	}
 	
+	if( enc->enctext ) {
+		sgr_init(&(enc->state->sgr));
+	}
 	for( y=0; y<char_height; y++ ) {
-	last_attr = AA_NORMAL;
 		for( x=0; x<char_width; x++ ) {
 			attr = aa->attrbuffer[y*char_width+x];
 			c = cp437[aa->textbuffer[y*char_width+x]];
-			utf8c = utf8_encode(0,c);
+			glyph = &cp437_glyphs[aa->textbuffer[y*char_width+x]];
 			reverse = (attr == AA_REVERSE);
 			bold = (attr == AA_BOLD);
 			if( enc->enctext ) {
-				if( attr != last_attr ) {
-					fprintf(enc->textfp,"\x1b[0m");
-					if( reverse ) {
-						fprintf(enc->textfp,"\x1b[7m");
-					}
-					else if( bold ) {
-						fprintf(enc->textfp,"\x1b[1m");
-					}
-					last_attr = attr;
-				}
-				fprintf(enc->textfp,"%s",utf8c);
+				ansiCell(enc,SGR_DEFAULT,SGR_DEFAULT,reverse ? SGR_REVERSE : bold ? SGR_BOLD : 0,glyph);
 			}
 			if( enc->encbinary ) {
 				binWriteCellRGB(enc,0x00FFFFFF,0x000000,
@@ -936,9 +1494,12 @@ static int asciiEncode( term_encode_t* enc, int extended) {
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
+	if( enc->enctext ) {
+		ansiRestore(enc);
+	}
 	fflush(stdout);
 	
 	if( enc->encbinary ) {
@@ -953,12 +1514,14 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 	uint32_t last_rgb;
 	uint32_t r, g, b;
 	int fg = 0xFF;
+	uint32_t fgcolor = SGR_DEFAULT;
+	uint32_t bgcolor = SGR_DEFAULT;
 	size_t hx,x;
 	size_t hy,y;
-	uint8_t attr, last_attr;
+	uint8_t attr;
 	uint8_t reverse, bold;
 	uint16_t c;
-	char *utf8c;
+	const utf8_glyph_t* glyph;
 	size_t char_width;
 	
 	uint8_t bw = (enc->stdpal) && (enc->palsize == 0);
@@ -973,20 +1536,19 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 	if( aa == 0 ) { return 1; }
 	
 	if( enc->encbinary ) {
-		binWriteHeader(enc,enc->width/2,enc->height/2);
+		binWriteHeader(enc,enc->state->width/2,enc->state->height/2);
 	}
 	
 	if( enc->enctext ) {
-		fprintf(enc->textfp,"\x1b[0m");
+		ansiReset(enc);
 	}
-	for( hy=0; hy<enc->height/2; hy++ ) {
+	for( hy=0; hy<enc->state->height/2; hy++ ) {
 		y = hy*2;
-		last_attr = AA_NORMAL;
 		last_rgb = -1;
-		for( hx=0; hx<enc->width/2; hx++ ) {
+		for( hx=0; hx<enc->state->width/2; hx++ ) {
 			x = hx*2;
 			if( !bw ) {
-				prgb = &(enc->rgbpixels[3*(y*enc->width+x)]);
+				prgb = &(enc->state->rgbpixels[3*(y*enc->state->width+x)]);
 				r = *(prgb);
 				g = *(++prgb);
 				b = *(++prgb);
@@ -994,7 +1556,7 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 					r = ( r + *(++prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
-					prgb = &(enc->rgbpixels[3*((y+1)*enc->width+x)]);
+					prgb = &(enc->state->rgbpixels[3*((y+1)*enc->state->width+x)]);
 					r = ( r + *(prgb));
 					g = ( g + *(++prgb));
 					b = ( b + *(++prgb));
@@ -1009,39 +1571,29 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 			}
 			attr = aa->attrbuffer[hy*char_width+hx];
 			c = cp437[aa->textbuffer[hy*char_width+hx]];
-			utf8c = utf8_encode(0,c);
+			glyph = &cp437_glyphs[aa->textbuffer[hy*char_width+hx]];
 			reverse = (attr == AA_REVERSE);
 			bold = (attr == AA_BOLD);
 			if( enc->enctext ) {
 				if( !bw ) {
 					if( last_rgb != rgb ) {
-						fprintf(enc->textfp,"\x1b[0m");
 						if( color_type == ENC_FGCOLOR ) {
-							ansiSetColor(enc,ENC_BGCOLOR,0,0,0);
-							ansiSetColor(enc,ENC_FGCOLOR,r,g,b);
+							bgcolor = ansiColorRGB(enc,0);
+							fgcolor = ansiColorRGB(enc,rgb);
 						}
 						else if( color_type == ENC_BGCOLOR ) {
-							ansiSetColorRGB(enc,ENC_BGCOLOR,rgb);
+							bgcolor = ansiColorRGB(enc,rgb);
 							if( (r*0.299 + g*0.587 + b*0.114) > 150 ) { //Theory Limit 186
 								fg = 0;
 							} else {
 								fg = 0xFF;
 							}
-							ansiSetColor(enc,ENC_FGCOLOR,fg,fg,fg);
+							fgcolor = ansiColorRGB(enc,(fg<<16)|(fg<<8)|fg);
 						}
+						last_rgb = rgb;
 					}
-					
-					if( reverse ) {
-						fprintf(enc->textfp,"\x1b[7m");
-					}
-					else if( bold ) {
-						fprintf(enc->textfp,"\x1b[1m");
-					}
-					
-					last_rgb = rgb;
-					last_attr = attr;
 				}
-				fprintf(enc->textfp,"%s",utf8c);
+				ansiCell(enc,fgcolor,bgcolor,reverse ? SGR_REVERSE : bold ? SGR_BOLD : 0,glyph);
 			}
 			if( enc->encbinary ) {
 				if( color_type == ENC_FGCOLOR ) {
@@ -1055,9 +1607,12 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
+	if( enc->enctext ) {
+		ansiRestore(enc);
+	}
 	
 	if( enc->encbinary ) {
 		binClose(enc);
@@ -1067,88 +1622,112 @@ static int asciiColorEncode( term_encode_t* enc, uint8_t color_type, int extende
 #endif //USE_AALIB
 
 #ifdef USE_LIBCACA
-caca_canvas_t* cacaRender( term_encode_t* enc,
+//Free the libcaca canvas and dither kept in the encoder state
+static void cacaFree( term_encode_t* enc ) {
+	struct term_encode_state* state = enc->state;
+	if( state->cacadither ) {
+		caca_free_dither(state->cacadither);
+		state->cacadither = 0;
+	}
+	if( state->cacacanvas ) {
+		caca_free_canvas(state->cacacanvas);
+		state->cacacanvas = 0;
+	}
+	state->cacacharset = 0;
+}
+
+//Dither the frame onto the encoder's libcaca canvas.  The canvas and
+//dither (and the dither's tables) are only created when the frame size
+//changes, and the character set is only set when it changes, so later
+//frames just convert the pixels and dither them.
+static caca_canvas_t* cacaRender( term_encode_t* enc,
 		size_t* char_width, size_t* char_height, 
-		char* charset, char* dither_algorithm ) {
+		const char* charset, const char* dither_algorithm ) {
+	struct term_encode_state* state = enc->state;
 	int error = 1;
-	caca_canvas_t *canvas = 0;
-	caca_dither_t *dither = 0;
 	size_t i;
 	uint8_t *rgb;
 	uint32_t *cacapixels;
 	size_t cwidth;
 	size_t cheight;
 	
-	cwidth = enc->width;
+	cwidth = state->width;
 	if( char_width ) {
 		*char_width = cwidth;
 	}
-	cheight = enc->height/2;
+	cheight = state->height/2;
 	if( char_height ) {
 		*char_height = cheight;
 	}
 	
-	cacapixels = (uint32_t*)malloc(sizeof(uint32_t)*enc->width*enc->height);
+	cacapixels = (uint32_t*)arenaAlloc(enc,sizeof(uint32_t)*state->width*state->height);
 	if( cacapixels == 0 ) {
 		fprintf(stderr,"Failed to allocate caca pixels\n");
 		goto cacaRenderEnd;
 	}
 	
-	canvas = caca_create_canvas(cwidth,cheight);
-	if( canvas ==0 ) {
-		fprintf(stderr,"Failed to crate caca canvas\n");
-		goto cacaRenderEnd;
+	if( state->cacacanvas && (state->cacawidth != state->width || state->cacaheight != state->height) ) {
+		cacaFree(enc);
+	}
+	if( state->cacacanvas == 0 ) {
+		state->cacacanvas = caca_create_canvas(cwidth,cheight);
+		if( state->cacacanvas ==0 ) {
+			fprintf(stderr,"Failed to crate caca canvas\n");
+			goto cacaRenderEnd;
+		}
+		state->cacadither = caca_create_dither(32,state->width,state->height,state->width*sizeof(uint32_t),
+			0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+		if( state->cacadither == 0 ) {
+			fprintf(stderr,"Failed to create caca dither\n");
+			goto cacaRenderEnd;
+		}
+		if( caca_set_dither_color(state->cacadither,"full16") ) {
+			fprintf(stderr,"Failed to set caca dither color\n");
+			goto cacaRenderEnd;
+		}
+		if( caca_set_dither_algorithm(state->cacadither,dither_algorithm) ) {
+			fprintf(stderr,"Failed to set caca dither algorithm to \"%s\"",dither_algorithm);
+			goto cacaRenderEnd;
+		}
+		state->cacawidth = state->width;
+		state->cacaheight = state->height;
+	}
+	if( state->cacacharset == 0 || strcmp(state->cacacharset,charset) ) {
+		if( caca_set_dither_charset(state->cacadither,charset) ) {
+			fprintf(stderr,"Failed to set caca character set to \"%s\"",charset);
+			goto cacaRenderEnd;
+		}
+		state->cacacharset = charset;
 	}
 
 	//Create a new array with alpha channel
-	for( i=0; i<enc->width*enc->height; i++ ) {
-		rgb = &(enc->rgbpixels[3*i]);
+	for( i=0; i<state->width*state->height; i++ ) {
+		rgb = &(state->rgbpixels[3*i]);
 		cacapixels[i] = 0xFF000000 | (*(rgb) << 16) | (*(rgb+1) << 8) | *(rgb+2);
 		//cacapixels[i] = ntohl(cacapixels[i]);
 	}
-	dither = caca_create_dither(32,enc->width,enc->height,enc->width*sizeof(uint32_t),
-		0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
-	if( dither == 0 ) {
-		fprintf(stderr,"Failed to create caca dither\n");
-		goto cacaRenderEnd;
-	}
-	if( caca_set_dither_color(dither,"full16") ) {
-		fprintf(stderr,"Failed to set caca dither color\n");
-		goto cacaRenderEnd;
-	}
-	if( caca_set_dither_charset(dither,charset) ) {
-		fprintf(stderr,"Failed to set caca character set to \"%s\"",charset);
-		goto cacaRenderEnd;
-	}
-	if( caca_set_dither_algorithm(dither,dither_algorithm) ) {
-		fprintf(stderr,"Failed to set caca dither algorithm to \"%s\"",dither_algorithm);
-		goto cacaRenderEnd;
-	}
-	caca_dither_bitmap(canvas,0,0,cwidth,cheight,
-		dither,cacapixels);
+	caca_dither_bitmap(state->cacacanvas,0,0,cwidth,cheight,
+		state->cacadither,cacapixels);
 	
 	error = 0;
 	cacaRenderEnd:
-	if( dither ) {
-		caca_free_dither(dither);
-	}
-	if( error && canvas ) {
-		caca_free_canvas(canvas);
-		canvas = 0;
+	arenaFree(enc,cacapixels);
+	if( error ) {
+		cacaFree(enc);
+		return 0;
 	}
-	return canvas;
+	return state->cacacanvas;
 }
 
 static int cacaEncode( term_encode_t* enc, uint8_t use_blocks ) {
 	caca_canvas_t *canvas;
 	const uint32_t *cacachars;
 	const uint32_t *cacaattrs;
-	uint32_t lastattr;
 	uint32_t currattr;
 	uint32_t currchar;
+	utf8_glyph_t glyph;
 	uint8_t blink,bold,underline;
 	uint8_t color, fg, bg;
-	char* utf8c;
 	size_t x,y;
 	size_t char_width;
 	size_t char_height;
@@ -1166,7 +1745,7 @@ static int cacaEncode( term_encode_t* enc, uint8_t use_blocks ) {
 	if( enc->encbinary ) {
 		enc->stdpal = 1;
 		enc->palsize = 16;
-		binWriteHeader(enc,enc->width,enc->height);
+		binWriteHeader(enc,enc->state->width,enc->state->height);
 	}
 	
 	//libcaca drivers want to control the entire terminal, and destroy the
@@ -1175,11 +1754,12 @@ static int cacaEncode( term_encode_t* enc, uint8_t use_blocks ) {
 	//routines, but then render it ourself.
 	cacachars = caca_get_canvas_chars(canvas);
 	cacaattrs = caca_get_canvas_attrs(canvas);
+	if( enc->enctext ) {
+		sgr_init(&(enc->state->sgr));
+	}
 	for( y=0; y<char_height; y++ ) {
-		lastattr = 0;
 		for( x=0; x<char_width; x++ ) {
 			currchar = cacachars[y*char_width+x];
-			utf8c = utf8_encode(0,currchar);
 			currattr = cacaattrs[y*char_width+x];
 			fg = caca_attr_to_ansi_fg(currattr);
 			bg = caca_attr_to_ansi_bg(currattr);
@@ -1190,23 +1770,13 @@ static int cacaEncode( term_encode_t* enc, uint8_t use_blocks ) {
 			if( currattr & CACA_UNDERLINE ) { underline=1; }
 			else { underline=0; }
 			if( enc->enctext ) {
-				if( currattr != lastattr ) {
-					fprintf(enc->textfp,"\x1b[0m");
-					ansiSetStdColor(enc,ENC_FGCOLOR,fg);
-					ansiSetStdColor(enc,ENC_BGCOLOR,bg);
-					if( bold ) {
-						fprintf(enc->textfp,"\x1b[1m");
-					}
-					//Ignoring Italics - it's not consistantly supported
-					if( underline ) {
-						fprintf(enc->textfp,"\x1b[4m");
-					}
-					if( blink ) {
-						fprintf(enc->textfp,"\x1b[5m");
-					}
-					lastattr = currattr;
-				}
-				fprintf(enc->textfp,"%s",utf8c);
+				//Ignoring Italics - it's not consistantly supported
+				//(CACA_DEFAULT and CACA_TRANSPARENT are above 15)
+				ansiCell(enc,
+					fg < 16 ? ansiStdColor(enc,fg) : SGR_DEFAULT,
+					bg < 16 ? ansiStdColor(enc,bg) : SGR_DEFAULT,
+					(bold ? SGR_BOLD : 0) | (underline ? SGR_UNDERLINE : 0) | (blink ? SGR_BLINK : 0),
+					utf8_glyph(&glyph,currchar));
 			}
 			if( enc->encbinary ) {
 				binWriteCellIndex(enc,fg,bg,
@@ -1214,43 +1784,389 @@ static int cacaEncode( term_encode_t* enc, uint8_t use_blocks ) {
 			}
 		}
 		if( enc->enctext ) {
-			fprintf(enc->textfp,"\x1b[0m\r\n");
+			ansiNewline(enc);
 		}
 	}
+	if( enc->enctext ) {
+		ansiRestore(enc);
+	}
 	fflush(stdout);
 	
 	if( enc->encbinary ) {
 		binClose(enc);
 	}
-
-	caca_free_canvas(canvas);
 	return 0;
 }
 #endif //USE_LIBCACA
 
-#if USE_LIBSIXEL
-static int sixelEncode( term_encode_t* enc ) {
-	SIXELSTATUS result = SIXEL_OK;
-	sixel_allocator_t *allocator;
-	sixel_encoder_t* encoder;
-	
-	result = sixel_allocator_new(&allocator,0,0,0,0);
-	if( result != SIXEL_OK ) {
-		fprintf(stderr,"Failed to create sixel allocator\n");
-		return 1;
-	}
-	
-	result = sixel_encoder_new(&encoder,allocator);
-	if( result != SIXEL_OK ) {
-		fprintf(stderr,"Failed to create encoded\n");
-		return 1;
-	}
+//Buffered sixel output, written to textfp in blocks
+#define SIXEL_BUFLEN 4096
+typedef struct {
+	char bytes[SIXEL_BUFLEN];
+	size_t len;
+} sixel_buf_t;
 
-	result = sixel_encoder_encode_bytes(
-		encoder,
-		enc->rgbpixels,
-		enc->width,
-		enc->height,
+static void sixelFlush( term_encode_t* enc, sixel_buf_t* buf ) {
+	textWrite(enc,buf->bytes,buf->len,0);
+	buf->len = 0;
+}
+
+static inline void sixelPutc( term_encode_t* enc, sixel_buf_t* buf, char c ) {
+	if( buf->len == SIXEL_BUFLEN ) {
+		sixelFlush(enc,buf);
+	}
+	buf->bytes[buf->len++] = c;
+}
+
+//Write the decimal value of n
+static void sixelPutUint( term_encode_t* enc, sixel_buf_t* buf, size_t n ) {
+	char digits[20];
+	size_t len = 0;
+	do {
+		digits[len++] = '0' + n%10;
+		n /= 10;
+	} while( n );
+	while( len ) {
+		sixelPutc(enc,buf,digits[--len]);
+	}
+}
+
+//Write n of the sixel c, as a repeat (!n) if that is shorter
+static void sixelPutRun( term_encode_t* enc, sixel_buf_t* buf, char c, size_t n ) {
+	if( n > 3 ) {
+		sixelPutc(enc,buf,'!');
+		sixelPutUint(enc,buf,n);
+		sixelPutc(enc,buf,c);
+	}
+	else {
+		while( n-- ) {
+			sixelPutc(enc,buf,c);
+		}
+	}
+}
+
+//Mean error (squared RGB distance per pixel, see sixelPalettize()) at
+//which an image gets a new palette: SIXEL_PALETTE_ERROR_RATIO times the
+//error of the image the kept palette was made for, plus SIXEL_PALETTE_ERROR_MIN
+#define SIXEL_PALETTE_ERROR_RATIO 2
+#define SIXEL_PALETTE_ERROR_MIN   12
+
+//ENC_SIXEL_REUSE and ENC_SIXEL_DELTA keep an optimal palette from image to
+//image (the dither quantizer always makes a new one)
+static int sixelKeepsPalette( term_encode_t* enc ) {
+	if( enc->renderer != ENC_RENDER_SIXEL || enc->sixel == ENC_SIXEL_FULL ) {
+		return 0;
+	}
+	#ifdef USE_QUANTPNM
+	if( enc->dither ) {
+		return 0;
+	}
+	#endif //USE_QUANTPNM
+	return 1;
+}
+
+//Set palpixels to the nearest color of state->palette for each pixel,
+//through the 15-bit color cache.  Returns the total squared RGB distance.
+static uint64_t sixelMapPalette( term_encode_t* enc, uint8_t* rgbpixels, size_t npixels ) {
+	struct term_encode_state* state = enc->state;
+	uint16_t* cache = (uint16_t*)state->sixelcache;
+	uint8_t* palette = state->palette;
+	uint64_t error = 0;
+	uint32_t dist, best;
+	uint8_t* rgb;
+	uint8_t* pal;
+	size_t i, p, key;
+	int dr, dg, db;
+	
+	for( i=0; i<npixels; i++ ) {
+		rgb = &(rgbpixels[3*i]);
+		key = ((rgb[0]>>3)<<10) | ((rgb[1]>>3)<<5) | (rgb[2]>>3);
+		if( cache[key] == 0 ) {
+			best = UINT32_MAX;
+			for( p=0; p<enc->palsize && best; p++ ) {
+				dr = (int)rgb[0] - palette[3*p];
+				dg = (int)rgb[1] - palette[3*p+1];
+				db = (int)rgb[2] - palette[3*p+2];
+				dist = dr*dr + dg*dg + db*db;
+				if( dist < best ) {
+					best = dist;
+					cache[key] = p+1;
+				}
+			}
+		}
+		state->palpixels[i] = cache[key]-1;
+		pal = &(palette[3*state->palpixels[i]]);
+		dr = (int)rgb[0] - pal[0];
+		dg = (int)rgb[1] - pal[1];
+		db = (int)rgb[2] - pal[2];
+		error += dr*dr + dg*dg + db*db;
+	}
+	return error;
+}
+
+//Optimal palette for a sixel image that keeps the last image's palette
+//(see sixelKeepsPalette()).  Quantizing costs far more than encoding, and
+//an unchanged palette leaves the terminal's color registers as they are,
+//so the image is mapped onto the kept palette, and only gets a new palette
+//(made by quant_quantize) when its error passes SIXEL_PALETTE_ERROR_*.
+static int sixelPalettize( term_encode_t* enc, uint8_t* rgbpixels ) {
+	struct term_encode_state* state = enc->state;
+	size_t npixels = state->width*state->height;
+	size_t reqpalsize = enc->palsize;
+	size_t palsize;
+	uint64_t error;
+	size_t i;
+	
+	if( npixels == 0 ) {
+		return 0;
+	}
+	if( growBuffer(enc,&(state->sixelcache),&(state->sixelcachelen),sizeof(uint16_t)<<15) ) {
+		fprintf(stderr,"Failed to allocate sixel palette cache\n");
+		state->sixelpalsize = 0;
+		return 1;
+	}
+	
+	error = UINT64_MAX;
+	if( state->sixelpalsize && state->sixelpalreq == reqpalsize ) {
+		memcpy(state->palette,state->sixelpalette,3*state->sixelpalsize);
+		enc->palsize = state->sixelpalsize;
+		error = sixelMapPalette(enc,rgbpixels,npixels)/npixels;
+	}
+	if( error > state->sixelpalerror*SIXEL_PALETTE_ERROR_RATIO + SIXEL_PALETTE_ERROR_MIN ) {
+		#ifdef DEBUG
+		if( state->sixelpalsize ) {
+			fprintf(stderr,"New sixel palette, mean error %lu (kept palette %lu)\n",(unsigned long)error,(unsigned long)state->sixelpalerror);
+		}
+		#endif
+		palsize = reqpalsize;
+		quant_quantize(state->palette,&palsize,state->palpixels,rgbpixels,npixels,0);
+		enc->palsize = palsize;
+		memset(state->sixelcache,0,sizeof(uint16_t)<<15);
+		state->sixelpalerror = sixelMapPalette(enc,rgbpixels,npixels)/npixels;
+		memcpy(state->sixelpalette,state->palette,3*palsize);
+		state->sixelpalsize = palsize;
+		state->sixelpalreq = reqpalsize;
+	}
+	for( i=0; i<npixels; i++ ) {
+		memcpy(&(rgbpixels[3*i]),&(state->palette[3*state->palpixels[i]]),3);
+	}
+	return 0;
+}
+
+//Built-in sixel encoder.  The image is written from the palette and
+//palette indexes made by prepImage() (true color is given an optimal
+//palette of 256 colors first), so it is not quantized again.  Each band of
+//6 pixel rows is written one color at a time, from the first to the last
+//pixel of that color, with runs repeated.
+//ENC_SIXEL_REUSE keeps the color registers of the last image (and its
+//optimal palette, see sixelPalettize()), so only colors that changed are
+//defined, and ENC_SIXEL_DELTA also skips the bands
+//whose palette indexes and colors are the same as the last image.  Zero
+//bits are left transparent (P2=1), so a skipped band keeps the last image.
+static int sixelEncode( term_encode_t* enc ) {
+	struct term_encode_state* state = enc->state;
+	size_t width = state->width;
+	size_t height = state->height;
+	size_t npixels = width*height;
+	sixel_buf_t* buf;
+	uint8_t* pixels;
+	uint8_t* bits;
+	uint8_t regs[3*256];
+	uint8_t redefined[256];
+	uint8_t used[256];
+	size_t first[256];
+	size_t last[256];
+	size_t palsize;
+	size_t nused;
+	size_t band, rows, r, x, i, c;
+	uint8_t *prow;
+	uint8_t *pbits;
+	uint8_t reuse = enc->sixel == ENC_SIXEL_REUSE || enc->sixel == ENC_SIXEL_DELTA;
+	uint8_t delta = enc->sixel == ENC_SIXEL_DELTA;
+	uint8_t changed;
+	
+	if( !enc->enctext || npixels == 0 ) {
+		return 0;
+	}
+	
+	//Palette indexes and colors (sixel colors are percentages)
+	if( enc->palsize ) {
+		pixels = state->palpixels;
+		palsize = enc->palsize;
+		for( i=0; i<3*palsize; i++ ) {
+			regs[i] = (state->palette[i]*100+127)/255;
+		}
+	}
+	else {
+		//Black and white
+		pixels = (uint8_t*)arenaAlloc(enc,npixels);
+		if( pixels == 0 ) {
+			fprintf(stderr,"Failed to allocate sixel pixels\n");
+			return 1;
+		}
+		for( i=0; i<npixels; i++ ) {
+			pixels[i] = state->rgbpixels[3*i] >= 128;
+		}
+		palsize = 2;
+		memset(regs,0,3);
+		memset(regs+3,100,3);
+	}
+	
+	buf = (sixel_buf_t*)arenaAlloc(enc,sizeof(sixel_buf_t));
+	bits = (uint8_t*)arenaAlloc(enc,palsize*width);
+	if( buf == 0 || bits == 0 ) {
+		fprintf(stderr,"Failed to allocate sixel buffers\n");
+		return 1;
+	}
+	buf->len = 0;
+	memset(bits,0,palsize*width);
+	
+	//Only the last image's registers (and bands and palette) can be reused
+	if( !reuse ) {
+		state->sixelregslen = 0;
+		state->sixelpalsize = 0;
+	}
+	if( !delta || state->sixelwidth != width || state->sixelheight != height ) {
+		state->sixelwidth = 0;
+		state->sixelheight = 0;
+	}
+	
+	if( reuse && state->sixelregslen == 0 ) {
+		//Share color registers between images
+		textWrite(enc,"\x1b[?1070l",8,1);
+		state->sixelshared = 1;
+	}
+	//DCS, transparent zero bits, square pixels, and the image size
+	textWrite(enc,"\x1bP0;1;0q\"1;1;",13,1);
+	sixelPutUint(enc,buf,width);
+	sixelPutc(enc,buf,';');
+	sixelPutUint(enc,buf,height);
+	for( i=0; i<palsize; i++ ) {
+		redefined[i] = i >= state->sixelregslen || memcmp(&(regs[3*i]),&(state->sixelregs[3*i]),3);
+		if( redefined[i] ) {
+			sixelPutc(enc,buf,'#');
+			sixelPutUint(enc,buf,i);
+			sixelPutc(enc,buf,';');
+			sixelPutc(enc,buf,'2');
+			for( c=0; c<3; c++ ) {
+				sixelPutc(enc,buf,';');
+				sixelPutUint(enc,buf,regs[3*i+c]);
+			}
+		}
+	}
+	
+	for( i=0; i<palsize; i++ ) {
+		first[i] = SIZE_MAX;
+	}
+	for( band=0; band<height; band+=6 ) {
+		rows = height-band < 6 ? height-band : 6;
+		if( band ) {
+			sixelPutc(enc,buf,'-');
+		}
+		
+		//Skip bands that are the same as the last image
+		if( state->sixelwidth ) {
+			changed = 0;
+			for( i=band*width; i<(band+rows)*width; i++ ) {
+				if( pixels[i] != state->sixelpixels[i] || redefined[pixels[i]] ) {
+					changed = 1;
+					break;
+				}
+			}
+			if( !changed ) {
+				continue;
+			}
+		}
+		
+		//Set each color's bits in the band, and note where it is used
+		nused = 0;
+		for( r=0; r<rows; r++ ) {
+			prow = &(pixels[(band+r)*width]);
+			for( x=0; x<width; x++ ) {
+				i = prow[x];
+				if( first[i] == SIZE_MAX ) {
+					used[nused++] = i;
+					first[i] = x;
+					last[i] = x;
+				}
+				else if( x < first[i] ) {
+					first[i] = x;
+				}
+				else if( x > last[i] ) {
+					last[i] = x;
+				}
+				bits[i*width+x] |= 1<<r;
+			}
+		}
+		
+		//Write each color, returning to the start of the band between them
+		for( c=0; c<nused; c++ ) {
+			i = used[c];
+			if( c ) {
+				sixelPutc(enc,buf,'$');
+			}
+			sixelPutc(enc,buf,'#');
+			sixelPutUint(enc,buf,i);
+			sixelPutRun(enc,buf,'?',first[i]);
+			pbits = &(bits[i*width]);
+			x = first[i];
+			while( x <= last[i] ) {
+				r = x;
+				while( x <= last[i] && pbits[x] == pbits[r] ) {
+					x++;
+				}
+				sixelPutRun(enc,buf,'?'+pbits[r],x-r);
+			}
+			memset(&(pbits[first[i]]),0,last[i]-first[i]+1);
+			first[i] = SIZE_MAX;
+		}
+	}
+	sixelFlush(enc,buf);
+	textWrite(enc,"\x1b\\",2,1);
+	
+	if( reuse ) {
+		memcpy(state->sixelregs,regs,3*palsize);
+		if( palsize > state->sixelregslen ) {
+			state->sixelregslen = palsize;
+		}
+	}
+	if( delta ) {
+		if( growBuffer(enc,&(state->sixelpixels),&(state->sixelpixlen),npixels) ) {
+			fprintf(stderr,"Failed to allocate sixel pixels\n");
+			state->sixelwidth = 0;
+			state->sixelheight = 0;
+			return 1;
+		}
+		memcpy(state->sixelpixels,pixels,npixels);
+		state->sixelwidth = width;
+		state->sixelheight = height;
+	}
+	return 0;
+}
+
+#if USE_LIBSIXEL
+static int libsixelEncode( term_encode_t* enc ) {
+	SIXELSTATUS result = SIXEL_OK;
+	sixel_allocator_t *allocator;
+	sixel_encoder_t* encoder;
+	
+	result = sixel_allocator_new(&allocator,0,0,0,0);
+	if( result != SIXEL_OK ) {
+		fprintf(stderr,"Failed to create sixel allocator\n");
+		return 1;
+	}
+	
+	result = sixel_encoder_new(&encoder,allocator);
+	if( result != SIXEL_OK ) {
+		fprintf(stderr,"Failed to create encoded\n");
+		return 1;
+	}
+
+	result = sixel_encoder_encode_bytes(
+		encoder,
+		enc->state->rgbpixels,
+		enc->state->width,
+		enc->state->height,
 		PIXELFORMAT_RGB888,0,256);
 	if( result != SIXEL_OK ) {
 		fprintf(stderr,"Failed to encode image\n");
@@ -1262,43 +2178,138 @@ static int sixelEncode( term_encode_t* enc ) {
 }
 #endif
 
+//Determine the region of the input image that will be encoded,
+//clipping the optional crop rectangle to the image.
+static int cropRegion( term_encode_t* enc, size_t* x, size_t* y, size_t* w, size_t* h ) {
+	*x = 0;
+	*y = 0;
+	*w = enc->imgwidth;
+	*h = enc->imgheight;
+	if( enc->crop.w && enc->crop.h ) {
+		if( enc->crop.y >= enc->imgheight || enc->crop.x >= enc->imgwidth ) {
+			fprintf(stderr,"Failed to crop image because rectange is out of bounds\n");
+			return 1;
+		}
+		*x = enc->crop.x;
+		*y = enc->crop.y;
+		if( enc->crop.y+enc->crop.h > enc->imgheight ) {
+			*h = enc->imgheight - enc->crop.y;
+		} else {
+			*h = enc->crop.h;
+		}
+		if( enc->crop.x+enc->crop.w > enc->imgwidth ) {
+			*w = enc->imgwidth - enc->crop.x;
+		} else {
+			*w = enc->crop.w;
+		}
+	}
+	return 0;
+}
+
+//Set the render width and height (pixels) so that the pixel width matches the
+//target character width (win_width).  The pixel height is calculated to maintain
+//the image ratio.  Things to consider:
+// 1) Pixels are square
+// 2) Terminal characters are rectangles (twice as height as they are wide)
+// 3) Renderers are responsible for "squaring" the resulting image (or not)
+//    through their selection of characters.  The pixel_ratio argument should
+//    specify how well the renderer will do this.
+static void renderSize( term_encode_t* enc, size_t imgwidth, size_t imgheight, float pixels_per_col, float pixel_ratio ) {
+	float imgratio;
+	//Set the terminal width (characters) for the encoder
+	if( enc->win_width == 0 ) {
+		enc->win_width = imgwidth;
+	}
+	imgratio = (float)imgheight / (float)imgwidth;
+	enc->state->width = enc->win_width*pixels_per_col;
+	enc->state->height = enc->state->width*imgratio*pixel_ratio;
+}
+
+//Allocate the palette and the palette indexes for npixels, and fill in
+//the palette if a standard palette is used.
+static int allocPalette( term_encode_t* enc, size_t npixels ) {
+	uint8_t *dstrgb;
+	size_t i;
+	
+	//allcode indexed (palettized) version of pixels
+	if( growBuffer(enc,&(enc->state->palpixels),&(enc->state->palpixlen),sizeof(uint8_t)*npixels) ) {
+		fprintf(stderr,"Failed to allocate palette pixels\n");
+		return 1;
+	}
+	
+	//A warm encoder keeps its standard palette between images
+	if( !enc->stdpal ) {
+		enc->state->stdpalsize = 0;
+	}
+	else if( enc->state->stdpalsize != enc->palsize ) {
+		enc->state->stdpalsize = enc->palsize;
+		if( enc->palsize == 24 ) {
+			dstrgb = &(enc->state->palette[0]);
+			*(dstrgb) = (standard_palette[0]>>16)&0xFF;
+			*(++dstrgb) = (standard_palette[0]>>8)&0xFF;
+			*(++dstrgb) = (standard_palette[0])&0xFF;
+			for( i=1; i<23; i++ ) {
+				dstrgb = &(enc->state->palette[3*i]);
+				*(dstrgb) = (standard_palette[231+i]>>16)&0xFF;
+				*(++dstrgb) = (standard_palette[231+i]>>8)&0xFF;
+				*(++dstrgb) = (standard_palette[231+i])&0xFF;
+			}
+			dstrgb = &(enc->state->palette[3*23]);
+			*(dstrgb) = (standard_palette[15]>>16)&0xFF;
+			*(++dstrgb) = (standard_palette[15]>>8)&0xFF;
+			*(++dstrgb) = (standard_palette[15])&0xFF;
+		}
+		else {
+			for( i=0; i<enc->palsize; i++ ) {
+				dstrgb = &(enc->state->palette[3*i]);
+				*(dstrgb) = (standard_palette[i]>>16)&0xFF;
+				*(++dstrgb) = (standard_palette[i]>>8)&0xFF;
+				*(++dstrgb) = (standard_palette[i])&0xFF;
+			}
+		}
+	}
+	return 0;
+}
+
+//Grow the resize buffer (reused between calls) to hold npixels
+static int allocResize( term_encode_t* enc, size_t npixels ) {
+	return growBuffer(enc,&(enc->state->rszpixels),&(enc->state->rszlen),sizeof(uint8_t)*3*npixels);
+}
+
+//Grow the edge detection scratch buffer (reused between calls) to hold npixels
+static int allocEdge( term_encode_t* enc, size_t npixels ) {
+	return growBuffer(enc,&(enc->state->edgepixels),&(enc->state->edgelen),sizeof(uint8_t)*npixels);
+}
+
 //pixels_per_col = number of pixels per character column in the renderer
 //pixel_ratio    = renderer pixel ratio (width/height);
 static int prepImage( term_encode_t* enc, float pixels_per_col, float pixel_ratio ) {
 	uint8_t *dstrgb;
 	uint8_t *srcrgb;
 	size_t i, x, y;
-	size_t orgcolors,genpalsize;
+	size_t cropx, cropy;
+	size_t genpalsize;
 	uint8_t *imgpixels= enc->imgpixels;
 	uint8_t *alloctmp;
 	size_t imgwidth;
 	size_t imgheight;
-	float imgratio;
+	#ifdef USE_QUANTPNM
+	quant_pnm_allocator_t quant_allocator = { arenaAlloc, arenaFree, enc };
+	uint16_t *cachetable;
+	#endif //USE_QUANTPNM
+	uint64_t mark = stageMark(enc);
 
 	//Crop Image
+	if( cropRegion(enc,&cropx,&cropy,&imgwidth,&imgheight) ) {
+		return 1;
+	}
 	if( enc->crop.w && enc->crop.h ) {
-		if( enc->crop.y >= imgheight || enc->crop.x >= imgwidth ) {
-			fprintf(stderr,"Failed to crop image because rectange is out of bounds\n");
-			return 1;
-		}
-		if( enc->crop.y+enc->crop.h > enc->imgheight ) {
-			imgheight = enc->imgheight - enc->crop.y;
-		} else {
-			imgheight = enc->crop.h;
-		}
-		if( enc->crop.x+enc->crop.w > enc->imgwidth ) {
-			imgwidth = enc->imgwidth - enc->crop.x;
-		} else {
-			imgwidth = enc->crop.w;
-		}
-		imgpixels = enc->imgpixels;
-		
 		//Crop the image by moving all of the wanted pixels to the
 		//top/left of the original images and change the reported
 		//image size.
 		for( y=0; y<imgheight; y++ ) {
 			for( x=0; x<imgwidth; x++ ) {
-				srcrgb = &(imgpixels[3*((y+enc->crop.y)*enc->imgwidth+(x+enc->crop.x))]);
+				srcrgb = &(imgpixels[3*((y+cropy)*enc->imgwidth+(x+cropx))]);
 				dstrgb = &(imgpixels[3*(y*imgwidth+x)]);
 				*(dstrgb) = *(srcrgb);
 				*(++dstrgb) = *(++srcrgb);
@@ -1308,57 +2319,50 @@ static int prepImage( term_encode_t* enc, float pixels_per_col, float pixel_rati
 		enc->imgwidth = imgwidth;
 		enc->imgheight = imgheight;
 	}
+	stageTime(enc,ENC_STAGE_CROP,&mark);
 	
-	//Resize image so that pixel width matches the  target character width (win_width).
-	//The pixel height is calculated to maintain the image ratio.  Things to consider:
-	// 1) Pixels are square
-	// 2) Terminal characters are rectangles (twice as height as they are wide)
-	// 3) Renderers are responsible for "squaring" the resulting image (or not)
-	//    through their selection of characters.  The pixel_ratio argument should
-	//    specify how well the renderer will do this.
-	imgpixels = enc->imgpixels;
-	imgwidth = enc->imgwidth;
-	imgheight = enc->imgheight;
-	//Set the terminal width (characters) for the encoder
-	if( enc->win_width == 0 ) {
-		enc->win_width = imgwidth;
-	}
-	//Set the render width and height (pixels) for the encoder 
-	imgratio = (float)imgheight / (float)imgwidth;
-	enc->width = enc->win_width*pixels_per_col;
-	enc->height = enc->width*imgratio*pixel_ratio;
+	renderSize(enc,imgwidth,imgheight,pixels_per_col,pixel_ratio);
 	
 	//Resize input image
-	if( imgwidth != enc->width || imgheight != enc->height ) {
-		imgpixels = (uint8_t*)malloc(sizeof(uint8_t)*3*enc->width*enc->height);
-		if( imgpixels == 0 ) {
-			fprintf(stderr,"Failed to allocate RGB pixels for resize: %f %ld %ld %ld\n",imgratio,enc->win_width,enc->width,enc->height);
+	if( imgwidth != enc->state->width || imgheight != enc->state->height ) {
+		if( allocResize(enc,enc->state->width*enc->state->height) ) {
+			fprintf(stderr,"Failed to allocate RGB pixels for resize: %ld %ld %ld\n",enc->win_width,enc->state->width,enc->state->height);
 			return 1;
 		}
-		if( ! stbir_resize_uint8(enc->imgpixels,enc->imgwidth,enc->imgheight,0,imgpixels,enc->width,enc->height,0,3) ) {
-			fprintf(stderr,"Failed to resize image with ratio: %f\n",imgratio);
+		imgpixels = enc->state->rszpixels;
+		if( ! stbir_resize_uint8_generic(enc->imgpixels,enc->imgwidth,enc->imgheight,0,
+				imgpixels,enc->state->width,enc->state->height,0,
+				3,STBIR_ALPHA_CHANNEL_NONE,0,STBIR_EDGE_CLAMP,STBIR_FILTER_DEFAULT,
+				STBIR_COLORSPACE_LINEAR,enc) ) {
+			fprintf(stderr,"Failed to resize image to: %ld %ld\n",enc->state->width,enc->state->height);
 			return 1;
 		}
-		imgwidth = enc->width;
-		imgheight = enc->height;
+		imgwidth = enc->state->width;
+		imgheight = enc->state->height;
 		#ifdef DEBUG
 		fprintf(stderr,"Resized image from %lu / %lu to %lu / %lu\n",enc->imgwidth,enc->imgheight,imgwidth,imgheight);
 		#endif
 	}
+	stageTime(enc,ENC_STAGE_RESIZE,&mark);
 	
 	//Perform filtering/processing
 	if( enc->filter != ENC_FILTER_NONE ) {
+		if( enc->filter >= ENC_FILTER_EDGE_SCALE && enc->filter <= ENC_FILTER_EDGE_HIGHLIGHT &&
+				allocEdge(enc,imgwidth*imgheight) ) {
+			fprintf(stderr,"Failed to allocate buffer for edge detection.\n");
+			return 1;
+		}
 		if( enc->filter == ENC_FILTER_EDGE_SCALE ) {
-			edge_scale( imgpixels, enc->color_rgb, enc->invert, 0, imgpixels, imgwidth, imgheight );
+			edge_scale( imgpixels, enc->state->edgepixels, enc->color_rgb, enc->invert, 0, imgpixels, imgwidth, imgheight );
 		}
 		else if( enc->filter == ENC_FILTER_EDGE_LINE ) {
-			edge_scale( imgpixels, enc->color_rgb, enc->invert, EDGE_DEFAULT_THRESHOLD, imgpixels, imgwidth, imgheight ); 
+			edge_scale( imgpixels, enc->state->edgepixels, enc->color_rgb, enc->invert, EDGE_DEFAULT_THRESHOLD, imgpixels, imgwidth, imgheight ); 
 		}
 		else if( enc->filter == ENC_FILTER_EDGE_GLOW ) {
-			edge_highlight( imgpixels, enc->color_rgb, 0, 1, imgpixels, imgwidth, imgheight );
+			edge_highlight( imgpixels, enc->state->edgepixels, enc->color_rgb, 0, 1, imgpixels, imgwidth, imgheight );
 		}
 		else if( enc->filter == ENC_FILTER_EDGE_HIGHLIGHT ) {
-			edge_highlight( imgpixels, enc->color_rgb, EDGE_DEFAULT_THRESHOLD, 0, imgpixels, imgwidth, imgheight );
+			edge_highlight( imgpixels, enc->state->edgepixels, enc->color_rgb, EDGE_DEFAULT_THRESHOLD, 0, imgpixels, imgwidth, imgheight );
 		}
 		else if( enc->filter == ENC_FILTER_APPLE2 ) {
 			apple2( imgpixels, imgpixels, imgwidth, imgheight, 0, 0 );
@@ -1367,87 +2371,57 @@ static int prepImage( term_encode_t* enc, float pixels_per_col, float pixel_rati
 			apple2( imgpixels, imgpixels, imgwidth, imgheight, 1, enc->color_rgb );
 		}
 	}
+	stageTime(enc,ENC_STAGE_FILTER,&mark);
 	
 	//Black and White
 	if( enc->stdpal && !enc->palsize ) {
 		//allocate bwpixels
-		alloctmp = (uint8_t*)malloc(sizeof(uint8_t)*enc->width*enc->height);
+		alloctmp = (uint8_t*)arenaAlloc(enc,sizeof(uint8_t)*enc->state->width*enc->state->height);
 		if( alloctmp == 0 ) {
-			fprintf(enc->textfp,"Failed allocate space for black and white pixels\n");
+			fprintf(stderr,"Failed allocate space for black and white pixels\n");
 			return 1;
 		}
-		quant_bw(alloctmp,imgpixels,enc->width*enc->height,1);
-		free(alloctmp);
+		quant_bw(alloctmp,imgpixels,enc->state->width*enc->state->height,1);
+		arenaFree(enc,alloctmp);
 	}
 	//Paletteize
 	else if( enc->palsize ) {
-		//allocate palette
-		alloctmp  = (uint8_t*)realloc(enc->palette,sizeof(uint8_t)*3*enc->palsize);
-		if( alloctmp == 0 ) {
-			fprintf(enc->textfp,"Failed allocate space for palette\n");
+		if( allocPalette(enc,enc->state->width*enc->state->height) ) {
 			return 1;
 		}
-		enc->palette = alloctmp;
-
-		//allcode indexed (palettized) version of pixels
-		alloctmp =  (uint8_t*)realloc(enc->palpixels,sizeof(uint8_t)*enc->width*enc->height);
-		if( alloctmp == 0 ) {
-			fprintf(stderr,"Failed to allocate palette pixels\n");
-			return 1;
-		}
-		enc->palpixels = alloctmp;
-		
 		if( enc->stdpal ) {
-			if( enc->palsize == 24 ) {
-				dstrgb = &(enc->palette[0]);
-				*(dstrgb) = (standard_palette[0]>>16)&0xFF;
-				*(++dstrgb) = (standard_palette[0]>>8)&0xFF;
-				*(++dstrgb) = (standard_palette[0])&0xFF;
-				for( i=1; i<23; i++ ) {
-					dstrgb = &(enc->palette[3*i]);
-					*(dstrgb) = (standard_palette[231+i]>>16)&0xFF;
-					*(++dstrgb) = (standard_palette[231+i]>>8)&0xFF;
-					*(++dstrgb) = (standard_palette[231+i])&0xFF;
-				}
-				dstrgb = &(enc->palette[3*23]);
-				*(dstrgb) = (standard_palette[15]>>16)&0xFF;
-				*(++dstrgb) = (standard_palette[15]>>8)&0xFF;
-				*(++dstrgb) = (standard_palette[15])&0xFF;
-			}
-			else {
-				for( i=0; i<enc->palsize; i++ ) {
-					dstrgb = &(enc->palette[3*i]);
-					*(dstrgb) = (standard_palette[i]>>16)&0xFF;
-					*(++dstrgb) = (standard_palette[i]>>8)&0xFF;
-					*(++dstrgb) = (standard_palette[i])&0xFF;
-				}
-			}
 			#ifdef USE_QUANTPNM
 			if( ! enc->dither ) 
 			#endif //USE_QUANTPNM
 			{
 				//Apply the palette for non-dither quantizer
 				//Dither quanizer will apply the palette below
-				quant_apply_palette(enc->palette, enc->palsize,
-					enc->palpixels, imgpixels, enc->width*enc->height,
+				quant_apply_palette(enc->state->palette, enc->palsize,
+					enc->state->palpixels, imgpixels, enc->state->width*enc->state->height,
 					1);
 			}
 			
 		}
+		else if( sixelKeepsPalette(enc) ) {
+			if( sixelPalettize(enc,imgpixels) ) {
+				return 1;
+			}
+		}
 		else {
 			//Quantize down to the "optimal" palette of specified palette size
 			genpalsize = enc->palsize;
 			#ifdef USE_QUANTPNM
 			if( enc->dither ) {
 				//quant_pnm_make_palette creates the palette, but it must be still be applied
-				enc->palette = quant_pnm_make_palette(imgpixels, enc->width*enc->height,
-					enc->palsize,&genpalsize,0,QUANT_LARGE_AUTO,QUANT_REP_AUTO,QUANT_QUALITY_HIGH);
+				quant_pnm_make_palette(enc->state->palette, imgpixels, enc->state->width*enc->state->height,
+					enc->palsize,&genpalsize,0,QUANT_LARGE_AUTO,QUANT_REP_AUTO,QUANT_QUALITY_HIGH,
+					&quant_allocator);
 			} else 
 			#endif //USE_QUANTPNM
 			{
 				//quant_quantize will apply the palette as it creates it
-				quant_quantize(enc->palette, &(genpalsize),
-					enc->palpixels, imgpixels, enc->width*enc->height,1);
+				quant_quantize(enc->state->palette, &(genpalsize),
+					enc->state->palpixels, imgpixels, enc->state->width*enc->state->height,1);
 			}
 			#ifdef DEBUG
 			fprintf(stderr,"Changing terminal encoder palette size from %lu to %lu\n",enc->palsize,genpalsize);
@@ -1458,10 +2432,18 @@ static int prepImage( term_encode_t* enc, float pixels_per_col, float pixel_rati
 		if( enc->dither ) {
 			//Dither quantizer needs a call to apply the the palette reguardless
 			//of whether a standard palette is used or not.
-			quant_pnm_apply_palette(enc->palpixels, imgpixels, enc->width, enc->height,
-				enc->palette, enc->palsize, QUANT_DIFFUSE_AUTO,1,0,1,0,&genpalsize);
-			for( i=0; i<enc->width*enc->height; i++ ) {
-				srcrgb = &(enc->palette[3*enc->palpixels[i]]);
+			//The lookup cache is 2^15 entries (5 bits per channel)
+			cachetable = (uint16_t*)arenaAlloc(enc,sizeof(uint16_t)<<15);
+			if( cachetable == 0 ) {
+				fprintf(stderr,"Failed to allocate palette lookup cache\n");
+				return 1;
+			}
+			memset(cachetable,0,sizeof(uint16_t)<<15);
+			quant_pnm_apply_palette(enc->state->palpixels, imgpixels, enc->state->width, enc->state->height,
+				enc->state->palette, enc->palsize, QUANT_DIFFUSE_AUTO,1,0,1,cachetable,&genpalsize);
+			arenaFree(enc,cachetable);
+			for( i=0; i<enc->state->width*enc->state->height; i++ ) {
+				srcrgb = &(enc->state->palette[3*enc->state->palpixels[i]]);
 				dstrgb = &(imgpixels[3*i]);
 				*(dstrgb) = *(srcrgb);
 				*(++dstrgb) = *(++srcrgb);
@@ -1471,8 +2453,188 @@ static int prepImage( term_encode_t* enc, float pixels_per_col, float pixel_rati
 		#endif //USE_QUANTPNM
 	}
 	//else True Color
+	stageTime(enc,ENC_STAGE_QUANTIZE,&mark);
 	
-	enc->rgbpixels = imgpixels;
+	enc->state->rgbpixels = imgpixels;
+	return 0;
+}
+
+//Renders rows of character cells from rgbpixels (enc->state->width pixels wide)
+typedef void (*ansi_rows_fn)( term_encode_t* enc, uint8_t* rgbpixels, size_t rows );
+
+static void ansiBegin( term_encode_t* enc, size_t cols, size_t rows ) {
+	if( enc->encbinary ) {
+		binWriteHeader(enc,cols,rows);
+	}
+	if( enc->enctext ) {
+		ansiReset(enc);
+	}
+}
+
+static void ansiEnd( term_encode_t* enc ) {
+	if( enc->enctext ) {
+		ansiRestore(enc);
+	}
+	if( enc->encbinary ) {
+		binClose(enc);
+	}
+}
+
+//Approximate size of an RGB strip.  A strip should stay in cache while it
+//is resized, filtered, palettized and rendered.
+#ifndef ENC_STRIP_BYTES
+#define ENC_STRIP_BYTES (128*1024)
+#endif
+
+//Strips can only be used when every stage only depends upon the pixels
+//of the character row being rendered.  Edge detection, the black and white
+//threshold, optimal palettes, dithering, and the braille dot threshold
+//all depend upon the whole image.
+static int stripEligible( term_encode_t* enc ) {
+	if( enc->renderer == ENC_RENDER_BRAILLE ) {
+		return 0;
+	}
+	if( enc->filter != ENC_FILTER_NONE &&
+			enc->filter != ENC_FILTER_APPLE2 && enc->filter != ENC_FILTER_APPLE2_BW ) {
+		return 0;
+	}
+	if( enc->stdpal && !enc->palsize ) {
+		return 0;
+	}
+	if( !enc->stdpal && enc->palsize ) {
+		return 0;
+	}
+	#ifdef USE_QUANTPNM
+	if( enc->palsize && enc->dither ) {
+		return 0;
+	}
+	#endif //USE_QUANTPNM
+	return 1;
+}
+
+//Resize, filter, palettize and render the image a strip of character rows
+//at a time, so that the full size resized image is never created.  Output
+//matches prepImage followed by encode_rows over the whole image.
+static int stripEncode( term_encode_t* enc, float pixels_per_col, float pixel_ratio,
+		size_t rows_per_char, ansi_rows_fn encode_rows ) {
+	uint8_t *srcpixels;
+	uint8_t *strippixels;
+	size_t srcx, srcy, srcwidth, srcheight, srcstride;
+	size_t rows, strip_rows, row, n, y, ny, i;
+	uint8_t resize, direct;
+	uint64_t mark = stageMark(enc);
+	
+	if( cropRegion(enc,&srcx,&srcy,&srcwidth,&srcheight) ) {
+		return 1;
+	}
+	stageTime(enc,ENC_STAGE_CROP,&mark);
+	srcstride = 3*enc->imgwidth;
+	srcpixels = &(enc->imgpixels[srcy*srcstride+3*srcx]);
+	renderSize(enc,srcwidth,srcheight,pixels_per_col,pixel_ratio);
+	
+	rows = enc->state->height / rows_per_char;
+	strip_rows = 1;
+	if( enc->state->width && 3*enc->state->width*rows_per_char < ENC_STRIP_BYTES ) {
+		strip_rows = ENC_STRIP_BYTES / (3*enc->state->width*rows_per_char);
+	}
+	if( strip_rows > rows ) {
+		strip_rows = rows;
+	}
+	resize = srcwidth != enc->state->width || srcheight != enc->state->height;
+	//Unmodified, contiguous rows are rendered straight from the source image
+	direct = !resize && srcwidth == enc->imgwidth && enc->filter == ENC_FILTER_NONE && !enc->palsize;
+	
+	if( !direct && strip_rows ) {
+		if( allocResize(enc,enc->state->width*strip_rows*rows_per_char) ) {
+			fprintf(stderr,"Failed to allocate RGB pixels for resize: %ld %ld %ld\n",enc->win_width,enc->state->width,enc->state->height);
+			return 1;
+		}
+	}
+	if( enc->palsize && strip_rows ) {
+		if( allocPalette(enc,enc->state->width*strip_rows*rows_per_char) ) {
+			return 1;
+		}
+	}
+	
+	ansiBegin(enc,enc->state->width/(size_t)pixels_per_col,rows);
+	for( row=0; row<rows; row=row+n ) {
+		n = rows-row;
+		if( n > strip_rows ) {
+			n = strip_rows;
+		}
+		y = row*rows_per_char;
+		ny = n*rows_per_char;
+		if( direct ) {
+			strippixels = &(srcpixels[y*srcstride]);
+		}
+		else {
+			strippixels = enc->state->rszpixels;
+			if( resize ) {
+				//Only the input rows that contribute to this strip are sampled
+				if( ! stbir_resize_subpixel(srcpixels,srcwidth,srcheight,srcstride,
+						strippixels,enc->state->width,ny,0,
+						STBIR_TYPE_UINT8,3,STBIR_ALPHA_CHANNEL_NONE,0,
+						STBIR_EDGE_CLAMP,STBIR_EDGE_CLAMP,
+						STBIR_FILTER_DEFAULT,STBIR_FILTER_DEFAULT,
+						STBIR_COLORSPACE_LINEAR,enc,
+						(float)enc->state->width/(float)srcwidth,(float)enc->state->height/(float)srcheight,
+						0,(float)y) ) {
+					fprintf(stderr,"Failed to resize image to: %ld %ld\n",enc->state->width,enc->state->height);
+					ansiEnd(enc);
+					return 1;
+				}
+			}
+			else {
+				for( i=0; i<ny; i++ ) {
+					memcpy(&(strippixels[3*i*enc->state->width]),&(srcpixels[(y+i)*srcstride]),3*enc->state->width);
+				}
+			}
+			stageTime(enc,ENC_STAGE_RESIZE,&mark);
+			if( enc->filter == ENC_FILTER_APPLE2 ) {
+				apple2( strippixels, strippixels, enc->state->width, ny, 0, 0 );
+			}
+			else if( enc->filter == ENC_FILTER_APPLE2_BW ) {
+				apple2( strippixels, strippixels, enc->state->width, ny, 1, enc->color_rgb );
+			}
+			stageTime(enc,ENC_STAGE_FILTER,&mark);
+			if( enc->palsize ) {
+				quant_apply_palette(enc->state->palette, enc->palsize,
+					enc->state->palpixels, strippixels, enc->state->width*ny,
+					1);
+			}
+			stageTime(enc,ENC_STAGE_QUANTIZE,&mark);
+		}
+		TRACE_BEGIN("render");
+		encode_rows(enc,strippixels,n);
+		TRACE_END("render");
+		//Rendering is charged by term_encode()
+		mark = stageMark(enc);
+	}
+	ansiEnd(enc);
+	enc->state->rgbpixels = 0;
+	return 0;
+}
+
+//Prepare the image using the renderer's pixel layout
+static int prepRenderer( term_encode_t* enc ) {
+	return prepImage(enc,renderer_info[enc->renderer].pixels_per_col,renderer_info[enc->renderer].pixel_ratio);
+}
+
+//Encode with one of the ANSI character renderers, using the pixel layout
+//in renderer_info
+static int ansiEncode( term_encode_t* enc, ansi_rows_fn encode_rows ) {
+	float pixels_per_col = renderer_info[enc->renderer].pixels_per_col;
+	float pixel_ratio = renderer_info[enc->renderer].pixel_ratio;
+	size_t rows_per_char = renderer_info[enc->renderer].rows_per_char;
+	if( stripEligible(enc) ) {
+		return stripEncode(enc,pixels_per_col,pixel_ratio,rows_per_char,encode_rows);
+	}
+	if( prepImage(enc,pixels_per_col,pixel_ratio) ) { return 1; }
+	TRACE_BEGIN("render");
+	ansiBegin(enc,enc->state->width/(size_t)pixels_per_col,enc->state->height/rows_per_char);
+	encode_rows(enc,enc->state->rgbpixels,enc->state->height/rows_per_char);
+	ansiEnd(enc);
+	TRACE_END("render");
 	return 0;
 }
 
@@ -1480,23 +2642,44 @@ void term_encode_init(term_encode_t* enc) {
 	memset(enc,0,sizeof(term_encode_t));
 }
 
+void term_encode_finish(term_encode_t* enc) {
+	struct term_encode_state* state = enc->state;
+	if( state == 0 ) {
+		return;
+	}
+	if( state->sixelshared && enc->textfp ) {
+		//Each image has its own color registers again (the default)
+		fwrite("\x1b[?1070h",1,8,enc->textfp);
+		fflush(enc->textfp);
+	}
+	state->sixelshared = 0;
+	//The next image starts a new stream, so nothing on the terminal is reused
+	state->sixelregslen = 0;
+	state->sixelwidth = 0;
+	state->sixelheight = 0;
+}
+
 void term_encode_destroy(term_encode_t* enc) {
-	if( enc->rgbpixels && enc->rgbpixels != enc->imgpixels ) {
-		free(enc->rgbpixels);
-		enc->rgbpixels = 0;
-	}
+	struct term_encode_state* state = enc->state;
 	if( enc->imgpixels ) {
 		free(enc->imgpixels);
 		enc->imgpixels = 0;
 	}
-	if( enc->palpixels ) {
-		free(enc->palpixels);
-		enc->palpixels = 0;
-	}
-	if( enc->palette ) {
-		free(enc->palette);
-		enc->palette = 0;
+	if( state == 0 ) {
+		return;
 	}
+	arenaReset(enc);
+	#ifdef USE_LIBCACA
+	cacaFree(enc);
+	#endif
+	encFree(enc,state->arena);
+	encFree(enc,state->rszpixels);
+	encFree(enc,state->edgepixels);
+	encFree(enc,state->palpixels);
+	encFree(enc,state->sixelpixels);
+	encFree(enc,state->sixelcache);
+	encFree(enc,state);
+	enc->state = 0;
 }
 
 //Use ioctl/TIOCGWINSZ to get terminal size
@@ -1507,95 +2690,297 @@ int term_encode_detect_win_width(term_encode_t* enc) {
 	return 0;
 }
 
-int term_encode(term_encode_t* enc) {
-	if( (enc->stdpal && enc->reqpalsize != 0 && enc->reqpalsize != 16 && enc->reqpalsize != 256 && enc->reqpalsize != 24) ||
-			enc->reqpalsize > 256 ) {
-		enc->palsize = 0;
-		fprintf(stderr,"Invalid palette size\n");
+size_t term_encode_pixel_width(term_encode_t* enc) {
+	if( enc->renderer >= RENDERER_INFO_LEN ) {
+		return 0;
+	}
+	return enc->win_width*renderer_info[enc->renderer].pixels_per_col;
+}
+
+uint32_t term_encode_version(void) {
+	return (TERM_ENCODE_VERSION_MAJOR<<16) | TERM_ENCODE_VERSION_MINOR;
+}
+
+int term_encode_renderer_info(uint8_t renderer, term_encode_renderer_info_t* info) {
+	if( renderer >= RENDERER_INFO_LEN || renderer_info[renderer].name == 0 ) {
 		return 1;
 	}
-	enc->palsize = enc->reqpalsize;
+	#ifndef USE_LIBSIXEL
+	if( renderer == ENC_RENDER_LIBSIXEL ) { return 1; }
+	#endif
+	#ifndef USE_AALIB
+	if( renderer >= ENC_RENDER_AA && renderer <= ENC_RENDER_AABGEXT ) { return 1; }
+	#endif
+	#ifndef USE_LIBCACA
+	if( renderer == ENC_RENDER_CACA || renderer == ENC_RENDER_CACABLK ) { return 1; }
+	#endif
+	*info = renderer_info[renderer];
+	return 0;
+}
+
+int term_encode_get_stats(term_encode_t* enc, term_encode_stats_t* stats) {
+	if( enc->state == 0 ) {
+		return 1;
+	}
+	*stats = enc->state->stats;
+	return 0;
+}
+
+void term_encode_stats_add(term_encode_stats_t* total, const term_encode_stats_t* stats) {
+	size_t i;
+	total->frames += stats->frames;
+	for( i=0; i<ENC_STAGE_COUNT; i++ ) {
+		total->stage_ns[i] += stats->stage_ns[i];
+	}
+	total->total_ns += stats->total_ns;
+	total->text_bytes += stats->text_bytes;
+	total->escapes += stats->escapes;
+	if( stats->palsize > total->palsize ) {
+		total->palsize = stats->palsize;
+	}
+	total->allocs += stats->allocs;
+}
+
+void term_encode_stats_print(FILE* fp, const term_encode_stats_t* total) {
+	double frames = total->frames ? (double)total->frames : 1.0;
+	size_t i;
+	fprintf(fp,"encoder stats: %lu frames, %.3f ms/frame\n",
+		(unsigned long)total->frames,total->total_ns/frames/1000000.0);
+	for( i=0; i<ENC_STAGE_COUNT; i++ ) {
+		fprintf(fp,"  %-8s %9.3f ms/frame %5.1f%%\n",stage_names[i],
+			total->stage_ns[i]/frames/1000000.0,
+			total->total_ns ? 100.0*total->stage_ns[i]/total->total_ns : 0.0);
+	}
+	fprintf(fp,"  text     %9.0f bytes/frame, %.0f escapes/frame\n",
+		total->text_bytes/frames,total->escapes/frames);
+	fprintf(fp,"  palette  %9lu colors (largest)\n",(unsigned long)total->palsize);
+	fprintf(fp,"  allocs   %9.1f /frame (%lu total)\n",
+		total->allocs/frames,(unsigned long)total->allocs);
+}
+
+void term_encode_trace_start(void) {
+	trace_start();
+}
+
+void term_encode_trace_begin(const char* name) {
+	TRACE_BEGIN(name);
+}
+
+void term_encode_trace_end(const char* name) {
+	TRACE_END(name);
+}
+
+void term_encode_trace_thread(const char* name) {
+	if( trace_enabled ) {
+		trace_thread_name(name);
+	}
+}
+
+int term_encode_trace_write(const char* path) {
+	return trace_write(path);
+}
+
+uint64_t term_encode_hash(uint64_t hash, const void* data, size_t len) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	const uint8_t* end = bytes+len;
+	uint64_t word;
+	//FNV-1a over 64-bit words (so large files hash at memory speed), with
+	//the high bits folded back down since a multiply only carries upwards
+	while( end-bytes >= 8 ) {
+		memcpy(&word,bytes,8);
+		hash = (hash ^ word) * 0x100000001b3ULL;
+		hash ^= hash >> 29;
+		bytes += 8;
+	}
+	while( bytes < end ) {
+		hash = (hash ^ *(bytes++)) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+//Bump when a change to the encoder changes its output, so old cache
+//entries are no longer found
+#define TERM_ENCODE_CACHE_VERSION 3
+
+uint64_t term_encode_cache_key(term_encode_t* enc, uint64_t data_hash) {
+	//Options are hashed as fixed width values so the key does not depend
+	//upon structure padding
+	uint64_t opts[16];
+	opts[0]  = TERM_ENCODE_CACHE_VERSION;
+	opts[1]  = enc->renderer;
+	opts[2]  = enc->win_width;
+	opts[3]  = enc->reqpalsize;
+	opts[4]  = enc->stdpal;
+	#ifdef USE_QUANTPNM
+	opts[5]  = enc->dither;
+	#else
+	opts[5]  = 0;
+	#endif
+	opts[6]  = enc->crop.x;
+	opts[7]  = enc->crop.y;
+	opts[8]  = enc->crop.w;
+	opts[9]  = enc->crop.h;
+	opts[10] = enc->filter;
+	opts[11] = enc->color_rgb;
+	opts[12] = enc->invert;
+	opts[13] = enc->clearterm;
+	opts[14] = enc->runs;
+	opts[15] = enc->sixel;
+	return term_encode_hash(data_hash,opts,sizeof(opts));
+}
+
+//Encode with the selected renderer
+static int encodeRenderer( term_encode_t* enc ) {
+	int error;
 	
 	if( enc->renderer && enc->textfp == 0 ){
 		enc->textfp = stdout;
 	}
 	
 	if( enc->clearterm ) {
-		fprintf(enc->textfp,"\x1b[2J\x1b[H");
+		textPrintf(enc,"\x1b[2J\x1b[H");
 	}
 	
 	if( enc->renderer == ENC_RENDER_NONE ) {
 	}
-	#ifdef USE_LIBSIXEL
 	else if( enc->renderer == ENC_RENDER_SIXEL ) {
-		if( prepImage(enc,1,1.0) ) { return 1; }
-		sixelEncode(enc);
+		//Sixel images are palettized, so true color is given an optimal
+		//palette of 256 colors
+		if( !enc->stdpal && enc->palsize == 0 ) {
+			enc->palsize = 256;
+		}
+		if( prepRenderer(enc) ) { return 1; }
+		TRACE_BEGIN("render");
+		error = sixelEncode(enc);
+		TRACE_END("render");
+		if( error ) { return 1; }
+	}
+	#ifdef USE_LIBSIXEL
+	else if( enc->renderer == ENC_RENDER_LIBSIXEL ) {
+		if( prepRenderer(enc) ) { return 1; }
+		libsixelEncode(enc);
 	}
 	#endif //USE_LIBSIXEL
 	else if( enc->renderer == ENC_RENDER_SIMPLE ) {
-		//pixel_ratio manually fine tuned based on Dejavu San Monospace
-		if( prepImage(enc,1,0.48) ) { return 1; }
-		ansiEncodeSimple( enc );
+		if( ansiEncode(enc,ansiEncodeSimple) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_HALF ) {
-		//pixel_ratio manually fine tuned based on Dejavu San Monospace
-		if( prepImage(enc,1.0,0.97) ) { return 1; }
-		ansiEncodeHalfHeight( enc );
+		if( ansiEncode(enc,ansiEncodeHalfHeight) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_QUARTER ) {
-		//pixel_ratio manually fine tuned based on Dejavu San Monospace
-		if( prepImage(enc,2.0,0.48) ) { return 1; }
-		ansiEncodeQuarter( enc );
+		if( ansiEncode(enc,ansiEncodeQuarter) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_SEXTANT ) {
-		//pixel_ratio manually fine tuned based on Dejavu San Monospace
-		if( prepImage(enc,2.0,0.72) ) { return 1; }
-		ansiEncodeSextant( enc );
+		if( ansiEncode(enc,ansiEncodeSextant) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_BRAILLE ) {
-		//pixel_ratio manually fine tuned based on Dejavu San Monospace
-		if( prepImage(enc,2.0,0.95) ) { return 1; }
-		ansiEncodeBraille( enc );
+		if( ansiEncode(enc,ansiEncodeBraille) ) { return 1; }
 	}
 	#ifdef USE_AALIB
 	else if( enc->renderer == ENC_RENDER_AA ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiEncode(enc,0) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_AAEXT ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiEncode(enc,1) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_AAFG ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiColorEncode(enc,ENC_FGCOLOR,0) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_AAFGEXT ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiColorEncode(enc,ENC_FGCOLOR,1) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_AABG ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiColorEncode(enc,ENC_BGCOLOR,0) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_AABGEXT ) {
-		if( prepImage(enc,2.0,0.5) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( asciiColorEncode(enc,ENC_BGCOLOR,1) ) { return 1; }
 	}
 	#endif //USE_AALIB
 	#ifdef USE_LIBCACA
 	else if( enc->renderer == ENC_RENDER_CACA ) {
-		if( prepImage(enc,1.0,1.0) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( cacaEncode(enc,0) ) { return 1; }
 	}
 	else if( enc->renderer == ENC_RENDER_CACABLK ) {
-		if( prepImage(enc,1.0,1.0) ) { return 1; }
+		if( prepRenderer(enc) ) { return 1; }
 		if( cacaEncode(enc,1) ) { return 1; }
 	}
 	#endif //USE_LIBCACA
+	else if( enc->renderer >= ENC_RENDER_ASCII && enc->renderer <= ENC_RENDER_ASCIIBGEXT ) {
+		if( ansiEncode(enc,ansiEncodeAscii) ) { return 1; }
+	}
 	else {
 		fprintf(stderr,"Renderer not implemented.");
 		return 1;
 	}
 	return 0;
 }
+
+int term_encode(term_encode_t* enc) {
+	term_encode_stats_t* stats;
+	uint64_t start = stageMark(enc);
+	uint64_t mark, now;
+	size_t i;
+	int error;
+	if( (enc->stdpal && enc->reqpalsize != 0 && enc->reqpalsize != 16 && enc->reqpalsize != 256 && enc->reqpalsize != 24) ||
+			enc->reqpalsize > 256 ) {
+		enc->palsize = 0;
+		fprintf(stderr,"Invalid palette size\n");
+		return 1;
+	}
+	enc->palsize = enc->reqpalsize;
+	if( enc->runs > ENC_RUNS_REP ) {
+		fprintf(stderr,"Invalid run mode\n");
+		return 1;
+	}
+	if( enc->sixel > ENC_SIXEL_DELTA ) {
+		fprintf(stderr,"Invalid sixel mode\n");
+		return 1;
+	}
+	
+	if( enc->state == 0 ) {
+		enc->state = (struct term_encode_state*)encAlloc(enc,sizeof(struct term_encode_state));
+		if( enc->state == 0 ) {
+			fprintf(stderr,"Failed to allocate encoder state\n");
+			return 1;
+		}
+		memset(enc->state,0,sizeof(struct term_encode_state));
+	}
+	
+	stats = &(enc->state->stats);
+	memset(stats,0,sizeof(term_encode_stats_t));
+	stats->frames = 1;
+	mark = stageMark(enc);
+	TRACE_BEGIN("term_encode");
+	error = encodeRenderer(enc);
+	arenaReset(enc);
+	TRACE_END("term_encode");
+	stats->palsize = enc->palsize;
+	if( enc->stats ) {
+		//Whatever was not charged to another stage was spent rendering
+		now = nowNs();
+		stats->stage_ns[ENC_STAGE_RENDER] = now-mark;
+		for( i=0; i<ENC_STAGE_COUNT; i++ ) {
+			if( i != ENC_STAGE_RENDER ) {
+				stats->stage_ns[ENC_STAGE_RENDER] -= stats->stage_ns[i];
+			}
+		}
+		if( enc->textfp ) {
+			fflush(enc->textfp);
+		}
+		//The binary file is closed by the encoder when it is done
+		if( enc->binaryfp ) {
+			fflush(enc->binaryfp);
+		}
+		stageTime(enc,ENC_STAGE_WRITE,&now);
+		stats->total_ns = now-start;
+	}
+	return error;
+}
+
@@ -26,8 +26,29 @@
 #ifndef __TERM_ENCODE_H__
 #define __TERM_ENCODE_H__
 
+#include <stdio.h>
 #include <stdint.h>
 
+//API version
+//The major version changes when term_encode_t, a function signature, or the
+//meaning of a field or constant changes incompatibly; the shared library's
+//soname (libterm_encode.so.MAJOR) changes with it.  The minor version
+//changes when something is added (fields are added at the end of
+//term_encode_t).
+//2.0: alloc_fn/free_fn/alloc_ctx, stats, runs, and sixel fields, stats,
+//     tracing, and term_encode_finish() functions, the ASCII renderers, and
+//     ENC_RENDER_SIXEL is the built-in encoder (libsixel is
+//     ENC_RENDER_LIBSIXEL)
+#define TERM_ENCODE_VERSION_MAJOR 2
+#define TERM_ENCODE_VERSION_MINOR 0
+
+//Functions exported from libterm_encode.so (everything else is hidden)
+#if defined(__GNUC__)
+#define TERM_ENCODE_API __attribute__((visibility("default")))
+#else
+#define TERM_ENCODE_API
+#endif
+
 /////////////
 // Renderers
 /////////////
@@ -46,6 +67,15 @@
 #define ENC_RENDER_AABGEXT   13
 #define ENC_RENDER_CACA      14
 #define ENC_RENDER_CACABLK   15
+//Native ASCII art (no aalib), in the same variations as ENC_RENDER_AA*
+#define ENC_RENDER_ASCII      16
+#define ENC_RENDER_ASCIIEXT   17
+#define ENC_RENDER_ASCIIFG    18
+#define ENC_RENDER_ASCIIFGEXT 19
+#define ENC_RENDER_ASCIIBG    20
+#define ENC_RENDER_ASCIIBGEXT 21
+//Sixel through libsixel (ENC_RENDER_SIXEL is built in)
+#define ENC_RENDER_LIBSIXEL   22
 
 //////////////////////////////
 // Image Filter Processing
@@ -58,6 +88,45 @@
 #define ENC_FILTER_APPLE2         5
 #define ENC_FILTER_APPLE2_BW      6
 
+//////////////////////////////
+// Run-length Text Output
+//////////////////////////////
+//Every character cell is written
+#define ENC_RUNS_NONE  0
+//Runs of blanks are erased (ECH) and stepped over (CUF), and blanks at
+//the end of a line in the default background are erased to the end of the
+//line (EL).  The terminal must erase with the current background color.
+#define ENC_RUNS_ERASE 1
+//As ENC_RUNS_ERASE, plus runs of any other character are repeated (REP)
+#define ENC_RUNS_REP   2
+
+//////////////////////////////
+// Sixel Image Updates
+//////////////////////////////
+//Each image defines its color registers and sends all of its bands
+#define ENC_SIXEL_FULL  0
+//Color registers are shared between images (DECRST 1070), defined by the
+//first image, and only redefined when their color changes.
+//term_encode_finish() turns DECSET 1070 back on at the end of the stream.
+#define ENC_SIXEL_REUSE 1
+//As ENC_SIXEL_REUSE, plus only the bands (6 pixel rows) that changed are
+//sent, drawn over the last image.  Each image must be the same size and
+//at the same position (as vidconvert's frames are).
+#define ENC_SIXEL_DELTA 2
+
+//////////////////////////////
+// Encoder Stages (timed in term_encode_stats_t)
+//////////////////////////////
+#define ENC_STAGE_CROP      0
+#define ENC_STAGE_RESIZE    1
+#define ENC_STAGE_FILTER    2
+#define ENC_STAGE_QUANTIZE  3
+//Character selection and formatting of the output
+#define ENC_STAGE_RENDER    4
+//Flushing textfp/binaryfp at the end of the call
+#define ENC_STAGE_WRITE     5
+#define ENC_STAGE_COUNT     6
+
 typedef struct {
 	size_t x;
 	size_t y;
@@ -98,11 +167,10 @@ typedef struct {
 	//false - Do not include terminal clear
 	uint8_t clearterm;
 	
-	#ifdef USE_QUANTPNM
 	//true  - Use quantizer derived from pnmcolormap.c
 	//false - Use quantizer without dither
+	//Ignored if the library is built without USE_QUANTPNM
 	uint8_t dither;
-	#endif
 	
 	//true  - Use a standard palette
 	//false - Use an optimal palette
@@ -147,23 +215,131 @@ typedef struct {
 	FILE* binaryfp;
 	
 	///////////////////////////////
-	// Internal Encoder Variables
+	// Internal Encoder State
+	///////////////////////////////
+	//Buffers reused from call to call, allocated by term_encode() and
+	//freed by term_encode_destroy().  A term_encode_t may be copied (to
+	//share a configuration) only while this is 0.
+	struct term_encode_state* state;
+	
+	///////////////////////////////
+	// Encoder input arguments added since version 1.0
 	///////////////////////////////
-	//RGB pixels
-	uint8_t* rgbpixels;
-	//Palette indexes for RGB pixels
-	uint8_t* palpixels;
-	//Palette used by palpixels
-	//Length is palsize
-	uint8_t* palette;
-	//Size of rgbpixel/palpixels
-	size_t width;
-	size_t height;
+	//New fields only ever go at the end, so the fields above keep their
+	//offsets
+	
+	//Optional allocator for the encoder's memory (0 - use malloc/free).
+	//Set before the first term_encode() and leave unchanged until
+	//term_encode_destroy().  Buffers are kept from call to call, and the
+	//scratch memory of a call comes from an arena that grows to fit, so
+	//repeated encodes of the same size make no allocator calls.
+	//imgpixels is always released with free().
+	void* (*alloc_fn)(void* ctx, size_t size);
+	void (*free_fn)(void* ctx, void* ptr);
+	void* alloc_ctx;
+	
+	//1 - Time each stage of term_encode() (see term_encode_get_stats()).
+	//    The output files are flushed at the end of each call, so that
+	//    writing them is timed as well.
+	//0 - Only the counters are kept
+	uint8_t stats;
+	
+	//How repeated character cells are written to textfp
+	//One of ENC_RUNS_* (ANSI and aalib/libcaca renderers)
+	uint8_t runs;
+	
+	//How each image is written by the sixel renderer
+	//One of ENC_SIXEL_*
+	uint8_t sixel;
 } term_encode_t;
 
-void term_encode_init(term_encode_t* enc);
-void term_encode_destroy(term_encode_t* enc);
-int term_encode_detect_win_width(term_encode_t* enc);
-int term_encode(term_encode_t* enc);
+//Encoders share no state, so separate encoders may be used in parallel
+//threads (aalib, libcaca, and libsixel renderers excepted)
+TERM_ENCODE_API void term_encode_init(term_encode_t* enc);
+//End a stream of images, and put back any terminal mode changed for it
+//(ENC_SIXEL_REUSE and ENC_SIXEL_DELTA turn off DECSET 1070 to share color
+//registers).  Call after the last term_encode(), while textfp is still
+//open.  The next term_encode() starts a new stream.
+TERM_ENCODE_API void term_encode_finish(term_encode_t* enc);
+TERM_ENCODE_API void term_encode_destroy(term_encode_t* enc);
+TERM_ENCODE_API int term_encode_detect_win_width(term_encode_t* enc);
+//Pixel width the renderer will resize the image to (0 if win_width is not
+//set).  Large images can be decoded at a reduced size that is still wider.
+TERM_ENCODE_API size_t term_encode_pixel_width(term_encode_t* enc);
+TERM_ENCODE_API int term_encode(term_encode_t* enc);
+
+//Version of the library, (TERM_ENCODE_VERSION_MAJOR<<16)|TERM_ENCODE_VERSION_MINOR
+//A program should check that the major version matches the header it was
+//built with.
+TERM_ENCODE_API uint32_t term_encode_version(void);
+
+//How a renderer maps image pixels to characters
+typedef struct {
+	//Short name of the renderer ("half", "braille", ...)
+	const char* name;
+	//Image pixels per character column; the image is resized to
+	//win_width*pixels_per_col pixels wide
+	float pixels_per_col;
+	//Correction for the shape of a character cell; the resized height is
+	//scaled by pixel_ratio
+	float pixel_ratio;
+	//Image pixel rows per character row (0 if the renderer lays out the
+	//characters itself)
+	uint8_t rows_per_char;
+} term_encode_renderer_info_t;
+
+//Fill info for one of ENC_RENDER_*.  Returns 1 if the renderer is unknown
+//or not built into the library.
+TERM_ENCODE_API int term_encode_renderer_info(uint8_t renderer, term_encode_renderer_info_t* info);
+
+//Figures for one term_encode() call (or a sum of them)
+typedef struct {
+	//Number of term_encode() calls summed
+	uint64_t frames;
+	//Monotonic time spent in each ENC_STAGE_* (0 unless stats is set)
+	uint64_t stage_ns[ENC_STAGE_COUNT];
+	//Monotonic time spent in term_encode() (0 unless stats is set)
+	uint64_t total_ns;
+	//Bytes and escape sequences written to textfp (libsixel output
+	//is not counted)
+	uint64_t text_bytes;
+	uint64_t escapes;
+	//Palette size reached (the largest, when summed)
+	uint64_t palsize;
+	//Calls to the allocator (alloc_fn or malloc)
+	uint64_t allocs;
+} term_encode_stats_t;
+
+//Get the figures for the last term_encode() call.
+//Returns 1 if the encoder has not been used.
+TERM_ENCODE_API int term_encode_get_stats(term_encode_t* enc, term_encode_stats_t* stats);
+//Add the figures of stats to total
+TERM_ENCODE_API void term_encode_stats_add(term_encode_stats_t* total, const term_encode_stats_t* stats);
+//Print a summary of total (per frame averages) to fp
+TERM_ENCODE_API void term_encode_stats_print(FILE* fp, const term_encode_stats_t* total);
+
+//Tracing
+//Record begin/end events (term_encode() and each of its stages, plus any
+//the caller adds) and write them as a Chrome trace event file, which
+//chrome://tracing and ui.perfetto.dev can open.  Each thread records into
+//its own buffer without locks; while tracing is off an event is one branch.
+//Names are not copied, so they must be string literals.
+TERM_ENCODE_API void term_encode_trace_start(void);
+TERM_ENCODE_API void term_encode_trace_begin(const char* name);
+TERM_ENCODE_API void term_encode_trace_end(const char* name);
+//Name the calling thread in the trace (only while tracing)
+TERM_ENCODE_API void term_encode_trace_thread(const char* name);
+//Stop tracing and write the events to path (after other threads are done)
+TERM_ENCODE_API int term_encode_trace_write(const char* path);
+
+//Output cache keys
+//A key is a hash (FNV-1a over 64-bit words) of the input file bytes followed
+//by every option that changes the encoded output, so identical requests map
+//to the same key.
+#define TERM_ENCODE_HASH_INIT 0xcbf29ce484222325ULL
+TERM_ENCODE_API uint64_t term_encode_hash(uint64_t hash, const void* data, size_t len);
+//data_hash is term_encode_hash(TERM_ENCODE_HASH_INIT,filedata,filelen)
+//(plus anything else the caller does that changes the decoded image)
+TERM_ENCODE_API uint64_t term_encode_cache_key(term_encode_t* enc, uint64_t data_hash);
 
 #endif //__TERM_ENCODE_H__
\ No newline at end of file
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2022, Daniel Tabor
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+//Begin/end events in the Chrome trace event format (chrome://tracing,
+//ui.perfetto.dev).  Every thread records into its own buffer, so recording
+//takes no locks; a thread's buffer is registered in a list the first time it
+//records an event.  While tracing is off an event costs one branch.
+//Event names are not copied, so they must be string literals (or otherwise
+//outlive the trace).
+
+//Nonzero between trace_start() and trace_write()
+extern int trace_enabled;
+
+#define TRACE_BEGIN(name) do { if( trace_enabled ) { trace_event('B',name,0); } } while(0)
+#define TRACE_END(name) do { if( trace_enabled ) { trace_event('E',name,0); } } while(0)
+
+//Start recording (timestamps in the file are relative to this call)
+void trace_start( void );
+//Record an event with phase 'B' or 'E' at ts_ns (CLOCK_MONOTONIC), or now
+//if ts_ns is 0
+void trace_event( char phase, const char* name, uint64_t ts_ns );
+//Name the calling thread in the trace
+void trace_thread_name( const char* name );
+//Stop recording and write {"traceEvents":[...]} to path.  Other threads
+//should be finished (or idle) by now; events they record while the file
+//is written may be missing.
+int trace_write( const char* path );
+
+#ifdef TRACE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TRACE_CHUNK_EVENTS 4096
+
+typedef struct {
+	uint64_t ts;
+	const char* name;
+	char phase;
+} trace_event_t;
+
+typedef struct trace_chunk {
+	struct trace_chunk* next;
+	size_t len;
+	trace_event_t events[TRACE_CHUNK_EVENTS];
+} trace_chunk_t;
+
+typedef struct trace_thread {
+	struct trace_thread* next;
+	trace_chunk_t* first;
+	trace_chunk_t* last;
+	const char* name;
+	uint32_t tid;
+} trace_thread_t;
+
+int trace_enabled = 0;
+static uint64_t trace_start_ns = 0;
+static uint32_t trace_next_tid = 0;
+static trace_thread_t* trace_threads = 0;
+static __thread trace_thread_t* trace_self = 0;
+
+static uint64_t trace_now( void ) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+void trace_start( void ) {
+	trace_start_ns = trace_now();
+	__atomic_store_n(&trace_enabled,1,__ATOMIC_RELEASE);
+}
+
+//Buffer of the calling thread, registered on first use
+static trace_thread_t* trace_thread( void ) {
+	trace_thread_t* thread = trace_self;
+	if( thread == 0 ) {
+		thread = (trace_thread_t*)calloc(1,sizeof(trace_thread_t));
+		if( thread == 0 ) {
+			return 0;
+		}
+		thread->tid = __atomic_add_fetch(&trace_next_tid,1,__ATOMIC_RELAXED);
+		thread->next = __atomic_load_n(&trace_threads,__ATOMIC_RELAXED);
+		while( !__atomic_compare_exchange_n(&trace_threads,&thread->next,thread,1,
+				__ATOMIC_RELEASE,__ATOMIC_RELAXED) ) {
+		}
+		trace_self = thread;
+	}
+	return thread;
+}
+
+void trace_event( char phase, const char* name, uint64_t ts_ns ) {
+	trace_thread_t* thread = trace_thread();
+	trace_chunk_t* chunk;
+	trace_event_t* event;
+	if( thread == 0 ) {
+		return;
+	}
+	chunk = thread->last;
+	if( chunk == 0 || chunk->len == TRACE_CHUNK_EVENTS ) {
+		chunk = (trace_chunk_t*)malloc(sizeof(trace_chunk_t));
+		if( chunk == 0 ) {
+			return;
+		}
+		chunk->next = 0;
+		chunk->len = 0;
+		if( thread->last ) {
+			__atomic_store_n(&thread->last->next,chunk,__ATOMIC_RELEASE);
+		}
+		else {
+			__atomic_store_n(&thread->first,chunk,__ATOMIC_RELEASE);
+		}
+		thread->last = chunk;
+	}
+	event = &(chunk->events[chunk->len]);
+	event->ts = ts_ns ? ts_ns : trace_now();
+	event->name = name;
+	event->phase = phase;
+	//Publish the event to trace_write()
+	__atomic_store_n(&chunk->len,chunk->len+1,__ATOMIC_RELEASE);
+}
+
+void trace_thread_name( const char* name ) {
+	trace_thread_t* thread = trace_thread();
+	if( thread ) {
+		thread->name = name;
+	}
+}
+
+int trace_write( const char* path ) {
+	trace_thread_t* thread;
+	trace_chunk_t* chunk;
+	trace_event_t* event;
+	size_t i, len;
+	int first = 1;
+	FILE* fp;
+	__atomic_store_n(&trace_enabled,0,__ATOMIC_RELEASE);
+	fp = fopen(path,"w");
+	if( fp == 0 ) {
+		fprintf(stderr,"Failed to open trace file: %s\n",path);
+		return 1;
+	}
+	fprintf(fp,"{\"traceEvents\":[");
+	for( thread = __atomic_load_n(&trace_threads,__ATOMIC_ACQUIRE); thread; thread = thread->next ) {
+		if( thread->name ) {
+			fprintf(fp,"%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",",thread->tid,thread->name);
+			first = 0;
+		}
+		for( chunk = __atomic_load_n(&thread->first,__ATOMIC_ACQUIRE); chunk; chunk = __atomic_load_n(&chunk->next,__ATOMIC_ACQUIRE) ) {
+			len = __atomic_load_n(&chunk->len,__ATOMIC_ACQUIRE);
+			for( i=0; i<len; i++ ) {
+				event = &(chunk->events[i]);
+				//Events from before trace_start() are clamped to the start
+				fprintf(fp,"%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+					first ? "" : ",",event->name,event->phase,
+					event->ts > trace_start_ns ? (event->ts-trace_start_ns)/1000.0 : 0.0,
+					thread->tid);
+				first = 0;
+			}
+		}
+	}
+	fprintf(fp,"\n],\"displayTimeUnit\":\"ms\"}\n");
+	if( fclose(fp) ) {
+		fprintf(stderr,"Failed to write trace file: %s\n",path);
+		return 1;
+	}
+	return 0;
+}
+
+#endif //TRACE_IMPLEMENTATION
+#endif //__TRACE_H__
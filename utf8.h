@@ -28,100 +28,142 @@
 
 #include <stdint.h>
 
+//A character encoded ahead of time, to be written as len bytes with no
+//encoding work (characters below 0x200000, which covers all of Unicode).
+//Like a utf8_encode() string, 0 is empty.
+typedef struct {
+	uint8_t bytes[4];
+	uint8_t len;
+} utf8_glyph_t;
+
+//Constant initializer for the utf8_glyph_t of character c, used to build
+//glyph tables at compile time from the same list as a character table:
+//  #define CHARS(X) X(0x0020), X(0x2580)
+//  uint16_t chars[2] = { CHARS(UTF8_CODE) };
+//  const utf8_glyph_t glyphs[2] = { CHARS(UTF8_GLYPH) };
+#define UTF8_CODE(c) (c)
+#define UTF8_GLYPH(c) { { \
+	(c) < 0x80    ? (c) : \
+	(c) < 0x800   ? 0xC0 | ((c)>>6) : \
+	(c) < 0x10000 ? 0xE0 | ((c)>>12) : 0xF0 | (((c)>>18)&0x07), \
+	(c) < 0x80    ? 0 : \
+	(c) < 0x800   ? 0x80 | ((c)&0x3F) : \
+	(c) < 0x10000 ? 0x80 | (((c)>>6)&0x3F) : 0x80 | (((c)>>12)&0x3F), \
+	(c) < 0x800   ? 0 : \
+	(c) < 0x10000 ? 0x80 | ((c)&0x3F) : 0x80 | (((c)>>6)&0x3F), \
+	(c) < 0x10000 ? 0 : 0x80 | ((c)&0x3F) }, \
+	(c) == 0 ? 0 : (c) < 0x80 ? 1 : (c) < 0x800 ? 2 : (c) < 0x10000 ? 3 : 4 }
 
 #ifndef UTF8_IMPLEMENTATION
 	#if defined(UTF8_EXT_CHARACTER_SETS)
 		extern uint32_t cp437[256];
 		extern uint32_t petscii[512];
 		extern uint32_t trs80[192];
+		extern const utf8_glyph_t cp437_glyphs[256];
+		extern const utf8_glyph_t petscii_glyphs[512];
+		extern const utf8_glyph_t trs80_glyphs[192];
 	#elif defined(UTF8_DOS_CHARACTER_SET)
 			extern uint16_t cp437[256];
+			extern const utf8_glyph_t cp437_glyphs[256];
 	#endif
 #endif
 
+//Longest encoding produced by utf8_encode (including the null)
+#define UTF8_MAX_LEN 8
+
+//Encode character into dst (at least UTF8_MAX_LEN bytes), returns dst
 char* utf8_encode(char* dst, uint32_t character);
 
+//Encode character (below 0x200000) into dst, returns dst
+utf8_glyph_t* utf8_glyph(utf8_glyph_t* dst, uint32_t character);
+
 #endif //__UTF8_H__
 
 #ifdef UTF8_IMPLEMENTATION
 
+#if defined(UTF8_EXT_CHARACTER_SETS) || defined(UTF8_DOS_CHARACTER_SET)
+#define UTF8_CP437_CHARS(X) \
+	X(0x0000),X(0x263A),X(0x263B),X(0x2665),X(0x2666),X(0x2663),X(0x2660),X(0x2022),X(0x25D8),X(0x25CB),X(0x25D9),X(0x2642),X(0x2640),X(0x266A),X(0x266B),X(0x263C), \
+	X(0x25BA),X(0x25C4),X(0x2195),X(0x203C),X(0x00B6),X(0x00A7),X(0x25AC),X(0x21A8),X(0x2191),X(0x2193),X(0x2192),X(0x2190),X(0x221F),X(0x2194),X(0x25B2),X(0x25BC), \
+	X(0x0020),X(0x0021),X(0x0022),X(0x0023),X(0x0024),X(0x0025),X(0x0026),X(0x0027),X(0x0028),X(0x0029),X(0x002A),X(0x002B),X(0x002C),X(0x002D),X(0x002E),X(0x002F), \
+	X(0x0030),X(0x0031),X(0x0032),X(0x0033),X(0x0034),X(0x0035),X(0x0036),X(0x0037),X(0x0038),X(0x0039),X(0x003A),X(0x003B),X(0x003C),X(0x003D),X(0x003E),X(0x003F), \
+	X(0x0040),X(0x0041),X(0x0042),X(0x0043),X(0x0044),X(0x0045),X(0x0046),X(0x0047),X(0x0048),X(0x0049),X(0x004A),X(0x004B),X(0x004C),X(0x004D),X(0x004E),X(0x004F), \
+	X(0x0050),X(0x0051),X(0x0052),X(0x0053),X(0x0054),X(0x0055),X(0x0056),X(0x0057),X(0x0058),X(0x0059),X(0x005A),X(0x005B),X(0x005C),X(0x005D),X(0x005E),X(0x005F), \
+	X(0x0060),X(0x0061),X(0x0062),X(0x0063),X(0x0064),X(0x0065),X(0x0066),X(0x0067),X(0x0068),X(0x0069),X(0x006A),X(0x006B),X(0x006C),X(0x006D),X(0x006E),X(0x006F), \
+	X(0x0070),X(0x0071),X(0x0072),X(0x0073),X(0x0074),X(0x0075),X(0x0076),X(0x0077),X(0x0078),X(0x0079),X(0x007A),X(0x007B),X(0x007C),X(0x007D),X(0x007E),X(0x2302), \
+	X(0x00C7),X(0x00FC),X(0x00E9),X(0x00E2),X(0x00E4),X(0x00E0),X(0x00E5),X(0x00E7),X(0x00EA),X(0x00EB),X(0x00E8),X(0x00EF),X(0x00EE),X(0x00EC),X(0x00C4),X(0x00C5), \
+	X(0x00C9),X(0x00E6),X(0x00C6),X(0x00F4),X(0x00F6),X(0x00F2),X(0x00FB),X(0x00F9),X(0x00FF),X(0x00D6),X(0x00DC),X(0x00A2),X(0x00A3),X(0x00A5),X(0x20A7),X(0x0192), \
+	X(0x00E1),X(0x00ED),X(0x00F3),X(0x00FA),X(0x00F1),X(0x00D1),X(0x00AA),X(0x00BA),X(0x00BF),X(0x2310),X(0x00AC),X(0x00BD),X(0x00BC),X(0x00A1),X(0x00AB),X(0x00BB), \
+	X(0x2591),X(0x2592),X(0x2593),X(0x2502),X(0x2524),X(0x2561),X(0x2562),X(0x2556),X(0x2555),X(0x2563),X(0x2551),X(0x2557),X(0x255D),X(0x255C),X(0x255B),X(0x2510), \
+	X(0x2514),X(0x2534),X(0x252C),X(0x251C),X(0x2500),X(0x253C),X(0x255E),X(0x255F),X(0x255A),X(0x2554),X(0x2569),X(0x2566),X(0x2560),X(0x2550),X(0x256C),X(0x2567), \
+	X(0x2568),X(0x2564),X(0x2565),X(0x2559),X(0x2558),X(0x2552),X(0x2553),X(0x256B),X(0x256A),X(0x2518),X(0x250C),X(0x2588),X(0x2584),X(0x258C),X(0x2590),X(0x2580), \
+	X(0x03B1),X(0x00DF),X(0x0393),X(0x03C0),X(0x03A3),X(0x03C3),X(0x00B5),X(0x03C4),X(0x03A6),X(0x0398),X(0x03A9),X(0x03B4),X(0x221E),X(0x03C6),X(0x03B5),X(0x2229), \
+	X(0x2261),X(0x00B1),X(0x2265),X(0x2264),X(0x2320),X(0x2321),X(0x00F7),X(0x2248),X(0x00B0),X(0x2219),X(0x00B7),X(0x221A),X(0x207F),X(0x00B2),X(0x25A0),X(0x00A0),
+
 #if defined(UTF8_EXT_CHARACTER_SETS)
-	uint32_t cp437[256] = {
-#elif defined(UTF8_DOS_CHARACTER_SET)
-	uint16_t cp437[256] = {
+	uint32_t cp437[256] = { UTF8_CP437_CHARS(UTF8_CODE) };
+#else
+	uint16_t cp437[256] = { UTF8_CP437_CHARS(UTF8_CODE) };
 #endif
-#if defined(UTF8_EXT_CHARACTER_SETS) || defined(UTF8_DOS_CHARACTER_SET)
-	0x0000,0x263A,0x263B,0x2665,0x2666,0x2663,0x2660,0x2022,0x25D8,0x25CB,0x25D9,0x2642,0x2640,0x266A,0x266B,0x263C,
-	0x25BA,0x25C4,0x2195,0x203C,0x00B6,0x00A7,0x25AC,0x21A8,0x2191,0x2193,0x2192,0x2190,0x221F,0x2194,0x25B2,0x25BC,
-	0x0020,0x0021,0x0022,0x0023,0x0024,0x0025,0x0026,0x0027,0x0028,0x0029,0x002A,0x002B,0x002C,0x002D,0x002E,0x002F,
-	0x0030,0x0031,0x0032,0x0033,0x0034,0x0035,0x0036,0x0037,0x0038,0x0039,0x003A,0x003B,0x003C,0x003D,0x003E,0x003F,
-	0x0040,0x0041,0x0042,0x0043,0x0044,0x0045,0x0046,0x0047,0x0048,0x0049,0x004A,0x004B,0x004C,0x004D,0x004E,0x004F,
-	0x0050,0x0051,0x0052,0x0053,0x0054,0x0055,0x0056,0x0057,0x0058,0x0059,0x005A,0x005B,0x005C,0x005D,0x005E,0x005F,
-	0x0060,0x0061,0x0062,0x0063,0x0064,0x0065,0x0066,0x0067,0x0068,0x0069,0x006A,0x006B,0x006C,0x006D,0x006E,0x006F,
-	0x0070,0x0071,0x0072,0x0073,0x0074,0x0075,0x0076,0x0077,0x0078,0x0079,0x007A,0x007B,0x007C,0x007D,0x007E,0x2302,
-	0x00C7,0x00FC,0x00E9,0x00E2,0x00E4,0x00E0,0x00E5,0x00E7,0x00EA,0x00EB,0x00E8,0x00EF,0x00EE,0x00EC,0x00C4,0x00C5,
-	0x00C9,0x00E6,0x00C6,0x00F4,0x00F6,0x00F2,0x00FB,0x00F9,0x00FF,0x00D6,0x00DC,0x00A2,0x00A3,0x00A5,0x20A7,0x0192,
-	0x00E1,0x00ED,0x00F3,0x00FA,0x00F1,0x00D1,0x00AA,0x00BA,0x00BF,0x2310,0x00AC,0x00BD,0x00BC,0x00A1,0x00AB,0x00BB,
-	0x2591,0x2592,0x2593,0x2502,0x2524,0x2561,0x2562,0x2556,0x2555,0x2563,0x2551,0x2557,0x255D,0x255C,0x255B,0x2510,
-	0x2514,0x2534,0x252C,0x251C,0x2500,0x253C,0x255E,0x255F,0x255A,0x2554,0x2569,0x2566,0x2560,0x2550,0x256C,0x2567,
-	0x2568,0x2564,0x2565,0x2559,0x2558,0x2552,0x2553,0x256B,0x256A,0x2518,0x250C,0x2588,0x2584,0x258C,0x2590,0x2580,
-	0x03B1,0x00DF,0x0393,0x03C0,0x03A3,0x03C3,0x00B5,0x03C4,0x03A6,0x0398,0x03A9,0x03B4,0x221E,0x03C6,0x03B5,0x2229,
-	0x2261,0x00B1,0x2265,0x2264,0x2320,0x2321,0x00F7,0x2248,0x00B0,0x2219,0x00B7,0x221A,0x207F,0x00B2,0x25A0,0x00A0,
-};
-#endif //UTF8_EXT_CHARACTERSES || UTF8_DOS_CHARACTER_SET
+const utf8_glyph_t cp437_glyphs[256] = { UTF8_CP437_CHARS(UTF8_GLYPH) };
+#endif //UTF8_EXT_CHARACTER_SETS || UTF8_DOS_CHARACTER_SET
 
 #if defined(UTF8_EXT_CHARACTER_SETS)
-uint32_t petscii[512] = {
-	//Unshifted
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00021,0x00022,0x00023,0x00024,0x00025,0x00026,0x00027,0x00028,0x00029,0x0002A,0x0002B,0x0002C,0x0002D,0x0002E,0x0002F,
-	0x00030,0x00031,0x00032,0x00033,0x00034,0x00035,0x00036,0x00037,0x00038,0x00039,0x0003A,0x0003B,0x0003C,0x0003D,0x0003E,0x0003F,
-	0x00040,0x00041,0x00042,0x00043,0x00044,0x00045,0x00046,0x00047,0x00048,0x00049,0x0004A,0x0004B,0x0004C,0x0004D,0x0004E,0x0004F,
-	0x00050,0x00051,0x00052,0x00053,0x00054,0x00055,0x00056,0x00057,0x00058,0x00059,0x0005A,0x0005B,0x000A3,0x0005D,0x02191,0x02190,
-	0x02500,0x02660,0x1FB72,0x1FB78,0x1FB77,0x1FB76,0x1FB7A,0x1FB71,0x1FB74,0x0256E,0x02570,0x0256F,0x1FB7C,0x02572,0x02571,0x1FB7D,
-	0x1FB7E,0x02022,0x1FB7B,0x02665,0x1FB70,0x0256D,0x02573,0x025CB,0x02663,0x1FB75,0x02666,0x0253C,0x1FB8C,0x02502,0x003C0,0x025E5,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x000A0,0x0258C,0x02584,0x02594,0x02581,0x0258F,0x02592,0x02595,0x1FB8F,0x025E4,0x1FB87,0x0251C,0x02597,0x02514,0x02510,0x02582,
-	0x0250C,0x02534,0x0252C,0x02524,0x0258E,0x0258D,0x1FB88,0x1FB82,0x1FB83,0x02583,0x1FB7F,0x02596,0x0259D,0x02518,0x02598,0x0259A,
-	0x02500,0x02660,0x1FB72,0x1FB78,0x1FB77,0x1FB76,0x1FB7A,0x1FB71,0x1FB74,0x0256E,0x02570,0x0256F,0x1FB7C,0x02572,0x02571,0x1FB7D,
-	0x1FB7E,0x02022,0x1FB7B,0x02665,0x1FB70,0x0256D,0x02573,0x025CB,0x02663,0x1FB75,0x02666,0x0253C,0x1FB8C,0x02502,0x003C0,0x025E5,
-	0x000A0,0x0258C,0x02584,0x02594,0x02581,0x0258F,0x02592,0x02595,0x1FB8F,0x025E4,0x1FB87,0x0251C,0x02597,0x02514,0x02510,0x02582,
-	0x0250C,0x02534,0x0252C,0x02524,0x0258E,0x0258D,0x1FB88,0x1FB82,0x1FB83,0x02583,0x1FB7F,0x02596,0x0259D,0x02518,0x02598,0x003C0,
-	//Shifted
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00021,0x00022,0x00023,0x00024,0x00025,0x00026,0x00027,0x00028,0x00029,0x0002A,0x0002B,0x0002C,0x0002D,0x0002E,0x0002F,
-	0x00030,0x00031,0x00032,0x00033,0x00034,0x00035,0x00036,0x00037,0x00038,0x00039,0x0003A,0x0003B,0x0003C,0x0003D,0x0003E,0x0003F,
-	0x00040,0x00061,0x00062,0x00063,0x00064,0x00065,0x00066,0x00067,0x00068,0x00069,0x0006A,0x0006B,0x0006C,0x0006D,0x0006E,0x0006F,
-	0x00070,0x00071,0x00072,0x00073,0x00074,0x00075,0x00076,0x00077,0x00078,0x00079,0x0007A,0x0005B,0x000A3,0x0005D,0x02191,0x02190,
-	0x02500,0x00041,0x00042,0x00043,0x00044,0x00045,0x00046,0x00047,0x00048,0x00049,0x0004A,0x0004B,0x0004C,0x0004D,0x0004E,0x0004F,
-	0x00050,0x00051,0x00052,0x00053,0x00054,0x00055,0x00056,0x00057,0x00058,0x00059,0x0005A,0x0253C,0x1FB8C,0x02502,0x1FB95,0x1FB98,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x000A0,0x0258C,0x02584,0x02594,0x02581,0x0258F,0x02592,0x02595,0x1FB8F,0x1FB99,0x1FB87,0x0251C,0x02597,0x02514,0x02510,0x02582,
-	0x0250C,0x02534,0x0252C,0x02524,0x0258E,0x0258D,0x1FB88,0x1FB82,0x1FB83,0x02583,0x02713,0x02596,0x0259D,0x02518,0x02598,0x0259A,
-	0x02500,0x00041,0x00042,0x00043,0x00044,0x00045,0x00046,0x00047,0x00048,0x00049,0x0004A,0x0004B,0x0004C,0x0004D,0x0004E,0x0004F,
-	0x00050,0x00051,0x00052,0x00053,0x00054,0x00055,0x00056,0x00057,0x00058,0x00059,0x0005A,0x0253C,0x1FB8C,0x02502,0x1FB95,0x1FB98,
-	0x000A0,0x0258C,0x02584,0x02594,0x02581,0x0258F,0x02592,0x02595,0x1FB8F,0x1FB99,0x1FB87,0x0251C,0x02597,0x02514,0x02510,0x02582,
-	0x0250C,0x02534,0x0252C,0x02524,0x0258E,0x0258D,0x1FB88,0x1FB82,0x1FB83,0x02583,0x02713,0x02596,0x0259D,0x02518,0x02598,0x1FB95,
-};
-
-uint32_t trs80[192] = {
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,0x00020,
-	0x00020,0x00021,0x00022,0x00023,0x00024,0x00025,0x00026,0x00027,0x00028,0x00029,0x0002A,0x0002B,0x0002C,0x0002D,0x0002E,0x0002F,
-	0x00030,0x00031,0x00032,0x00033,0x00034,0x00035,0x00036,0x00037,0x00038,0x00039,0x0003A,0x0003B,0x0003C,0x0003D,0x0003E,0x0003F,
-	0x00040,0x00041,0x00042,0x00043,0x00044,0x00045,0x00046,0x00047,0x00048,0x00049,0x0004A,0x0004B,0x0004C,0x0004D,0x0004E,0x0004F,
-	0x00050,0x00051,0x00052,0x00053,0x00054,0x00055,0x00056,0x00057,0x00058,0x00059,0x0005A,0x0005B,0x0005C,0x0005D,0x0005E,0x0005F,
-	0x00060,0x00061,0x00062,0x00063,0x00064,0x00065,0x00066,0x00067,0x00068,0x00069,0x0006A,0x0006B,0x0006C,0x0006D,0x0006E,0x0006F,
-	0x00070,0x00071,0x00072,0x00073,0x00074,0x00075,0x00076,0x00077,0x00078,0x00079,0x0007A,0x0007B,0x0007C,0x0007D,0x0007E,0x000B1,
-	0x000A0,0x1FB00,0x1FB01,0x1FB02,0x1FB03,0x1FB04,0x1FB05,0x1FB06,0x1FB07,0x1FB08,0x1FB09,0x1FB0A,0x1FB0B,0x1FB0C,0x1FB0D,0x1FB0E,
-	0x1FB0F,0x1FB10,0x1FB11,0x1FB11,0x1FB13,0x0258C,0x1FB14,0x1FB15,0x1FB16,0x1FB17,0x1FB18,0x1FB19,0x1FB1A,0x1FB1B,0x1FB1C,0x1FB1D,
-	0x1FB1E,0x1FB1F,0x1FB20,0x1FB21,0x1FB22,0x1FB23,0x1FB24,0x1FB25,0x1FB26,0x1FB27,0x02590,0x1FB28,0x1FB29,0x1FB2A,0x1FB2B,0x1FB2C,
-	0x1FB2D,0x1FB2E,0x1FB2F,0x1FB30,0x1FB31,0x1FB32,0x1FB33,0x1FB34,0x1FB35,0x1FB36,0x1FB37,0x1FB38,0x1FB39,0x1FB3A,0x1FB3B,0x02588,
-};
+#define UTF8_PETSCII_CHARS(X) \
+	/* Unshifted */ \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00021),X(0x00022),X(0x00023),X(0x00024),X(0x00025),X(0x00026),X(0x00027),X(0x00028),X(0x00029),X(0x0002A),X(0x0002B),X(0x0002C),X(0x0002D),X(0x0002E),X(0x0002F), \
+	X(0x00030),X(0x00031),X(0x00032),X(0x00033),X(0x00034),X(0x00035),X(0x00036),X(0x00037),X(0x00038),X(0x00039),X(0x0003A),X(0x0003B),X(0x0003C),X(0x0003D),X(0x0003E),X(0x0003F), \
+	X(0x00040),X(0x00041),X(0x00042),X(0x00043),X(0x00044),X(0x00045),X(0x00046),X(0x00047),X(0x00048),X(0x00049),X(0x0004A),X(0x0004B),X(0x0004C),X(0x0004D),X(0x0004E),X(0x0004F), \
+	X(0x00050),X(0x00051),X(0x00052),X(0x00053),X(0x00054),X(0x00055),X(0x00056),X(0x00057),X(0x00058),X(0x00059),X(0x0005A),X(0x0005B),X(0x000A3),X(0x0005D),X(0x02191),X(0x02190), \
+	X(0x02500),X(0x02660),X(0x1FB72),X(0x1FB78),X(0x1FB77),X(0x1FB76),X(0x1FB7A),X(0x1FB71),X(0x1FB74),X(0x0256E),X(0x02570),X(0x0256F),X(0x1FB7C),X(0x02572),X(0x02571),X(0x1FB7D), \
+	X(0x1FB7E),X(0x02022),X(0x1FB7B),X(0x02665),X(0x1FB70),X(0x0256D),X(0x02573),X(0x025CB),X(0x02663),X(0x1FB75),X(0x02666),X(0x0253C),X(0x1FB8C),X(0x02502),X(0x003C0),X(0x025E5), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x000A0),X(0x0258C),X(0x02584),X(0x02594),X(0x02581),X(0x0258F),X(0x02592),X(0x02595),X(0x1FB8F),X(0x025E4),X(0x1FB87),X(0x0251C),X(0x02597),X(0x02514),X(0x02510),X(0x02582), \
+	X(0x0250C),X(0x02534),X(0x0252C),X(0x02524),X(0x0258E),X(0x0258D),X(0x1FB88),X(0x1FB82),X(0x1FB83),X(0x02583),X(0x1FB7F),X(0x02596),X(0x0259D),X(0x02518),X(0x02598),X(0x0259A), \
+	X(0x02500),X(0x02660),X(0x1FB72),X(0x1FB78),X(0x1FB77),X(0x1FB76),X(0x1FB7A),X(0x1FB71),X(0x1FB74),X(0x0256E),X(0x02570),X(0x0256F),X(0x1FB7C),X(0x02572),X(0x02571),X(0x1FB7D), \
+	X(0x1FB7E),X(0x02022),X(0x1FB7B),X(0x02665),X(0x1FB70),X(0x0256D),X(0x02573),X(0x025CB),X(0x02663),X(0x1FB75),X(0x02666),X(0x0253C),X(0x1FB8C),X(0x02502),X(0x003C0),X(0x025E5), \
+	X(0x000A0),X(0x0258C),X(0x02584),X(0x02594),X(0x02581),X(0x0258F),X(0x02592),X(0x02595),X(0x1FB8F),X(0x025E4),X(0x1FB87),X(0x0251C),X(0x02597),X(0x02514),X(0x02510),X(0x02582), \
+	X(0x0250C),X(0x02534),X(0x0252C),X(0x02524),X(0x0258E),X(0x0258D),X(0x1FB88),X(0x1FB82),X(0x1FB83),X(0x02583),X(0x1FB7F),X(0x02596),X(0x0259D),X(0x02518),X(0x02598),X(0x003C0), \
+	/* Shifted */ \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00021),X(0x00022),X(0x00023),X(0x00024),X(0x00025),X(0x00026),X(0x00027),X(0x00028),X(0x00029),X(0x0002A),X(0x0002B),X(0x0002C),X(0x0002D),X(0x0002E),X(0x0002F), \
+	X(0x00030),X(0x00031),X(0x00032),X(0x00033),X(0x00034),X(0x00035),X(0x00036),X(0x00037),X(0x00038),X(0x00039),X(0x0003A),X(0x0003B),X(0x0003C),X(0x0003D),X(0x0003E),X(0x0003F), \
+	X(0x00040),X(0x00061),X(0x00062),X(0x00063),X(0x00064),X(0x00065),X(0x00066),X(0x00067),X(0x00068),X(0x00069),X(0x0006A),X(0x0006B),X(0x0006C),X(0x0006D),X(0x0006E),X(0x0006F), \
+	X(0x00070),X(0x00071),X(0x00072),X(0x00073),X(0x00074),X(0x00075),X(0x00076),X(0x00077),X(0x00078),X(0x00079),X(0x0007A),X(0x0005B),X(0x000A3),X(0x0005D),X(0x02191),X(0x02190), \
+	X(0x02500),X(0x00041),X(0x00042),X(0x00043),X(0x00044),X(0x00045),X(0x00046),X(0x00047),X(0x00048),X(0x00049),X(0x0004A),X(0x0004B),X(0x0004C),X(0x0004D),X(0x0004E),X(0x0004F), \
+	X(0x00050),X(0x00051),X(0x00052),X(0x00053),X(0x00054),X(0x00055),X(0x00056),X(0x00057),X(0x00058),X(0x00059),X(0x0005A),X(0x0253C),X(0x1FB8C),X(0x02502),X(0x1FB95),X(0x1FB98), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x000A0),X(0x0258C),X(0x02584),X(0x02594),X(0x02581),X(0x0258F),X(0x02592),X(0x02595),X(0x1FB8F),X(0x1FB99),X(0x1FB87),X(0x0251C),X(0x02597),X(0x02514),X(0x02510),X(0x02582), \
+	X(0x0250C),X(0x02534),X(0x0252C),X(0x02524),X(0x0258E),X(0x0258D),X(0x1FB88),X(0x1FB82),X(0x1FB83),X(0x02583),X(0x02713),X(0x02596),X(0x0259D),X(0x02518),X(0x02598),X(0x0259A), \
+	X(0x02500),X(0x00041),X(0x00042),X(0x00043),X(0x00044),X(0x00045),X(0x00046),X(0x00047),X(0x00048),X(0x00049),X(0x0004A),X(0x0004B),X(0x0004C),X(0x0004D),X(0x0004E),X(0x0004F), \
+	X(0x00050),X(0x00051),X(0x00052),X(0x00053),X(0x00054),X(0x00055),X(0x00056),X(0x00057),X(0x00058),X(0x00059),X(0x0005A),X(0x0253C),X(0x1FB8C),X(0x02502),X(0x1FB95),X(0x1FB98), \
+	X(0x000A0),X(0x0258C),X(0x02584),X(0x02594),X(0x02581),X(0x0258F),X(0x02592),X(0x02595),X(0x1FB8F),X(0x1FB99),X(0x1FB87),X(0x0251C),X(0x02597),X(0x02514),X(0x02510),X(0x02582), \
+	X(0x0250C),X(0x02534),X(0x0252C),X(0x02524),X(0x0258E),X(0x0258D),X(0x1FB88),X(0x1FB82),X(0x1FB83),X(0x02583),X(0x02713),X(0x02596),X(0x0259D),X(0x02518),X(0x02598),X(0x1FB95),
+
+uint32_t petscii[512] = { UTF8_PETSCII_CHARS(UTF8_CODE) };
+const utf8_glyph_t petscii_glyphs[512] = { UTF8_PETSCII_CHARS(UTF8_GLYPH) };
+
+#define UTF8_TRS80_CHARS(X) \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020),X(0x00020), \
+	X(0x00020),X(0x00021),X(0x00022),X(0x00023),X(0x00024),X(0x00025),X(0x00026),X(0x00027),X(0x00028),X(0x00029),X(0x0002A),X(0x0002B),X(0x0002C),X(0x0002D),X(0x0002E),X(0x0002F), \
+	X(0x00030),X(0x00031),X(0x00032),X(0x00033),X(0x00034),X(0x00035),X(0x00036),X(0x00037),X(0x00038),X(0x00039),X(0x0003A),X(0x0003B),X(0x0003C),X(0x0003D),X(0x0003E),X(0x0003F), \
+	X(0x00040),X(0x00041),X(0x00042),X(0x00043),X(0x00044),X(0x00045),X(0x00046),X(0x00047),X(0x00048),X(0x00049),X(0x0004A),X(0x0004B),X(0x0004C),X(0x0004D),X(0x0004E),X(0x0004F), \
+	X(0x00050),X(0x00051),X(0x00052),X(0x00053),X(0x00054),X(0x00055),X(0x00056),X(0x00057),X(0x00058),X(0x00059),X(0x0005A),X(0x0005B),X(0x0005C),X(0x0005D),X(0x0005E),X(0x0005F), \
+	X(0x00060),X(0x00061),X(0x00062),X(0x00063),X(0x00064),X(0x00065),X(0x00066),X(0x00067),X(0x00068),X(0x00069),X(0x0006A),X(0x0006B),X(0x0006C),X(0x0006D),X(0x0006E),X(0x0006F), \
+	X(0x00070),X(0x00071),X(0x00072),X(0x00073),X(0x00074),X(0x00075),X(0x00076),X(0x00077),X(0x00078),X(0x00079),X(0x0007A),X(0x0007B),X(0x0007C),X(0x0007D),X(0x0007E),X(0x000B1), \
+	X(0x000A0),X(0x1FB00),X(0x1FB01),X(0x1FB02),X(0x1FB03),X(0x1FB04),X(0x1FB05),X(0x1FB06),X(0x1FB07),X(0x1FB08),X(0x1FB09),X(0x1FB0A),X(0x1FB0B),X(0x1FB0C),X(0x1FB0D),X(0x1FB0E), \
+	X(0x1FB0F),X(0x1FB10),X(0x1FB11),X(0x1FB11),X(0x1FB13),X(0x0258C),X(0x1FB14),X(0x1FB15),X(0x1FB16),X(0x1FB17),X(0x1FB18),X(0x1FB19),X(0x1FB1A),X(0x1FB1B),X(0x1FB1C),X(0x1FB1D), \
+	X(0x1FB1E),X(0x1FB1F),X(0x1FB20),X(0x1FB21),X(0x1FB22),X(0x1FB23),X(0x1FB24),X(0x1FB25),X(0x1FB26),X(0x1FB27),X(0x02590),X(0x1FB28),X(0x1FB29),X(0x1FB2A),X(0x1FB2B),X(0x1FB2C), \
+	X(0x1FB2D),X(0x1FB2E),X(0x1FB2F),X(0x1FB30),X(0x1FB31),X(0x1FB32),X(0x1FB33),X(0x1FB34),X(0x1FB35),X(0x1FB36),X(0x1FB37),X(0x1FB38),X(0x1FB39),X(0x1FB3A),X(0x1FB3B),X(0x02588),
+
+uint32_t trs80[192] = { UTF8_TRS80_CHARS(UTF8_CODE) };
+const utf8_glyph_t trs80_glyphs[192] = { UTF8_TRS80_CHARS(UTF8_GLYPH) };
 #endif //UTF8_EXT_CHARACTER_SETS
 
 //UTF-8 Encoding
@@ -140,15 +182,10 @@ uint32_t trs80[192] = {
 //
 // Unicode character are really only valid upto 0x10FFFF, but this function
 // encodes any 32bit value.
-static char utf8_encoded_character[8];
 char* utf8_encode(char* dst, uint32_t character) {
 	uint8_t shift;
 	uint8_t i;
 	
-	if( dst == 0 ) {
-		dst = utf8_encoded_character;
-	}
-	
 	if( character >= 0x8000000 ) {
 		dst[0] = 0b11111110;
 		dst[1] = 0b10000000 | ((character>>30)&0b00000011);
@@ -201,4 +238,30 @@ char* utf8_encode(char* dst, uint32_t character) {
 	return dst;
 }
 
+utf8_glyph_t* utf8_glyph(utf8_glyph_t* dst, uint32_t character) {
+	if( character >= 0x00010000 ) {
+		dst->bytes[0] = 0b11110000 | ((character>>18)&0b00000111);
+		dst->bytes[1] = 0b10000000 | ((character>>12)&0b00111111);
+		dst->bytes[2] = 0b10000000 | ((character>> 6)&0b00111111);
+		dst->bytes[3] = 0b10000000 | ((character>> 0)&0b00111111);
+		dst->len = 4;
+	}
+	else if( character >= 0x00000800 ) {
+		dst->bytes[0] = 0b11100000 | ((character>>12)&0b00001111);
+		dst->bytes[1] = 0b10000000 | ((character>> 6)&0b00111111);
+		dst->bytes[2] = 0b10000000 | ((character>> 0)&0b00111111);
+		dst->len = 3;
+	}
+	else if( character >= 0x00000080 ) {
+		dst->bytes[0] = 0b11000000 | ((character>> 6)&0b00011111);
+		dst->bytes[1] = 0b10000000 | ((character>> 0)&0b00111111);
+		dst->len = 2;
+	}
+	else { // character >= 0 
+		dst->bytes[0] = 0b00000000 | ((character>> 0)&0b01111111);
+		dst->len = character ? 1 : 0;
+	}
+	return dst;
+}
+
 #endif //UTF8_IMPLEMENTATION
\ No newline at end of file
@@ -29,6 +29,8 @@
 #include <sys/ioctl.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
@@ -49,6 +51,8 @@ typedef struct {
 	size_t len;
 	size_t write_off;
 	size_t read_off;
+	//Callbacks that ran out of samples
+	size_t underflows;
 } paBuffer_t;
 
 int paCallback(
@@ -64,6 +68,8 @@ int paCallback(
 	paBuffer_t *buffer = (paBuffer_t*)userData;
 	uint8_t *out = (uint8_t*)output;
 
+	term_encode_trace_thread("portaudio");
+	term_encode_trace_begin("audio_callback");
 	outLen = buffer->frame_len*frameCount;
 	
 	if( buffer->read_off == buffer->write_off ) {
@@ -94,6 +100,9 @@ int paCallback(
 	memcpy(out,buffer->samples+buffer->read_off,copyLen1);
 	memcpy(out+copyLen1,buffer->samples,copyLen2);
 	memset(out+copyLen1+copyLen2,0,zeroFill);
+	if( zeroFill ) {
+		buffer->underflows++;
+	}
 	
 	#ifdef DEBUG
 	if( zeroFill ) { 
@@ -102,6 +111,7 @@ int paCallback(
 	#endif
 	
 	buffer->read_off = (buffer->read_off + copyLen1 + copyLen2) % buffer->len;
+	term_encode_trace_end("audio_callback");
 	return paContinue;
 }
 
@@ -397,9 +407,359 @@ double findFramePeriod(AVStream* stream, AVCodecContext *codecCtx, double defaul
 		return frame_period_sec;
 }
 
+#define PATTERN_NONE     0
+#define PATTERN_GRADIENT 1
+#define PATTERN_NOISE    2
+#define PATTERN_TEXT     3
+
+#define BENCH_DECODE 0
+#define BENCH_SCALE  1
+#define BENCH_ENCODE 2
+#define BENCH_WRITE  3
+#define BENCH_STAGES 4
+
+static const char* bench_stage_names[BENCH_STAGES] = { "decode", "scale", "encode", "write" };
+
+typedef struct {
+	uint64_t ns[BENCH_STAGES];
+} bench_frame_t;
+
+typedef struct {
+	bench_frame_t* frames;
+	size_t len;
+	size_t count;
+	uint64_t start;
+	uint64_t mark;
+	bench_frame_t frame;
+} bench_t;
+
+static uint64_t benchNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+//av_read_frame(), traced
+static int readFrame(AVFormatContext* ctx, AVPacket* packet) {
+	int ret;
+	term_encode_trace_begin("av_read_frame");
+	ret = av_read_frame(ctx,packet);
+	term_encode_trace_end("av_read_frame");
+	return ret;
+}
+
+static void benchStart(bench_t* bench) {
+	bench->frames = 0;
+	bench->len = 0;
+	bench->count = 0;
+	bench->start = benchNow();
+	bench->mark = bench->start;
+}
+
+//Charge the time since the last mark to one stage of the current frame
+static void benchStage(bench_t* bench, size_t stage) {
+	uint64_t now = benchNow();
+	bench->frame.ns[stage] = now - bench->mark;
+	bench->mark = now;
+}
+
+//Store the current frame's stage times.  Done as the last stage of
+//a frame, so the next frame's decode starts from here.
+static void benchFrameDone(bench_t* bench) {
+	bench_frame_t* frames;
+	if( bench->count == bench->len ) {
+		bench->len = bench->len ? bench->len*2 : 1024;
+		frames = (bench_frame_t*)realloc(bench->frames,bench->len*sizeof(bench_frame_t));
+		if( frames == 0 ) {
+			fprintf(stderr,"Failed to allocate benchmark frame times\n");
+			exit(1);
+		}
+		bench->frames = frames;
+	}
+	bench->frames[bench->count++] = bench->frame;
+}
+
+static int cmpU64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void benchReport(FILE* fp, bench_t* bench, const char* sink) {
+	uint64_t elapsed = benchNow() - bench->start;
+	uint64_t* ns;
+	uint64_t sum;
+	size_t stage;
+	size_t i;
+	size_t n = bench->count;
+
+	fprintf(fp,"Bench: %lu frames in %.3f s, %.2f fps (%s sink)\n",n,
+		(double)elapsed/1e9,
+		elapsed ? (double)n*1e9/(double)elapsed : 0.0,
+		sink);
+	if( n == 0 ) {
+		return;
+	}
+	ns = (uint64_t*)malloc(n*sizeof(uint64_t));
+	if( ns == 0 ) {
+		fprintf(stderr,"Failed to allocate benchmark report\n");
+		return;
+	}
+	fprintf(fp,"%-7s %9s %9s %9s %9s %9s (ms)\n","stage","mean","p50","p90","p99","max");
+	//The last pass reports the total of all stages per frame
+	for( stage=0; stage<=BENCH_STAGES; stage++ ) {
+		sum = 0;
+		for( i=0; i<n; i++ ) {
+			if( stage < BENCH_STAGES ) {
+				ns[i] = bench->frames[i].ns[stage];
+			} else {
+				ns[i] = bench->frames[i].ns[BENCH_DECODE] + bench->frames[i].ns[BENCH_SCALE] +
+				        bench->frames[i].ns[BENCH_ENCODE] + bench->frames[i].ns[BENCH_WRITE];
+			}
+			sum += ns[i];
+		}
+		qsort(ns,n,sizeof(uint64_t),cmpU64);
+		fprintf(fp,"%-7s %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+			stage < BENCH_STAGES ? bench_stage_names[stage] : "total",
+			(double)sum/(double)n/1e6,
+			(double)ns[(n-1)*50/100]/1e6,
+			(double)ns[(n-1)*90/100]/1e6,
+			(double)ns[(n-1)*99/100]/1e6,
+			(double)ns[n-1]/1e6);
+	}
+	free(ns);
+}
+
+//Histogram buckets are powers of two of microseconds: bucket i holds
+//times from 2^i-1 up to (but not including) 2^(i+1)-1 us
+#define HIST_BUCKETS 32
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+//Playback totals, collected whenever frames are paced to the terminal
+typedef struct {
+	hist_t lateness;
+	hist_t stage[BENCH_STAGES];
+	//Frames decoded, displayed, skipped because they were already behind
+	//schedule, and displayed more than a frame period after their time
+	uint64_t decoded;
+	uint64_t displayed;
+	uint64_t skipped;
+	uint64_t late;
+	//Video packets discarded while waiting for the audio stream to start
+	uint64_t dropped;
+} play_stats_t;
+
+static void histAdd(hist_t* hist, uint64_t ns) {
+	uint64_t us = ns / 1000;
+	uint64_t v = us + 1;
+	size_t i = 0;
+	while( v > 1 && i < HIST_BUCKETS-1 ) {
+		v = v >> 1;
+		i++;
+	}
+	hist->buckets[i]++;
+	hist->count++;
+	hist->sum_us += us;
+	if( us > hist->max_us ) {
+		hist->max_us = us;
+	}
+}
+
+//Upper bound (us) of the bucket holding the pct percentile, or the
+//maximum if that is lower
+static uint64_t histPercentile(hist_t* hist, uint64_t pct) {
+	uint64_t seen = 0;
+	uint64_t target = (hist->count*pct + 99) / 100;
+	size_t i;
+	for( i=0; i<HIST_BUCKETS; i++ ) {
+		seen += hist->buckets[i];
+		if( seen >= target && seen ) {
+			break;
+		}
+	}
+	if( i == HIST_BUCKETS ) {
+		i--;
+	}
+	if( ((uint64_t)2 << i) - 1 > hist->max_us ) {
+		return hist->max_us;
+	}
+	return ((uint64_t)2 << i) - 1;
+}
+
+static void histPrint(FILE* fp, const char* name, hist_t* hist) {
+	if( hist->count == 0 ) {
+		fprintf(fp,"  %-9s no samples\n",name);
+		return;
+	}
+	fprintf(fp,"  %-9s mean %8.3f  p50 <=%8.3f  p90 <=%8.3f  p99 <=%8.3f  max %8.3f ms\n",name,
+		(double)hist->sum_us/(double)hist->count/1000.0,
+		(double)histPercentile(hist,50)/1000.0,
+		(double)histPercentile(hist,90)/1000.0,
+		(double)histPercentile(hist,99)/1000.0,
+		(double)hist->max_us/1000.0);
+}
+
+static void histJSON(FILE* fp, hist_t* hist) {
+	size_t i;
+	int first = 1;
+	fprintf(fp,"{\"count\":%lu,\"mean_us\":%.1f,\"max_us\":%lu,"
+		"\"p50_le_us\":%lu,\"p90_le_us\":%lu,\"p99_le_us\":%lu,\"buckets\":[",
+		hist->count,
+		hist->count ? (double)hist->sum_us/(double)hist->count : 0.0,
+		hist->max_us,
+		histPercentile(hist,50),histPercentile(hist,90),histPercentile(hist,99));
+	//Only the buckets in use, as [upper bound us, count]
+	for( i=0; i<HIST_BUCKETS; i++ ) {
+		if( hist->buckets[i] ) {
+			fprintf(fp,"%s[%lu,%lu]",first ? "" : ",",((uint64_t)2 << i) - 1,hist->buckets[i]);
+			first = 0;
+		}
+	}
+	fprintf(fp,"]}");
+}
+
+static void playStatsPrint(FILE* fp, play_stats_t* play, uint64_t underflows, double frame_period_sec) {
+	size_t stage;
+	fprintf(fp,"playback: %lu decoded, %lu displayed, %lu skipped, %lu late (> %.1f ms), %lu dropped\n",
+		play->decoded,play->displayed,play->skipped,play->late,frame_period_sec*1000.0,play->dropped);
+	#ifdef USE_PORTAUDIO
+	fprintf(fp,"  audio underflows %lu\n",underflows);
+	#endif
+	histPrint(fp,"lateness",&(play->lateness));
+	for( stage=0; stage<BENCH_STAGES; stage++ ) {
+		histPrint(fp,bench_stage_names[stage],&(play->stage[stage]));
+	}
+}
+
+static int playStatsJSON(const char* path, play_stats_t* play, uint64_t underflows, double frame_period_sec) {
+	FILE* fp;
+	size_t stage;
+	fp = fopen(path,"w");
+	if( fp == 0 ) {
+		fprintf(stderr,"Failed to open %s\n",path);
+		return 1;
+	}
+	fprintf(fp,"{\"frame_period_ms\":%.3f,\"decoded\":%lu,\"displayed\":%lu,\"skipped\":%lu,"
+		"\"late\":%lu,\"dropped\":%lu,\"audio_underflows\":%lu,\n",
+		frame_period_sec*1000.0,play->decoded,play->displayed,play->skipped,
+		play->late,play->dropped,underflows);
+	fprintf(fp," \"lateness\":");
+	histJSON(fp,&(play->lateness));
+	fprintf(fp,",\n \"stages\":{");
+	for( stage=0; stage<BENCH_STAGES; stage++ ) {
+		fprintf(fp,"%s\n  \"%s\":",stage ? "," : "",bench_stage_names[stage]);
+		histJSON(fp,&(play->stage[stage]));
+	}
+	fprintf(fp,"}}\n");
+	fclose(fp);
+	return 0;
+}
+
+//3x5 digits for the text test pattern, one row per byte, MSB on the left
+static const uint8_t pattern_digits[10][5] = {
+	{7,5,5,5,7}, {2,6,2,2,7}, {7,1,7,4,7}, {7,1,7,1,7}, {5,5,7,1,1},
+	{7,4,7,1,7}, {7,4,7,5,7}, {7,1,1,1,1}, {7,5,7,5,7}, {7,5,7,1,7} };
+
+static void drawDigit(uint8_t* pixels, size_t stride, size_t width, size_t height,
+                      size_t x, size_t y, size_t scale, size_t digit, uint8_t shade) {
+	size_t row, col;
+	size_t px, py;
+	uint8_t* p;
+	for( row=0; row<5*scale; row++ ) {
+		py = y + row;
+		if( py >= height ) {
+			break;
+		}
+		for( col=0; col<3*scale; col++ ) {
+			px = x + col;
+			if( px >= width ) {
+				break;
+			}
+			if( (pattern_digits[digit][row/scale] >> (2-col/scale)) & 1 ) {
+				p = pixels + py*stride + px*3;
+				p[0] = shade;
+				p[1] = shade;
+				p[2] = shade;
+			}
+		}
+	}
+}
+
+//Generate a synthetic RGB frame, so the pipeline can be benchmarked without
+//a media file.  gradient: color ramps that move every frame.  noise: new
+//random pixels every frame (the worst case for every stage).  text: rows of
+//scrolling digits over a dark gradient, with the frame number in large digits.
+static void drawPattern(uint8_t pattern, uint8_t* pixels, size_t stride,
+                        size_t width, size_t height, size_t frame_number) {
+	static uint32_t seed = 0x12345678;
+	size_t x, y;
+	size_t scale;
+	size_t n;
+	size_t digits;
+	uint32_t gx, gy;
+	uint32_t stepx = (255<<16) / width;
+	uint32_t stepy = (255<<16) / height;
+	uint8_t* p;
+
+	//Ramps are 16.16 fixed point, so the generator stays cheap next to decoding
+	for( y=0, gy=0; y<height; y++, gy+=stepy ) {
+		p = pixels + y*stride;
+		for( x=0, gx=0; x<width; x++, gx+=stepx ) {
+			if( pattern == PATTERN_NOISE ) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				p[0] = seed;
+				p[1] = seed >> 8;
+				p[2] = seed >> 16;
+			}
+			else if( pattern == PATTERN_TEXT ) {
+				p[0] = gx >> 18;
+				p[1] = gy >> 18;
+				p[2] = 48;
+			}
+			else {
+				p[0] = (gx >> 16) + frame_number*2;
+				p[1] = (gy >> 16) + frame_number*3;
+				p[2] = ((gx + gy) >> 17) - frame_number*5;
+			}
+			p += 3;
+		}
+	}
+	if( pattern != PATTERN_TEXT ) {
+		return;
+	}
+	//Small digits, 4 pixels per character cell, scrolling left one cell per frame
+	for( y=0; y+10<=height; y+=12 ) {
+		for( x=0; x+8<=width; x+=8 ) {
+			n = (x/8 + y/12*7 + frame_number) % 10;
+			drawDigit(pixels,stride,width,height,x,y,2,n,224);
+		}
+	}
+	//Frame number
+	scale = height / 16 ? height / 16 : 1;
+	n = frame_number;
+	for( digits=1; n>=10; digits++ ) {
+		n = n / 10;
+	}
+	n = frame_number;
+	x = width/2 + digits*4*scale/2;
+	while( digits-- && x >= 4*scale ) {
+		x = x - 4*scale;
+		drawDigit(pixels,stride,width,height,x,height/2-5*scale/2,scale,n%10,255);
+		n = n / 10;
+	}
+}
+
 static void usage(char* cmd) {
 	fprintf(stderr,"Usage:\n");
-	fprintf(stderr,"%s [-h] [-v] ",cmd);
+	fprintf(stderr,"%s [-h] [-v] [-stats] [-json file] [-trace file] ",cmd);
 	#ifdef USE_PORTAUDIO
 	fprintf(stderr,"[-m] ");
 	#endif
@@ -409,11 +769,18 @@ static void usage(char* cmd) {
 	fprintf(stderr," [-dither]");
 	#endif //USE_QUANTPNM
 	fprintf(stderr,"\n");
-	fprintf(stderr,"  [-crop x y w h]  [([-edge | -line | -glow | -hi | -apple2bw] 0xRRGGBB) | -apple2 ]\n");
-	fprintf(stderr,"  renderer vidfile\n");
+	fprintf(stderr,"  [-crop x y w h] [-runs erase|rep] [([-edge | -line | -glow | -hi | -apple2bw] 0xRRGGBB) | -apple2 ]\n");
+	fprintf(stderr,"  [-sixelmode reuse|delta] [-bench null|mem [-count #]]\n");
+	fprintf(stderr,"  renderer (vidfile | -pattern gradient|noise|text w h)\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-h     : Print usage message\n");
 	fprintf(stderr,"-v     : Print information after the frame\n");
+	fprintf(stderr,"-stats : Print encoder stage timings and counters to stderr at exit,\n");
+	fprintf(stderr,"         with playback lateness, stage times, and frame totals\n");
+	fprintf(stderr,"-json  : Write the playback statistics to file as JSON at exit\n");
+	fprintf(stderr,"-trace : Write a Chrome trace event file (chrome://tracing or\n");
+	fprintf(stderr,"         ui.perfetto.dev) of the read/decode/scale/encode/write\n");
+	fprintf(stderr,"         steps to file at exit\n");
 	#ifdef USE_PORTAUDIO
 	fprintf(stderr,"-m     : Mute audio\n");
 	#endif
@@ -427,6 +794,16 @@ static void usage(char* cmd) {
 	fprintf(stderr,"-dither: Use palette quantizer with dither\n");
 	#endif //USE_QUANTPNM
 	fprintf(stderr,"-crop  : Crop the video before processing\n");
+	fprintf(stderr,"-runs  : Erase runs of blank cells (erase), and also repeat runs\n");
+	fprintf(stderr,"         of other characters (rep), instead of writing each cell\n");
+	fprintf(stderr,"-sixelmode: Keep the sixel color registers between frames (reuse),\n");
+	fprintf(stderr,"         and also only send the bands that changed (delta)\n");
+	fprintf(stderr,"-bench : Run without pacing, write to /dev/null or memory, and\n");
+	fprintf(stderr,"         print per-frame decode/scale/encode/write times to stderr\n");
+	fprintf(stderr,"         (aalib, libcaca and libsixel always write to stdout)\n");
+	fprintf(stderr,"-count : Stop after # frames (test patterns default to 300)\n");
+	fprintf(stderr,"-pattern: Benchmark a generated w x h test pattern instead of\n");
+	fprintf(stderr,"         a video file (requires -bench)\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-= Filters =-\n");
 	fprintf(stderr,"-edge     : Render edge detection (scaled) using specified color\n");
@@ -437,8 +814,9 @@ static void usage(char* cmd) {
 	fprintf(stderr,"-apple2   : Render like an apple2 hi-res color image\n");
 	fprintf(stderr,"\n");
 	fprintf(stderr,"-= Renderers =-\n");
+	fprintf(stderr,"-sixel   : Sixel\n");
 	#ifdef USE_LIBSIXEL
-	fprintf(stderr,"-sixel   : Sixel (not well supported)\n");
+	fprintf(stderr,"-libsixel: Sixel encoded by libsixel (not well supported)\n");
 	#endif //USE_LIBSIXEL
 	fprintf(stderr,"-frames #: Dump frames as PPM files\n");
 	fprintf(stderr,"-simple  : ANSI Simple\n");
@@ -446,6 +824,14 @@ static void usage(char* cmd) {
 	fprintf(stderr,"-qchar   : ANSI Quarter-Character\n");
 	fprintf(stderr,"-six     : ANSI Sextant-Character\n");
 	fprintf(stderr,"-bra     : ANSI Braille-Character\n");
+	fprintf(stderr,"-ascii     : Native ASCII Art\n");
+	fprintf(stderr,"-asciiext  : Native ASCII Art with extended characters\n");
+	fprintf(stderr,"-asciifg   : Native ASCII Art with Foreground Color\n");
+	fprintf(stderr,"-asciifgext: Native ASCII Art with Foreground Color and\n");
+	fprintf(stderr,"             extended characters\n");
+	fprintf(stderr,"-asciibg   : Native ASCII Art with Foreground and Background Color\n");
+	fprintf(stderr,"-asciibgext: Native ASCII Art with Foreground and Background\n");
+	fprintf(stderr,"             Color and extended characters\n");
 	#ifdef USE_AALIB
 	fprintf(stderr,"-aa      : ASCII Art\n");
 	fprintf(stderr,"-aaext   : ASCII Art with extended characters\n");
@@ -517,8 +903,32 @@ int main(int argc, char** argv) {
 	char *psub;
 	size_t linelen;
 	size_t lineoff;
+	term_encode_stats_t stats;
+	term_encode_stats_t total;
+	char* bench_sink = 0;
+	bench_t bench;
+	size_t bench_count = 0;
+	FILE* bench_memfp = 0;
+	char* bench_mem = 0;
+	size_t bench_memlen = 0;
+	int null_fd;
+	uint8_t pattern = PATTERN_NONE;
+	play_stats_t play;
+	char* json_path = 0;
+	char* trace_path = 0;
+	uint64_t underflows = 0;
+	uint64_t decode_ns = 0;
+	uint64_t mark;
+	uint64_t start_ns;
+	int64_t lateness_ns;
+	int ret;
+	int src_width;
+	int src_height;
+	enum AVPixelFormat src_format;
 	
 	term_encode_init(&enc);
+	memset(&total,0,sizeof(total));
+	memset(&play,0,sizeof(play));
 	
 	i=1;
 	while( i < argc ) {
@@ -531,6 +941,62 @@ int main(int argc, char** argv) {
 			}
 			verbose = 1;
 		}
+		else if( strcmp(argv[i],"-stats") == 0 ) {
+			enc.stats = 1;
+		}
+		else if( strcmp(argv[i],"-json") == 0 ) {
+			if( i >= argc-1 || json_path ) {
+				usage(argv[0]);
+			}
+			json_path = argv[++i];
+		}
+		else if( strcmp(argv[i],"-trace") == 0 ) {
+			if( i >= argc-1 || trace_path ) {
+				usage(argv[0]);
+			}
+			trace_path = argv[++i];
+		}
+		else if( strcmp(argv[i],"-bench") == 0 ) {
+			if( i >= argc-1 || bench_sink ) {
+				usage(argv[0]);
+			}
+			bench_sink = argv[++i];
+			if( strcmp(bench_sink,"null") != 0 && strcmp(bench_sink,"mem") != 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-count") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			bench_count = atoi(argv[++i]);
+			if( bench_count == 0 ) {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-pattern") == 0 ) {
+			if( i >= argc-3 || pattern != PATTERN_NONE ) {
+				usage(argv[0]);
+			}
+			i++;
+			if( strcmp(argv[i],"gradient") == 0 ) {
+				pattern = PATTERN_GRADIENT;
+			}
+			else if( strcmp(argv[i],"noise") == 0 ) {
+				pattern = PATTERN_NOISE;
+			}
+			else if( strcmp(argv[i],"text") == 0 ) {
+				pattern = PATTERN_TEXT;
+			}
+			else {
+				usage(argv[0]);
+			}
+			src_width  = atoi(argv[++i]);
+			src_height = atoi(argv[++i]);
+			if( src_width <= 0 || src_height <= 0 ) {
+				usage(argv[0]);
+			}
+		}
 		#ifdef USE_PORTAUDIO
 		else if( strcmp(argv[i],"-m") == 0 ) {
 			if( mute ) {
@@ -618,6 +1084,36 @@ int main(int argc, char** argv) {
 			enc.dither = 1;
 		}
 		#endif //USE_QUANTPNM
+		else if( strcmp(argv[i],"-runs") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			i++;
+			if( strcmp(argv[i],"erase") == 0 ) {
+				enc.runs = ENC_RUNS_ERASE;
+			}
+			else if( strcmp(argv[i],"rep") == 0 ) {
+				enc.runs = ENC_RUNS_REP;
+			}
+			else {
+				usage(argv[0]);
+			}
+		}
+		else if( strcmp(argv[i],"-sixelmode") == 0 ) {
+			if( i >= argc-1 ) {
+				usage(argv[0]);
+			}
+			i++;
+			if( strcmp(argv[i],"reuse") == 0 ) {
+				enc.sixel = ENC_SIXEL_REUSE;
+			}
+			else if( strcmp(argv[i],"delta") == 0 ) {
+				enc.sixel = ENC_SIXEL_DELTA;
+			}
+			else {
+				usage(argv[0]);
+			}
+		}
 		else if( strcmp(argv[i],"-crop") == 0 ) {
 			if( i >= argc-4 ) {
 				usage(argv[0]);
@@ -718,13 +1214,19 @@ int main(int argc, char** argv) {
 				usage(argv[0]);
 			}
 		}
-		#ifdef USE_LIBSIXEL
 		else if( strcmp(argv[i],"-sixel") == 0 ) {
 			if( enc.renderer ) {
 				usage(argv[0]);
 			}
 			enc.renderer = ENC_RENDER_SIXEL;
 		}
+		#ifdef USE_LIBSIXEL
+		else if( strcmp(argv[i],"-libsixel") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_LIBSIXEL;
+		}
 		#endif //SIXEL
 		else if( strcmp(argv[i],"-simple") == 0 ) {
 			if( enc.renderer ) {
@@ -756,6 +1258,42 @@ int main(int argc, char** argv) {
 			}
 			enc.renderer = ENC_RENDER_BRAILLE;
 		}
+		else if( strcmp(argv[i],"-ascii") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCII;
+		}
+		else if( strcmp(argv[i],"-asciiext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIEXT;
+		}
+		else if( strcmp(argv[i],"-asciifg") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIFG;
+		}
+		else if( strcmp(argv[i],"-asciifgext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIFGEXT;
+		}
+		else if( strcmp(argv[i],"-asciibg") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIBG;
+		}
+		else if( strcmp(argv[i],"-asciibgext") == 0 ) {
+			if( enc.renderer ) {
+				usage(argv[0]);
+			}
+			enc.renderer = ENC_RENDER_ASCIIBGEXT;
+		}
 		#ifdef USE_AALIB
 		else if( strcmp(argv[i],"-aa") == 0 ) {
 			if( enc.renderer ) {
@@ -817,10 +1355,13 @@ int main(int argc, char** argv) {
 		i++;
 	}
 	
-	if( vidpath == 0 ) {
+	if( vidpath == 0 && pattern == PATTERN_NONE ) {
 		fprintf(stderr,"No Video path specified\n");
 		return 1;
 	}
+	if( vidpath != 0 && pattern != PATTERN_NONE ) {
+		usage(argv[0]);
+	}
 	
 	if( !enc.renderer && !dump_frames ) {
 		fprintf(stderr,"No renderer specified\n");
@@ -830,64 +1371,103 @@ int main(int argc, char** argv) {
 	enc.enctext = 1;
 	enc.clearterm = 0;
 
-	//Double check special sixel concerns
-	if( enc.renderer == ENC_RENDER_SIXEL && (verbose || srtfile )) {
-		fprintf(stderr,"Verbose output and subtitles are not supported with sixel renderer.\n");
+	if( bench_sink ) {
+		if( !enc.renderer ) {
+			fprintf(stderr,"-bench requires a renderer.\n");
+			return 1;
+		}
+		if( verbose || srtfile ) {
+			fprintf(stderr,"Verbose output and subtitles are not supported with -bench.\n");
+			return 1;
+		}
+	}
+	else if( pattern != PATTERN_NONE ) {
+		fprintf(stderr,"Test patterns are only supported with -bench.\n");
 		return 1;
 	}
-	
-	// Open video file
-	if(avformat_open_input(&pFormatCtx, vidpath, NULL, NULL)!=0) {
-		fprintf(stderr,"Failed to open Video file.\n");
+	else if( bench_count ) {
+		usage(argv[0]);
+	}
+	if( json_path && (bench_sink || !enc.renderer) ) {
+		fprintf(stderr,"-json requires a renderer and is not supported with -bench.\n");
 		return 1;
 	}
-
-	// Retrieve stream information
-	if(avformat_find_stream_info(pFormatCtx, NULL)<0) {
-		fprintf(stderr,"Failed to to find stream information\n");
+	if( pattern != PATTERN_NONE && bench_count == 0 ) {
+		bench_count = 300;
+	}
+	if( trace_path ) {
+		term_encode_trace_start();
+		term_encode_trace_thread("main");
+	}
+	
+	//Double check special sixel concerns
+	if( (enc.renderer == ENC_RENDER_SIXEL || enc.renderer == ENC_RENDER_LIBSIXEL) && (verbose || srtfile )) {
+		fprintf(stderr,"Verbose output and subtitles are not supported with sixel renderer.\n");
 		return 1;
 	}
+	
+	if( pattern == PATTERN_NONE ) {
+		// Open video file
+		if(avformat_open_input(&pFormatCtx, vidpath, NULL, NULL)!=0) {
+			fprintf(stderr,"Failed to open Video file.\n");
+			return 1;
+		}
 
-	// Find the first video (and audio) stream
-	for(i=0; i<pFormatCtx->nb_streams; i++) {
-		if(pFormatCtx->streams[i]->codecpar->codec_type==AVMEDIA_TYPE_VIDEO) {
-			if( videoStream < 0 ) {
-				videoStream=i;
-			}
+		// Retrieve stream information
+		if(avformat_find_stream_info(pFormatCtx, NULL)<0) {
+			fprintf(stderr,"Failed to to find stream information\n");
+			return 1;
 		}
-		#ifdef USE_PORTAUDIO
-		else if(pFormatCtx->streams[i]->codecpar->codec_type==AVMEDIA_TYPE_AUDIO) {
-			if( audioStream < 0 && !mute ) {
-				audioStream = i;
+
+		// Find the first video (and audio) stream
+		for(i=0; i<pFormatCtx->nb_streams; i++) {
+			if(pFormatCtx->streams[i]->codecpar->codec_type==AVMEDIA_TYPE_VIDEO) {
+				if( videoStream < 0 ) {
+					videoStream=i;
+				}
 			}
+			#ifdef USE_PORTAUDIO
+			else if(pFormatCtx->streams[i]->codecpar->codec_type==AVMEDIA_TYPE_AUDIO) {
+				if( audioStream < 0 && !mute ) {
+					audioStream = i;
+				}
+			}
+			#endif
+		}
+		if(videoStream==-1) {
+			fprintf(stderr,"Failed to find Video stream\n");
+			return 1;
 		}
-		#endif
-	}
-	if(videoStream==-1) {
-		fprintf(stderr,"Failed to find Video stream\n");
-		return 1;
-	}
 
-	// Find the decoder for the video stream
-	pVideoCodec=avcodec_find_decoder(pFormatCtx->streams[videoStream]->codecpar->codec_id);
-	if( !pVideoCodec ) {
-		fprintf(stderr,"Unsupported video codec!\n");
-		return 1; // Codec not found
-	}
-	// Copy context
-	pVideoCodecCtx = avcodec_alloc_context3(pVideoCodec);
-	if( pVideoCodecCtx == 0 ) {
-		fprintf(stderr,"Failed to allocate video codec context\n");
-		return 1;
-	}
-	if( avcodec_parameters_to_context(pVideoCodecCtx,pFormatCtx->streams[videoStream]->codecpar) < 0 ) {
-		fprintf(stderr,"Couldn't copy video codec parameters");
-		return 1;
+		// Find the decoder for the video stream
+		pVideoCodec=avcodec_find_decoder(pFormatCtx->streams[videoStream]->codecpar->codec_id);
+		if( !pVideoCodec ) {
+			fprintf(stderr,"Unsupported video codec!\n");
+			return 1; // Codec not found
+		}
+		// Copy context
+		pVideoCodecCtx = avcodec_alloc_context3(pVideoCodec);
+		if( pVideoCodecCtx == 0 ) {
+			fprintf(stderr,"Failed to allocate video codec context\n");
+			return 1;
+		}
+		if( avcodec_parameters_to_context(pVideoCodecCtx,pFormatCtx->streams[videoStream]->codecpar) < 0 ) {
+			fprintf(stderr,"Couldn't copy video codec parameters");
+			return 1;
+		}
+		// Open Video Codec
+		if( avcodec_open2(pVideoCodecCtx, pVideoCodec, NULL) ) {
+			fprintf(stderr,"Failed to open video codec\n");
+			return 1;
+		}
+		src_width  = pVideoCodecCtx->width;
+		src_height = pVideoCodecCtx->height;
+		src_format = pVideoCodecCtx->pix_fmt;
 	}
-	// Open Video Codec
-	if( avcodec_open2(pVideoCodecCtx, pVideoCodec, NULL) ) {
-		fprintf(stderr,"Failed to open video codec\n");
-		return 1;
+	else {
+		//Test patterns are generated as RGB frames at the requested
+		//size and go through sws_scale like a decoded frame
+		src_format = AV_PIX_FMT_RGB24;
 	}
 	
 	//Calculate the proper scale sizes for this
@@ -895,22 +1475,28 @@ int main(int argc, char** argv) {
 	//Ensure that the encoding fits inside the
 	//terminal window and that term_encode doesn't
 	//try to resize the image again.
-	if( ioctl(0,TIOCGWINSZ,&ws) ) {
+	if( bench_sink ) {
+		//Benchmarks don't depend on the terminal: default to
+		//80 columns and never limit the height
+		ws.ws_col = 80;
+		ws.ws_row = 0xFFFF;
+	}
+	else if( ioctl(0,TIOCGWINSZ,&ws) ) {
 		fprintf(stderr,"Failed to determine terminal size\n");
 		return 1;
 	}
 	if( enc.renderer == ENC_RENDER_NONE ) {
-		scale_width   = pVideoCodecCtx->width;
-		scale_height  = pVideoCodecCtx->height;
+		scale_width   = src_width;
+		scale_height  = src_height;
 	}
-	else if( enc.renderer == ENC_RENDER_SIXEL ) {
+	else if( enc.renderer == ENC_RENDER_SIXEL || enc.renderer == ENC_RENDER_LIBSIXEL ) {
 		if( enc.win_width == 0 ) {
 			#ifdef DEBUG
 			fprintf(stderr,"Using original image size of sixel render\n");
 			#endif
-			enc.win_width = pVideoCodecCtx->width;
+			enc.win_width = src_width;
 		}
-		ratio = (float)pVideoCodecCtx->height / (float)pVideoCodecCtx->width;
+		ratio = (float)src_height / (float)src_width;
 		scale_width   = enc.win_width;
 		scale_height  = scale_width * ratio;
 	}
@@ -934,15 +1520,15 @@ int main(int argc, char** argv) {
 		//frame to the same size, but attempt to adjust enc.win_width 
 		//so the whole cropped results can fit on a single terminal screen.
 		if( enc.crop.w || enc.crop.h ) {
-			scale_width   = pVideoCodecCtx->width;
-			scale_height  = pVideoCodecCtx->height;
-			if( enc.crop.y+enc.crop.h > pVideoCodecCtx->height ) {
-				ratio = (float)(pVideoCodecCtx->height - enc.crop.y);
+			scale_width   = src_width;
+			scale_height  = src_height;
+			if( enc.crop.y+enc.crop.h > src_height ) {
+				ratio = (float)(src_height - enc.crop.y);
 			} else {
 				ratio = (float)enc.crop.h;
 			}
-			if( enc.crop.x+enc.crop.w > pVideoCodecCtx->width ) {
-				ratio = ratio / (float)(pVideoCodecCtx->width - enc.crop.x);
+			if( enc.crop.x+enc.crop.w > src_width ) {
+				ratio = ratio / (float)(src_width - enc.crop.x);
 			} else {
 				ratio = ratio / (float)enc.crop.w;
 			}
@@ -956,11 +1542,11 @@ int main(int argc, char** argv) {
 		//possible to speed up term_encode by preventing another
 		//resize after sws_scale.
 		else {
-			ratio = (float)pVideoCodecCtx->height / (float)pVideoCodecCtx->width;
+			ratio = (float)src_height / (float)src_width;
 			#ifdef DEBUG
-			fprintf(stderr,"Frame Size: %d / %d\n",pVideoCodecCtx->height,pVideoCodecCtx->width);
+			fprintf(stderr,"Frame Size: %d / %d\n",src_height,src_width);
 			fprintf(stderr,"Crop: x(%ld) y(%ld) w(%ld) h(%ld)\n",enc.crop.x, enc.crop.y,enc.crop.w,enc.crop.h);
-			fprintf(stderr,"Ratio  %f = %f / %f\n",ratio,(float)pVideoCodecCtx->height,(float)pVideoCodecCtx->width);
+			fprintf(stderr,"Ratio  %f = %f / %f\n",ratio,(float)src_height,(float)src_width);
 			fprintf(stderr,"Terminal Size: %ld / %ld\n",enc.win_width,win_height);
 			#endif
 			scale_width = enc.win_width;
@@ -982,6 +1568,15 @@ int main(int argc, char** argv) {
 	
 	// Allocate video frame
 	pFrame=av_frame_alloc();
+	if( pattern != PATTERN_NONE ) {
+		pFrame->format = src_format;
+		pFrame->width  = src_width;
+		pFrame->height = src_height;
+		if( av_frame_get_buffer(pFrame,0) < 0 ) {
+			fprintf(stderr,"Failed to allocate pattern frame\n");
+			return 1;
+		}
+	}
 
 	// Allocate an AVFrame structure
 	pFrameRGB=av_frame_alloc();
@@ -1005,12 +1600,16 @@ int main(int argc, char** argv) {
 
 	// initialize SWS context for software scaling
 	sws_ctx = sws_getContext(
-		pVideoCodecCtx->width, pVideoCodecCtx->height, pVideoCodecCtx->pix_fmt,
+		src_width, src_height, src_format,
 		scale_width, scale_height, AV_PIX_FMT_RGB24,
 		SWS_BILINEAR,
 		NULL,NULL,NULL);
 	
-	frame_period_sec = findFramePeriod(pFormatCtx->streams[videoStream],pVideoCodecCtx,23.976024);
+	if( pattern == PATTERN_NONE ) {
+		frame_period_sec = findFramePeriod(pFormatCtx->streams[videoStream],pVideoCodecCtx,23.976024);
+	} else {
+		frame_period_sec = 1.0/30.0;
+	}
 	seek_frame_count = seek_time_sec / frame_period_sec;
 	
 	#ifdef USE_PORTAUDIO
@@ -1077,6 +1676,7 @@ int main(int argc, char** argv) {
 		}
 		paBuffer.read_off  = 0;
 		paBuffer.write_off = 0;
+		paBuffer.underflows = 0;
 		paInfo = Pa_GetStreamInfo(paBuffer.stream);
 	}
 	#endif
@@ -1095,18 +1695,74 @@ int main(int argc, char** argv) {
 		}
 	}
 		
+	if( bench_sink ) {
+		if( strcmp(bench_sink,"mem") == 0 ) {
+			bench_memfp = open_memstream(&bench_mem,&bench_memlen);
+			if( bench_memfp == 0 ) {
+				fprintf(stderr,"Failed to open memory sink\n");
+				return 1;
+			}
+			enc.textfp = bench_memfp;
+		}
+		else {
+			//Point stdout itself at /dev/null so renderers that write
+			//to stdout directly are also discarded
+			null_fd = open("/dev/null",O_WRONLY);
+			if( null_fd < 0 || dup2(null_fd,1) < 0 ) {
+				fprintf(stderr,"Failed to open /dev/null\n");
+				return 1;
+			}
+			close(null_fd);
+			setvbuf(stdout,0,_IOFBF,1<<16);
+			enc.textfp = stdout;
+		}
+		benchStart(&bench);
+	}
+	
+	// Generate test pattern frames
+	for( frame_number=0; pattern != PATTERN_NONE && frame_number < bench_count; frame_number++ ) {
+		term_encode_trace_begin("pattern");
+		drawPattern(pattern,pFrame->data[0],pFrame->linesize[0],src_width,src_height,frame_number);
+		term_encode_trace_end("pattern");
+		benchStage(&bench,BENCH_DECODE);
+		term_encode_trace_begin("sws_scale");
+		sws_scale(sws_ctx, (uint8_t const * const *)pFrame->data,
+			pFrame->linesize, 0, src_height,
+			pFrameRGB->data, pFrameRGB->linesize);
+		term_encode_trace_end("sws_scale");
+		benchStage(&bench,BENCH_SCALE);
+		enc.imgpixels = pFrameRGB->data[0];
+		enc.imgwidth  = scale_width;
+		enc.imgheight = scale_height;
+		term_encode(&enc);
+		if( enc.stats && term_encode_get_stats(&enc,&stats) == 0 ) {
+			term_encode_stats_add(&total,&stats);
+		}
+		benchStage(&bench,BENCH_ENCODE);
+		term_encode_trace_begin("flush");
+		fflush(enc.textfp);
+		term_encode_trace_end("flush");
+		if( bench_memfp ) {
+			rewind(enc.textfp);
+		}
+		benchStage(&bench,BENCH_WRITE);
+		benchFrameDone(&bench);
+	}
+	
 	// Read frames
-	while(av_read_frame(pFormatCtx, &packet)>=0) {
+	while(pattern == PATTERN_NONE && readFrame(pFormatCtx, &packet)>=0) {
 		#ifdef USE_PORTAUDIO
 		if( packet.stream_index==audioStream ) {
 			if( seek_frame_count ) {
 				av_packet_unref(&packet);
 				continue;
 			}
+			term_encode_trace_begin("audio_decode");
 			avcodec_send_packet(pAudioCodecCtx,&packet);
 			if( avcodec_receive_frame(pAudioCodecCtx,pFrame) == 0 ) {
 				paWriteBuffer(&paBuffer,pFrame->data,pFrame->nb_samples);
 			}
+			term_encode_trace_end("audio_decode");
 		} else
 		#endif
 		if(packet.stream_index==videoStream) {
@@ -1120,13 +1776,23 @@ int main(int argc, char** argv) {
 			}
 			#ifdef USE_PORTAUDIO
 			if( audioStream != -1 && !Pa_IsStreamActive(paBuffer.stream) ) {
+				play.dropped++;
 				av_packet_unref(&packet);
 				continue;
 			}
 			#endif
 			// Decode video frame
+			//Decode time includes packets that didn't complete a frame
+			mark = benchNow();
+			term_encode_trace_begin("decode");
 			avcodec_send_packet(pVideoCodecCtx,&packet);
-			if( avcodec_receive_frame(pVideoCodecCtx,pFrame) == 0 ) {
+			ret = avcodec_receive_frame(pVideoCodecCtx,pFrame);
+			term_encode_trace_end("decode");
+			decode_ns += benchNow() - mark;
+			if( ret == 0 ) {
+				histAdd(&(play.stage[BENCH_DECODE]),decode_ns);
+				decode_ns = 0;
+				play.decoded++;
 				#ifdef DEBUG
 				fprintf(stderr,"Got a new frame %08lu\n",frame_number);
 				#endif
@@ -1135,7 +1801,9 @@ int main(int argc, char** argv) {
 				//the epoch for our frame time calculations.
 				if( !start_time.tv_sec && !start_time.tv_nsec ) {
 					#ifndef DEBUG
-					printf("\x1b[2J\x1b[0m");
+					if( !bench_sink ) {
+						printf("\x1b[2J\x1b[0m");
+					}
 					#endif
 					start_time.tv_nsec = current_time.tv_nsec;
 					start_time.tv_sec  = current_time.tv_sec;
@@ -1165,26 +1833,59 @@ int main(int argc, char** argv) {
 				fprintf(stderr,"frame time: tv_sec(%lu) tv_nsec(%lu)\n",frame_time.tv_sec,frame_time.tv_nsec);
 				#endif
 				
-				if( enc.renderer && timediff(&sleep_time,&frame_time,&current_time) < 0 ) {
+				if( enc.renderer && !bench_sink && timediff(&sleep_time,&frame_time,&current_time) < 0 ) {
 					#ifdef DEBUG
 					fprintf(stderr,"SKIP FRAME!\n");
 					#endif
 					skip++;
+					play.skipped++;
 				}
 				else {
-					if( enc.renderer ) {
+					if( enc.renderer && !bench_sink ) {
 						//Wait until enough time has past to renderer the next frame
 						#ifdef DEBUG
 						fprintf(stderr,"sleep tv_sec(%lu) tv_nsec(%lu)\n",sleep_time.tv_sec,sleep_time.tv_nsec);
 						#endif
+						term_encode_trace_begin("sleep");
 						nanosleep(&sleep_time,0);
+						term_encode_trace_end("sleep");
 					}
 					
+					if( bench_sink ) {
+						benchStage(&bench,BENCH_DECODE);
+					}
+					mark = benchNow();
+					term_encode_trace_begin("sws_scale");
 					sws_scale(sws_ctx, (uint8_t const * const *)pFrame->data,
-						pFrame->linesize, 0, pVideoCodecCtx->height,
+						pFrame->linesize, 0, src_height,
 						pFrameRGB->data, pFrameRGB->linesize);
+					term_encode_trace_end("sws_scale");
 
-					if( enc.renderer ) {
+					if( bench_sink ) {
+						enc.imgpixels = pFrameRGB->data[0];
+						enc.imgwidth  = scale_width;
+						enc.imgheight = scale_height;
+						benchStage(&bench,BENCH_SCALE);
+						term_encode(&enc);
+						if( enc.stats && term_encode_get_stats(&enc,&stats) == 0 ) {
+							term_encode_stats_add(&total,&stats);
+						}
+						benchStage(&bench,BENCH_ENCODE);
+						term_encode_trace_begin("flush");
+						fflush(enc.textfp);
+						term_encode_trace_end("flush");
+						if( bench_memfp ) {
+							rewind(enc.textfp);
+						}
+						benchStage(&bench,BENCH_WRITE);
+						benchFrameDone(&bench);
+						if( bench_count && bench.count >= bench_count ) {
+							av_packet_unref(&packet);
+							break;
+						}
+					} else if( enc.renderer ) {
+						histAdd(&(play.stage[BENCH_SCALE]),benchNow() - mark);
+						mark = benchNow();
 						enc.imgpixels = pFrameRGB->data[0];
 						enc.imgwidth  = scale_width;
 						enc.imgheight = scale_height;
@@ -1192,6 +1893,11 @@ int main(int argc, char** argv) {
 						printf("\x1b[H");
 						#endif
 						term_encode(&enc);
+						if( enc.stats && term_encode_get_stats(&enc,&stats) == 0 ) {
+							term_encode_stats_add(&total,&stats);
+						}
+						histAdd(&(play.stage[BENCH_ENCODE]),benchNow() - mark);
+						mark = benchNow();
 						
 						if( srtfile ) {
 							#ifdef DEBUG
@@ -1232,8 +1938,24 @@ int main(int argc, char** argv) {
 								(time_t)(display_time_sec*1000.0) % 1000,
 								skip);
 						}
+						term_encode_trace_begin("flush");
 						fflush(stdout);
+						term_encode_trace_end("flush");
 						skip = 0;
+						
+						//Lateness is how long after its scheduled time the
+						//frame finished reaching the terminal
+						histAdd(&(play.stage[BENCH_WRITE]),benchNow() - mark);
+						start_ns = (uint64_t)start_time.tv_sec*1000000000ULL + start_time.tv_nsec;
+						lateness_ns = (int64_t)(benchNow() - start_ns) - (int64_t)(frame_time_sec*1e9);
+						if( lateness_ns < 0 ) {
+							lateness_ns = 0;
+						}
+						histAdd(&(play.lateness),lateness_ns);
+						if( lateness_ns > frame_period_sec*1e9 ) {
+							play.late++;
+						}
+						play.displayed++;
 					} else if( dump_frames ) {
 						printf("\rSaving frame(%08ld)",frame_number);
 						savePPM(frame_number,pFrameRGB->data[0],scale_width,scale_height);
@@ -1271,7 +1993,32 @@ int main(int argc, char** argv) {
 	// Close the video file
 	avformat_close_input(&pFormatCtx);
 	
+	term_encode_finish(&enc);
 	term_encode_destroy(&enc);
+	if( enc.stats ) {
+		term_encode_stats_print(stderr,&total);
+	}
+	#ifdef USE_PORTAUDIO
+	if( audioStream != -1 ) {
+		underflows = paBuffer.underflows;
+	}
+	#endif
+	if( !bench_sink && enc.renderer ) {
+		if( enc.stats ) {
+			playStatsPrint(stderr,&play,underflows,frame_period_sec);
+		}
+		if( json_path ) {
+			playStatsJSON(json_path,&play,underflows,frame_period_sec);
+		}
+	}
+	if( bench_sink ) {
+		benchReport(stderr,&bench,bench_sink);
+		free(bench.frames);
+		if( bench_memfp ) {
+			fclose(bench_memfp);
+			free(bench_mem);
+		}
+	}
 		
 	if( srtfile ) {
 		fclose(srtfile);
@@ -1286,5 +2033,8 @@ int main(int argc, char** argv) {
 		Pa_Terminate();
 		free(paBuffer.samples);
 	#endif
+	if( trace_path && term_encode_trace_write(trace_path) ) {
+		return 1;
+	}
 	return 0;
 }